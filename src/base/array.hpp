@@ -55,6 +55,64 @@ namespace puffin {
         Allocator* allocator;
     };
 
+    // Array with inline storage for the first N elements, it spills to the allocator past them.
+    // Same interface as Array, for lists that only ever hold a handful of elements.
+    // data points into the struct itself while inline, so it can't be copied.
+    template<typename T, u32 N>
+    struct SmallArray {
+        static_assert(N > 0, "Use Array without inline storage");
+
+        SmallArray();
+
+        ~SmallArray();
+
+        SmallArray(const SmallArray&) = delete;
+        SmallArray& operator=(const SmallArray&) = delete;
+
+        void init(Allocator* allocator, u32 initial_capacity, u32 initial_size = 0);
+
+        void shutdown();
+
+        void push(const T& element);
+
+        T& push_use();
+
+        void pop();
+
+        void delete_swap(u32 index);
+
+        T& operator[](u32 index);
+        const T& operator[](u32 index) const;
+
+        void clear();
+
+        void set_size(u32 new_size);
+
+        void set_capacity(u32 new_capacity);
+        void grow(u32 new_capacity);
+
+        T& back();
+
+        const T& back() const;
+
+        T& front();
+
+        const T& front() const;
+
+        u32 size_in_bytes() const;
+
+        u32 capacity_in_bytes() const;
+
+        bool is_inline() const;
+
+        T* data;
+        u32 size;       // Occupied size
+        u32 capacity;   // Inline or allocated capacity
+        Allocator* allocator;
+
+        T inline_data[N];
+    };
+
     // View over a contiguous memory block
     template<typename T>
     struct ArrayView {
@@ -112,7 +170,8 @@ namespace puffin {
 
         T* new_data = (T*) allocator->allocate(new_capacity * sizeof(T), alignof(T));
         if (capacity) {
-            memory_copy(new_data, data, capacity * sizeof(T));
+            // Only the occupied part is worth moving
+            memory_copy(new_data, data, size * sizeof(T));
             allocator->deallocate(data);
         }
 
@@ -218,6 +277,159 @@ namespace puffin {
         data[size++] = element;
     }
 
+    // SmallArray //////////////////////////////////////////////
+
+    template<typename T, u32 N>
+    inline SmallArray<T, N>::SmallArray()
+        : data(inline_data), size(0), capacity(N), allocator(nullptr) {
+    }
+
+    template<typename T, u32 N>
+    inline SmallArray<T, N>::~SmallArray() {}
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::init(Allocator* allocator_, u32 initial_capacity, u32 initial_size) {
+        data = inline_data;
+        size = 0;
+        capacity = N;
+        allocator = allocator_;
+
+        if (initial_capacity > N) {
+            grow(initial_capacity);
+        }
+        set_size(initial_size);
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::shutdown() {
+        if (!is_inline()) {
+            allocator->deallocate(data);
+        }
+
+        data = inline_data;
+        size = 0;
+        capacity = N;
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::grow(u32 new_capacity) {
+        if (new_capacity < capacity * 2) {
+            new_capacity = capacity * 2;
+        }
+
+        T* new_data = (T*) allocator->allocate(new_capacity * sizeof(T), alignof(T));
+        memory_copy(new_data, data, size * sizeof(T));
+        if (!is_inline()) {
+            allocator->deallocate(data);
+        }
+
+        data = new_data;
+        capacity = new_capacity;
+    }
+
+    template<typename T, u32 N>
+    inline bool SmallArray<T, N>::is_inline() const {
+        return data == inline_data;
+    }
+
+    template<typename T, u32 N>
+    inline u32 SmallArray<T, N>::capacity_in_bytes() const {
+        return capacity * sizeof(T);
+    }
+
+    template<typename T, u32 N>
+    inline u32 SmallArray<T, N>::size_in_bytes() const {
+        return size * sizeof(T);
+    }
+
+    template<typename T, u32 N>
+    inline const T& SmallArray<T, N>::front() const {
+        PASSERT(size);
+        return data[0];
+    }
+
+    template<typename T, u32 N>
+    inline T& SmallArray<T, N>::front() {
+        PASSERT(size);
+        return data[0];
+    }
+
+    template<typename T, u32 N>
+    inline const T& SmallArray<T, N>::back() const {
+        PASSERT(size);
+        return data[size - 1];
+    }
+
+    template<typename T, u32 N>
+    inline T& SmallArray<T, N>::back() {
+        PASSERT(size);
+        return data[size - 1];
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::set_capacity(u32 new_capacity) {
+        if (new_capacity > capacity) {
+            grow(new_capacity);
+        }
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::set_size(u32 new_size) {
+        if (new_size > capacity) {
+            grow(new_size);
+        }
+        size = new_size;
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::clear() {
+        size = 0;
+    }
+
+    template<typename T, u32 N>
+    inline const T& SmallArray<T, N>::operator[](u32 index) const {
+        PASSERT(index < size);
+        return data[index];
+    }
+
+    template<typename T, u32 N>
+    inline T& SmallArray<T, N>::operator[](u32 index) {
+        PASSERT(index < size);
+        return data[index];
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::delete_swap(u32 index) {
+        PASSERT(size > 0);
+        size--;
+        data[index] = data[size];
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::pop() {
+        PASSERT(size > 0);
+        size--;
+    }
+
+    template<typename T, u32 N>
+    inline T& SmallArray<T, N>::push_use() {
+        if (size >= capacity) {
+            grow(capacity + 1);
+        }
+        size++;
+
+        return back();
+    }
+
+    template<typename T, u32 N>
+    inline void SmallArray<T, N>::push(const T& element) {
+        if (size >= capacity) {
+            grow(capacity + 1);
+        }
+
+        data[size++] = element;
+    }
+
     // ArrayView //////////////////////////////////////////////
 
     template<typename T>
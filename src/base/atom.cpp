@@ -0,0 +1,304 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "atom.hpp"
+#include "log.hpp"
+#include "time.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+namespace puffin {
+
+    // Atom Table ////////////////////////////////////////////////////
+
+    void AtomTable::init(Allocator* allocator_, u32 initial_atoms) {
+        allocator = allocator_;
+
+        // Strings live in pages kept until shutdown, so readers can compare keys without the lock
+        atoms.init(allocator, initial_atoms, true);
+        atoms.set_default_value(k_invalid_atom);
+
+        memset(directory_pages, 0, sizeof(directory_pages));
+        string_page = nullptr;
+        string_page_used = string_page_size = 0;
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    void AtomTable::shutdown() {
+        atoms.shutdown();
+
+        for(u32 i = 0; i < k_atom_table_max_directory_pages; i++) {
+            if(directory_pages[i]) {
+                puffin_free(directory_pages[i], allocator);
+                directory_pages[i] = nullptr;
+            }
+        }
+
+        while(string_page) {
+            char* previous_page;
+            memcpy(&previous_page, string_page, sizeof(char*));
+            puffin_free(string_page, allocator);
+            string_page = previous_page;
+        }
+        string_page_used = string_page_size = 0;
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    cstring AtomTable::store_string(const StringView& string) {
+        const u32 needed = (u32)string.length + 1;
+        if(string_page == nullptr || string_page_used + needed > string_page_size) {
+            const u32 header_size = sizeof(char*);
+            const u32 page_size = header_size + needed > k_atom_table_string_page_size ? header_size + needed : k_atom_table_string_page_size;
+
+            char* page = (char*)puffin_alloc(page_size, allocator);
+            memcpy(page, &string_page, sizeof(char*));
+            string_page = page;
+            string_page_used = header_size;
+            string_page_size = page_size;
+        }
+
+        char* stored = string_page + string_page_used;
+        memcpy(stored, string.text, string.length);
+        stored[string.length] = 0;
+        string_page_used += needed;
+        return stored;
+    }
+
+    Atom AtomTable::intern(cstring string) {
+        return intern(StringView{ (char*)string, strlen(string) });
+    }
+
+    Atom AtomTable::intern(const StringView& string) {
+        const u64 hashed_string = hash_bytes(string.text, string.length);
+
+        Atom atom = atoms.get_with_hash(string, hashed_string);
+        if(atom != k_invalid_atom) {
+            return atom;
+        }
+
+        std::lock_guard<std::mutex> lock(intern_mutex);
+
+        // Another thread could have added it meanwhile
+        atom = atoms.get_with_hash(string, hashed_string);
+        if(atom != k_invalid_atom) {
+            return atom;
+        }
+
+        atom = count.load(std::memory_order_relaxed) + 1;
+        const u32 directory_page = atom >> k_atom_table_directory_page_shift;
+        if(directory_page >= k_atom_table_max_directory_pages) {
+            p_print("Atom table is full, %u atoms\n", atom - 1);
+            return k_invalid_atom;
+        }
+
+        if(directory_pages[directory_page] == nullptr) {
+            directory_pages[directory_page] = (cstring*)puffin_alloc(k_atom_table_directory_page_size * sizeof(cstring), allocator);
+            memset(directory_pages[directory_page], 0, k_atom_table_directory_page_size * sizeof(cstring));
+        }
+
+        // The string is in place before the atom can be found
+        cstring stored = store_string(string);
+        directory_pages[directory_page][atom & (k_atom_table_directory_page_size - 1)] = stored;
+        atoms.insert_with_hash(stored, hashed_string, atom);
+        count.store(atom, std::memory_order_release);
+
+        return atom;
+    }
+
+    Atom AtomTable::find(cstring string) {
+        return find_with_hash(string, hash_calculate(string));
+    }
+
+    Atom AtomTable::find(const StringView& string) {
+        return atoms.get_with_hash(string, hash_bytes(string.text, string.length));
+    }
+
+    Atom AtomTable::find_with_hash(cstring string, u64 hashed_string) {
+        return atoms.get_with_hash(string, hashed_string);
+    }
+
+    cstring AtomTable::get_string(Atom atom) const {
+        if(atom == k_invalid_atom || atom > count.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return directory_pages[atom >> k_atom_table_directory_page_shift][atom & (k_atom_table_directory_page_size - 1)];
+    }
+
+    u32 AtomTable::get_count() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // Test //////////////////////////////////////////////////////////
+
+    static const u32        k_atom_test_strings = 100000;
+    static const u32        k_atom_test_name_length = 16;
+    static const u32        k_atom_benchmark_runs = 5;
+
+    static cstring atom_test_name(char* names, u32 index) {
+        return names + index * k_atom_test_name_length;
+    }
+
+    // Every thread interns all the names starting from a different one
+    static void atom_table_test_thread(AtomTable* table, char* names, Atom* out_atoms, u32 first) {
+        for(u32 i = 0; i < k_atom_test_strings; i++) {
+            const u32 index = (first + i) % k_atom_test_strings;
+            out_atoms[index] = table->intern(atom_test_name(names, index));
+        }
+    }
+
+    static void atom_table_find_thread(AtomTable* table, char* names, u32 first, u64* out_sum) {
+        u64 sum = 0;
+        for(u32 i = 0; i < k_atom_test_strings; i++) {
+            sum += table->find(atom_test_name(names, (first + i) % k_atom_test_strings));
+        }
+        *out_sum = sum;
+    }
+
+    bool atom_table_test() {
+        // Thread caches, the benchmark also runs StringArray and the tables from several threads
+        HeapAllocator heap;
+        heap.init(puffin_mega(128), true);
+
+        const u32 hardware_threads = std::thread::hardware_concurrency();
+        const u32 max_threads = hardware_threads < 2 ? 2 : (hardware_threads > 8 ? 8 : hardware_threads);
+
+        char* names = (char*)heap.allocate(k_atom_test_strings * k_atom_test_name_length, 1);
+        for(u32 i = 0; i < k_atom_test_strings; i++) {
+            snprintf(names + i * k_atom_test_name_length, k_atom_test_name_length, "texture_%07u", i);
+        }
+        Atom* thread_atoms = (Atom*)heap.allocate(max_threads * k_atom_test_strings * sizeof(Atom), alignof(Atom));
+
+        bool valid = true;
+
+        // Threads racing on the same strings must agree on every atom
+        AtomTable table;
+        table.init(&heap, 16);
+
+        std::thread threads[8];
+        for(u32 t = 0; t < max_threads; t++) {
+            threads[t] = std::thread(atom_table_test_thread, &table, names, thread_atoms + t * k_atom_test_strings,
+                                     t * k_atom_test_strings / max_threads);
+        }
+        for(u32 t = 0; t < max_threads; t++) {
+            threads[t].join();
+        }
+
+        valid = valid && table.get_count() == k_atom_test_strings;
+        for(u32 i = 0; i < k_atom_test_strings; i++) {
+            const Atom atom = thread_atoms[i];
+            for(u32 t = 1; t < max_threads; t++) {
+                valid = valid && thread_atoms[t * k_atom_test_strings + i] == atom;
+            }
+            cstring stored = table.get_string(atom);
+            valid = valid && atom != k_invalid_atom && stored && strcmp(stored, atom_test_name(names, i)) == 0;
+            valid = valid && table.find(atom_test_name(names, i)) == atom;
+        }
+
+        // Views compare by content, not up to the end of the text
+        char longer_name[32];
+        snprintf(longer_name, sizeof(longer_name), "%s_suffix", atom_test_name(names, 5));
+        StringView view{ longer_name, strlen(atom_test_name(names, 5)) };
+        valid = valid && table.find(view) == thread_atoms[5];
+        valid = valid && table.find(longer_name) == k_invalid_atom;
+        valid = valid && table.get_string(k_invalid_atom) == nullptr && table.get_string(k_atom_test_strings + 1) == nullptr;
+
+        // Strings longer than a page get a page of their own
+        const u32 long_length = k_atom_table_string_page_size * 2;
+        char* long_string = (char*)heap.allocate(long_length + 1, 1);
+        memset(long_string, 'a', long_length);
+        long_string[long_length] = 0;
+        const Atom long_atom = table.intern(long_string);
+        valid = valid && table.intern(long_string) == long_atom && strcmp(table.get_string(long_atom), long_string) == 0;
+        valid = valid && strcmp(table.get_string(table.intern("after_long")), "after_long") == 0;
+        heap.deallocate(long_string);
+
+        table.shutdown();
+        p_print("Atom table test %s, %u threads interning %u strings\n", valid ? "passed" : "failed", max_threads, k_atom_test_strings);
+
+        // Insertion and lookup, against StringArray which looks strings up by content the same way
+        f64 best_intern = 1e9;
+        f64 best_find = 1e9;
+        f64 best_array_intern = 1e9;
+        f64 best_array_find = 1e9;
+        u64 checksum = 0;
+        for(u32 run = 0; run < k_atom_benchmark_runs; run++) {
+            AtomTable benchmark_table;
+            benchmark_table.init(&heap, 16);
+
+            i64 start = time_now();
+            for(u32 i = 0; i < k_atom_test_strings; i++) {
+                checksum += benchmark_table.intern(atom_test_name(names, i));
+            }
+            f64 seconds = time_delta_seconds(start, time_now());
+            best_intern = seconds < best_intern ? seconds : best_intern;
+
+            start = time_now();
+            for(u32 i = 0; i < k_atom_test_strings; i++) {
+                checksum -= benchmark_table.find(atom_test_name(names, i));
+            }
+            seconds = time_delta_seconds(start, time_now());
+            best_find = seconds < best_find ? seconds : best_find;
+
+            benchmark_table.shutdown();
+
+            StringArray array;
+            array.init(&heap, k_atom_test_strings * k_atom_test_name_length);
+
+            start = time_now();
+            for(u32 i = 0; i < k_atom_test_strings; i++) {
+                checksum += (u64)array.intern(atom_test_name(names, i));
+            }
+            seconds = time_delta_seconds(start, time_now());
+            best_array_intern = seconds < best_array_intern ? seconds : best_array_intern;
+
+            start = time_now();
+            for(u32 i = 0; i < k_atom_test_strings; i++) {
+                checksum -= (u64)array.intern(atom_test_name(names, i));
+            }
+            seconds = time_delta_seconds(start, time_now());
+            best_array_find = seconds < best_array_find ? seconds : best_array_find;
+
+            array.shutdown();
+        }
+
+        p_print("Atom table benchmark, %u strings\n", k_atom_test_strings);
+        p_print("\tintern new %5.1f M/s, find %5.1f M/s\n", k_atom_test_strings / best_intern / 1000000.0,
+                k_atom_test_strings / best_find / 1000000.0);
+        p_print("\tStringArray intern new %5.1f M/s, existing %5.1f M/s%s\n", k_atom_test_strings / best_array_intern / 1000000.0,
+                k_atom_test_strings / best_array_find / 1000000.0, checksum ? " MISMATCH" : "");
+
+        // Lock free lookups from several threads
+        table.init(&heap, k_atom_test_strings);
+        for(u32 i = 0; i < k_atom_test_strings; i++) {
+            table.intern(atom_test_name(names, i));
+        }
+        for(u32 thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+            u64 sums[8] = {};
+            const i64 start = time_now();
+            for(u32 t = 0; t < thread_count; t++) {
+                threads[t] = std::thread(atom_table_find_thread, &table, names, t * k_atom_test_strings / thread_count, sums + t);
+            }
+            for(u32 t = 0; t < thread_count; t++) {
+                threads[t].join();
+            }
+            const f64 seconds = time_delta_seconds(start, time_now());
+
+            // Atoms 1 to N
+            const u64 expected_sum = (u64)k_atom_test_strings * (k_atom_test_strings + 1) / 2;
+            for(u32 t = 0; t < thread_count; t++) {
+                valid = valid && sums[t] == expected_sum;
+            }
+            p_print("\t%u threads: find %5.1f M/s\n", thread_count, (f64)thread_count * k_atom_test_strings / seconds / 1000000.0);
+        }
+        table.shutdown();
+
+        heap.deallocate(thread_atoms);
+        heap.deallocate(names);
+        heap.shutdown();
+        return valid;
+    }
+
+}
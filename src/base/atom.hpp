@@ -0,0 +1,72 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "concurrent_hash_map.hpp"
+#include "string.hpp"
+
+#include <atomic>
+#include <mutex>
+
+namespace puffin {
+
+    // Atom Table ////////////////////////////////////////////////////
+    //
+    // Interns strings into stable u32 ids, handed out in order from 1. Strings are compared by content, never
+    // by hash alone, and copied into pages that never move: the string of an atom lives as long as the table.
+    // Finding an atom and getting its string are lock free, interning a new string takes a lock.
+
+    using Atom = u32;
+
+    static const Atom       k_invalid_atom = 0;
+
+    static const u32        k_atom_table_string_page_size = 64 * 1024;
+    static const u32        k_atom_table_directory_page_shift = 12;
+    static const u32        k_atom_table_directory_page_size = 1 << k_atom_table_directory_page_shift;
+    static const u32        k_atom_table_max_directory_pages = 1024;     // 4M atoms
+
+    struct AtomTable {
+
+        void                init(Allocator* allocator, u32 initial_atoms);
+        void                shutdown();
+
+        // Adds the string the first time it is seen. Thread safe.
+        Atom                intern(cstring string);
+        Atom                intern(const StringView& string);
+
+        // k_invalid_atom if the string was never interned. Lock free.
+        Atom                find(cstring string);
+        Atom                find(const StringView& string);
+        // hashed_string is hash_calculate(string)
+        Atom                find_with_hash(cstring string, u64 hashed_string);
+
+        // Lock free, nullptr for k_invalid_atom
+        cstring             get_string(Atom atom) const;
+        u32                 get_count() const;
+
+        // Copies the string to the current page, or a page of its own if it is too long. Locked.
+        cstring             store_string(const StringView& string);
+
+        ConcurrentFlatHashMap<cstring, Atom, HashString, HashStringEqual> atoms;
+
+        // Atom to string, pages of k_atom_table_directory_page_size
+        cstring*            directory_pages[ k_atom_table_max_directory_pages ] = {};
+
+        // Each string page starts with the pointer to the previous one
+        char*               string_page         = nullptr;
+        u32                 string_page_used    = 0;
+        u32                 string_page_size    = 0;
+
+        std::atomic<u32>    count{ 0 };
+        std::mutex          intern_mutex;
+
+        Allocator*          allocator           = nullptr;
+    };
+
+    // Multithreaded interning checked for agreement between threads, followed by a lookup and insertion
+    // benchmark. Returns true if every string kept its atom and its content.
+    bool                    atom_table_test();
+
+}
@@ -5,6 +5,8 @@
 #include "bit.hpp"
 #include "log.hpp"
 #include "memory.hpp"
+#include "assert.hpp"
+#include "time.hpp"
 
 #if defined (_MSC_VER)
 #include <immintrin.h>
@@ -12,13 +14,31 @@
 #endif
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PUFFIN_BIT_AVX2
+#endif
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PUFFIN_BIT_SSE2
+#endif
+
 namespace puffin {
 
     u32 leading_zeroes_u32(u32 x) {
 #if defined(_MSC_VER)
         return _lzcnt_u32(x);
 #else
-        return __builtin_clz(x);
+        return x ? __builtin_clz(x) : 32;
+#endif
+    }
+
+    u64 leading_zeroes_u64(u64 x) {
+#if defined(_MSC_VER)
+        return _lzcnt_u64(x);
+#else
+        return x ? __builtin_clzll(x) : 64;
 #endif
     }
 
@@ -38,7 +58,7 @@ namespace puffin {
 #if defined(_MSC_VER)
         return _tzcnt_u32(x); // trailing zero count
 #else
-        return __builtin_ctz(x);
+        return x ? __builtin_ctz(x) : 32;
 #endif
     }
 
@@ -46,7 +66,15 @@ namespace puffin {
 #if defined(_MSC_VER)
         return _tzcnt_u64(x);
 #else
-        return __builtin_ctzl(x);
+        return x ? __builtin_ctzll(x) : 64;
+#endif
+    }
+
+    u32 popcount_u64(u64 x) {
+#if defined(_MSC_VER)
+        return (u32)__popcnt64(x);
+#else
+        return (u32)__builtin_popcountll(x);
 #endif
     }
 
@@ -73,5 +101,344 @@ namespace puffin {
         p_print(" ");
     }
 
+    // Bit arrays ////////////////////////////////////////////////////
+
+    void bit_words_and(u64* dst, const u64* a, const u64* b, u32 word_count) {
+        u32 i = 0;
+#if defined(PUFFIN_BIT_AVX2)
+        for(; i + 4 <= word_count; i += 4) {
+            const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_and_si256(va, vb));
+        }
+#elif defined(PUFFIN_BIT_SSE2)
+        for(; i + 2 <= word_count; i += 2) {
+            const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_and_si128(va, vb));
+        }
+#endif
+        for(; i < word_count; i++) {
+            dst[i] = a[i] & b[i];
+        }
+    }
+
+    void bit_words_or(u64* dst, const u64* a, const u64* b, u32 word_count) {
+        u32 i = 0;
+#if defined(PUFFIN_BIT_AVX2)
+        for(; i + 4 <= word_count; i += 4) {
+            const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(va, vb));
+        }
+#elif defined(PUFFIN_BIT_SSE2)
+        for(; i + 2 <= word_count; i += 2) {
+            const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(va, vb));
+        }
+#endif
+        for(; i < word_count; i++) {
+            dst[i] = a[i] | b[i];
+        }
+    }
+
+    void bit_words_and_not(u64* dst, const u64* a, const u64* b, u32 word_count) {
+        u32 i = 0;
+#if defined(PUFFIN_BIT_AVX2)
+        for(; i + 4 <= word_count; i += 4) {
+            const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+            // andnot negates its first operand
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_andnot_si256(vb, va));
+        }
+#elif defined(PUFFIN_BIT_SSE2)
+        for(; i + 2 <= word_count; i += 2) {
+            const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_andnot_si128(vb, va));
+        }
+#endif
+        for(; i < word_count; i++) {
+            dst[i] = a[i] & ~b[i];
+        }
+    }
+
+    u64 bit_words_popcount(const u64* words, u32 word_count) {
+        u64 count = 0;
+        u32 i = 0;
+#if defined(PUFFIN_BIT_AVX2)
+        // Counts of each nibble looked up with a shuffle, summed per 64 bits with sad
+        const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i total = _mm256_setzero_si256();
+        for(; i + 4 <= word_count; i += 4) {
+            const __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+            const __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_mask));
+            const __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+        }
+        count = (u64)_mm256_extract_epi64(total, 0) + (u64)_mm256_extract_epi64(total, 1) +
+                (u64)_mm256_extract_epi64(total, 2) + (u64)_mm256_extract_epi64(total, 3);
+#elif defined(PUFFIN_BIT_SSE2)
+        // No shuffle in SSE2, bit counts folded in registers the same way as the scalar SWAR popcount
+        const __m128i m1 = _mm_set1_epi8(0x55);
+        const __m128i m2 = _mm_set1_epi8(0x33);
+        const __m128i m4 = _mm_set1_epi8(0x0f);
+        __m128i total = _mm_setzero_si128();
+        for(; i + 2 <= word_count; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(words + i));
+            v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+            v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+            v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+            total = _mm_add_epi64(total, _mm_sad_epu8(v, _mm_setzero_si128()));
+        }
+        u64 lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, total);
+        count = lanes[0] + lanes[1];
+#endif
+        for(; i < word_count; i++) {
+            count += popcount_u64(words[i]);
+        }
+        return count;
+    }
+
+    // Bit Set ///////////////////////////////////////////////////////
+
+    void BitSet::init(Allocator* allocator_, u32 total_bits) {
+        allocator = allocator_;
+        bits = nullptr;
+        size = 0;
+        word_count = 0;
+
+        resize(total_bits);
+    }
+
+    void BitSet::shutdown() {
+        if(bits) {
+            puffin_free(bits, allocator);
+        }
+        bits = nullptr;
+        size = word_count = 0;
+    }
+
+    void BitSet::resize(u32 total_bits) {
+        const u32 new_word_count = (total_bits + 63) / 64;
+        if(new_word_count != word_count) {
+            u64* new_bits = (u64*)allocator->allocate(new_word_count * sizeof(u64), 32, __FILE__, __LINE__);
+            const u32 kept_words = word_count < new_word_count ? word_count : new_word_count;
+            if(kept_words) {
+                memcpy(new_bits, bits, kept_words * sizeof(u64));
+            }
+            memset(new_bits + kept_words, 0, (new_word_count - kept_words) * sizeof(u64));
+
+            if(bits) {
+                puffin_free(bits, allocator);
+            }
+            bits = new_bits;
+            word_count = new_word_count;
+        }
+
+        // Bits past the end stay clear, popcount and iteration count whole words
+        if(total_bits < size && word_count) {
+            const u32 tail = total_bits % 64;
+            if(tail) {
+                bits[word_count - 1] &= (1ull << tail) - 1;
+            }
+        }
+        size = total_bits;
+    }
+
+    void BitSet::clear_all() {
+        memset(bits, 0, word_count * sizeof(u64));
+    }
+
+    void BitSet::set_and(const BitSet& a, const BitSet& b) {
+        PASSERT(a.word_count == word_count && b.word_count == word_count);
+        bit_words_and(bits, a.bits, b.bits, word_count);
+    }
+
+    void BitSet::set_or(const BitSet& a, const BitSet& b) {
+        PASSERT(a.word_count == word_count && b.word_count == word_count);
+        bit_words_or(bits, a.bits, b.bits, word_count);
+    }
+
+    void BitSet::set_and_not(const BitSet& a, const BitSet& b) {
+        PASSERT(a.word_count == word_count && b.word_count == word_count);
+        bit_words_and_not(bits, a.bits, b.bits, word_count);
+    }
+
+    // Test //////////////////////////////////////////////////////////
+
+    static const u32        k_bit_set_test_bits = 300001;       // Not a multiple of any register width
+    static const u32        k_bit_set_benchmark_bits = 1 << 19;
+    static const u32        k_bit_set_benchmark_runs = 20;
+
+    static u32 bit_set_test_random(u32& seed) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    // One bit in 2^density_shift set on average
+    static void bit_set_test_fill(BitSet& set, u32 density_shift, u32& seed) {
+        set.clear_all();
+        for(u32 i = 0; i < set.size; i++) {
+            if((bit_set_test_random(seed) & ((1u << density_shift) - 1)) == 0) {
+                set.set_bit(i);
+            }
+        }
+    }
+
+    static bool bit_set_test_correctness(Allocator* allocator) {
+        bool valid = true;
+        u32 seed = 0x9e3779b9u;
+
+        BitSet a, b, result;
+        a.init(allocator, k_bit_set_test_bits);
+        b.init(allocator, k_bit_set_test_bits);
+        result.init(allocator, k_bit_set_test_bits);
+        bit_set_test_fill(a, 1, seed);
+        bit_set_test_fill(b, 2, seed);
+
+        result.set_and(a, b);
+        for(u32 i = 0; i < k_bit_set_test_bits; i++) {
+            valid = valid && result.get_bit(i) == (a.get_bit(i) && b.get_bit(i));
+        }
+        result.set_or(a, b);
+        for(u32 i = 0; i < k_bit_set_test_bits; i++) {
+            valid = valid && result.get_bit(i) == (a.get_bit(i) || b.get_bit(i));
+        }
+        result.set_and_not(a, b);
+        for(u32 i = 0; i < k_bit_set_test_bits; i++) {
+            valid = valid && result.get_bit(i) == (a.get_bit(i) && !b.get_bit(i));
+        }
+
+        // In place, dst aliasing an operand
+        result.set_or(result, b);
+        for(u32 i = 0; i < k_bit_set_test_bits; i++) {
+            valid = valid && result.get_bit(i) == (a.get_bit(i) || b.get_bit(i));
+        }
+
+        u64 expected_count = 0;
+        for(u32 i = 0; i < k_bit_set_test_bits; i++) {
+            expected_count += a.get_bit(i);
+        }
+        valid = valid && a.popcount() == expected_count;
+
+        // Every set bit once, in order
+        u64 visited = 0;
+        i64 previous = -1;
+        a.for_each_set_bit([&](u32 index) {
+            valid = valid && (i64)index > previous && a.get_bit(index);
+            previous = index;
+            visited++;
+        });
+        valid = valid && visited == expected_count;
+
+        // Shrinking clears the bits past the end, growing keeps the others
+        a.resize(k_bit_set_test_bits / 2 + 3);
+        expected_count = 0;
+        for(u32 i = 0; i < a.size; i++) {
+            expected_count += a.get_bit(i);
+        }
+        valid = valid && a.popcount() == expected_count;
+        a.resize(k_bit_set_test_bits);
+        valid = valid && a.popcount() == expected_count;
+
+        BitSetFixed<64> fixed_a, fixed_b;
+        fixed_a.clear_all();
+        fixed_b.clear_all();
+        fixed_a.set_bit(3);
+        fixed_a.set_bit(500);
+        fixed_b.set_bit(500);
+        fixed_b.set_bit(511);
+        fixed_b.set_or(fixed_a, fixed_b);
+        valid = valid && fixed_b.popcount() == 3 && fixed_b.get_bit(3) && fixed_b.get_bit(511) && !fixed_b.get_bit(4);
+        fixed_b.set_and_not(fixed_b, fixed_a);
+        valid = valid && fixed_b.popcount() == 1 && fixed_b.get_bit(511);
+
+        result.shutdown();
+        b.shutdown();
+        a.shutdown();
+        return valid;
+    }
+
+    bool bit_set_test() {
+        Allocator* allocator = &MemoryService::instance()->system_allocator;
+
+        const bool valid = bit_set_test_correctness(allocator);
+        p_print("Bit set test %s\n", valid ? "passed" : "failed");
+
+        // Visibility style masks: visible = in frustum & ~occluded, then count and walk the visible ones
+        u32 seed = 0x2545f491u;
+        BitSet a, b, result;
+        a.init(allocator, k_bit_set_benchmark_bits);
+        b.init(allocator, k_bit_set_benchmark_bits);
+        result.init(allocator, k_bit_set_benchmark_bits);
+        bit_set_test_fill(a, 1, seed);
+        bit_set_test_fill(b, 1, seed);
+
+        f64 best_words = 1e9;
+        f64 best_bits = 1e9;
+        u64 checksum = 0;
+        for(u32 run = 0; run < k_bit_set_benchmark_runs; run++) {
+            i64 start = time_now();
+            result.set_and_not(a, b);
+            checksum += result.popcount();
+            f64 seconds = time_delta_seconds(start, time_now());
+            best_words = seconds < best_words ? seconds : best_words;
+
+            // A bit at a time, as the single bit interface allows
+            start = time_now();
+            u64 count = 0;
+            for(u32 i = 0; i < k_bit_set_benchmark_bits; i++) {
+                if(a.get_bit(i) && !b.get_bit(i)) {
+                    result.set_bit(i);
+                    count++;
+                } else {
+                    result.clear_bit(i);
+                }
+            }
+            checksum -= count;
+            seconds = time_delta_seconds(start, time_now());
+            best_bits = seconds < best_bits ? seconds : best_bits;
+        }
+        p_print("Bit set benchmark, %u bits: and_not + popcount %.1f us, per bit %.1f us, %.0fx%s\n", k_bit_set_benchmark_bits,
+                best_words * 1e6, best_bits * 1e6, best_bits / best_words, checksum ? " MISMATCH" : "");
+
+        // Walking the set bits against testing every bit, sparse and dense
+        for(u32 density_shift = 0; density_shift <= 6; density_shift += 3) {
+            bit_set_test_fill(result, density_shift, seed);
+
+            f64 best_iterate = 1e9;
+            f64 best_scan = 1e9;
+            u64 sum = 0;
+            for(u32 run = 0; run < k_bit_set_benchmark_runs; run++) {
+                i64 start = time_now();
+                result.for_each_set_bit([&](u32 index) { sum += index; });
+                f64 seconds = time_delta_seconds(start, time_now());
+                best_iterate = seconds < best_iterate ? seconds : best_iterate;
+
+                start = time_now();
+                for(u32 i = 0; i < k_bit_set_benchmark_bits; i++) {
+                    if(result.get_bit(i)) {
+                        sum -= i;
+                    }
+                }
+                seconds = time_delta_seconds(start, time_now());
+                best_scan = seconds < best_scan ? seconds : best_scan;
+            }
+            p_print("\t1 in %2u bits set: for_each_set_bit %6.1f us, get_bit scan %6.1f us%s\n", 1u << density_shift,
+                    best_iterate * 1e6, best_scan * 1e6, sum ? " MISMATCH" : "");
+        }
+
+        result.shutdown();
+        b.shutdown();
+        a.shutdown();
+        return valid;
+    }
 
-}
\ No newline at end of file
+}
@@ -6,17 +6,29 @@
 
 #include "platform.hpp"
 
+#include <string.h>
+
 namespace puffin {
     struct Allocator;
 
     // Common bit methods ////////////////
+    // Zero in gives the bit width out
     u32             leading_zeroes_u32(u32 x);
+    u64             leading_zeroes_u64(u64 x);
 #if defined (_MSC_VER)
     u32             leading_zeroes_u32_msvc(u32 x);
 #endif
     u32             trailing_zeroes_u32(u32 x);
     u64             trailing_zeroes_u64(u64 x);
 
+    u32             popcount_u64(u64 x);
+
+    // Width matched overloads for the templates below
+    inline u32      leading_zeroes(u32 x) { return leading_zeroes_u32(x); }
+    inline u32      leading_zeroes(u64 x) { return (u32)leading_zeroes_u64(x); }
+    inline u32      trailing_zeroes(u32 x) { return trailing_zeroes_u32(x); }
+    inline u32      trailing_zeroes(u64 x) { return (u32)trailing_zeroes_u64(x); }
+
     u32             round_up_to_power_of_2(u32 v);
 
     void            print_binary(u64 n);
@@ -56,11 +68,11 @@ namespace puffin {
         }
 
         uint32_t LowestBitSet() const {
-            return trailing_zeroes_u32(mask_) >> Shift;
+            return trailing_zeroes(mask_) >> Shift;
         }
 
         uint32_t HighestBitSet() const {
-            return static_cast<uint32_t>((bit_width(mask_) - 1) >> Shift);
+            return static_cast<uint32_t>((sizeof(T) * 8 - 1 - leading_zeroes(mask_)) >> Shift);
         }
 
         BitMask begin() const {
@@ -72,11 +84,13 @@ namespace puffin {
         }
 
         uint32_t TrailingZeros() const {
-            return trailing_zeroes_u32(mask_); // >> Shift
+            return trailing_zeroes(mask_) >> Shift;
         }
 
+        // Counted from the highest significant bit, not the top of T
         uint32_t LeadingZeros() const {
-            return leading_zeroes_u32(mask_); // >> Shift
+            constexpr int k_extra_bits = (int)sizeof(T) * 8 - (SignificantBits << Shift);
+            return leading_zeroes(static_cast<T>(mask_ << k_extra_bits)) >> Shift;
         }
 
     private:
@@ -97,31 +111,86 @@ namespace puffin {
     // Gets the slot index for a specific bit position
     inline u32          bit_slot_8(u32 bit) { return bit / 8; }
 
-    struct BitSet {
+    // Same for 64-bit words
+    inline u64          bit_mask_64(u32 bit) { return 1ull << (bit & 63); }
+    inline u32          bit_slot_64(u32 bit) { return bit / 64; }
+
+    // Bit arrays //////////////////////
+    // Word wide operations with SSE2/AVX2 paths, dst can be a or b.
+    void            bit_words_and(u64* dst, const u64* a, const u64* b, u32 word_count);
+    void            bit_words_or(u64* dst, const u64* a, const u64* b, u32 word_count);
+    // a & ~b
+    void            bit_words_and_not(u64* dst, const u64* a, const u64* b, u32 word_count);
+    u64             bit_words_popcount(const u64* words, u32 word_count);
+
+    // Function gets the index of every set bit, in increasing order. Empty words cost a compare.
+    template<typename Function>
+    inline void bit_words_for_each_set_bit(const u64* words, u32 word_count, Function&& function) {
+        for(u32 w = 0; w < word_count; w++) {
+            u64 word = words[w];
+            while(word) {
+                function(w * 64 + (u32)trailing_zeroes_u64(word));
+                word &= word - 1;
+            }
+        }
+    }
 
-        Allocator*      allocator = nullptr;
-        u8*             bits = nullptr;
-        u32             size = 0;
+    // Bits in 64-bit words, so that masks over many objects combine a word or a register at a time
+    struct BitSet {
 
         void            init(Allocator* allocator, u32 total_bits);
         void            shutdown();
 
+        // Keeps the bits that still fit, new bits are cleared
         void            resize(u32 total_bits);
 
-        void            set_bit(u32 index) { bits[index / 8] |= bit_mask_8(index); }
-        void            clear_bit(u32 index) { bits[index / 8] &= ~bit_mask_8((index)); }
-        u8              get_bit(u32 index) { return bits[index / 8] & bit_mask_8(index); }
+        void            set_bit(u32 index) { bits[bit_slot_64(index)] |= bit_mask_64(index); }
+        void            clear_bit(u32 index) { bits[bit_slot_64(index)] &= ~bit_mask_64(index); }
+        bool            get_bit(u32 index) const { return (bits[bit_slot_64(index)] & bit_mask_64(index)) != 0; }
+
+        void            clear_all();
+
+        // this = a & b, a | b, a & ~b. All the sets have the same size, this can be a or b.
+        void            set_and(const BitSet& a, const BitSet& b);
+        void            set_or(const BitSet& a, const BitSet& b);
+        void            set_and_not(const BitSet& a, const BitSet& b);
+
+        u64             popcount() const { return bit_words_popcount(bits, word_count); }
+
+        template<typename Function>
+        void            for_each_set_bit(Function&& function) const { bit_words_for_each_set_bit(bits, word_count, function); }
+
+        Allocator*      allocator = nullptr;
+        u64*            bits = nullptr;
+        u32             size = 0;           // In bits
+        u32             word_count = 0;
     };
 
     template <u32 SizeInBytes>
     struct BitSetFixed {
 
-        u8              bits[ SizeInBytes ];
+        static constexpr u32 k_word_count = (SizeInBytes + 7) / 8;
+
+        u64             bits[ k_word_count ];
+
+        void            set_bit(u32 index) { bits[bit_slot_64(index)] |= bit_mask_64(index); }
+        void            clear_bit(u32 index) { bits[bit_slot_64(index)] &= ~bit_mask_64(index); }
+        bool            get_bit(u32 index) const { return (bits[bit_slot_64(index)] & bit_mask_64(index)) != 0; }
+
+        void            clear_all() { memset(bits, 0, sizeof(bits)); }
+
+        void            set_and(const BitSetFixed& a, const BitSetFixed& b) { bit_words_and(bits, a.bits, b.bits, k_word_count); }
+        void            set_or(const BitSetFixed& a, const BitSetFixed& b) { bit_words_or(bits, a.bits, b.bits, k_word_count); }
+        void            set_and_not(const BitSetFixed& a, const BitSetFixed& b) { bit_words_and_not(bits, a.bits, b.bits, k_word_count); }
+
+        u64             popcount() const { return bit_words_popcount(bits, k_word_count); }
 
-        void            set_bit(u32 index) { bits[index / 8] |= bit_mask_8(index); }
-        void            clear_bit(u32 index) { bits[index / 8] &= ~bit_mask_8(index); }
-        void            get_bit(u32 index) { bits[index / 8] & bit_mask_8(index); }
+        template<typename Function>
+        void            for_each_set_bit(Function&& function) const { bit_words_for_each_set_bit(bits, k_word_count, function); }
     };
 
+    // Bulk operations and iteration checked against per bit loops, then timed on a large set.
+    // Returns true if every result matched.
+    bool            bit_set_test();
 
-}
\ No newline at end of file
+}
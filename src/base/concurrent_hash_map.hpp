@@ -0,0 +1,339 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "hash_map.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+namespace puffin {
+
+    // Concurrent Flat Hash Map //////////////////////////////////////
+    //
+    // FlatHashMap split in shards picked by the high bits of the hash. Writers lock their shard, readers
+    // don't: each shard is a seqlock, a reader probes the table and retries if a writer went through the
+    // shard meanwhile, taking the lock after a few failed attempts.
+    //
+    // Readers can look at a table that is being changed. They load it with relaxed atomic loads matching the
+    // stores of the shard maps (see HashMapRelaxedAccess), copy slots out before looking at them, and only trust what
+    // they copied once the sequence shows no writer went through. Keys and values must be trivially copyable.
+    // Pointer keys are followed by Equal, so a reader compares them only after validating the copy and only
+    // if what they point to is never freed while the map lives: keys_never_freed at init. Otherwise maps
+    // with pointer keys read with the lock.
+    // Tables replaced when a shard grows are freed at shutdown, they add up to less than the live ones.
+    // The allocator must be thread safe if different shards are written from different threads.
+
+    static const u32        k_concurrent_hash_map_shard_bits = 4;
+    static const u32        k_concurrent_hash_map_shards = 1 << k_concurrent_hash_map_shard_bits;
+    // Lock free attempts of a read before waiting on the writer
+    static const u32        k_concurrent_hash_map_read_attempts = 8;
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    struct alignas(64) ConcurrentHashMapShard {
+        FlatHashMap<K, V, Hasher, Equal, Group, HashMapRelaxedAccess> map;
+        DeferredFreeAllocator                   table_allocator;
+
+        std::atomic<u32>    sequence{ 0 };      // Odd while a writer changes the map
+        std::mutex          write_mutex;
+    };
+
+    template <typename K, typename V, typename Hasher = HashCalculate<K>, typename Equal = HashEqual<K>,
+              typename Group = HashMapGroup>
+    struct ConcurrentFlatHashMap {
+        static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                      "Readers copy keys and values that can be changing under them");
+
+        using Shard = ConcurrentHashMapShard<K, V, Hasher, Equal, Group>;
+        using Map = FlatHashMap<K, V, Hasher, Equal, Group, HashMapRelaxedAccess>;
+        using KeyValue = FlatHashSlot<K, V>;
+        using Probe = ProbeSequence<Group::kWidth>;
+
+        // initial_capacity is spread over the shards
+        void                init(Allocator* allocator, u64 initial_capacity, bool keys_never_freed = false);
+        void                shutdown();
+
+        // Lock free unless a writer is on the same shard
+        bool                find(const K& key, V& out_value);
+        template <typename Q>
+        bool                find_with_hash(const Q& key, u64 hash, V& out_value);
+
+        // The value, or the default value when the key is missing
+        V                   get(const K& key);
+        template <typename Q>
+        V                   get_with_hash(const Q& key, u64 hash);
+
+        void                insert(const K& key, const V& value);
+        void                insert_with_hash(const K& key, u64 hash, const V& value);
+
+        u32                 remove(const K& key);
+
+        void                set_default_value(const V& value);
+
+        // Function gets each key and value with the shard locked, it must not write to this map.
+        template<typename Function>
+        void                for_each(Function&& function);
+        // Copies up to max_values values, the copy can be used to remove the entries
+        u64                 copy_values(V* values, u64 max_values);
+
+        void                clear();
+        u64                 get_size();
+
+        Shard&              get_shard(u64 hash);
+
+        // Writes while holding the lock and keeping the sequence odd
+        template<typename Function>
+        void                write(Shard& shard, Function&& function);
+
+        // True if no writer went through the shard since sequence was read, what was loaded meanwhile is consistent
+        static bool         read_valid(const Shard& shard, u32 sequence);
+
+        Shard               shards[k_concurrent_hash_map_shards];
+        bool                lock_free_reads     = true;
+
+    }; // struct ConcurrentFlatHashMap
+
+    // Multithreaded stress test of insert, find and remove, followed by a lookup benchmark against a locked
+    // FlatHashMap. Returns true if readers only ever saw values that were inserted for their key.
+    bool                    concurrent_hash_map_test();
+
+    // Implementation /////////////////////////////////////////////////
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::init(Allocator* allocator, u64 initial_capacity, bool keys_never_freed) {
+        lock_free_reads = !std::is_pointer_v<K> || keys_never_freed;
+
+        for(u32 i = 0; i < k_concurrent_hash_map_shards; i++) {
+            shards[i].table_allocator.init(allocator);
+            shards[i].map.init(&shards[i].table_allocator, initial_capacity / k_concurrent_hash_map_shards);
+            shards[i].sequence.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::shutdown() {
+        for(u32 i = 0; i < k_concurrent_hash_map_shards; i++) {
+            shards[i].map.shutdown();
+            shards[i].table_allocator.shutdown();
+        }
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline typename ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::Shard&
+    ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::get_shard(u64 hash) {
+        // The table uses the low bits of the hash
+        return shards[hash >> (64 - k_concurrent_hash_map_shard_bits)];
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    template<typename Function>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::write(Shard& shard, Function&& function) {
+        std::lock_guard<std::mutex> lock(shard.write_mutex);
+
+        const u32 sequence = shard.sequence.load(std::memory_order_relaxed);
+        shard.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        function(shard.map);
+
+        shard.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline bool ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::find(const K& key, V& out_value) {
+        return find_with_hash(key, Hasher{}(key), out_value);
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline bool ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::read_valid(const Shard& shard, u32 sequence) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return shard.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    // Loads the control bytes of a group in the aligned words covering them, and the group shifts them together
+    // in registers. Tables are 16 byte aligned and followed by their slots, so the words stay within the table.
+    template <typename Group>
+    inline Group concurrent_hash_map_load_group(const i8* control) {
+        static constexpr u64 k_words = Group::kWidth / 8;
+
+        const uintptr_t address = reinterpret_cast<uintptr_t>(control);
+        const HashMapWord64* words = reinterpret_cast<const HashMapWord64*>(address & ~(uintptr_t)7);
+        const u32 shift = (u32)(address & 7) * 8;
+
+        u64 group_words[k_words + 1];
+        for(u64 i = 0; i < k_words; i++) {
+            group_words[i] = hash_map_load_word(words + i);
+        }
+        // An aligned group has no word past it, the last one is loaded again and shifted out
+        group_words[k_words] = hash_map_load_word(words + k_words - (shift == 0));
+
+        return Group::from_words(group_words, shift);
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    template <typename Q>
+    bool ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::find_with_hash(const Q& key, u64 hash, V& out_value) {
+        Shard& shard = get_shard(hash);
+        const i8 hash2 = hash_2(hash);
+
+        for(u32 attempt = 0; lock_free_reads && attempt < k_concurrent_hash_map_read_attempts; attempt++) {
+            const u32 sequence = shard.sequence.load(std::memory_order_acquire);
+            if(sequence & 1) {
+                continue;
+            }
+
+            // Table memory is only freed at shutdown, but the three have to belong to the same table
+            const i8* control_bytes = hash_map_load(&shard.map.control_bytes);
+            const KeyValue* slots = hash_map_load(&shard.map.slots_);
+            const u64 capacity = hash_map_load(&shard.map.capacity);
+            if(!read_valid(shard, sequence)) {
+                continue;
+            }
+
+            // Same probing as FlatHashMap::find_with_hash, bounded as the control bytes can be changing
+            bool found = false;
+            bool changed = false;
+            V value;
+            Probe probe(hash_1(hash, control_bytes), capacity);
+            for(u64 probed = 0; probed <= capacity; probed += Group::kWidth) {
+                const Group group = concurrent_hash_map_load_group<Group>(control_bytes + probe.get_offset());
+                for(int i : group.Match(hash2)) {
+                    KeyValue key_value;
+                    hash_map_read(&key_value, slots + probe.get_offset(i));
+
+                    // A pointer key of a slot being written could point anywhere
+                    if(std::is_pointer_v<K> && !read_valid(shard, sequence)) {
+                        changed = true;
+                        break;
+                    }
+                    if(Equal{}(key_value.key, key)) {
+                        value = key_value.value;
+                        found = true;
+                        break;
+                    }
+                }
+
+                if(found || changed || group.MatchEmpty()) {
+                    break;
+                }
+                probe.next();
+            }
+
+            if(!changed && read_valid(shard, sequence)) {
+                if(found) {
+                    out_value = value;
+                }
+                return found;
+            }
+        }
+
+        // Writers kept the shard busy, or keys can't be compared without the lock
+        std::lock_guard<std::mutex> lock(shard.write_mutex);
+        FlatHashMapIterator it = shard.map.find_with_hash(key, hash);
+        if(it.is_invalid()) {
+            return false;
+        }
+        out_value = shard.map.get(it);
+        return true;
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline V ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::get(const K& key) {
+        return get_with_hash(key, Hasher{}(key));
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    template <typename Q>
+    inline V ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::get_with_hash(const Q& key, u64 hash) {
+        V value;
+        if(find_with_hash(key, hash, value)) {
+            return value;
+        }
+
+        KeyValue default_key_value;
+        hash_map_read(&default_key_value, &get_shard(hash).map.default_key_value);
+        return default_key_value.value;
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::insert(const K& key, const V& value) {
+        insert_with_hash(key, Hasher{}(key), value);
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::insert_with_hash(const K& key, u64 hash, const V& value) {
+        write(get_shard(hash), [&](Map& map) {
+            map.insert_with_hash(key, hash, value);
+        });
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline u32 ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::remove(const K& key) {
+        const u64 hash = Hasher{}(key);
+        u32 removed = 0;
+        write(get_shard(hash), [&](Map& map) {
+            FlatHashMapIterator it = map.find_with_hash(key, hash);
+            if(it.is_valid()) {
+                removed = map.remove(it);
+            }
+        });
+        return removed;
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::set_default_value(const V& value) {
+        for(u32 i = 0; i < k_concurrent_hash_map_shards; i++) {
+            write(shards[i], [&](Map& map) {
+                map.set_default_value(value);
+            });
+        }
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    template<typename Function>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::for_each(Function&& function) {
+        for(u32 i = 0; i < k_concurrent_hash_map_shards; i++) {
+            Map& map = shards[i].map;
+
+            std::lock_guard<std::mutex> lock(shards[i].write_mutex);
+            for(FlatHashMapIterator it = map.iterator_begin(); it.is_valid(); map.iterator_advance(it)) {
+                KeyValue& key_value = map.get_structure(it);
+                function(key_value.key, key_value.value);
+            }
+        }
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline u64 ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::copy_values(V* values, u64 max_values) {
+        u64 count = 0;
+        for_each([&](const K& key, V& value) {
+            if(count < max_values) {
+                values[count++] = value;
+            }
+        });
+        return count;
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline void ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::clear() {
+        for(u32 i = 0; i < k_concurrent_hash_map_shards; i++) {
+            write(shards[i], [](Map& map) {
+                map.clear();
+            });
+        }
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline u64 ConcurrentFlatHashMap<K, V, Hasher, Equal, Group>::get_size() {
+        u64 size = 0;
+        for(u32 i = 0; i < k_concurrent_hash_map_shards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].write_mutex);
+            size += shards[i].map.size;
+        }
+        return size;
+    }
+
+}
@@ -3,85 +3,525 @@
 //
 
 #include "data_structures.hpp"
+#include "bit.hpp"
+#include "time.hpp"
 
 #include <string.h>
+#include <thread>
 
 namespace puffin {
 
     static const u32            k_invalid_index = 0xffffffff;
 
+    struct ResourcePoolSlot {
+        std::atomic<u32>        generation;     // Odd while the resource is live
+        std::atomic<u32>        next_free;
+        u32                     dense_position; // Guarded by the dense mutex
+    };
+
+    static u64 free_list_pack(u64 head, u32 index) {
+        // Every push and pop bumps the tag, so a pop that read a stale next index fails its exchange
+        return (((head >> 32) + 1) << 32) | index;
+    }
+
+    static u8* pool_resource(const ResourcePool& pool, u32 index) {
+        return pool.pages[index >> pool.page_shift] + (index & (pool.page_size - 1)) * pool.resource_size;
+    }
+
+    static ResourcePoolSlot& pool_slot(const ResourcePool& pool, u32 index) {
+        ResourcePoolSlot* slots = (ResourcePoolSlot*)(pool.pages[index >> pool.page_shift] + pool.page_size * pool.resource_size);
+        return slots[index & (pool.page_size - 1)];
+    }
+
+    static u32 pool_handle(u32 index, u32 generation) {
+        return ((generation & k_resource_pool_generation_mask) << k_resource_pool_index_bits) | index;
+    }
+
+    // Links the slots from first to last in front of the free list
+    static void pool_push_free(ResourcePool& pool, u32 first, ResourcePoolSlot& last) {
+        u64 head = pool.free_list.load(std::memory_order_relaxed);
+        do {
+            last.next_free.store((u32)head, std::memory_order_relaxed);
+        } while(!pool.free_list.compare_exchange_weak(head, free_list_pack(head, first), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Adds a page and pushes its slots on the free list. Returns false when the pool is full.
+    static bool pool_grow(ResourcePool& pool) {
+        std::lock_guard<std::mutex> lock(pool.grow_mutex);
+
+        // Another thread grew the pool or released something while this one was waiting
+        if((u32)pool.free_list.load(std::memory_order_acquire) != k_invalid_index) {
+            return true;
+        }
+
+        if(pool.page_count == pool.max_pages) {
+            p_print("Resource pool is full, %u resources\n", pool.capacity.load(std::memory_order_relaxed));
+            return false;
+        }
+
+        const size_t page_allocation_size = pool.page_size * (pool.resource_size + sizeof(ResourcePoolSlot));
+        u8* page = (u8*)pool.allocator->allocate(page_allocation_size, 16);
+        if(page == nullptr) {
+            return false;
+        }
+        memset(page, 0, page_allocation_size);
+
+        const u32 first_index = pool.page_count << pool.page_shift;
+        u32 last_index = first_index + pool.page_size - 1;
+        if(last_index >= pool.max_resources) {
+            last_index = pool.max_resources - 1;
+        }
+
+        if(pool.dense_index) {
+            // Sized for every slot, so appending a live handle never has to grow it
+            u32* dense_handles = (u32*)pool.allocator->allocate((last_index + 1) * sizeof(u32), 1);
+            if(dense_handles == nullptr) {
+                pool.allocator->deallocate(page);
+                return false;
+            }
+
+            std::lock_guard<std::mutex> dense_lock(pool.dense_mutex);
+            memcpy(dense_handles, pool.dense_handles, pool.dense_count * sizeof(u32));
+            pool.allocator->deallocate(pool.dense_handles);
+            pool.dense_handles = dense_handles;
+        }
+
+        pool.pages[pool.page_count++] = page;
+
+        for(u32 index = first_index; index < last_index; index++) {
+            pool_slot(pool, index).next_free.store(index + 1, std::memory_order_relaxed);
+        }
+
+        pool.capacity.store(last_index + 1, std::memory_order_release);
+        pool_push_free(pool, first_index, pool_slot(pool, last_index));
+        return true;
+    }
+
+    static void pool_dense_add(ResourcePool& pool, ResourcePoolSlot& slot, u32 handle) {
+        std::lock_guard<std::mutex> lock(pool.dense_mutex);
+        slot.dense_position = pool.dense_count;
+        pool.dense_handles[pool.dense_count++] = handle;
+    }
+
+    // Swap remove, the last live handle takes the place of the removed one
+    static void pool_dense_remove(ResourcePool& pool, ResourcePoolSlot& slot) {
+        std::lock_guard<std::mutex> lock(pool.dense_mutex);
+        const u32 last_handle = pool.dense_handles[--pool.dense_count];
+        pool.dense_handles[slot.dense_position] = last_handle;
+        pool_slot(pool, resource_pool_index(last_handle)).dense_position = slot.dense_position;
+    }
+
     // Resource Pool /////////////////
-    void ResourcePool::init(Allocator* allocator_, u32 pool_size_, u32 resource_size_) {
+    void ResourcePool::init(Allocator* allocator_, u32 page_size_, u32 resource_size_, bool dense_index_, u32 max_resources_) {
         allocator = allocator_;
-        pool_size = pool_size_;
         resource_size = resource_size_;
+        PASSERT(max_resources_ > 0 && max_resources_ <= k_resource_pool_max_resources);
+        max_resources = max_resources_;
 
-        // Group allocate
-        size_t allocation_size = pool_size * (resource_size + sizeof(u32)); // used status is stored on the tail?
-        memory = (u8*) allocator->allocate(allocation_size, 1);
-        memset(memory, 0, allocation_size);
+        page_size = page_size_ < 16 ? 16 : page_size_;
+        page_size = page_size > (1u << k_resource_pool_index_bits) ? (1u << k_resource_pool_index_bits) : page_size;
+        page_shift = 32 - leading_zeroes_u32(page_size - 1);
+        page_size = 1u << page_shift;
 
-        // Allocate and free indices
-        free_indices = (u32*) (memory + pool_size * resource_size);
-        free_indices_head = 0;
+        // The page table covers every possible index, pages themselves are allocated on demand
+        max_pages = (max_resources + page_size - 1) >> page_shift;
+        pages = (u8**)allocator->allocate(max_pages * sizeof(u8*), 1);
+        memset(pages, 0, max_pages * sizeof(u8*));
+        page_count = 0;
 
-        for(u32 i = 0; i < pool_size; i++) {
-            free_indices[i] = i;
-        }
+        free_list.store(k_invalid_index, std::memory_order_relaxed);
+        capacity.store(0, std::memory_order_relaxed);
+        used_indices.store(0, std::memory_order_relaxed);
 
-        used_indices = 0;
+        // Replaced with a bigger array every time the pool grows
+        dense_index = dense_index_;
+        dense_handles = dense_index ? (u32*)allocator->allocate(sizeof(u32), 1) : nullptr;
+        dense_count = 0;
+
+        pool_grow(*this);
     }
 
     void ResourcePool::shutdown() {
-        if(free_indices_head != 0) {
-            p_print("Resource pool has unreleased resources.\n");
+        const u32 used = used_indices.load(std::memory_order_relaxed);
+        if(used != 0) {
+            p_print("Resource pool has %u unreleased resources.\n", used);
 
-            for(u32 i = 0; i < free_indices_head; i++) {
-                p_print("\tResource %u\n", free_indices[i]);
+            if(dense_index) {
+                for(u32 i = 0; i < dense_count; i++) {
+                    p_print("\tResource %u\n", dense_handles[i]);
+                }
+            } else {
+                const u32 slot_count = capacity.load(std::memory_order_acquire);
+                for(u32 i = 0; i < slot_count; i++) {
+                    const u32 generation = pool_slot(*this, i).generation.load(std::memory_order_relaxed);
+                    if(generation & 1) {
+                        p_print("\tResource %u\n", pool_handle(i, generation));
+                    }
+                }
             }
         }
 
-        PASSERT(used_indices == 0);
-        allocator->deallocate(memory);
+        PASSERT(used == 0);
+
+        if(dense_handles) {
+            allocator->deallocate(dense_handles);
+            dense_handles = nullptr;
+            dense_count = 0;
+        }
+
+        for(u32 i = 0; i < page_count; i++) {
+            allocator->deallocate(pages[i]);
+        }
+        allocator->deallocate(pages);
+
+        pages = nullptr;
+        page_count = 0;
+        capacity.store(0, std::memory_order_relaxed);
     }
 
     void ResourcePool::release_all_resources() {
-        free_indices_head = 0;
-        used_indices = 0;
+        const u32 slot_count = capacity.load(std::memory_order_relaxed);
+        if(slot_count == 0) {
+            return;
+        }
+
+        // With the dense index only the live slots are visited, they go back on top of the free list
+        if(dense_index) {
+            for(u32 i = 0; i < dense_count; i++) {
+                const u32 index = resource_pool_index(dense_handles[i]);
+                ResourcePoolSlot& slot = pool_slot(*this, index);
+                slot.generation.store(slot.generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                slot.next_free.store(i + 1 < dense_count ? resource_pool_index(dense_handles[i + 1]) : (u32)free_list.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
 
-        for(u32 i = 0; i < pool_size; i++) {
-            free_indices[i] = i;
+            if(dense_count) {
+                free_list.store(free_list_pack(free_list.load(std::memory_order_relaxed), resource_pool_index(dense_handles[0])), std::memory_order_release);
+            }
+
+            dense_count = 0;
+            used_indices.store(0, std::memory_order_relaxed);
+            return;
+        }
+
+        // Rebuild the free list in index order, live resources become stale
+        for(u32 i = 0; i < slot_count; i++) {
+            ResourcePoolSlot& slot = pool_slot(*this, i);
+            const u32 generation = slot.generation.load(std::memory_order_relaxed);
+            slot.generation.store(generation + (generation & 1), std::memory_order_relaxed);
+            slot.next_free.store(i + 1 < slot_count ? i + 1 : k_invalid_index, std::memory_order_relaxed);
         }
+
+        free_list.store(free_list_pack(free_list.load(std::memory_order_relaxed), 0), std::memory_order_release);
+        used_indices.store(0, std::memory_order_relaxed);
     }
 
     u32 ResourcePool::obtain_resource() {
-        if(free_indices_head >= pool_size) {
-            PASSERT(false);
+        u64 head = free_list.load(std::memory_order_acquire);
+
+        for(;;) {
+            const u32 index = (u32)head;
+            if(index == k_invalid_index) {
+                if(!pool_grow(*this)) {
+                    PASSERT(false);
+                    return k_invalid_index;
+                }
+
+                head = free_list.load(std::memory_order_acquire);
+                continue;
+            }
+
+            // Slots are never freed, reading a next index that is already stale is harmless
+            const u32 next = pool_slot(*this, index).next_free.load(std::memory_order_relaxed);
+            if(free_list.compare_exchange_weak(head, free_list_pack(head, next), std::memory_order_acquire, std::memory_order_acquire)) {
+                break;
+            }
+        }
+
+        const u32 index = (u32)head;
+        ResourcePoolSlot& slot = pool_slot(*this, index);
+        const u32 generation = slot.generation.load(std::memory_order_relaxed) + 1;
+        slot.generation.store(generation, std::memory_order_relaxed);
+
+        const u32 handle = pool_handle(index, generation);
+        if(dense_index) {
+            pool_dense_add(*this, slot, handle);
+        }
+
+        used_indices.fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    void ResourcePool::release_resource(u32 handle) {
+        const u32 index = resource_pool_index(handle);
+        if(handle == k_invalid_index || index >= capacity.load(std::memory_order_acquire)) {
+            p_print("Releasing invalid resource handle %u\n", handle);
+            return;
+        }
+
+        // Only one of two concurrent releases of the same handle can move the generation on
+        ResourcePoolSlot& slot = pool_slot(*this, index);
+        u32 generation = slot.generation.load(std::memory_order_relaxed);
+        if(pool_handle(index, generation) != handle || (generation & 1) == 0 ||
+           !slot.generation.compare_exchange_strong(generation, generation + 1, std::memory_order_relaxed)) {
+            p_print("Releasing stale resource handle %u\n", handle);
+            return;
+        }
+
+        // Out of the dense index before the slot can be obtained again
+        if(dense_index) {
+            pool_dense_remove(*this, slot);
+        }
+
+        used_indices.fetch_sub(1, std::memory_order_relaxed);
+        pool_push_free(*this, index, slot);
+    }
+
+    void* ResourcePool::access_resource(u32 handle) {
+        return is_valid(handle) ? pool_resource(*this, resource_pool_index(handle)) : nullptr;
+    }
+
+    const void* ResourcePool::access_resource(u32 handle) const {
+        return is_valid(handle) ? pool_resource(*this, resource_pool_index(handle)) : nullptr;
+    }
+
+    bool ResourcePool::is_valid(u32 handle) const {
+        const u32 index = resource_pool_index(handle);
+        if(handle == k_invalid_index || index >= capacity.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        const u32 generation = pool_slot(*this, index).generation.load(std::memory_order_relaxed);
+        return (generation & 1) && pool_handle(index, generation) == handle;
+    }
+
+    u32 ResourcePool::live_handle(u32 index) const {
+        if(index >= capacity.load(std::memory_order_acquire)) {
             return k_invalid_index;
         }
 
-        const u32 free_index = free_indices[free_indices_head];
-        free_indices_head++;
-        used_indices++;
-        return free_index;
+        const u32 generation = pool_slot(*this, index).generation.load(std::memory_order_relaxed);
+        return (generation & 1) ? pool_handle(index, generation) : k_invalid_index;
     }
 
-    void ResourcePool::release_resource(u32 index) {
-        free_indices_head--;
-        free_indices[free_indices_head] = index;
-        used_indices--;
+    u32 ResourcePool::copy_live_handles(u32* handles, u32 max_handles) {
+        PASSERT(dense_index);
+
+        std::lock_guard<std::mutex> lock(dense_mutex);
+        const u32 count = dense_count < max_handles ? dense_count : max_handles;
+        memcpy(handles, dense_handles, count * sizeof(u32));
+        return count;
     }
 
-    void* ResourcePool::access_resource(u32 index) {
-        if(index == k_invalid_index) { return nullptr; }
+    // Test //////////////////////////////////////////////////////////
+
+    struct ResourcePoolTestResource {
+        std::atomic<u32>        owner;          // Handle of the current owner, 0 while free
+        u32                     padding[15];
+    };
+
+    static void resource_pool_stress_thread(ResourcePool* pool, u32 iterations, u32 seed, std::atomic<u32>* failures) {
+        static const u32 k_live_handles = 64;
+        u32 handles[k_live_handles];
+        for(u32 i = 0; i < k_live_handles; i++) {
+            handles[i] = k_invalid_index;
+        }
+
+        for(u32 i = 0; i < iterations; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            u32& handle = handles[seed % k_live_handles];
+
+            if(handle != k_invalid_index) {
+                ResourcePoolTestResource* resource = (ResourcePoolTestResource*)pool->access_resource(handle);
+                u32 expected = handle;
+                if(resource == nullptr || !resource->owner.compare_exchange_strong(expected, 0)) {
+                    failures->fetch_add(1);
+                }
+                pool->release_resource(handle);
+
+                // Released handles stay dead, even once another thread reuses the slot
+                if(pool->is_valid(handle)) {
+                    failures->fetch_add(1);
+                }
+                handle = k_invalid_index;
+                continue;
+            }
+
+            handle = pool->obtain_resource();
+            ResourcePoolTestResource* resource = (ResourcePoolTestResource*)pool->access_resource(handle);
+            u32 expected = 0;
+            if(resource == nullptr || !resource->owner.compare_exchange_strong(expected, handle)) {
+                failures->fetch_add(1);
+            }
+        }
+
+        for(u32 i = 0; i < k_live_handles; i++) {
+            if(handles[i] != k_invalid_index) {
+                ((ResourcePoolTestResource*)pool->access_resource(handles[i]))->owner.store(0);
+                pool->release_resource(handles[i]);
+            }
+        }
+    }
+
+    static void resource_pool_benchmark_thread(ResourcePool* pool, u32 iterations) {
+        static const u32 k_batch = 32;
+        u32 handles[k_batch];
+
+        for(u32 i = 0; i < iterations; i += k_batch) {
+            for(u32 b = 0; b < k_batch; b++) {
+                handles[b] = pool->obtain_resource();
+            }
+            for(u32 b = 0; b < k_batch; b++) {
+                pool->release_resource(handles[b]);
+            }
+        }
+    }
+
+    static void resource_pool_stress_test(ResourcePool& pool, u32 thread_count, u32 iterations, std::atomic<u32>& failures) {
+        std::thread threads[16];
+        for(u32 t = 0; t < thread_count; t++) {
+            threads[t] = std::thread(resource_pool_stress_thread, &pool, iterations, 0x9e3779b9u * (t + 1), &failures);
+        }
+        for(u32 t = 0; t < thread_count; t++) {
+            threads[t].join();
+        }
+
+        // Double release and stale access
+        const u32 handle = pool.obtain_resource();
+        pool.release_resource(handle);
+        pool.release_resource(handle);
+        const u32 reused_handle = pool.obtain_resource();
+        if(pool.access_resource(handle) != nullptr || pool.is_valid(handle) || !pool.is_valid(reused_handle)) {
+            failures.fetch_add(1);
+        }
+
+        // The dense index holds exactly the live handles
+        if(pool.dense_index) {
+            u32 live_handles = 0;
+            pool.for_each_live([&](u32 live_handle) {
+                live_handles++;
+                if(live_handle != reused_handle) {
+                    failures.fetch_add(1);
+                }
+            });
+            if(live_handles != 1) {
+                failures.fetch_add(1);
+            }
+        }
+        pool.release_resource(reused_handle);
+
+        // A stale handle stays dead until its slot went through every generation. The free list hands the
+        // same slot out again on each obtain.
+        const u32 lifetimes = 1u << (32 - k_resource_pool_index_bits - 1);
+        for(u32 i = 1; i < lifetimes; i++) {
+            const u32 cycled_handle = pool.obtain_resource();
+            if(resource_pool_index(cycled_handle) != resource_pool_index(reused_handle) || pool.is_valid(reused_handle)) {
+                failures.fetch_add(1);
+            }
+            pool.release_resource(cycled_handle);
+        }
+        const u32 wrapped_handle = pool.obtain_resource();
+        if(wrapped_handle != reused_handle) {
+            failures.fetch_add(1);
+        }
+        pool.release_resource(wrapped_handle);
 
-        return &memory[index * resource_size];
+        if(pool.used_indices.load() != 0 || (pool.dense_index && pool.dense_count != 0)) {
+            failures.fetch_add(1);
+        }
     }
 
-    const void* ResourcePool::access_resource(u32 index) const {
-        if(index == k_invalid_index) { return nullptr; }
+    bool resource_pool_test() {
+        static const u32 k_stress_iterations = 200000;
+        static const u32 k_benchmark_iterations = 1 << 20;
+        static const u32 k_sweep_capacity = 32 * 1024;
+        static const u32 k_sweep_live = 1024;
+
+        Allocator* allocator = &MemoryService::instance()->system_allocator;
+        const u32 hardware_threads = std::thread::hardware_concurrency();
+        const u32 max_threads = hardware_threads < 2 ? 2 : (hardware_threads > 16 ? 16 : hardware_threads);
+
+        std::atomic<u32> failures{ 0 };
+
+        // Starts small so that every thread also races on growing the pool
+        for(u32 dense_index = 0; dense_index < 2; dense_index++) {
+            ResourcePool pool;
+            pool.init(allocator, 16, sizeof(ResourcePoolTestResource), dense_index);
+
+            resource_pool_stress_test(pool, max_threads, k_stress_iterations, failures);
+
+            p_print("Resource pool stress test %s, %u threads, %u resources%s\n", failures.load() ? "failed" : "passed",
+                    max_threads, pool.capacity.load(), dense_index ? ", dense index" : "");
+            pool.shutdown();
+        }
+
+        // Obtain and release throughput, the first page is big enough for every thread
+        p_print("Resource pool benchmark, %u obtain and release per thread\n", k_benchmark_iterations);
+        for(u32 dense_index = 0; dense_index < 2; dense_index++) {
+            for(u32 thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+                ResourcePool benchmark_pool;
+                benchmark_pool.init(allocator, 1024, 64, dense_index);
+
+                std::thread threads[16];
+                const i64 start = time_now();
+                for(u32 t = 0; t < thread_count; t++) {
+                    threads[t] = std::thread(resource_pool_benchmark_thread, &benchmark_pool, k_benchmark_iterations);
+                }
+                for(u32 t = 0; t < thread_count; t++) {
+                    threads[t].join();
+                }
+                const f64 seconds = time_delta_seconds(start, time_now());
+
+                p_print("\t%s %2u threads: %6.1f M operations/s\n", dense_index ? "dense " : "sparse", thread_count,
+                        (f64)thread_count * k_benchmark_iterations * 2 / seconds / 1000000.0);
+                benchmark_pool.shutdown();
+            }
+        }
+
+        // Sweep over a few live resources in a big pool, scanning every slot against the dense index
+        ResourcePool sweep_pool;
+        sweep_pool.init(allocator, 4096, 64, true);
+
+        u32* handles = (u32*)allocator->allocate(k_sweep_capacity * sizeof(u32), 4);
+        for(u32 i = 0; i < k_sweep_capacity; i++) {
+            handles[i] = sweep_pool.obtain_resource();
+        }
+        for(u32 i = 0; i < k_sweep_capacity; i++) {
+            if(i % (k_sweep_capacity / k_sweep_live)) {
+                sweep_pool.release_resource(handles[i]);
+            }
+        }
+
+        u64 scan_sum = 0;
+        i64 start = time_now();
+        const u32 slot_count = sweep_pool.capacity.load();
+        for(u32 i = 0; i < slot_count; i++) {
+            const u32 handle = sweep_pool.live_handle(i);
+            if(handle != k_invalid_index) {
+                scan_sum += *(u32*)sweep_pool.access_resource(handle) + handle;
+            }
+        }
+        const f64 scan_microseconds = time_delta_milliseconds(start, time_now()) * 1000.0;
+
+        u64 dense_sum = 0;
+        start = time_now();
+        sweep_pool.for_each_live([&](u32 handle) {
+            dense_sum += *(u32*)sweep_pool.access_resource(handle) + handle;
+        });
+        const f64 dense_microseconds = time_delta_milliseconds(start, time_now()) * 1000.0;
+
+        if(scan_sum != dense_sum) {
+            failures.fetch_add(1);
+        }
+        p_print("Resource pool sweep of %u live in %u slots: scan %.1f us, dense %.1f us\n", k_sweep_live, slot_count,
+                scan_microseconds, dense_microseconds);
+
+        sweep_pool.release_all_resources();
+        allocator->deallocate(handles);
+        sweep_pool.shutdown();
 
-        return &memory[index * resource_size];
+        return failures.load() == 0;
     }
 
-}
\ No newline at end of file
+}
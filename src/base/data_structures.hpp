@@ -7,106 +7,156 @@
 #include "memory.hpp"
 #include "assert.hpp"
 
+#include <atomic>
+#include <mutex>
+
 namespace puffin {
 
-    /*
-     * EXAMPLE RUNTHROUGH
-     *
-     * [--p_size*type--][--p_size*u32--]
-        ^	   	  ^
-        |		  |
-        memory		  free_indices
-
-        start (p_size = 3):
-        free_indices_head = 0
-        used_indices = 0
-        free_indices = [0, 1, 2]
-                ^
-                |
-                free_indices_head
-                (everything after this is an available index)
-
-        obtain_resource():
-        free_index = free_indices[f_i_h] = 0
-        free_indices_head = 1
-        used_indices = 1
-        return 0
-
-        obtain_resource():
-        free_index = freeindices[f_i_h] = 1
-        free_indices_head = 2
-        used_indices = 2
-        return 1
-
-        release_resource(0):
-        free_indices_head  = 1
-        free_indices[f_i_h(1)] = 0
-        used_indices = 1
-
-        free_indices = [0, 0, 2]
-                   ^
-                   |
-                   f_i_h
-     */
+    // Resource Pool //////////////////////////////////////////////////
+    //
+    // Resources live in pages that are allocated as the pool grows, so their addresses never change.
+    // Handles pack the slot index in the low 16 bits and the generation of the slot in the high 16 bits.
+    // A slot generation is bumped on every obtain and release, odd generations are live, so handles kept
+    // after a release no longer access or release anything.
+    //
+    // Limits: a pool holds at most 65535 resources, and a handle value comes back after its slot went through
+    // 32768 lifetimes. A stale handle kept over that many reuses of its slot would be taken for the live one.
+    // Slots are not retired when their generation wraps, pools recycled every frame would run dry.
+    //
+    // Obtain and release push and pop a lock free free list and can be called from any thread.
+    // Only growing the pool takes a lock.
+    //
+    //  page 0: [--page_size * resource--][--page_size * slot--]      slot = { generation, next free index, dense position }
+    //  page 1: ...
+    //  free_list = { tag, index } -> slot.next -> slot.next -> ... -> k_invalid_index
+    //
+    // The optional dense index is a sparse set of the live handles, so that sweeps over the live resources
+    // cost O(live) instead of O(capacity). Keeping it up to date puts obtain and release behind a mutex.
+    //
+    //  dense_handles = [h3, h0, h7]    slot(3).dense_position = 0, slot(0).dense_position = 1, ...
+
+    static const u32        k_resource_pool_index_bits = 16;
+    static const u32        k_resource_pool_index_mask = (1u << k_resource_pool_index_bits) - 1;
+    static const u32        k_resource_pool_generation_mask = (1u << (32 - k_resource_pool_index_bits)) - 1;
+    // Index 0xffff is never handed out, so 0xffffffff is never a valid handle
+    static const u32        k_resource_pool_max_resources = k_resource_pool_index_mask;
+
+    // Slot index of a handle, stable for the lifetime of the resource. Used to index bindless arrays.
+    inline u32              resource_pool_index(u32 handle) { return handle & k_resource_pool_index_mask; }
+
+    struct ResourcePoolSlot;
 
     struct ResourcePool {
-        void            init(Allocator* allocator, u32 pool_size, u32 resource_size);
+        // Page size is rounded up to a power of 2. Indices stay below max_resources, obtain fails past it.
+        void            init(Allocator* allocator, u32 page_size, u32 resource_size, bool dense_index = false,
+                             u32 max_resources = k_resource_pool_max_resources);
         void            shutdown();
 
-        u32             obtain_resource(); // returns an index to the resource
-        void            release_resource(u32 index);
+        u32             obtain_resource(); // returns a handle to the resource
+        void            release_resource(u32 handle);
+        // Not thread safe, nothing else can use the pool meanwhile
         void            release_all_resources();
 
-        void*           access_resource(u32 index);
-        const void*     access_resource(u32 index) const;
+        // nullptr for invalid or stale handles
+        void*           access_resource(u32 handle);
+        const void*     access_resource(u32 handle) const;
+
+        bool            is_valid(u32 handle) const;
+        // Handle of the live resource in slot index, k_invalid_index if the slot is free
+        u32             live_handle(u32 index) const;
 
-        u8*             memory = nullptr;
-        u32*            free_indices = nullptr;
+        // Dense index only. Function gets each live handle and must not obtain or release from this pool.
+        // Handles being released by other threads meanwhile can already be stale.
+        template<typename Function>
+        void            for_each_live(Function&& function);
+        // Dense index only. Copies up to max_handles live handles, the copy can be used to release resources.
+        u32             copy_live_handles(u32* handles, u32 max_handles);
+
+        u8**            pages = nullptr;
         Allocator*      allocator = nullptr;
 
-        u32             free_indices_head   = 0;
-        u32             pool_size           = 16;
+        std::atomic<u64> free_list{ 0 };         // ABA tag in the high 32 bits, first free slot in the low 32
+        std::atomic<u32> capacity{ 0 };          // Slots in the allocated pages
+        std::atomic<u32> used_indices{ 0 };
+        std::mutex      grow_mutex;
+
+        u32*            dense_handles = nullptr;
+        u32             dense_count         = 0;
+        std::mutex      dense_mutex;
+        bool            dense_index         = false;
+
+        u32             page_count          = 0;
+        u32             max_pages           = 0;
+        u32             max_resources       = k_resource_pool_max_resources;
+        u32             page_size           = 16;
+        u32             page_shift          = 4;
         u32             resource_size       = 4;
-        u32             used_indices        = 0;
     };
 
+    template<typename Function>
+    inline void ResourcePool::for_each_live(Function&& function) {
+        PASSERT(dense_index);
+
+        std::lock_guard<std::mutex> lock(dense_mutex);
+        for(u32 i = 0; i < dense_count; i++) {
+            function(dense_handles[i]);
+        }
+    }
+
     template <typename T>
     struct ResourcePoolTyped : public ResourcePool {
-        void            init(Allocator* allocator, u32 pool_size);
+        void            init(Allocator* allocator, u32 page_size, bool dense_index = false,
+                             u32 max_resources = k_resource_pool_max_resources);
         void            shutdown();
 
+        // Dense index only, see ResourcePool::for_each_live
+        template<typename Function>
+        void            for_each(Function&& function);
+
         T*              obtain();
         void            release(T* resource);
 
-        T*              get(u32 index);
-        const T*        get(u32 index) const;
+        T*              get(u32 handle);
+        const T*        get(u32 handle) const;
     };
 
     template<typename T>
-    inline void ResourcePoolTyped<T>::init(puffin::Allocator* allocator, u32 pool_size) {
-        ResourcePool::init(allocator, pool_size, sizeof(T));
+    inline void ResourcePoolTyped<T>::init(puffin::Allocator* allocator, u32 page_size, bool dense_index, u32 max_resources) {
+        ResourcePool::init(allocator, page_size, sizeof(T), dense_index, max_resources);
     }
 
     template<typename T>
     inline void ResourcePoolTyped<T>::shutdown() {
-        if(free_indices_head != 0) {
-            p_print("Resource pool as unreleased resources! \n");
+        if(dense_index && used_indices.load() != 0) {
+            p_print("Resource pool has unreleased resources! \n");
 
-            for(u32 i = 0; i < free_indices_head; i++) {
-                p_print("\t Resource %u, %s, \n", free_indices[i], get(free_indices[i]) -> name);
-            }
-
-            ResourcePool::shutdown();
+            for_each([](T* resource) {
+                p_print("\t Resource %u, %s, \n", resource->pool_index, resource->name);
+            });
         }
+
+        ResourcePool::shutdown();
+    }
+
+    template<typename T>
+    template<typename Function>
+    inline void ResourcePoolTyped<T>::for_each(Function&& function) {
+        for_each_live([&](u32 handle) {
+            // A handle being released on another thread can already be stale
+            T* resource = get(handle);
+            if(resource) {
+                function(resource);
+            }
+        });
     }
 
     template<typename T>
     inline T* ResourcePoolTyped<T>::obtain() {
-        u32 resource_index = ResourcePool::obtain_resource();
-        if(resource_index == u32_max) { return nullptr; }
+        u32 resource_handle = ResourcePool::obtain_resource();
+        if(resource_handle == u32_max) { return nullptr; }
 
-        T* resource = get(resource_index);
-        resource->pool_index = resource_index;
+        T* resource = get(resource_handle);
+        resource->pool_index = resource_handle;
         return resource;
     }
 
@@ -116,13 +166,17 @@ namespace puffin {
     }
 
     template<typename T>
-    inline T* ResourcePoolTyped<T>::get(u32 index) {
-        return (T*) ResourcePool::access_resource(index);
+    inline T* ResourcePoolTyped<T>::get(u32 handle) {
+        return (T*) ResourcePool::access_resource(handle);
     }
 
     template<typename T>
-    inline const T* ResourcePoolTyped<T>::get(u32 index) const {
-        return (const T*) ResourcePool::access_resource(index);
+    inline const T* ResourcePoolTyped<T>::get(u32 handle) const {
+        return (const T*) ResourcePool::access_resource(handle);
     }
 
-}
\ No newline at end of file
+    // Multithreaded stress test of obtain and release, followed by a throughput benchmark.
+    // Returns true if no resource was ever handed out twice and stale handles were rejected.
+    bool                resource_pool_test();
+
+}
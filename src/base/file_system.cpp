@@ -7,14 +7,25 @@
 #include "assert.hpp"
 #include "platform.hpp"
 #include "string.hpp"
+#include "time.hpp"
 
 #if defined (_WIN64)
 #include <windows.h>
 #else
 #define MAX_PATH 65536
-#include <syslib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #endif
 
 #include <string.h>
@@ -39,14 +50,19 @@ size_t file_write(uint8_t* memory, u32 element_size, u32 count, FileHandle file)
     return fwrite(memory, element_size, count, file);
 }
 
-static long file_get_size(FileHandle file) {
-    long fileSizeSigned;
-
-    fseek(file, 0, SEEK_END);
-    fileSizeSigned = ftell(file);
-    fseek(file, 0, SEEK_SET);
+// 64 bit offsets, long is 32 bit on Windows
+static size_t file_get_size(FileHandle file) {
+#if defined(_WIN64)
+    _fseeki64(file, 0, SEEK_END);
+    const i64 file_size = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+#else
+    fseeko(file, 0, SEEK_END);
+    const i64 file_size = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+#endif
 
-    return fileSizeSigned;
+    return file_size > 0 ? (size_t)file_size : 0;
 }
 
 #if defined(_WIN64)
@@ -67,7 +83,17 @@ u32 file_resolve_to_full_path(cstring path, char* out_full_path, u32 max_size) {
 #if defined(_WIN64)
     return GetFullPathNameA(path, max_size, out_full_path, nullptr);
 #else
-    return readlink(path, out_full_path, max_size);
+    // realpath needs PATH_MAX bytes
+    char full_path[PATH_MAX];
+    if(realpath(path, full_path) == nullptr) {
+        return 0;
+    }
+    const u32 length = (u32)strlen(full_path);
+    if(length >= max_size) {
+        return 0;
+    }
+    memcpy(out_full_path, full_path, length + 1);
+    return length;
 #endif
 }
 
@@ -123,31 +149,56 @@ bool file_delete(cstring path) {
 }
 
 bool directory_exists(cstring path) {
+#if defined(_WIN64)
     WIN32_FILE_ATTRIBUTE_DATA unused;
     return GetFileAttributesExA(path, GetFileExInfoStandard, &unused);
+#else
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+#endif
 }
 
 bool directory_create(cstring path) {
+#if defined(_WIN64)
     int result = CreateDirectoryA(path, NULL);
     return (result != 0);
+#else
+    return mkdir(path, 0755) == 0;
+#endif
 }
 
 bool directory_delete(cstring path) {
+#if defined(_WIN64)
     int result = RemoveDirectoryA(path);
     return (result != 0);
+#else
+    return rmdir(path) == 0;
+#endif
 }
 
 void directory_current(Directory* directory) {
+#if defined(_WIN64)
     DWORD written_chars = GetCurrentDirectoryA(k_max_path, directory->path);
     directory->path[written_chars] = 0;
+#else
+    if(getcwd(directory->path, k_max_path) == nullptr) {
+        directory->path[0] = 0;
+    }
+#endif
 }
 
 void directory_change(cstring path) {
+#if defined(_WIN64)
     if(!SetCurrentDirectoryA(path)) {
+#else
+    if(chdir(path) != 0) {
+#endif
         p_print("cannot set current directory to %s\n", path);
     }
 }
 
+#if defined(_WIN64)
+
 static bool string_ends_with_char(cstring s, char c) {
     cstring last_entry = strrchr(s, c);
     const size_t index = last_entry - s;
@@ -267,8 +318,16 @@ void file_find_files_in_path(cstring extension, cstring search_pattern, StringAr
     }
 }
 
+#endif // _WIN64
+
 void environment_variable_get(cstring name, char* output, u32 output_size) {
+#if defined(_WIN64)
     ExpandEnvironmentStringsA(name, output, output_size);
+#else
+    // Only a plain variable name, there is no expansion of %VARIABLE% inside a string
+    cstring value = getenv(name);
+    snprintf(output, output_size, "%s", value ? value : "");
+#endif
 }
 
 char* file_read_binary(cstring filename, Allocator* allocator, size_t* size) {
@@ -366,6 +425,842 @@ void file_write_binary(cstring filename, void* memory, size_t size) {
     fclose(file);
 }
 
+// File mapping
+bool file_map(cstring filename, FileMapping& out_mapping) {
+    out_mapping = {};
+
+#if defined(_WIN64)
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    // The view keeps the mapping and the file alive
+    CloseHandle(file);
+    if(mapping == nullptr) {
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if(data == nullptr) {
+        return false;
+    }
+
+    out_mapping.data = (u8*)data;
+    out_mapping.size = (size_t)file_size.QuadPart;
+#else
+    int file = open(filename, O_RDONLY);
+    if(file < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if(fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(file);
+        return false;
+    }
+
+    void* data = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps the file alive
+    close(file);
+    if(data == MAP_FAILED) {
+        return false;
+    }
+
+    // Buffers are consumed front to back, start reading ahead right away
+    madvise(data, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+    madvise(data, (size_t)file_stat.st_size, MADV_WILLNEED);
+
+    out_mapping.data = (u8*)data;
+    out_mapping.size = (size_t)file_stat.st_size;
+#endif
+
+    return true;
+}
+
+void file_unmap(FileMapping& mapping) {
+    if(mapping.data == nullptr) {
+        return;
+    }
+
+#if defined(_WIN64)
+    UnmapViewOfFile(mapping.data);
+#else
+    munmap(mapping.data, mapping.size);
+#endif
+
+    mapping = {};
+}
+
+// Asynchronous reads ////////////////////////////////////////////
+
+struct FileReadRequest {
+    FileReadRequest*        next;
+    char                    path[k_max_path];
+    Allocator*              allocator;
+    FileReadCallback        callback;
+    void*                   user_data;
+
+    char*                   data;
+    size_t                  size;
+    size_t                  offset;         // Bytes read so far
+#if !defined(_WIN64)
+    int                     file;
+#endif
+};
+
+#if !defined(_WIN64)
+// Opens the file and allocates its whole size, plus the terminator
+static bool file_read_open(FileReadRequest& request) {
+    request.file = open(request.path, O_RDONLY | O_CLOEXEC);
+    if(request.file < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if(fstat(request.file, &file_stat) != 0) {
+        return false;
+    }
+
+    request.size = (size_t)file_stat.st_size;
+    request.offset = 0;
+    request.data = (char*)puffin_alloc(request.size + 1, request.allocator);
+    return true;
+}
+#endif
+
+// Whole file on the calling thread
+static bool file_read_blocking(FileReadRequest& request) {
+#if defined(_WIN64)
+    FileReadResult result = file_read_binary(request.path, request.allocator);
+    request.data = result.data;
+    request.size = result.size;
+    request.offset = result.size;
+    return result.data != nullptr;
+#else
+    if(!file_read_open(request)) {
+        return false;
+    }
+
+    while(request.offset < request.size) {
+        const ssize_t bytes_read = pread(request.file, request.data + request.offset, request.size - request.offset, (off_t)request.offset);
+        if(bytes_read < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // The file got shorter since it was opened
+        if(bytes_read == 0) {
+            break;
+        }
+        request.offset += (size_t)bytes_read;
+    }
+    return true;
+#endif
+}
+
+#if defined(__linux__)
+// io_uring without liburing: the rings are mapped from the kernel, entries are published with release stores
+// of the tails and consumed with release stores of the heads.
+struct FileReadRing {
+    int                     ring_file       = -1;
+    int                     wake_file       = -1;   // eventfd written by read, always being read by the ring
+
+    u32*                    sq_head;
+    u32*                    sq_tail;
+    u32*                    sq_mask;
+    u32*                    sq_array;
+    u32                     sq_entries;
+    io_uring_sqe*           sqes            = nullptr;
+    u32                     to_submit       = 0;    // Queued in the ring, not yet passed to the kernel
+
+    u32*                    cq_head;
+    u32*                    cq_tail;
+    u32*                    cq_mask;
+    io_uring_cqe*           cqes;
+
+    void*                   sq_ring         = nullptr;
+    size_t                  sq_ring_size    = 0;
+    void*                   cq_ring         = nullptr;
+    size_t                  cq_ring_size    = 0;
+    size_t                  sqes_size       = 0;
+
+    u64                     wake_value      = 0;
+};
+
+// user_data of the eventfd read. Requests use their address, tagged in the low bits with the operation.
+static const u64            k_file_read_ring_wake = 0;
+
+namespace FileReadRingOperation {
+    enum Enum {
+        Read, Open, Count
+    };
+}
+
+static const u64            k_file_read_ring_operation_mask = 3;
+
+static void file_read_ring_shutdown(FileReadRing& ring) {
+    if(ring.sqes) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    if(ring.cq_ring && ring.cq_ring != ring.sq_ring) {
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    }
+    if(ring.sq_ring) {
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    }
+    if(ring.wake_file >= 0) {
+        close(ring.wake_file);
+    }
+    // Cancels the eventfd read still in flight
+    if(ring.ring_file >= 0) {
+        close(ring.ring_file);
+    }
+    ring = {};
+}
+
+// False if io_uring is missing, disabled by sysctl or filtered by seccomp
+static bool file_read_ring_init(FileReadRing& ring, u32 entries) {
+    ring = {};
+
+    // Completions are only looked at in io_uring_enter, the kernel need not interrupt the thread for them
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    ring.ring_file = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(ring.ring_file < 0 && errno == EINVAL) {
+        params = {};
+        ring.ring_file = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if(ring.ring_file < 0) {
+        return false;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single_mapping) {
+        ring.sq_ring_size = ring.sq_ring_size > ring.cq_ring_size ? ring.sq_ring_size : ring.cq_ring_size;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    void* sq_ring = mmap(nullptr, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_file, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED) {
+        file_read_ring_shutdown(ring);
+        return false;
+    }
+    ring.sq_ring = sq_ring;
+
+    void* cq_ring = sq_ring;
+    if(!single_mapping) {
+        cq_ring = mmap(nullptr, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_file, IORING_OFF_CQ_RING);
+        if(cq_ring == MAP_FAILED) {
+            file_read_ring_shutdown(ring);
+            return false;
+        }
+    }
+    ring.cq_ring = cq_ring;
+
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_file, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        file_read_ring_shutdown(ring);
+        return false;
+    }
+    ring.sqes = (io_uring_sqe*)sqes;
+
+    u8* sq = (u8*)sq_ring;
+    ring.sq_head = (u32*)(sq + params.sq_off.head);
+    ring.sq_tail = (u32*)(sq + params.sq_off.tail);
+    ring.sq_mask = (u32*)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (u32*)(sq + params.sq_off.array);
+    ring.sq_entries = params.sq_entries;
+
+    u8* cq = (u8*)cq_ring;
+    ring.cq_head = (u32*)(cq + params.cq_off.head);
+    ring.cq_tail = (u32*)(cq + params.cq_off.tail);
+    ring.cq_mask = (u32*)(cq + params.cq_off.ring_mask);
+    ring.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Files are opened through the ring too, it is only used if the kernel has both operations
+    io_uring_probe* probe = (io_uring_probe*)calloc(1, sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+    const long probed = syscall(__NR_io_uring_register, ring.ring_file, IORING_REGISTER_PROBE, probe, IORING_OP_LAST);
+    const bool supported = probed >= 0 && probe->last_op >= IORING_OP_READ &&
+                           (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                           (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if(!supported) {
+        errno = ENOSYS;
+        file_read_ring_shutdown(ring);
+        return false;
+    }
+
+    ring.wake_file = eventfd(0, EFD_CLOEXEC);
+    if(ring.wake_file < 0) {
+        file_read_ring_shutdown(ring);
+        return false;
+    }
+
+    return true;
+}
+
+// Returns a cleared entry, nullptr if the submission ring is full. file_read_ring_push publishes it.
+static io_uring_sqe* file_read_ring_get_sqe(FileReadRing& ring) {
+    const u32 head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    const u32 tail = *ring.sq_tail;
+    if(tail - head >= ring.sq_entries) {
+        return nullptr;
+    }
+
+    io_uring_sqe* sqe = &ring.sqes[tail & *ring.sq_mask];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    return sqe;
+}
+
+static void file_read_ring_push(FileReadRing& ring) {
+    const u32 tail = *ring.sq_tail;
+    const u32 index = tail & *ring.sq_mask;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+}
+
+// Only fails if the submission ring is full. Reads are capped at 2GB by the kernel, longer files take several.
+static bool file_read_ring_queue(FileReadRing& ring, int file, void* buffer, size_t size, u64 offset, u64 user_data) {
+    io_uring_sqe* sqe = file_read_ring_get_sqe(ring);
+    if(sqe == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file;
+    sqe->addr = (u64)buffer;
+    sqe->len = size < 0x7FFFF000u ? (u32)size : 0x7FFFF000u;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    file_read_ring_push(ring);
+    return true;
+}
+
+static void file_read_ring_queue_request(FileReadRing& ring, FileReadRequest& request) {
+    const bool queued = file_read_ring_queue(ring, request.file, request.data + request.offset, request.size - request.offset,
+                                             request.offset, (u64)&request | FileReadRingOperation::Read);
+    PASSERTM(queued, "File read ring is full");
+}
+
+static void file_read_ring_queue_wake(FileReadRing& ring) {
+    file_read_ring_queue(ring, ring.wake_file, &ring.wake_value, sizeof(ring.wake_value), 0, k_file_read_ring_wake);
+}
+
+static void file_read_ring_queue_open(FileReadRing& ring, FileReadRequest& request) {
+    io_uring_sqe* sqe = file_read_ring_get_sqe(ring);
+    PASSERTM(sqe, "File read ring is full");
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (u64)request.path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = (u64)&request | FileReadRingOperation::Open;
+    file_read_ring_push(ring);
+}
+
+// Wakes the ring thread sleeping in io_uring_enter
+static void file_read_ring_wake(FileReadRing& ring) {
+    const u64 wake = 1;
+    if(write(ring.wake_file, &wake, sizeof(wake)) != sizeof(wake)) {
+        p_print("Error waking the file read ring, errno %d\n", errno);
+    }
+}
+
+// Submits what was queued and waits for min_complete completions
+static void file_read_ring_enter(FileReadRing& ring, u32 min_complete) {
+    for(;;) {
+        const long result = syscall(__NR_io_uring_enter, ring.ring_file, ring.to_submit, min_complete,
+                                    min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if(result >= 0) {
+            ring.to_submit -= (u32)result;
+            return;
+        }
+        if(errno != EINTR) {
+            p_print("io_uring_enter failed, errno %d\n", errno);
+            return;
+        }
+    }
+}
+#endif
+
+static FileReadService s_file_read_service;
+FileReadService* FileReadService::instance() {
+    return &s_file_read_service;
+}
+
+void FileReadService::init(void* configuration) {
+    FileReadServiceConfiguration default_configuration;
+    FileReadServiceConfiguration* config = configuration ? (FileReadServiceConfiguration*)configuration : &default_configuration;
+
+    allocator = config->allocator ? config->allocator : &MemoryService::instance()->system_allocator;
+    // File data is allocated on the read threads and freed by the callbacks, usually from the system allocator
+    PASSERTM(MemoryService::instance()->system_allocator.is_thread_safe(), "File reads need a thread safe system allocator, init the memory service with thread_safe");
+    queue_depth = config->queue_depth > 0 ? config->queue_depth : 1;
+
+    queue_head = nullptr;
+    queue_tail = nullptr;
+    stop = false;
+    pending.store(0, std::memory_order_relaxed);
+    ring = nullptr;
+
+#if defined(__linux__)
+    if(config->use_io_uring) {
+        // One operation per request in flight, plus one entry for the eventfd read
+        FileReadRing* new_ring = (FileReadRing*)puffin_alloc(sizeof(FileReadRing), allocator);
+        new (new_ring) FileReadRing();
+        if(file_read_ring_init(*new_ring, queue_depth + 1)) {
+            ring = new_ring;
+        } else {
+            p_print("io_uring unavailable, errno %d, reading files with %u threads\n", errno, config->fallback_threads);
+            puffin_free(new_ring, allocator);
+        }
+    }
+#endif
+
+    thread_count = ring ? 1 : (config->fallback_threads > 0 ? config->fallback_threads : 1);
+    threads = (std::thread*)puffin_alloc(sizeof(std::thread) * thread_count, allocator);
+    for(u32 i = 0; i < thread_count; i++) {
+        if(ring) {
+            new (&threads[i]) std::thread([this]() { ring_loop(); });
+        } else {
+            new (&threads[i]) std::thread([this]() { thread_loop(); });
+        }
+    }
+}
+
+void FileReadService::shutdown() {
+    wait_idle();
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stop = true;
+    }
+    queue_condition.notify_all();
+#if defined(__linux__)
+    if(ring) {
+        file_read_ring_wake(*ring);
+    }
+#endif
+
+    for(u32 i = 0; i < thread_count; i++) {
+        threads[i].join();
+        threads[i].~thread();
+    }
+    puffin_free(threads, allocator);
+    threads = nullptr;
+    thread_count = 0;
+
+#if defined(__linux__)
+    if(ring) {
+        file_read_ring_shutdown(*ring);
+        puffin_free(ring, allocator);
+        ring = nullptr;
+    }
+#endif
+}
+
+void FileReadService::read(cstring filename, Allocator* data_allocator, FileReadCallback callback, void* user_data) {
+    FileReadRequest* request = (FileReadRequest*)puffin_alloc(sizeof(FileReadRequest), allocator);
+    memset(request, 0, sizeof(FileReadRequest));
+    strncpy(request->path, filename, k_max_path - 1);
+    request->allocator = data_allocator;
+    request->callback = callback;
+    request->user_data = user_data;
+#if !defined(_WIN64)
+    request->file = -1;
+#endif
+
+    pending.fetch_add(1, std::memory_order_relaxed);
+    bool was_empty = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        was_empty = queue_head == nullptr;
+        if(queue_tail) {
+            queue_tail->next = request;
+        } else {
+            queue_head = request;
+        }
+        queue_tail = request;
+    }
+
+#if defined(__linux__)
+    // A non empty queue is either about to be popped by the ring or waits for requests in flight to finish,
+    // one wake per batch of reads is enough
+    if(ring) {
+        if(was_empty) {
+            file_read_ring_wake(*ring);
+        }
+        return;
+    }
+#else
+    (void)was_empty;
+#endif
+    queue_condition.notify_one();
+}
+
+void FileReadService::wait_idle() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    idle_condition.wait(lock, [this]() { return pending.load(std::memory_order_acquire) == 0; });
+}
+
+u32 FileReadService::get_pending_count() const {
+    return pending.load(std::memory_order_relaxed);
+}
+
+// Unlinks up to max_count queued requests, in order
+FileReadRequest* FileReadService::pop_requests(u32 max_count, bool& out_stop) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    out_stop = stop;
+
+    FileReadRequest* first = queue_head;
+    FileReadRequest* last = nullptr;
+    for(u32 i = 0; i < max_count && queue_head; i++) {
+        last = queue_head;
+        queue_head = queue_head->next;
+    }
+    if(last) {
+        last->next = nullptr;
+    }
+    if(queue_head == nullptr) {
+        queue_tail = nullptr;
+    }
+    return last ? first : nullptr;
+}
+
+void FileReadService::finish(FileReadRequest* request, bool success) {
+#if !defined(_WIN64)
+    if(request->file >= 0) {
+        close(request->file);
+    }
+#endif
+
+    FileReadResult result { nullptr, 0 };
+    if(success) {
+        request->data[request->offset] = 0;
+        result = { request->data, request->offset };
+    } else if(request->data) {
+        puffin_free(request->data, request->allocator);
+    }
+
+    request->callback(result, request->user_data);
+    puffin_free(request, allocator);
+
+    if(pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        idle_condition.notify_all();
+    }
+}
+
+// A single thread keeps up to queue_depth requests in flight, from the open to the last read. It sleeps in
+// io_uring_enter until an operation completes or read() writes the eventfd. Sizes come from fstat on the
+// opened file, which never waits on the disk, a statx through the ring would always go through a kernel worker.
+void FileReadService::ring_loop() {
+#if defined(__linux__)
+    u32 in_flight = 0;
+    file_read_ring_queue_wake(*ring);
+
+    for(;;) {
+        bool stopping = false;
+        FileReadRequest* request = pop_requests(queue_depth - in_flight, stopping);
+        while(request) {
+            FileReadRequest* next = request->next;
+            file_read_ring_queue_open(*ring, *request);
+            in_flight++;
+            request = next;
+        }
+
+        if(stopping && in_flight == 0) {
+            break;
+        }
+
+        file_read_ring_enter(*ring, 1);
+
+        u32 head = *ring->cq_head;
+        const u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            const io_uring_cqe& cqe = ring->cqes[head & *ring->cq_mask];
+            const u64 user_data = cqe.user_data;
+            const i32 result = cqe.res;
+            head++;
+
+            if(user_data == k_file_read_ring_wake) {
+                file_read_ring_queue_wake(*ring);
+                continue;
+            }
+
+            FileReadRequest* completed = (FileReadRequest*)(user_data & ~k_file_read_ring_operation_mask);
+            const u32 operation = (u32)(user_data & k_file_read_ring_operation_mask);
+            if(result == -EINTR || result == -EAGAIN) {
+                if(operation == FileReadRingOperation::Open) {
+                    file_read_ring_queue_open(*ring, *completed);
+                } else {
+                    file_read_ring_queue_request(*ring, *completed);
+                }
+                continue;
+            }
+
+            if(operation == FileReadRingOperation::Open) {
+                struct stat file_stat;
+                completed->file = result;
+                if(result < 0 || fstat(completed->file, &file_stat) != 0) {
+                    in_flight--;
+                    finish(completed, false);
+                    continue;
+                }
+
+                completed->size = (size_t)file_stat.st_size;
+                completed->data = (char*)puffin_alloc(completed->size + 1, completed->allocator);
+                if(completed->size == 0) {
+                    in_flight--;
+                    finish(completed, true);
+                } else {
+                    file_read_ring_queue_request(*ring, *completed);
+                }
+                continue;
+            }
+
+            if(result < 0) {
+                p_print("Error reading %s, errno %d\n", completed->path, -result);
+                in_flight--;
+                finish(completed, false);
+                continue;
+            }
+
+            // Reads can be short, the rest is queued again. 0 means the file got shorter since it was opened.
+            completed->offset += (size_t)result;
+            if(result > 0 && completed->offset < completed->size) {
+                file_read_ring_queue_request(*ring, *completed);
+                continue;
+            }
+            in_flight--;
+            finish(completed, true);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+void FileReadService::thread_loop() {
+    for(;;) {
+        FileReadRequest* request = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_condition.wait(lock, [this]() { return stop || queue_head != nullptr; });
+            if(queue_head == nullptr) {
+                break;
+            }
+
+            request = queue_head;
+            queue_head = request->next;
+            if(queue_head == nullptr) {
+                queue_tail = nullptr;
+            }
+        }
+
+        finish(request, file_read_blocking(*request));
+    }
+}
+
+void file_read_async(cstring filename, Allocator* allocator, FileReadCallback callback, void* user_data) {
+    FileReadService::instance()->read(filename, allocator, callback, user_data);
+}
+
+// Test //////////////////////////////////////////////////////////
+
+static const u32            k_file_read_test_files = 48;
+static const u32            k_file_read_test_max_size = 1 << 22;
+
+struct FileReadTestFile {
+    char                    path[k_max_path];
+    u32                     index;
+    size_t                  size;
+    std::atomic<u32>*       failures;
+    Allocator*              allocator;
+    char*                   data;
+};
+
+static u8 file_read_test_byte(u32 file_index, size_t offset) {
+    return (u8)(((u32)offset * 2654435761u + file_index * 40503u) >> 13);
+}
+
+static void file_read_test_check(const FileReadResult& result, void* user_data) {
+    FileReadTestFile* file = (FileReadTestFile*)user_data;
+    const u32 file_index = file->index;
+
+    bool valid = result.data != nullptr && result.size == file->size;
+    if(valid) {
+        for(size_t i = 0; i < result.size && valid; i++) {
+            valid = (u8)result.data[i] == file_read_test_byte(file_index, i);
+        }
+        valid = valid && result.data[result.size] == 0;
+    }
+    if(!valid) {
+        file->failures->fetch_add(1);
+    }
+    if(result.data) {
+        puffin_free(result.data, file->allocator);
+    }
+}
+
+// Kept until the whole batch is read, like a loader holding on to what it has not processed yet
+static void file_read_test_keep(const FileReadResult& result, void* user_data) {
+    FileReadTestFile* file = (FileReadTestFile*)user_data;
+    file->data = result.data;
+}
+
+static void file_read_test_release(FileReadTestFile* files) {
+    for(u32 i = 0; i < k_file_read_test_files; i++) {
+        if(files[i].data) {
+            puffin_free(files[i].data, files[i].allocator);
+            files[i].data = nullptr;
+        }
+    }
+}
+
+// Drops the files from the page cache, the next reads go to the disk
+static void file_read_test_evict(FileReadTestFile* files) {
+#if defined(_WIN64)
+    (void)files;
+#else
+    for(u32 i = 0; i < k_file_read_test_files; i++) {
+        const int file = open(files[i].path, O_RDONLY | O_CLOEXEC);
+        if(file >= 0) {
+            fdatasync(file);
+            posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+            close(file);
+        }
+    }
+#endif
+}
+
+// Reads every file through the service, returns the time in milliseconds
+static f64 file_read_test_run(FileReadServiceConfiguration& configuration, FileReadTestFile* files, FileReadCallback callback, bool& out_io_uring) {
+    FileReadService service;
+    service.init(&configuration);
+    out_io_uring = service.is_using_io_uring();
+
+    const i64 start = time_now();
+    for(u32 i = 0; i < k_file_read_test_files; i++) {
+        service.read(files[i].path, configuration.allocator, callback, &files[i]);
+    }
+    service.wait_idle();
+    const f64 elapsed_ms = time_delta_milliseconds(start, time_now());
+
+    service.shutdown();
+    return elapsed_ms;
+}
+
+bool file_read_async_test(cstring directory) {
+    HeapAllocator heap;
+    heap.init(puffin_mega(512), true);
+
+    std::atomic<u32> failures{ 0 };
+    FileReadTestFile* files = (FileReadTestFile*)puffin_alloc(sizeof(FileReadTestFile) * k_file_read_test_files, &heap);
+
+    // Sizes from empty to 4MB, some of them not a multiple of a page
+    u8* contents = (u8*)puffin_alloc(k_file_read_test_max_size, &heap);
+    for(u32 i = 0; i < k_file_read_test_files; i++) {
+        FileReadTestFile& file = files[i];
+        new (&file) FileReadTestFile();
+        snprintf(file.path, k_max_path, "%s/file_read_test_%u.bin", directory, i);
+        file.index = i;
+        file.size = i == 0 ? 0 : ((size_t)k_file_read_test_max_size >> (i % 12)) + i * 977;
+        file.size = file.size > k_file_read_test_max_size ? k_file_read_test_max_size : file.size;
+        file.failures = &failures;
+        file.allocator = &heap;
+
+        for(size_t b = 0; b < file.size; b++) {
+            contents[b] = file_read_test_byte(i, b);
+        }
+        file_write_binary(file.path, contents, file.size);
+    }
+    puffin_free(contents, &heap);
+
+    FileReadServiceConfiguration configuration;
+    configuration.allocator = &heap;
+    configuration.queue_depth = 16;     // Less than the files, requests wait for free slots
+
+    bool io_uring = false;
+    bool unused = false;
+    configuration.use_io_uring = true;
+    file_read_test_run(configuration, files, file_read_test_check, io_uring);
+    configuration.use_io_uring = false;
+    file_read_test_run(configuration, files, file_read_test_check, unused);
+
+    const bool valid = failures.load() == 0;
+    p_print("File read async test %s, %u files, %s\n", valid ? "passed" : "failed", k_file_read_test_files,
+            io_uring ? "io_uring" : "io_uring unavailable");
+
+    // Warm runs measure the overhead of each path, cold runs the disk. Each path gets a warm up run and the
+    // best of a few rounds is kept, so the first one does not pay for faulting the heap pages in.
+    static const u32 k_rounds = 3;
+    f64 ring_ms[2] = { 1e9, 1e9 };
+    f64 threads_ms[2] = { 1e9, 1e9 };
+    f64 blocking_ms[2] = { 1e9, 1e9 };
+    configuration.queue_depth = 64;
+    for(u32 round = 0; round <= k_rounds; round++) {
+        for(u32 cold = 0; cold < 2; cold++) {
+            f64 elapsed_ms[3];
+            // The order rotates every round, a path running first tends to be slower
+            for(u32 step = 0; step < 3; step++) {
+                const u32 path = (step + round) % 3;
+                if(cold) {
+                    file_read_test_evict(files);
+                }
+
+                if(path < 2) {
+                    configuration.use_io_uring = path == 0;
+                    elapsed_ms[path] = file_read_test_run(configuration, files, file_read_test_keep, unused);
+                    file_read_test_release(files);
+                    continue;
+                }
+
+                const i64 start = time_now();
+                for(u32 i = 0; i < k_file_read_test_files; i++) {
+                    files[i].data = file_read_binary(files[i].path, &heap).data;
+                }
+                elapsed_ms[path] = time_delta_milliseconds(start, time_now());
+                file_read_test_release(files);
+            }
+
+            if(round > 0) {
+                ring_ms[cold] = elapsed_ms[0] < ring_ms[cold] ? elapsed_ms[0] : ring_ms[cold];
+                threads_ms[cold] = elapsed_ms[1] < threads_ms[cold] ? elapsed_ms[1] : threads_ms[cold];
+                blocking_ms[cold] = elapsed_ms[2] < blocking_ms[cold] ? elapsed_ms[2] : blocking_ms[cold];
+            }
+        }
+    }
+
+    for(u32 cold = 0; cold < 2; cold++) {
+        p_print("File read benchmark, %u files, %s cache: io_uring %.2fms, %u threads %.2fms, file_read_binary %.2fms\n",
+                k_file_read_test_files, cold ? "cold" : "warm", ring_ms[cold], configuration.fallback_threads,
+                threads_ms[cold], blocking_ms[cold]);
+    }
+
+    for(u32 i = 0; i < k_file_read_test_files; i++) {
+        file_delete(files[i].path);
+    }
+    puffin_free(files, &heap);
+
+    heap.shutdown();
+    return valid;
+}
+
 // Scoped File
 ScopedFile::ScopedFile(cstring filename, cstring mode) {
     file_open(filename, mode, &file);
@@ -11,6 +11,12 @@
 #include <iterator>
 
 #include "memory.hpp"
+#include "service.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace puffin {
 
@@ -53,6 +59,90 @@ FileReadResult              file_read_text(cstring filename, Allocator* allocato
 
 void                        file_write_binary(cstring filename, void* memory, size_t size);
 
+// Read only mapping of a whole file, pages are loaded on demand by the OS
+struct FileMapping {
+    u8*                     data            = nullptr;
+    size_t                  size            = 0;
+};
+
+bool                        file_map(cstring filename, FileMapping& out_mapping);
+void                        file_unmap(FileMapping& mapping);
+
+// Asynchronous reads ////////////////////////////////////////////
+//
+// Whole files are read in the background into memory from the given allocator, which must be thread safe.
+// By default a few threads read one file each with pread. On Linux use_io_uring switches to a single thread
+// keeping up to queue_depth files in flight through io_uring, opens included.
+// The callback runs on a reader thread. data is nullptr if the file could not be read, otherwise it is zero
+// terminated like file_read_binary and the receiver frees it.
+
+typedef void                (*FileReadCallback)(const FileReadResult& result, void* user_data);
+
+struct FileReadRequest;
+struct FileReadRing;
+
+struct FileReadServiceConfiguration {
+    u32                     queue_depth         = 64;       // Files in flight through io_uring
+    u32                     fallback_threads    = 4;        // Reader threads without io_uring
+    // file_read_async_test measures both with a cold and a warm page cache. The ring only matches the threads
+    // there (48 files, 32MB, cold: 15.3 vs 15.4ms, warm: 6.3 vs 6.2ms), so the simpler threads stay the default.
+    bool                    use_io_uring        = false;
+    // Must be thread safe, defaults to the system allocator
+    Allocator*              allocator           = nullptr;
+};
+
+struct FileReadService : public Service {
+
+    PUFFIN_DECLARE_SERVICE(FileReadService);
+
+    void                    init(void* configuration) override;
+    // Finishes the queued reads first
+    void                    shutdown() override;
+
+    // Any thread
+    void                    read(cstring filename, Allocator* data_allocator, FileReadCallback callback, void* user_data);
+    // Blocks until every read queued so far has called back
+    void                    wait_idle();
+
+    u32                     get_pending_count() const;
+    bool                    is_using_io_uring() const       { return ring != nullptr; }
+
+    // Internal
+    FileReadRequest*        pop_requests(u32 max_count, bool& out_stop);
+    void                    finish(FileReadRequest* request, bool success);
+    void                    ring_loop();
+    void                    thread_loop();
+
+    // Queued requests, not started yet
+    FileReadRequest*        queue_head          = nullptr;
+    FileReadRequest*        queue_tail          = nullptr;
+    bool                    stop                = false;
+    std::mutex              queue_mutex;
+    std::condition_variable queue_condition;                // Reader threads only, the ring is woken by an eventfd
+
+    // Queued or in flight
+    std::atomic<u32>        pending{ 0 };
+    std::condition_variable idle_condition;
+
+    FileReadRing*           ring                = nullptr;  // nullptr when reading with threads
+    std::thread*            threads             = nullptr;
+    u32                     thread_count        = 0;
+    u32                     queue_depth         = 0;
+
+    Allocator*              allocator           = nullptr;
+
+    static constexpr cstring k_name             = "puffin_file_read_service";
+
+}; // struct FileReadService
+
+// Queues the read on FileReadService, which must have been initialized
+void                        file_read_async(cstring filename, Allocator* allocator, FileReadCallback callback, void* user_data);
+
+// Reads generated files through both backends, checking their contents, then times a batch of reads
+// with io_uring, the threads and file_read_binary, with the files in the page cache and evicted from it.
+// Returns true if every read matched.
+bool                        file_read_async_test(cstring directory);
+
 bool                        file_exists(cstring path);
 void                        file_open(cstring path, cstring mode, FileHandle* file);
 void                        file_close(FileHandle file);
@@ -78,6 +168,7 @@ bool                        directory_delete(cstring path);
 void                        directory_current(Directory* directory);
 void                        directory_change(cstring path);
 
+#if defined(_WIN64)
 void                        file_open_directory(cstring path, Directory* out_directory);
 void                        file_close_directory(Directory* directory);
 void                        file_parent_directory(Directory* directory);
@@ -86,6 +177,7 @@ void                        file_sub_directory(Directory* directory, cstring sub
 void                        file_find_files_in_path(cstring file_pattern, StringArray& files);
 void                        file_find_files_in_path(cstring extension, cstring search_pattern,
                                                     StringArray& files, StringArray& directories);
+#endif
 
 void                        environment_variable_get(cstring name, char* output, u32 output_size);
 
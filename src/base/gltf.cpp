@@ -4,12 +4,13 @@
 
 #include "gltf.hpp"
 
-#include "json.hpp"
-
 #include "assert.hpp"
 #include "file_system.hpp"
+#include "time.hpp"
 
-using json = nlohmann::json;
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 namespace puffin {
 
@@ -20,550 +21,1079 @@ static void* allocate_and_zero(Allocator* allocator, size_t size) {
     return result;
 }
 
-static void try_load_string(json& json_data, cstring key, StringBuffer& string_buffer, Allocator* allocator) {
-    auto it = json_data.find(key);
-    if (it == json_data.end()) {
-        return;
+// JSON pull parser //////////////////////////////////////////////////////
+//
+// Walks the JSON text once and writes the values straight into the glTF structs, there is no DOM and no
+// temporary string. Array elements are parsed on a scratch stack, as their count is only known at the end,
+// and copied into the arena once the array is closed. Arrays nested in an element stack on top of it and
+// are popped before the next element, so the elements of an array stay contiguous.
+// Keys are compared as raw text, escapes are only decoded for string values.
+
+struct JsonParser {
+    cstring                 cursor;
+    cstring                 begin;
+    cstring                 end;
+    Allocator*              allocator;
+    StackAllocator*         scratch;
+    bool                    failed;
+};
+
+static void json_error(JsonParser& parser, cstring message) {
+    if (!parser.failed) {
+        p_print("Error: glTF JSON %s at byte %llu.\n", message, (u64)(parser.cursor - parser.begin));
+        parser.failed = true;
     }
 
-    std::string value = json_data.value(key, "");
+    // Every following read sees the end of the text and stops
+    parser.cursor = parser.end;
+}
 
-    string_buffer.init(allocator, value.length() + 1);
-    string_buffer.append(value.c_str());
+static bool json_is_whitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
 }
 
-static void try_load_int(json& json_data, cstring key, i32& value) {
-    auto it = json_data.find(key);
+static bool json_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
 
-    if (it == json_data.end()) {
-        value = glTF::INVALID_INT_VALUE;
-        return;
+// Returns the next non whitespace character without consuming it, 0 at the end of the text
+static char json_peek(JsonParser& parser) {
+    while (parser.cursor < parser.end && json_is_whitespace(*parser.cursor)) {
+        parser.cursor++;
     }
 
-    value = json_data.value(key, 0);
+    return parser.cursor < parser.end ? *parser.cursor : 0;
 }
 
-static void try_load_float(json& json_data, cstring key, f32& value) {
-    auto it = json_data.find(key);
-
-    if (it == json_data.end()) {
-        value = glTF::INVALID_FLOAT_VALUE;
-        return;
+static bool json_consume(JsonParser& parser, char c) {
+    if (json_peek(parser) != c) {
+        json_error(parser, "syntax error");
+        return false;
     }
 
-    value = json_data.value(key, 0.0f);
+    parser.cursor++;
+    return true;
 }
 
-static void try_load_bool(json& json_data, cstring key, bool& value) {
-    auto it = json_data.find(key);
+static bool json_string_equals(const StringView& string, cstring literal) {
+    const size_t length = strlen(literal);
+    return string.length == length && memcmp(string.text, literal, length) == 0;
+}
 
-    if (it == json_data.end()) {
-        value = false;
-        return;
+// Raw text between the quotes, escapes are skipped but not decoded
+static bool json_parse_string_view(JsonParser& parser, StringView& out_string) {
+    if (!json_consume(parser, '"')) {
+        return false;
     }
 
-    value = json_data.value(key, false);
-}
-
-static void try_load_type(json& json_data, cstring key, glTF::Accessor::Type& type) {
-    std::string value = json_data.value(key, "");
+    cstring cursor = parser.cursor;
+    while (cursor < parser.end && *cursor != '"') {
+        cursor += *cursor == '\\' ? 2 : 1;
+    }
 
-    if (value == "SCALAR") {
-        type = glTF::Accessor::Type::Scalar;
-    } else if (value == "VEC2") {
-        type = glTF::Accessor::Type::Vec2;
-    } else if (value == "VEC3") {
-        type = glTF::Accessor::Type::Vec3;
-    } else if (value == "VEC4") {
-        type = glTF::Accessor::Type::Vec4;
-    } else if (value == "MAT2") {
-        type = glTF::Accessor::Type::Mat2;
-    } else if (value == "MAT3") {
-        type = glTF::Accessor::Type::Mat3;
-    } else if (value == "MAT4") {
-        type = glTF::Accessor::Type::Mat4;
-    } else {
-        PASSERT(false);
+    if (cursor >= parser.end) {
+        json_error(parser, "unterminated string");
+        return false;
     }
 
+    out_string.text = (char*)parser.cursor;
+    out_string.length = cursor - parser.cursor;
+    parser.cursor = cursor + 1;
+    return true;
 }
 
-static void try_load_int_array(json& json_data, cstring key, u32& count, i32** array, Allocator* allocator) {
-    auto it = json_data.find(key);
-
-    if (it == json_data.end()) {
-        count = 0;
-        *array = nullptr;
-        return;
+static bool json_parse_hex4(cstring text, u32& out_value) {
+    out_value = 0;
+    for (u32 i = 0; i < 4; i++) {
+        const char c = text[i];
+        u32 digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        out_value = (out_value << 4) | digit;
     }
+    return true;
+}
 
-    json json_array = json_data.at(key);
+static char* json_encode_utf8(u32 code_point, char* out) {
+    if (code_point < 0x80) {
+        *out++ = (char)code_point;
+    } else if (code_point < 0x800) {
+        *out++ = (char)(0xC0 | (code_point >> 6));
+        *out++ = (char)(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        *out++ = (char)(0xE0 | (code_point >> 12));
+        *out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code_point & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (code_point >> 18));
+        *out++ = (char)(0x80 | ((code_point >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code_point & 0x3F));
+    }
+    return out;
+}
 
-    count = json_array.size();
+// Copies the raw string into the arena. Decoded text is never longer than the escaped one.
+static void json_decode_string(JsonParser& parser, const StringView& raw, StringBuffer& out_string) {
+    out_string.init(parser.allocator, raw.length + 1);
+    char* destination = out_string.data;
 
-    i32* values = (i32*) allocate_and_zero(allocator, sizeof(i32) * count);
+    if (memchr(raw.text, '\\', raw.length) == nullptr) {
+        memcpy(destination, raw.text, raw.length);
+        destination += raw.length;
+    } else {
+        cstring source = raw.text;
+        cstring source_end = raw.text + raw.length;
+
+        while (source < source_end) {
+            const char c = *source++;
+            if (c != '\\') {
+                *destination++ = c;
+                continue;
+            }
 
-    for (size_t i = 0; i < count; i++) {
-        values[i] = json_array.at(i);
+            // The string view guarantees a character after each backslash
+            const char escape = *source++;
+            switch (escape) {
+                case 'b': *destination++ = '\b'; break;
+                case 'f': *destination++ = '\f'; break;
+                case 'n': *destination++ = '\n'; break;
+                case 'r': *destination++ = '\r'; break;
+                case 't': *destination++ = '\t'; break;
+                case 'u': {
+                    u32 code_point;
+                    if (source_end - source < 4 || !json_parse_hex4(source, code_point)) {
+                        json_error(parser, "invalid unicode escape");
+                        break;
+                    }
+                    source += 4;
+
+                    // Characters outside the BMP are written as a surrogate pair
+                    u32 low_surrogate;
+                    if (code_point >= 0xD800 && code_point < 0xDC00 && source_end - source >= 6 &&
+                        source[0] == '\\' && source[1] == 'u' && json_parse_hex4(source + 2, low_surrogate) &&
+                        low_surrogate >= 0xDC00 && low_surrogate < 0xE000) {
+                        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low_surrogate - 0xDC00);
+                        source += 6;
+                    }
+
+                    destination = json_encode_utf8(code_point, destination);
+                    break;
+                }
+                default:
+                    // \" \\ and \/
+                    *destination++ = escape;
+                    break;
+            }
+        }
     }
 
-    *array = values;
+    *destination = 0;
+    out_string.current_size = (u32)(destination - out_string.data);
 }
 
-static void try_load_float_array(json& json_data, cstring key, u32& count, f32** array, Allocator* allocator) {
-    auto it = json_data.find(key);
-
-    if (it == json_data.end()) {
-        count = 0;
-        *array = nullptr;
-        return;
+static void json_parse_string(JsonParser& parser, StringBuffer& out_string) {
+    StringView raw;
+    if (json_parse_string_view(parser, raw)) {
+        json_decode_string(parser, raw, out_string);
     }
+}
 
-    json json_array = json_data.at(key);
+// Exactly representable powers of ten
+static const f64 k_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-    count = json_array.size();
+// Up to 19 significant digits are accumulated in an integer and scaled once at the end,
+// plenty for the 32 bit values glTF stores.
+static bool json_parse_number(JsonParser& parser, f64& out_value) {
+    json_peek(parser);
 
-    f32* values = (f32*) allocate_and_zero(allocator, sizeof(f32) * count);
+    cstring cursor = parser.cursor;
+    cstring end = parser.end;
 
-    for (size_t i = 0; i < count; i++) {
-        values[i] = json_array.at(i);
+    bool negative = false;
+    if (cursor < end && *cursor == '-') {
+        negative = true;
+        cursor++;
     }
 
-    *array = values;
-}
-
-static void load_asset(json& json_data, glTF::Asset& asset, Allocator* allocator) {
-    json json_asset = json_data["asset"];
-
-    try_load_string(json_asset, "copyright", asset.copyright, allocator);
-    try_load_string(json_asset, "generator", asset.generator, allocator);
-    try_load_string(json_asset, "minVersion", asset.minVersion, allocator);
-    try_load_string(json_asset, "version", asset.version, allocator);
-}
-
-static void load_scene(json& json_data, glTF::Scene& scene, Allocator* allocator) {
-    try_load_int_array(json_data, "nodes", scene.nodes_count, &scene.nodes, allocator);
-}
+    u64 mantissa = 0;
+    u32 significant_digits = 0;
+    i32 exponent = 0;
+
+    cstring integer_begin = cursor;
+    for (; cursor < end && json_is_digit(*cursor); cursor++) {
+        if (significant_digits < 19) {
+            mantissa = mantissa * 10 + (*cursor - '0');
+            significant_digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
 
-static void load_scenes(json& json_data, glTF::glTF& gltf_data, Allocator* allocator) {
-    json scenes = json_data["scenes"];
+    if (cursor == integer_begin) {
+        json_error(parser, "invalid number");
+        return false;
+    }
 
-    size_t scene_count = scenes.size();
-    gltf_data.scenes = (glTF::Scene*) allocate_and_zero(allocator, sizeof(glTF::Scene) * scene_count);
-    gltf_data.scene_count = scene_count;
+    if (cursor < end && *cursor == '.') {
+        cursor++;
+        cstring fraction_begin = cursor;
+        for (; cursor < end && json_is_digit(*cursor); cursor++) {
+            if (significant_digits < 19) {
+                mantissa = mantissa * 10 + (*cursor - '0');
+                significant_digits += mantissa != 0;
+                exponent--;
+            }
+        }
 
-    for (size_t i = 0; i < scene_count; i++) {
-        load_scene(scenes[i], gltf_data.scenes[i], allocator);
+        if (cursor == fraction_begin) {
+            json_error(parser, "invalid number");
+            return false;
+        }
     }
 
-}
+    if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+        cursor++;
+        bool negative_exponent = false;
+        if (cursor < end && (*cursor == '+' || *cursor == '-')) {
+            negative_exponent = *cursor == '-';
+            cursor++;
+        }
 
-static void load_buffer(json& json_data, glTF::Buffer& buffer, Allocator* allocator) {
-    try_load_string(json_data, "uri", buffer.uri, allocator);
-    try_load_int(json_data, "byteLength", buffer.byte_length);
-    try_load_string(json_data, "name", buffer.name, allocator);
-}
+        cstring exponent_begin = cursor;
+        i32 exponent_value = 0;
+        for (; cursor < end && json_is_digit(*cursor); cursor++) {
+            if (exponent_value < 10000) {
+                exponent_value = exponent_value * 10 + (*cursor - '0');
+            }
+        }
 
-static void load_buffers(json& json_data, glTF::glTF& gltf_data, Allocator* allocator) {
-    json buffers = json_data["buffers"];
+        if (cursor == exponent_begin) {
+            json_error(parser, "invalid number");
+            return false;
+        }
 
-    size_t buffer_count = buffers.size();
-    gltf_data.buffers = (glTF::Buffer*) allocate_and_zero(allocator, sizeof(glTF::Buffer) * buffer_count);
-    gltf_data.buffers_count = buffer_count;
+        exponent += negative_exponent ? -exponent_value : exponent_value;
+    }
 
-    for (size_t i = 0; i < buffer_count; i++) {
-        load_buffer(buffers[i], gltf_data.buffers[i], allocator);
+    f64 value = (f64)mantissa;
+    if (exponent < 0) {
+        value = exponent >= -22 ? value / k_powers_of_ten[-exponent] : value * pow(10.0, exponent);
+    } else if (exponent > 0) {
+        value = exponent <= 22 ? value * k_powers_of_ten[exponent] : value * pow(10.0, exponent);
     }
-}
 
-static void load_buffer_view(json& json_data, glTF::BufferView& buffer_view, Allocator* allocator) {
-    try_load_int(json_data, "buffer", buffer_view.buffer);
-    try_load_int(json_data, "byteLength", buffer_view.byte_length);
-    try_load_int(json_data, "byteOffset", buffer_view.byte_offset);
-    try_load_int(json_data, "byteStride", buffer_view.byte_stride);
-    try_load_int(json_data, "target", buffer_view.target);
-    try_load_string(json_data, "name", buffer_view.name, allocator);
+    out_value = negative ? -value : value;
+    parser.cursor = cursor;
+    return true;
 }
 
-static void load_buffer_views(json& json_data, glTF::glTF& gltf_data, Allocator* allocator) {
-    json buffers = json_data["bufferViews"];
-
-    size_t buffer_count = buffers.size();
-    gltf_data.buffer_views = (glTF::BufferView*) allocate_and_zero(allocator, sizeof(glTF::BufferView) * buffer_count);
-    gltf_data.buffer_views_count = buffer_count;
-
-    for (size_t i = 0; i < buffer_count; i++) {
-        load_buffer_view(buffers[i], gltf_data.buffer_views[i], allocator);
+static void json_parse_int(JsonParser& parser, i32& out_value) {
+    f64 value;
+    if (json_parse_number(parser, value)) {
+        out_value = (i32)value;
     }
 }
 
-static void load_node(json& json_data, glTF::Node& node, Allocator* allocator) {
-    try_load_int(json_data, "camera", node.camera);
-    try_load_int(json_data, "mesh", node.mesh);
-    try_load_int(json_data, "skin", node.skin);
-    try_load_int_array(json_data, "children", node.children_count, &node.children, allocator);
-    try_load_float_array(json_data, "matrix", node.matrix_count, &node.matrix, allocator);
-    try_load_float_array(json_data, "rotation", node.rotation_count, &node.rotation, allocator);
-    try_load_float_array(json_data, "scale", node.scale_count, &node.scale, allocator);
-    try_load_float_array(json_data, "translation", node.translation_count, &node.translation, allocator);
-    try_load_float_array(json_data, "weights", node.weights_count, &node.weights, allocator);
-    try_load_string(json_data, "name", node.name, allocator);
+static void json_parse_float(JsonParser& parser, f32& out_value) {
+    f64 value;
+    if (json_parse_number(parser, value)) {
+        out_value = (f32)value;
+    }
 }
 
-static void load_nodes(json& json_data, glTF::glTF& gltf_data, Allocator* allocator) {
-    json array = json_data["nodes"];
-
-    size_t array_count = array.size();
-    gltf_data.nodes = (glTF::Node*) allocate_and_zero(allocator, sizeof(glTF::Node) * array_count);
-    gltf_data.nodes_count = array_count;
+static void json_parse_bool(JsonParser& parser, bool& out_value) {
+    const char c = json_peek(parser);
+    const size_t remaining = parser.end - parser.cursor;
 
-    for (size_t i = 0; i < array_count; i++) {
-        load_node(array[i], gltf_data.nodes[i], allocator);
+    if (c == 't' && remaining >= 4 && memcmp(parser.cursor, "true", 4) == 0) {
+        out_value = true;
+        parser.cursor += 4;
+    } else if (c == 'f' && remaining >= 5 && memcmp(parser.cursor, "false", 5) == 0) {
+        out_value = false;
+        parser.cursor += 5;
+    } else {
+        json_error(parser, "invalid boolean");
     }
 }
 
-static void load_mesh_primitive(json& json_data, glTF::MeshPrimitive& mesh_primitive, Allocator* allocator) {
-    try_load_int(json_data, "indices", mesh_primitive.indices);
-    try_load_int(json_data, "material", mesh_primitive.material);
-    try_load_int(json_data, "mode", mesh_primitive.mode);
-
-    json attributes = json_data["attributes"];
+static void json_skip_value(JsonParser& parser) {
+    const char c = json_peek(parser);
 
-    mesh_primitive.attributes = (glTF::MeshPrimitive::Attribute*) allocate_and_zero(allocator,
-                                                                                    sizeof(glTF::MeshPrimitive::Attribute) *
-                                                                                    attributes.size());
-    mesh_primitive.attribute_count = attributes.size();
-
-    u32 index = 0;
-    for (auto json_attribute: attributes.items()) {
-        std::string key = json_attribute.key();
-        glTF::MeshPrimitive::Attribute& attribute = mesh_primitive.attributes[index];
-
-        attribute.key.init(allocator, key.size() + 1);
-        attribute.key.append(key.c_str());
+    if (c == '"') {
+        StringView unused;
+        json_parse_string_view(parser, unused);
+        return;
+    }
 
-        attribute.accessor_index = json_attribute.value();
+    cstring cursor = parser.cursor;
+
+    if (c == '{' || c == '[') {
+        // Only brackets and strings matter, the content is validated if it is ever parsed for real
+        u32 depth = 0;
+        while (cursor < parser.end) {
+            const char current = *cursor++;
+            if (current == '"') {
+                while (cursor < parser.end && *cursor != '"') {
+                    cursor += *cursor == '\\' ? 2 : 1;
+                }
+                cursor++;
+            } else if (current == '{' || current == '[') {
+                depth++;
+            } else if (current == '}' || current == ']') {
+                if (--depth == 0) {
+                    parser.cursor = cursor;
+                    return;
+                }
+            }
+        }
 
-        index++;
+        json_error(parser, "unterminated object or array");
+        return;
     }
-}
 
-static void load_mesh_primitives(json& json_data, glTF::Mesh& mesh, Allocator* allocator) {
-    json array = json_data["primitives"];
-
-    size_t array_count = array.size();
-    mesh.primitives = (glTF::MeshPrimitive*) allocate_and_zero(allocator, sizeof(glTF::MeshPrimitive) * array_count);
-    mesh.primitives_count = array_count;
+    // Numbers and literals run up to the next delimiter
+    while (cursor < parser.end && *cursor != ',' && *cursor != '}' && *cursor != ']' && !json_is_whitespace(*cursor)) {
+        cursor++;
+    }
 
-    for (size_t i = 0; i < array_count; i++) {
-        load_mesh_primitive(array[i], mesh.primitives[i], allocator);
+    if (cursor == parser.cursor) {
+        json_error(parser, "missing value");
+        return;
     }
-}
 
-static void load_mesh(json& json_data, glTF::Mesh& mesh, Allocator* allocator) {
-    load_mesh_primitives(json_data, mesh, allocator);
-    try_load_float_array(json_data, "weights", mesh.weights_count, &mesh.weights, allocator);
-    try_load_string(json_data, "name", mesh.name, allocator);
+    parser.cursor = cursor;
 }
 
-static void load_meshes(json& json_data, glTF::glTF& gltf_data, Allocator* allocator) {
-    json array = json_data["meshes"];
+// Reads the key of the next member and leaves the cursor on its value
+static bool json_parse_key(JsonParser& parser, StringView& out_key) {
+    return json_parse_string_view(parser, out_key) && json_consume(parser, ':');
+}
 
-    size_t array_count = array.size();
-    gltf_data.meshes = (glTF::Mesh*) allocate_and_zero(allocator, sizeof(glTF::Mesh) * array_count);
-    gltf_data.meshes_count = array_count;
+// Object members are visited with
+//     for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key))
+// and each iteration has to consume the value of key.
+static bool json_object_begin(JsonParser& parser, StringView& out_key) {
+    if (!json_consume(parser, '{')) {
+        return false;
+    }
 
-    for (size_t i = 0; i < array_count; i++) {
-        load_mesh(array[i], gltf_data.meshes[i], allocator);
+    if (json_peek(parser) == '}') {
+        parser.cursor++;
+        return false;
     }
-}
 
-static void load_accessor(json& json_data, glTF::Accessor& accessor, Allocator* allocator) {
-    try_load_int(json_data, "bufferView", accessor.buffer_view);
-    try_load_int(json_data, "byteOffset", accessor.byte_offset);
-    try_load_int(json_data, "componentType", accessor.component_type);
-    try_load_int(json_data, "count", accessor.count);
-    try_load_int(json_data, "sparse", accessor.sparse);
-    try_load_float_array(json_data, "max", accessor.max_count, &accessor.max, allocator);
-    try_load_float_array(json_data, "min", accessor.min_count, &accessor.min, allocator);
-    try_load_bool(json_data, "normalized", accessor.normalized);
-    try_load_type(json_data, "type", accessor.type);
+    return json_parse_key(parser, out_key);
 }
 
-static void load_accessors(json& json_data, glTF::glTF& gltf_data, Allocator* allocator) {
-    json array = json_data["accessors"];
-
-    size_t array_count = array.size();
-    gltf_data.accessors = (glTF::Accessor*) allocate_and_zero(allocator, sizeof(glTF::Accessor) * array_count);
-    gltf_data.accessors_count = array_count;
+static bool json_object_next(JsonParser& parser, StringView& out_key) {
+    const char c = json_peek(parser);
+    if (c == ',') {
+        parser.cursor++;
+        return json_parse_key(parser, out_key);
+    }
 
-    for (size_t i = 0; i < array_count; i++) {
-        load_accessor(array[i], gltf_data.accessors[i], allocator);
+    if (c == '}') {
+        parser.cursor++;
+    } else {
+        json_error(parser, "expected ',' or '}'");
     }
+    return false;
 }
 
-static void try_load_TextureInfo(json& json_data, cstring key, glTF::TextureInfo** texture_info, Allocator* allocator) {
-    auto it = json_data.find(key);
-    if (it == json_data.end()) {
-        *texture_info = nullptr;
-        return;
+// Same as objects, each iteration has to consume one element
+static bool json_array_begin(JsonParser& parser) {
+    if (!json_consume(parser, '[')) {
+        return false;
     }
 
-    glTF::TextureInfo* ti = (glTF::TextureInfo*) allocator->allocate(sizeof(glTF::TextureInfo), 64);
-
-    try_load_int(*it, "index", ti->index);
-    try_load_int(*it, "texCoord", ti->texCoord);
+    if (json_peek(parser) == ']') {
+        parser.cursor++;
+        return false;
+    }
 
-    *texture_info = ti;
+    return true;
 }
 
-static void
-try_load_MaterialNormalTextureInfo(json& json_data, cstring key, glTF::MaterialNormalTextureInfo** texture_info,
-                                   Allocator* allocator) {
-    auto it = json_data.find(key);
-    if (it == json_data.end()) {
-        *texture_info = nullptr;
-        return;
+static bool json_array_next(JsonParser& parser) {
+    const char c = json_peek(parser);
+    if (c == ',') {
+        parser.cursor++;
+        return true;
     }
 
-    glTF::MaterialNormalTextureInfo* ti = (glTF::MaterialNormalTextureInfo*) allocator->allocate(
-            sizeof(glTF::MaterialNormalTextureInfo), 64);
-
-    try_load_int(*it, "index", ti->index);
-    try_load_int(*it, "texCoord", ti->tex_coord);
-    try_load_float(*it, "scale", ti->scale);
+    if (c == ']') {
+        parser.cursor++;
+    } else {
+        json_error(parser, "expected ',' or ']'");
+    }
+    return false;
+}
 
-    *texture_info = ti;
+// Value initialized element on top of the scratch stack: zeroed, then given its default member initializers
+template<typename T>
+static T* json_scratch_push(JsonParser& parser) {
+    void* memory = parser.scratch->allocate(sizeof(T), alignof(T));
+    return new (memory) T();
 }
 
-static void
-try_load_MaterialOcclusionTextureInfo(json& json_data, cstring key, glTF::MaterialOcclusionTextureInfo** texture_info,
-                                      Allocator* allocator) {
-    auto it = json_data.find(key);
-    if (it == json_data.end()) {
-        *texture_info = nullptr;
-        return;
+// Copies the count elements pushed from first into the arena and pops them
+template<typename T>
+static void json_scratch_pop(JsonParser& parser, size_t marker, const T* first, u32 count, u32& out_count, T*& out_values) {
+    T* values = nullptr;
+    if (count) {
+        values = (T*)parser.allocator->allocate(sizeof(T) * count, 64);
+        memcpy(values, first, sizeof(T) * count);
     }
+    parser.scratch->free_marker(marker);
 
-    glTF::MaterialOcclusionTextureInfo* ti = (glTF::MaterialOcclusionTextureInfo*) allocator->allocate(
-            sizeof(glTF::MaterialOcclusionTextureInfo), 64);
-
-    try_load_int(*it, "index", ti->index);
-    try_load_int(*it, "texCoord", ti->texCoord);
-    try_load_float(*it, "strength", ti->strength);
-
-    *texture_info = ti;
+    out_count = count;
+    out_values = values;
 }
 
-static void
-try_load_MaterialPBRMetallicRoughness(json& json_data, cstring key, glTF::MaterialPBRMetallicRoughness** texture_info,
-                                      Allocator* allocator) {
-    auto it = json_data.find(key);
-    if (it == json_data.end()) {
-        *texture_info = nullptr;
-        return;
-    }
-
-    glTF::MaterialPBRMetallicRoughness* ti = (glTF::MaterialPBRMetallicRoughness*) allocator->allocate(
-            sizeof(glTF::MaterialPBRMetallicRoughness), 64);
+static void json_parse_int_array(JsonParser& parser, u32& out_count, i32*& out_values) {
+    const size_t marker = parser.scratch->get_marker();
+    i32* first = nullptr;
+    u32 count = 0;
 
-    try_load_float_array(*it, "baseColorFactor", ti->base_color_factor_count, &ti->base_color_factor, allocator);
-    try_load_TextureInfo(*it, "baseColorTexture", &ti->base_color_texture, allocator);
-    try_load_float(*it, "metallicFactor", ti->metallic_factor);
-    try_load_TextureInfo(*it, "metallicRoughnessTexture", &ti->metallic_roughness_texture, allocator);
-    try_load_float(*it, "roughnessFactor", ti->roughness_factor);
+    for (bool more = json_array_begin(parser); more; more = json_array_next(parser)) {
+        i32* value = json_scratch_push<i32>(parser);
+        first = count++ ? first : value;
+        json_parse_int(parser, *value);
+    }
 
-    *texture_info = ti;
+    json_scratch_pop(parser, marker, first, count, out_count, out_values);
 }
 
+static void json_parse_float_array(JsonParser& parser, u32& out_count, f32*& out_values) {
+    const size_t marker = parser.scratch->get_marker();
+    f32* first = nullptr;
+    u32 count = 0;
 
-static void load_material(json& json_data, glTF::Material& material, Allocator* allocator) {
-    try_load_float_array(json_data, "emissiveFactor", material.emissive_factor_count, &material.emissive_factor, allocator);
-    try_load_float(json_data, "alphaCutoff", material.alpha_cutoff);
-    try_load_string(json_data, "alphaMode", material.alpha_mode, allocator);
-    try_load_bool(json_data, "doubleSided", material.double_sided);
-
-    try_load_TextureInfo(json_data, "emissiveTexture", &material.emissive_texture, allocator);
-    try_load_MaterialNormalTextureInfo( json_data, "normalTexture", &material.normal_texture, allocator );
-    try_load_MaterialOcclusionTextureInfo( json_data, "occlusionTexture", &material.occlusion_texture, allocator );
-    try_load_MaterialPBRMetallicRoughness( json_data, "pbrMetallicRoughness", &material.pbr_metallic_roughness, allocator );
+    for (bool more = json_array_begin(parser); more; more = json_array_next(parser)) {
+        f32* value = json_scratch_push<f32>(parser);
+        first = count++ ? first : value;
+        json_parse_float(parser, *value);
+    }
 
-    try_load_string( json_data, "name", material.name, allocator );
+    json_scratch_pop(parser, marker, first, count, out_count, out_values);
 }
 
-static void load_materials( json& json_data, glTF::glTF& gltf_data, Allocator* allocator ) {
-    json array = json_data[ "materials" ];
+// Elements start value initialized, each parse function sets its own defaults for missing keys
+template<typename T>
+static void json_parse_object_array(JsonParser& parser, u32& out_count, T*& out_values, void (*parse_element)(JsonParser&, T&)) {
+    const size_t marker = parser.scratch->get_marker();
+    T* first = nullptr;
+    u32 count = 0;
+
+    for (bool more = json_array_begin(parser); more; more = json_array_next(parser)) {
+        T* value = json_scratch_push<T>(parser);
+        first = count++ ? first : value;
+        parse_element(parser, *value);
+    }
 
-    size_t array_count = array.size();
-    gltf_data.materials = ( glTF::Material* )allocate_and_zero( allocator, sizeof( glTF::Material ) * array_count );
-    gltf_data.materials_count = array_count;
+    json_scratch_pop(parser, marker, first, count, out_count, out_values);
+}
 
-    for ( size_t i = 0; i < array_count; ++i ) {
-        load_material( array[ i ], gltf_data.materials[ i ], allocator );
-    }
+template<typename T>
+static T* json_parse_object(JsonParser& parser, void (*parse_object)(JsonParser&, T&)) {
+    T* value = (T*)allocate_and_zero(parser.allocator, sizeof(T));
+    parse_object(parser, *value);
+    return value;
 }
 
-static void load_texture( json& json_data, glTF::Texture& texture, Allocator* allocator ) {
-    try_load_int( json_data, "sampler", texture.sampler );
-    try_load_int( json_data, "source", texture.source );
-    try_load_string( json_data, "name", texture.name, allocator );
+// glTF objects //////////////////////////////////////////////////////////
+
+static void parse_asset(JsonParser& parser, glTF::Asset& asset) {
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "copyright")) {
+            json_parse_string(parser, asset.copyright);
+        } else if (json_string_equals(key, "generator")) {
+            json_parse_string(parser, asset.generator);
+        } else if (json_string_equals(key, "minVersion")) {
+            json_parse_string(parser, asset.minVersion);
+        } else if (json_string_equals(key, "version")) {
+            json_parse_string(parser, asset.version);
+        } else {
+            json_skip_value(parser);
+        }
+    }
 }
 
-static void load_textures( json& json_data, glTF::glTF& gltf_data, Allocator* allocator ) {
-    json array = json_data[ "textures" ];
+static void parse_scene(JsonParser& parser, glTF::Scene& scene) {
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "nodes")) {
+            json_parse_int_array(parser, scene.nodes_count, scene.nodes);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    size_t array_count = array.size();
-    gltf_data.textures = ( glTF::Texture* )allocate_and_zero( allocator, sizeof( glTF::Texture ) * array_count );
-    gltf_data.textures_count = array_count;
+static void parse_buffer(JsonParser& parser, glTF::Buffer& buffer) {
+    buffer.byte_length = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "uri")) {
+            json_parse_string(parser, buffer.uri);
+        } else if (json_string_equals(key, "byteLength")) {
+            json_parse_int(parser, buffer.byte_length);
+        } else if (json_string_equals(key, "name")) {
+            json_parse_string(parser, buffer.name);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    for ( size_t i = 0; i < array_count; ++i ) {
-        load_texture( array[ i ], gltf_data.textures[ i ], allocator );
+static void parse_buffer_view(JsonParser& parser, glTF::BufferView& buffer_view) {
+    buffer_view.buffer = glTF::INVALID_INT_VALUE;
+    buffer_view.byte_length = glTF::INVALID_INT_VALUE;
+    buffer_view.byte_offset = glTF::INVALID_INT_VALUE;
+    buffer_view.byte_stride = glTF::INVALID_INT_VALUE;
+    buffer_view.target = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "buffer")) {
+            json_parse_int(parser, buffer_view.buffer);
+        } else if (json_string_equals(key, "byteLength")) {
+            json_parse_int(parser, buffer_view.byte_length);
+        } else if (json_string_equals(key, "byteOffset")) {
+            json_parse_int(parser, buffer_view.byte_offset);
+        } else if (json_string_equals(key, "byteStride")) {
+            json_parse_int(parser, buffer_view.byte_stride);
+        } else if (json_string_equals(key, "target")) {
+            json_parse_int(parser, buffer_view.target);
+        } else if (json_string_equals(key, "name")) {
+            json_parse_string(parser, buffer_view.name);
+        } else {
+            json_skip_value(parser);
+        }
     }
 }
 
-static void load_image( json& json_data, glTF::Image& image, Allocator* allocator ) {
-    try_load_int( json_data, "bufferView", image.buffer_view );
-    try_load_string( json_data, "mimeType", image.mime_type, allocator );
-    try_load_string( json_data, "uri", image.uri, allocator );
+static void parse_node(JsonParser& parser, glTF::Node& node) {
+    node.camera = glTF::INVALID_INT_VALUE;
+    node.mesh = glTF::INVALID_INT_VALUE;
+    node.skin = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "camera")) {
+            json_parse_int(parser, node.camera);
+        } else if (json_string_equals(key, "mesh")) {
+            json_parse_int(parser, node.mesh);
+        } else if (json_string_equals(key, "skin")) {
+            json_parse_int(parser, node.skin);
+        } else if (json_string_equals(key, "children")) {
+            json_parse_int_array(parser, node.children_count, node.children);
+        } else if (json_string_equals(key, "matrix")) {
+            json_parse_float_array(parser, node.matrix_count, node.matrix);
+        } else if (json_string_equals(key, "rotation")) {
+            json_parse_float_array(parser, node.rotation_count, node.rotation);
+        } else if (json_string_equals(key, "scale")) {
+            json_parse_float_array(parser, node.scale_count, node.scale);
+        } else if (json_string_equals(key, "translation")) {
+            json_parse_float_array(parser, node.translation_count, node.translation);
+        } else if (json_string_equals(key, "weights")) {
+            json_parse_float_array(parser, node.weights_count, node.weights);
+        } else if (json_string_equals(key, "name")) {
+            json_parse_string(parser, node.name);
+        } else {
+            json_skip_value(parser);
+        }
+    }
 }
 
-static void load_images( json& json_data, glTF::glTF& gltf_data, Allocator* allocator ) {
-    json array = json_data[ "images" ];
+static void parse_mesh_primitive_attributes(JsonParser& parser, glTF::MeshPrimitive& mesh_primitive) {
+    const size_t marker = parser.scratch->get_marker();
+    glTF::MeshPrimitive::Attribute* first = nullptr;
+    u32 count = 0;
 
-    size_t array_count = array.size();
-    gltf_data.images = ( glTF::Image* )allocate_and_zero( allocator, sizeof( glTF::Image ) * array_count );
-    gltf_data.images_count = array_count;
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        glTF::MeshPrimitive::Attribute* attribute = json_scratch_push<glTF::MeshPrimitive::Attribute>(parser);
+        first = count++ ? first : attribute;
 
-    for ( size_t i = 0; i < array_count; i++ ) {
-        load_image( array[ i ], gltf_data.images[ i ], allocator );
+        json_decode_string(parser, key, attribute->key);
+        json_parse_int(parser, attribute->accessor_index);
     }
-}
 
+    json_scratch_pop(parser, marker, first, count, mesh_primitive.attribute_count, mesh_primitive.attributes);
+}
 
-static void load_sampler( json& json_data, glTF::Sampler& sampler, Allocator* allocator ) {
-    try_load_int( json_data, "magFilter", sampler.mag_filter );
-    try_load_int( json_data, "minFilter", sampler.min_filter );
-    try_load_int( json_data, "wrapS", sampler.wrap_s );
-    try_load_int( json_data, "wrapT", sampler.wrap_t );
+static void parse_mesh_primitive(JsonParser& parser, glTF::MeshPrimitive& mesh_primitive) {
+    mesh_primitive.indices = glTF::INVALID_INT_VALUE;
+    mesh_primitive.material = glTF::INVALID_INT_VALUE;
+    mesh_primitive.mode = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "indices")) {
+            json_parse_int(parser, mesh_primitive.indices);
+        } else if (json_string_equals(key, "material")) {
+            json_parse_int(parser, mesh_primitive.material);
+        } else if (json_string_equals(key, "mode")) {
+            json_parse_int(parser, mesh_primitive.mode);
+        } else if (json_string_equals(key, "attributes")) {
+            parse_mesh_primitive_attributes(parser, mesh_primitive);
+        } else {
+            json_skip_value(parser);
+        }
+    }
 }
 
-static void load_samplers( json& json_data, glTF::glTF& gltf_data, Allocator* allocator ) {
-    json array = json_data[ "samplers" ];
+static void parse_mesh(JsonParser& parser, glTF::Mesh& mesh) {
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "primitives")) {
+            json_parse_object_array(parser, mesh.primitives_count, mesh.primitives, parse_mesh_primitive);
+        } else if (json_string_equals(key, "weights")) {
+            json_parse_float_array(parser, mesh.weights_count, mesh.weights);
+        } else if (json_string_equals(key, "name")) {
+            json_parse_string(parser, mesh.name);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    size_t array_count = array.size();
-    gltf_data.samplers = ( glTF::Sampler* )allocate_and_zero( allocator, sizeof( glTF::Sampler ) * array_count );
-    gltf_data.samplers_count = array_count;
+static void parse_accessor_type(JsonParser& parser, glTF::Accessor::Type& type) {
+    StringView value;
+    if (!json_parse_string_view(parser, value)) {
+        return;
+    }
 
-    for ( size_t i = 0; i < array_count; ++i ) {
-        load_sampler( array[ i ], gltf_data.samplers[ i ], allocator );
+    if (json_string_equals(value, "SCALAR")) {
+        type = glTF::Accessor::Type::Scalar;
+    } else if (json_string_equals(value, "VEC2")) {
+        type = glTF::Accessor::Type::Vec2;
+    } else if (json_string_equals(value, "VEC3")) {
+        type = glTF::Accessor::Type::Vec3;
+    } else if (json_string_equals(value, "VEC4")) {
+        type = glTF::Accessor::Type::Vec4;
+    } else if (json_string_equals(value, "MAT2")) {
+        type = glTF::Accessor::Type::Mat2;
+    } else if (json_string_equals(value, "MAT3")) {
+        type = glTF::Accessor::Type::Mat3;
+    } else if (json_string_equals(value, "MAT4")) {
+        type = glTF::Accessor::Type::Mat4;
+    } else {
+        PASSERTM(false, "Unknown accessor type %.*s\n", (i32)value.length, value.text);
     }
 }
 
-static void load_skin( json& json_data, glTF::Skin& skin, Allocator* allocator ) {
-    try_load_int( json_data, "skeleton", skin.skeleton_root_node_index );
-    try_load_int( json_data, "inverseBindMatrices", skin.inverse_bind_matrices_buffer_index );
-    try_load_int_array( json_data, "joints", skin.joints_count, &skin.joints, allocator );
+static void parse_accessor(JsonParser& parser, glTF::Accessor& accessor) {
+    accessor.buffer_view = glTF::INVALID_INT_VALUE;
+    accessor.byte_offset = glTF::INVALID_INT_VALUE;
+    accessor.component_type = glTF::INVALID_INT_VALUE;
+    accessor.count = glTF::INVALID_INT_VALUE;
+    accessor.sparse = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "bufferView")) {
+            json_parse_int(parser, accessor.buffer_view);
+        } else if (json_string_equals(key, "byteOffset")) {
+            json_parse_int(parser, accessor.byte_offset);
+        } else if (json_string_equals(key, "componentType")) {
+            json_parse_int(parser, accessor.component_type);
+        } else if (json_string_equals(key, "count")) {
+            json_parse_int(parser, accessor.count);
+        } else if (json_string_equals(key, "max")) {
+            json_parse_float_array(parser, accessor.max_count, accessor.max);
+        } else if (json_string_equals(key, "min")) {
+            json_parse_float_array(parser, accessor.min_count, accessor.min);
+        } else if (json_string_equals(key, "normalized")) {
+            json_parse_bool(parser, accessor.normalized);
+        } else if (json_string_equals(key, "type")) {
+            parse_accessor_type(parser, accessor.type);
+        } else {
+            // Sparse accessors are not supported
+            json_skip_value(parser);
+        }
+    }
 }
 
-static void load_skins( json& json_data, glTF::glTF& gltf_data, Allocator* allocator ) {
-    json array = json_data[ "skins" ];
+static void parse_texture_info(JsonParser& parser, glTF::TextureInfo& texture_info) {
+    texture_info.index = glTF::INVALID_INT_VALUE;
+    texture_info.texCoord = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "index")) {
+            json_parse_int(parser, texture_info.index);
+        } else if (json_string_equals(key, "texCoord")) {
+            json_parse_int(parser, texture_info.texCoord);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    size_t array_count = array.size();
-    gltf_data.skins = ( glTF::Skin* )allocate_and_zero( allocator, sizeof( glTF::Skin ) * array_count );
-    gltf_data.skins_count = array_count;
+static void parse_material_normal_texture_info(JsonParser& parser, glTF::MaterialNormalTextureInfo& texture_info) {
+    texture_info.index = glTF::INVALID_INT_VALUE;
+    texture_info.tex_coord = glTF::INVALID_INT_VALUE;
+    texture_info.scale = glTF::INVALID_FLOAT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "index")) {
+            json_parse_int(parser, texture_info.index);
+        } else if (json_string_equals(key, "texCoord")) {
+            json_parse_int(parser, texture_info.tex_coord);
+        } else if (json_string_equals(key, "scale")) {
+            json_parse_float(parser, texture_info.scale);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    for ( size_t i = 0; i < array_count; ++i ) {
-        load_skin( array[ i ], gltf_data.skins[ i ], allocator );
+static void parse_material_occlusion_texture_info(JsonParser& parser, glTF::MaterialOcclusionTextureInfo& texture_info) {
+    texture_info.index = glTF::INVALID_INT_VALUE;
+    texture_info.texCoord = glTF::INVALID_INT_VALUE;
+    texture_info.strength = glTF::INVALID_FLOAT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "index")) {
+            json_parse_int(parser, texture_info.index);
+        } else if (json_string_equals(key, "texCoord")) {
+            json_parse_int(parser, texture_info.texCoord);
+        } else if (json_string_equals(key, "strength")) {
+            json_parse_float(parser, texture_info.strength);
+        } else {
+            json_skip_value(parser);
+        }
     }
 }
 
+static void parse_material_pbr_metallic_roughness(JsonParser& parser, glTF::MaterialPBRMetallicRoughness& pbr) {
+    pbr.metallic_factor = glTF::INVALID_FLOAT_VALUE;
+    pbr.roughness_factor = glTF::INVALID_FLOAT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "baseColorFactor")) {
+            json_parse_float_array(parser, pbr.base_color_factor_count, pbr.base_color_factor);
+        } else if (json_string_equals(key, "baseColorTexture")) {
+            pbr.base_color_texture = json_parse_object(parser, parse_texture_info);
+        } else if (json_string_equals(key, "metallicFactor")) {
+            json_parse_float(parser, pbr.metallic_factor);
+        } else if (json_string_equals(key, "metallicRoughnessTexture")) {
+            pbr.metallic_roughness_texture = json_parse_object(parser, parse_texture_info);
+        } else if (json_string_equals(key, "roughnessFactor")) {
+            json_parse_float(parser, pbr.roughness_factor);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-static void load_animation( json& json_data, glTF::Animation& animation, Allocator* allocator ) {
+static void parse_material(JsonParser& parser, glTF::Material& material) {
+    material.alpha_cutoff = glTF::INVALID_FLOAT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "emissiveFactor")) {
+            json_parse_float_array(parser, material.emissive_factor_count, material.emissive_factor);
+        } else if (json_string_equals(key, "alphaCutoff")) {
+            json_parse_float(parser, material.alpha_cutoff);
+        } else if (json_string_equals(key, "alphaMode")) {
+            json_parse_string(parser, material.alpha_mode);
+        } else if (json_string_equals(key, "doubleSided")) {
+            json_parse_bool(parser, material.double_sided);
+        } else if (json_string_equals(key, "emissiveTexture")) {
+            material.emissive_texture = json_parse_object(parser, parse_texture_info);
+        } else if (json_string_equals(key, "normalTexture")) {
+            material.normal_texture = json_parse_object(parser, parse_material_normal_texture_info);
+        } else if (json_string_equals(key, "occlusionTexture")) {
+            material.occlusion_texture = json_parse_object(parser, parse_material_occlusion_texture_info);
+        } else if (json_string_equals(key, "pbrMetallicRoughness")) {
+            material.pbr_metallic_roughness = json_parse_object(parser, parse_material_pbr_metallic_roughness);
+        } else if (json_string_equals(key, "name")) {
+            json_parse_string(parser, material.name);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    json json_array = json_data.at( "samplers" );
-    if ( json_array.is_array() ) {
-        size_t count = json_array.size();
+static void parse_texture(JsonParser& parser, glTF::Texture& texture) {
+    texture.sampler = glTF::INVALID_INT_VALUE;
+    texture.source = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "sampler")) {
+            json_parse_int(parser, texture.sampler);
+        } else if (json_string_equals(key, "source")) {
+            json_parse_int(parser, texture.source);
+        } else if (json_string_equals(key, "name")) {
+            json_parse_string(parser, texture.name);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-        glTF::AnimationSampler* values = ( glTF::AnimationSampler* )allocate_and_zero( allocator, sizeof( glTF::AnimationSampler ) * count );
+static void parse_image(JsonParser& parser, glTF::Image& image) {
+    image.buffer_view = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "bufferView")) {
+            json_parse_int(parser, image.buffer_view);
+        } else if (json_string_equals(key, "mimeType")) {
+            json_parse_string(parser, image.mime_type);
+        } else if (json_string_equals(key, "uri")) {
+            json_parse_string(parser, image.uri);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-        for ( size_t i = 0; i < count; ++i ) {
-            json element = json_array.at( i );
-            glTF::AnimationSampler& sampler = values[ i ];
+static void parse_sampler(JsonParser& parser, glTF::Sampler& sampler) {
+    sampler.mag_filter = glTF::INVALID_INT_VALUE;
+    sampler.min_filter = glTF::INVALID_INT_VALUE;
+    sampler.wrap_s = glTF::INVALID_INT_VALUE;
+    sampler.wrap_t = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "magFilter")) {
+            json_parse_int(parser, sampler.mag_filter);
+        } else if (json_string_equals(key, "minFilter")) {
+            json_parse_int(parser, sampler.min_filter);
+        } else if (json_string_equals(key, "wrapS")) {
+            json_parse_int(parser, sampler.wrap_s);
+        } else if (json_string_equals(key, "wrapT")) {
+            json_parse_int(parser, sampler.wrap_t);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-            try_load_int( element, "input", sampler.input_keyframe_buffer_index );
-            try_load_int( element, "output", sampler.output_keyframe_buffer_index );
+static void parse_skin(JsonParser& parser, glTF::Skin& skin) {
+    skin.skeleton_root_node_index = glTF::INVALID_INT_VALUE;
+    skin.inverse_bind_matrices_buffer_index = glTF::INVALID_INT_VALUE;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "skeleton")) {
+            json_parse_int(parser, skin.skeleton_root_node_index);
+        } else if (json_string_equals(key, "inverseBindMatrices")) {
+            json_parse_int(parser, skin.inverse_bind_matrices_buffer_index);
+        } else if (json_string_equals(key, "joints")) {
+            json_parse_int_array(parser, skin.joints_count, skin.joints);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-            std::string value = element.value( "interpolation", "");
-            if ( value == "LINEAR" ) {
-                sampler.interpolation = glTF::AnimationSampler::Linear;
+static void parse_animation_sampler(JsonParser& parser, glTF::AnimationSampler& sampler) {
+    sampler.input_keyframe_buffer_index = glTF::INVALID_INT_VALUE;
+    sampler.output_keyframe_buffer_index = glTF::INVALID_INT_VALUE;
+    sampler.interpolation = glTF::AnimationSampler::Linear;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "input")) {
+            json_parse_int(parser, sampler.input_keyframe_buffer_index);
+        } else if (json_string_equals(key, "output")) {
+            json_parse_int(parser, sampler.output_keyframe_buffer_index);
+        } else if (json_string_equals(key, "interpolation")) {
+            StringView value;
+            if (!json_parse_string_view(parser, value)) {
+                continue;
             }
-            else if ( value == "STEP" ) {
+
+            if (json_string_equals(value, "STEP")) {
                 sampler.interpolation = glTF::AnimationSampler::Step;
-            }
-            else if ( value == "CUBICSPLINE" ) {
+            } else if (json_string_equals(value, "CUBICSPLINE")) {
                 sampler.interpolation = glTF::AnimationSampler::CubicSpline;
-            }
-            else {
+            } else {
                 sampler.interpolation = glTF::AnimationSampler::Linear;
             }
+        } else {
+            json_skip_value(parser);
         }
-
-        animation.samplers = values;
-        animation.samplers_count = count;
     }
+}
 
-    json_array = json_data.at( "channels" );
-    if ( json_array.is_array() ) {
-        size_t count = json_array.size();
-
-        glTF::AnimationChannel* values = ( glTF::AnimationChannel* )allocate_and_zero( allocator, sizeof( glTF::AnimationChannel ) * count );
-
-        for ( size_t i = 0; i < count; ++i ) {
-            json element = json_array.at( i );
-            glTF::AnimationChannel& channel = values[ i ];
-
-            try_load_int( element, "sampler", channel.sampler );
-            json target = element.at( "target" );
-            try_load_int( target, "node", channel.target_node );
+static void parse_animation_channel_target(JsonParser& parser, glTF::AnimationChannel& channel) {
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "node")) {
+            json_parse_int(parser, channel.target_node);
+        } else if (json_string_equals(key, "path")) {
+            StringView value;
+            if (!json_parse_string_view(parser, value)) {
+                continue;
+            }
 
-            std::string target_path = target.value( "path", "");
-            if ( target_path == "scale" ) {
+            if (json_string_equals(value, "scale")) {
                 channel.target_type = glTF::AnimationChannel::Scale;
-            }
-            else if ( target_path == "rotation" ) {
+            } else if (json_string_equals(value, "rotation")) {
                 channel.target_type = glTF::AnimationChannel::Rotation;
-            }
-            else if ( target_path == "translation" ) {
+            } else if (json_string_equals(value, "translation")) {
                 channel.target_type = glTF::AnimationChannel::Translation;
-            }
-            else if ( target_path == "weights" ) {
+            } else if (json_string_equals(value, "weights")) {
                 channel.target_type = glTF::AnimationChannel::Weights;
-            }
-            else {
-                PASSERTM( false, "Error parsing target path %s\n", target_path.c_str() );
+            } else {
+                PASSERTM(false, "Error parsing target path %.*s\n", (i32)value.length, value.text);
                 channel.target_type = glTF::AnimationChannel::Count;
             }
+        } else {
+            json_skip_value(parser);
         }
-
-        animation.channels = values;
-        animation.channels_count = count;
     }
 }
 
-static void load_animations( json& json_data, glTF::glTF& gltf_data, Allocator* allocator ) {
-    json array = json_data[ "animations" ];
+static void parse_animation_channel(JsonParser& parser, glTF::AnimationChannel& channel) {
+    channel.sampler = glTF::INVALID_INT_VALUE;
+    channel.target_node = glTF::INVALID_INT_VALUE;
+    channel.target_type = glTF::AnimationChannel::Count;
+
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "sampler")) {
+            json_parse_int(parser, channel.sampler);
+        } else if (json_string_equals(key, "target")) {
+            parse_animation_channel_target(parser, channel);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    size_t array_count = array.size();
-    gltf_data.animations = ( glTF::Animation* )allocate_and_zero( allocator, sizeof( glTF::Animation ) * array_count );
-    gltf_data.animations_count = array_count;
+static void parse_animation(JsonParser& parser, glTF::Animation& animation) {
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "samplers")) {
+            json_parse_object_array(parser, animation.samplers_count, animation.samplers, parse_animation_sampler);
+        } else if (json_string_equals(key, "channels")) {
+            json_parse_object_array(parser, animation.channels_count, animation.channels, parse_animation_channel);
+        } else {
+            json_skip_value(parser);
+        }
+    }
+}
 
-    for ( size_t i = 0; i < array_count; ++i ) {
-        load_animation( array[ i ], gltf_data.animations[ i ], allocator );
+static void parse_gltf(JsonParser& parser, glTF::glTF& gltf) {
+    StringView key;
+    for (bool more = json_object_begin(parser, key); more; more = json_object_next(parser, key)) {
+        if (json_string_equals(key, "asset")) {
+            parse_asset(parser, gltf.asset);
+        } else if (json_string_equals(key, "scene")) {
+            json_parse_int(parser, gltf.scene);
+        } else if (json_string_equals(key, "scenes")) {
+            json_parse_object_array(parser, gltf.scene_count, gltf.scenes, parse_scene);
+        } else if (json_string_equals(key, "buffers")) {
+            json_parse_object_array(parser, gltf.buffers_count, gltf.buffers, parse_buffer);
+        } else if (json_string_equals(key, "bufferViews")) {
+            json_parse_object_array(parser, gltf.buffer_views_count, gltf.buffer_views, parse_buffer_view);
+        } else if (json_string_equals(key, "nodes")) {
+            json_parse_object_array(parser, gltf.nodes_count, gltf.nodes, parse_node);
+        } else if (json_string_equals(key, "meshes")) {
+            json_parse_object_array(parser, gltf.meshes_count, gltf.meshes, parse_mesh);
+        } else if (json_string_equals(key, "accessors")) {
+            json_parse_object_array(parser, gltf.accessors_count, gltf.accessors, parse_accessor);
+        } else if (json_string_equals(key, "materials")) {
+            json_parse_object_array(parser, gltf.materials_count, gltf.materials, parse_material);
+        } else if (json_string_equals(key, "textures")) {
+            json_parse_object_array(parser, gltf.textures_count, gltf.textures, parse_texture);
+        } else if (json_string_equals(key, "images")) {
+            json_parse_object_array(parser, gltf.images_count, gltf.images, parse_image);
+        } else if (json_string_equals(key, "samplers")) {
+            json_parse_object_array(parser, gltf.samplers_count, gltf.samplers, parse_sampler);
+        } else if (json_string_equals(key, "skins")) {
+            json_parse_object_array(parser, gltf.skins_count, gltf.skins, parse_skin);
+        } else if (json_string_equals(key, "animations")) {
+            json_parse_object_array(parser, gltf.animations_count, gltf.animations, parse_animation);
+        } else {
+            json_skip_value(parser);
+        }
     }
 }
 
+// GLB container layout: 12 bytes header followed by a JSON chunk and an optional BIN chunk
+static const u32 k_glb_magic = 0x46546C67;         // "glTF"
+static const u32 k_glb_chunk_json = 0x4E4F534A;    // "JSON"
+static const u32 k_glb_chunk_bin = 0x004E4942;     // "BIN\0"
+static const u32 k_glb_header_size = 12;
+static const u32 k_glb_chunk_header_size = 8;
+
+static u32 read_u32( const u8* data ) {
+    u32 value;
+    memcpy( &value, data, sizeof( u32 ) );
+    return value;
+}
+
+// Finds the JSON text and the BIN chunk inside the mapping. Plain .gltf files are the JSON text as a whole.
+static bool glb_parse_chunks( const FileMapping& mapping, const u8*& json_begin, const u8*& json_end, glTF::glTF& result ) {
+    json_begin = mapping.data;
+    json_end = mapping.data + mapping.size;
+
+    if ( mapping.size < k_glb_header_size || read_u32( mapping.data ) != k_glb_magic ) {
+        return true;
+    }
+
+    const u32 version = read_u32( mapping.data + 4 );
+    const u32 length = read_u32( mapping.data + 8 );
+    if ( version != 2 || length < k_glb_header_size || length > mapping.size ) {
+        p_print( "Error: unsupported GLB version %u or truncated file.\n", version );
+        return false;
+    }
+
+    // Bounds are checked against the bytes left so a huge chunk length cannot wrap around
+    u32 offset = k_glb_header_size;
+    while ( length - offset >= k_glb_chunk_header_size ) {
+        const u32 chunk_length = read_u32( mapping.data + offset );
+        const u32 chunk_type = read_u32( mapping.data + offset + 4 );
+        const u8* chunk_data = mapping.data + offset + k_glb_chunk_header_size;
+
+        if ( chunk_length > length - offset - k_glb_chunk_header_size ) {
+            p_print( "Error: GLB chunk exceeds file length.\n" );
+            return false;
+        }
+
+        if ( chunk_type == k_glb_chunk_json ) {
+            json_begin = chunk_data;
+            json_end = chunk_data + chunk_length;
+        } else if ( chunk_type == k_glb_chunk_bin && result.binary_chunk == nullptr ) {
+            result.binary_chunk = ( u8* )chunk_data;
+            result.binary_chunk_size = chunk_length;
+        }
 
+        // Chunks are 4 bytes aligned, the padding of the last one may be missing
+        const u32 padded_length = ( chunk_length + 3 ) & ~3u;
+        if ( padded_length > length - offset - k_glb_chunk_header_size ) {
+            break;
+        }
+        offset += k_glb_chunk_header_size + padded_length;
+    }
 
+    return true;
+}
 
 glTF::glTF gltf_load_file( cstring file_path ) {
     glTF::glTF result{ };
@@ -573,53 +1103,67 @@ glTF::glTF gltf_load_file( cstring file_path ) {
         return result;
     }
 
-    Allocator* heap_allocator = &MemoryService::instance()->system_allocator;
-
-    FileReadResult read_result = file_read_text( file_path, heap_allocator );
-
-    json gltf_data = json::parse( read_result.data );
-
-    result.allocator.init( puffin_mega(2) );
-    Allocator* allocator = &result.allocator;
-
-    for ( auto properties : gltf_data.items() ) {
-        if ( properties.key() == "asset" ) {
-            load_asset( gltf_data, result.asset, allocator );
-        } else if ( properties.key() == "scene" ) {
-            try_load_int( gltf_data, "scene", result.scene );
-        } else if ( properties.key() == "scenes" ) {
-            load_scenes( gltf_data, result, allocator );
-        } else if ( properties.key() == "buffers" ) {
-            load_buffers( gltf_data, result, allocator );
-        } else if ( properties.key() == "bufferViews" ) {
-            load_buffer_views( gltf_data, result, allocator );
-        } else if ( properties.key() == "nodes" ) {
-            load_nodes( gltf_data, result, allocator );
-        } else if ( properties.key() == "meshes" ) {
-            load_meshes( gltf_data, result, allocator );
-        } else if ( properties.key() == "accessors" ) {
-            load_accessors( gltf_data, result, allocator );
-        } else if ( properties.key() == "materials" ) {
-            load_materials( gltf_data, result, allocator );
-        } else if ( properties.key() == "textures" ) {
-            load_textures( gltf_data, result, allocator );
-        } else if ( properties.key() == "images" ) {
-            load_images( gltf_data, result, allocator );
-        } else if ( properties.key() == "samplers" ) {
-            load_samplers( gltf_data, result, allocator );
-        } else if ( properties.key() == "skins" ) {
-            load_skins( gltf_data, result, allocator );
-        } else if ( properties.key() == "animations" ) {
-            load_animations( gltf_data, result, allocator );
-        }
-    }
-
-    heap_allocator->deallocate( read_result.data );
+    // One map for the whole file, the JSON is parsed in place
+    FileMapping mapping;
+    if ( !file_map( file_path, mapping ) ) {
+        p_print( "Error: file %s could not be mapped.\n", file_path );
+        return result;
+    }
+
+    const u8* json_begin = nullptr;
+    const u8* json_end = nullptr;
+    if ( !glb_parse_chunks( mapping, json_begin, json_end, result ) ) {
+        file_unmap( mapping );
+        return result;
+    }
+
+    // Only the part of the reservations the scene actually uses gets committed
+    const size_t json_size = json_end - json_begin;
+    result.allocator.init_virtual( puffin_giga( 1 ) );
+    StackAllocator scratch;
+    scratch.init_virtual( puffin_giga( 1 ) );
+
+    JsonParser parser{ ( cstring )json_begin, ( cstring )json_begin, ( cstring )json_end, &result.allocator, &scratch, false };
+
+    const i64 parse_start = time_now();
+    parse_gltf( parser, result );
+    const f64 parse_ms = time_from_milliseconds( parse_start );
+    scratch.shutdown();
+
+    if ( parser.failed ) {
+        p_print( "Error: file %s is not a valid glTF.\n", file_path );
+        result.allocator.shutdown();
+        file_unmap( mapping );
+        return glTF::glTF{ };
+    }
+
+    const f64 json_mb = json_size / ( 1024.0 * 1024.0 );
+    p_print( "glTF JSON parsed: %.2f MB in %.2f ms, %.1f MB/s, arena %.2f MB\n", json_mb, parse_ms,
+             parse_ms > 0.0 ? json_mb / ( parse_ms / 1000.0 ) : 0.0, result.allocator.allocated_size / ( 1024.0 * 1024.0 ) );
+
+    // Keep the mapping alive only if the BIN chunk is referenced
+    if ( result.binary_chunk ) {
+        result.file_mapping = mapping;
+    } else {
+        file_unmap( mapping );
+    }
 
     return result;
 }
 
+u8* gltf_get_embedded_buffer_data( glTF::glTF& scene, u32 buffer_index ) {
+    if ( buffer_index == 0 && scene.binary_chunk != nullptr && scene.buffers[ 0 ].uri.data == nullptr ) {
+        return scene.binary_chunk;
+    }
+
+    return nullptr;
+}
+
 void gltf_free( glTF::glTF& scene ) {
+    file_unmap( scene.file_mapping );
+    scene.binary_chunk = nullptr;
+    scene.binary_chunk_size = 0;
+
     scene.allocator.shutdown();
 }
 
@@ -634,6 +1178,91 @@ i32 gltf_get_attribute_accessor_index( glTF::MeshPrimitive::Attribute* attribute
     return -1;
 }
 
+// Test //////////////////////////////////////////////////////////////////
+
+static u32 glb_test_write_u32( u8* data, u32 offset, u32 value ) {
+    memcpy( data + offset, &value, sizeof( u32 ) );
+    return offset + sizeof( u32 );
+}
+
+// Writes a GLB of a JSON chunk and a BIN chunk holding the accessor data, chunk_length_override replaces the BIN chunk length
+static void glb_test_write( cstring path, const f32* values, u32 values_count, u32 chunk_length_override ) {
+    static const u32 k_accessor_offset = 8;
+    const u32 bin_size = k_accessor_offset + values_count * sizeof( f32 );
+
+    char json[ 512 ];
+    u32 json_size = ( u32 )snprintf( json, sizeof( json ),
+        "{\"asset\":{\"version\":\"2.0\"},\"buffers\":[{\"byteLength\":%u}],"
+        "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":%u}],"
+        "\"accessors\":[{\"bufferView\":0,\"byteOffset\":%u,\"componentType\":5126,\"count\":%u,\"type\":\"SCALAR\"}]}",
+        bin_size, bin_size, k_accessor_offset, values_count );
+    // The JSON chunk is padded with spaces
+    while ( json_size & 3 ) {
+        json[ json_size++ ] = ' ';
+    }
+
+    u8 file[ 1024 ];
+    memset( file, 0, sizeof( file ) );
+    u32 offset = glb_test_write_u32( file, 0, k_glb_magic );
+    offset = glb_test_write_u32( file, offset, 2 );
+    offset = glb_test_write_u32( file, offset, k_glb_header_size + 2 * k_glb_chunk_header_size + json_size + bin_size );
+    offset = glb_test_write_u32( file, offset, json_size );
+    offset = glb_test_write_u32( file, offset, k_glb_chunk_json );
+    memcpy( file + offset, json, json_size );
+    offset += json_size;
+    offset = glb_test_write_u32( file, offset, chunk_length_override ? chunk_length_override : bin_size );
+    offset = glb_test_write_u32( file, offset, k_glb_chunk_bin );
+    memcpy( file + offset + k_accessor_offset, values, values_count * sizeof( f32 ) );
+    offset += bin_size;
+
+    file_write_binary( path, file, offset );
+}
+
+bool gltf_glb_test( cstring directory ) {
+    static const f32 k_values[] = { 1.0f, -2.5f, 3.25f, 1024.0f };
+    static const u32 k_values_count = PuffinArraySize( k_values );
+
+    char path[ 512 ];
+    snprintf( path, sizeof( path ), "%s/gltf_glb_test.glb", directory );
+
+    u32 failures = 0;
+
+    // Round trip, the accessor reads its values from the BIN chunk through the buffer view
+    glb_test_write( path, k_values, k_values_count, 0 );
+    glTF::glTF scene = gltf_load_file( path );
+    if ( scene.accessors_count != 1 || scene.buffer_views_count != 1 || scene.buffers_count != 1 ) {
+        p_print( "glTF GLB test failed: scene not loaded\n" );
+        failures++;
+    } else {
+        const glTF::Accessor& accessor = scene.accessors[ 0 ];
+        const glTF::BufferView& buffer_view = scene.buffer_views[ accessor.buffer_view ];
+        const u8* buffer_data = gltf_get_embedded_buffer_data( scene, buffer_view.buffer );
+        const i32 data_offset = glTF::get_data_offset( accessor.byte_offset, buffer_view.byte_offset );
+
+        if ( buffer_data == nullptr || accessor.count != ( i32 )k_values_count ||
+             data_offset + accessor.count * sizeof( f32 ) > scene.binary_chunk_size ||
+             memcmp( buffer_data + data_offset, k_values, sizeof( k_values ) ) != 0 ) {
+            p_print( "glTF GLB test failed: accessor data does not match\n" );
+            failures++;
+        }
+    }
+    gltf_free( scene );
+
+    // A chunk length reaching past 4GB must be rejected, not wrap around
+    glb_test_write( path, k_values, k_values_count, 0xFFFFFFF8 );
+    scene = gltf_load_file( path );
+    if ( scene.accessors_count != 0 || scene.binary_chunk != nullptr ) {
+        p_print( "glTF GLB test failed: overflowing chunk length accepted\n" );
+        failures++;
+        gltf_free( scene );
+    }
+
+    file_delete( path );
+
+    p_print( "glTF GLB test %s\n", failures ? "failed" : "passed" );
+    return failures == 0;
+}
+
 } // namespace puffin
 
 i32 puffin::glTF::get_data_offset( i32 accessor_offset, i32 buffer_view_offset ) {
@@ -306,6 +306,11 @@ struct glTF {
     Texture*                textures;
 
     LinearAllocator         allocator;
+
+    // GLB only: the file stays mapped and the BIN chunk backs buffer 0
+    FileMapping             file_mapping;
+    u8*                     binary_chunk;
+    u32                     binary_chunk_size;
 };
 
 
@@ -313,10 +318,17 @@ i32                 get_data_offset(i32 accessor_offset, i32 buffer_view_offset)
 
 } // glTF
 
+// Loads both .gltf text files and .glb binary containers
 glTF::glTF          gltf_load_file(cstring file_path);
 
+// Returns the data of a buffer if it is stored in the GLB BIN chunk, nullptr if it has to be loaded from its uri
+u8*                 gltf_get_embedded_buffer_data(glTF::glTF& scene, u32 buffer_index);
+
 void                gltf_free( glTF::glTF& scene );
 
 i32                 gltf_get_attribute_accessor_index(glTF::MeshPrimitive::Attribute* attributes, u32 attributes_count, cstring attribute_name);
 
+// Writes a small GLB in directory, loads it back and checks the accessor bytes read through the BIN chunk
+bool                gltf_glb_test(cstring directory);
+
 } // puffin
@@ -0,0 +1,506 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "hash_map.hpp"
+#include "concurrent_hash_map.hpp"
+#include "log.hpp"
+#include "time.hpp"
+
+#include <thread>
+
+namespace puffin {
+
+    static const u32            k_hash_map_benchmark_lookups = 1 << 20;
+    static const u32            k_hash_map_benchmark_runs = 5;
+
+    static const u32            k_hash_map_test_key_space = 4096;
+    static const u32            k_hash_map_test_churn_steps = 200000;
+    static const u32            k_hash_map_test_window = 1000;
+    // Fits L2, so the load factor and the group width show rather than the memory latency
+    static const u64            k_hash_map_load_capacity = (1 << 16) - 1;
+
+    // splitmix64 finalizer, a bijection, so different indices give different keys
+    static u64 hash_map_test_key(u64 index) {
+        u64 z = index + 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Correctness ////
+    // The same checks for every group implementation: small tables, growth, churn over tombstones,
+    // iteration, reserve, clear and the set.
+    template <typename Group>
+    static bool hash_map_test_group(Allocator* allocator, u64* mirror) {
+        using Map = FlatHashMap<u64, u64, HashCalculate<u64>, HashEqual<u64>, Group>;
+        bool valid = true;
+
+        // Every size a small table goes through while growing, including 7 slots with 8-wide groups
+        for(u32 count = 1; count <= 64 && valid; count++) {
+            Map map;
+            map.init(allocator, 4);
+            for(u32 i = 0; i < count; i++) {
+                map.insert(hash_map_test_key(i), i);
+            }
+            for(u32 i = 0; i < count; i++) {
+                const FlatHashMapIterator it = map.find(hash_map_test_key(i));
+                valid = valid && it.is_valid() && map.get(it) == i;
+            }
+            valid = valid && map.size == count && map.find(hash_map_test_key(count)).is_invalid();
+            map.shutdown();
+        }
+
+        // Random inserts and removes over a small key space. mirror holds the expected value, u64_max when absent.
+        Map map;
+        map.init(allocator, 4);
+        for(u32 i = 0; i < k_hash_map_test_key_space; i++) {
+            mirror[i] = u64_max;
+        }
+
+        u64 expected_size = 0;
+        u32 seed = 0x2545f491u;
+        for(u32 step = 0; step < k_hash_map_test_churn_steps && valid; step++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            const u32 index = seed % k_hash_map_test_key_space;
+            const u64 key = hash_map_test_key(index);
+            if(seed & 0x80000000u) {
+                expected_size += mirror[index] == u64_max;
+                mirror[index] = step;
+                map.insert(key, step);
+            } else {
+                const u32 removed = map.remove(key);
+                valid = valid && removed == (mirror[index] != u64_max);
+                expected_size -= removed;
+                mirror[index] = u64_max;
+            }
+        }
+
+        for(u32 i = 0; i < k_hash_map_test_key_space; i++) {
+            const FlatHashMapIterator it = map.find(hash_map_test_key(i));
+            valid = valid && (mirror[i] == u64_max ? it.is_invalid() : it.is_valid() && map.get(it) == mirror[i]);
+        }
+        valid = valid && map.size == expected_size;
+
+        // Iteration visits every entry once
+        u64 iterated = 0;
+        for(FlatHashMapIterator it = map.iterator_begin(); it.is_valid(); map.iterator_advance(it)) {
+            iterated++;
+            valid = valid && map.find(map.get_structure(it).key).index == it.index;
+        }
+        valid = valid && iterated == expected_size;
+
+        // Clear keeps the memory, reserve makes room without growing later
+        map.clear();
+        valid = valid && map.size == 0 && map.find(hash_map_test_key(0)).is_invalid();
+        map.reserve(k_hash_map_test_key_space);
+        const u64 reserved_capacity = map.capacity;
+        for(u32 i = 0; i < k_hash_map_test_key_space; i++) {
+            map.insert(hash_map_test_key(i), i);
+        }
+        valid = valid && map.capacity == reserved_capacity && map.size == k_hash_map_test_key_space;
+        map.shutdown();
+
+        // A sliding window of live keys over ever new ones. Erases leave tombstones until the table runs out of
+        // empty slots with few entries in it, then it is cleaned in place instead of growing.
+        map.init(allocator, 4);
+        for(u32 step = 0; step < k_hash_map_test_churn_steps && valid; step++) {
+            map.insert(hash_map_test_key(step), step);
+            if(step >= k_hash_map_test_window) {
+                valid = valid && map.remove(hash_map_test_key(step - k_hash_map_test_window)) == 1;
+            }
+        }
+        for(u32 step = k_hash_map_test_churn_steps - k_hash_map_test_window * 2; step < k_hash_map_test_churn_steps; step++) {
+            const FlatHashMapIterator it = map.find(hash_map_test_key(step));
+            const bool live = step >= k_hash_map_test_churn_steps - k_hash_map_test_window;
+            valid = valid && (live ? it.is_valid() && map.get(it) == step : it.is_invalid());
+        }
+        iterated = 0;
+        for(FlatHashMapIterator it = map.iterator_begin(); it.is_valid(); map.iterator_advance(it)) {
+            iterated++;
+        }
+        valid = valid && iterated == k_hash_map_test_window && map.size == k_hash_map_test_window;
+        map.shutdown();
+
+        FlatHashSet<u64, HashCalculate<u64>, HashEqual<u64>, Group> set;
+        set.init(allocator, 4);
+        for(u32 i = 0; i < k_hash_map_test_key_space; i++) {
+            valid = valid && set.insert(hash_map_test_key(i / 2)) == ((i & 1) == 0);
+        }
+        for(u32 i = 0; i < k_hash_map_test_key_space / 2; i += 2) {
+            valid = valid && set.remove(hash_map_test_key(i)) == 1;
+        }
+        for(u32 i = 0; i < k_hash_map_test_key_space / 2; i++) {
+            valid = valid && set.contains(hash_map_test_key(i)) == ((i & 1) == 1);
+        }
+        valid = valid && set.get_size() == k_hash_map_test_key_space / 4;
+        set.shutdown();
+
+        return valid;
+    }
+
+    // Load factors ////
+    // Lookups in a table of fixed capacity filled to 25, 50, 75% and the maximum load before growing.
+    template <typename Group>
+    static void hash_map_benchmark_load(Allocator* allocator, cstring name, u64* keys) {
+        using Map = FlatHashMap<u64, u64, HashCalculate<u64>, HashEqual<u64>, Group>;
+
+        const u64 max_entries = capacity_to_growth(k_hash_map_load_capacity, Group::kWidth);
+        const u64 loads[] = { k_hash_map_load_capacity / 4, k_hash_map_load_capacity / 2,
+                              k_hash_map_load_capacity * 3 / 4, max_entries };
+
+        for(u64 entries : loads) {
+            Map map;
+            map.init(allocator, max_entries);
+            for(u64 i = 0; i < entries; i++) {
+                map.insert(hash_map_test_key(i), i);
+            }
+
+            u32 seed = 0x9e3779b9u;
+            for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                keys[i] = seed % entries;
+            }
+
+            // Hits then misses, over the same index sequence
+            f64 best_seconds[2] = { 1e9, 1e9 };
+            u64 checksum = 0;
+            for(u32 run = 0; run < k_hash_map_benchmark_runs; run++) {
+                for(u32 miss = 0; miss < 2; miss++) {
+                    const u64 offset = miss ? entries : 0;
+                    const i64 start = time_now();
+                    for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+                        checksum += map.find(hash_map_test_key(keys[i] + offset)).index;
+                    }
+                    const f64 seconds = time_delta_seconds(start, time_now());
+                    best_seconds[miss] = seconds < best_seconds[miss] ? seconds : best_seconds[miss];
+                }
+            }
+
+            p_print("\t%-8s load %3llu%%: hit %5.1f ns, miss %5.1f ns (%llx)\n", name, entries * 100 / map.capacity,
+                    best_seconds[0] * 1e9 / k_hash_map_benchmark_lookups, best_seconds[1] * 1e9 / k_hash_map_benchmark_lookups,
+                    checksum & 0xf);
+            map.shutdown();
+        }
+    }
+
+    // Batched lookups ////
+    static bool hash_map_benchmark(Allocator* allocator, u32 entries, u64* keys, FlatHashMapIterator* iterators) {
+        FlatHashMap<u64, u64> map;
+        map.init(allocator, entries);
+
+        for(u32 i = 0; i < entries; i++) {
+            map.insert(hash_map_test_key(i), i);
+        }
+
+        // Random present keys, every other lookup misses
+        u32 seed = 0x9e3779b9u;
+        for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            const u64 index = seed % entries;
+            keys[i] = hash_map_test_key((i & 1) ? index + entries : index);
+        }
+
+        // find_batch must agree with find
+        bool valid = true;
+        map.find_batch(keys, k_hash_map_benchmark_lookups, iterators);
+        u32 found = 0;
+        for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+            const FlatHashMapIterator it = map.find(keys[i]);
+            valid = valid && it.index == iterators[i].index;
+            found += it.is_valid();
+        }
+        valid = valid && found == k_hash_map_benchmark_lookups / 2;
+
+        f64 find_seconds = 1e9;
+        f64 batch_seconds = 1e9;
+        u64 checksum = 0;
+        for(u32 run = 0; run < k_hash_map_benchmark_runs; run++) {
+            // Both write their results out, as a caller would
+            i64 start = time_now();
+            for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+                iterators[i] = map.find(keys[i]);
+            }
+            f64 seconds = time_delta_seconds(start, time_now());
+            find_seconds = seconds < find_seconds ? seconds : find_seconds;
+            for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+                checksum += iterators[i].index;
+            }
+
+            start = time_now();
+            map.find_batch(keys, k_hash_map_benchmark_lookups, iterators);
+            seconds = time_delta_seconds(start, time_now());
+            batch_seconds = seconds < batch_seconds ? seconds : batch_seconds;
+            for(u32 i = 0; i < k_hash_map_benchmark_lookups; i++) {
+                checksum -= iterators[i].index;
+            }
+        }
+        valid = valid && checksum == 0;
+
+        const u64 table_bytes = map.calculate_size(map.capacity);
+        p_print("\t%8u entries, %6llu KB: find %5.1f ns, find_batch %5.1f ns, %.2fx\n", entries, table_bytes / 1024,
+                find_seconds * 1e9 / k_hash_map_benchmark_lookups, batch_seconds * 1e9 / k_hash_map_benchmark_lookups,
+                find_seconds / batch_seconds);
+
+        map.shutdown();
+        return valid;
+    }
+
+    bool hash_map_test() {
+        // The biggest table doesn't fit the default system allocator
+        HeapAllocator heap;
+        heap.init(puffin_mega(512));
+
+        u64* keys = (u64*)heap.allocate(k_hash_map_benchmark_lookups * sizeof(u64), alignof(u64));
+        FlatHashMapIterator* iterators = (FlatHashMapIterator*)heap.allocate(k_hash_map_benchmark_lookups * sizeof(FlatHashMapIterator),
+                                                                             alignof(FlatHashMapIterator));
+
+        bool valid = true;
+        bool group_valid = hash_map_test_group<GroupPortableImpl>(&heap, keys);
+        p_print("Hash map portable group %s\n", group_valid ? "valid" : "FAILED");
+        valid = valid && group_valid;
+#if defined(PUFFIN_HASH_MAP_SSE2)
+        group_valid = hash_map_test_group<GroupSse2Impl>(&heap, keys);
+        p_print("Hash map SSE2 group %s\n", group_valid ? "valid" : "FAILED");
+        valid = valid && group_valid;
+#endif
+#if defined(PUFFIN_HASH_MAP_AVX2)
+        group_valid = hash_map_test_group<GroupAvx2Impl>(&heap, keys);
+        p_print("Hash map AVX2 group %s\n", group_valid ? "valid" : "FAILED");
+        valid = valid && group_valid;
+#endif
+
+        p_print("Hash map lookups by load factor, %llu slots\n", k_hash_map_load_capacity);
+        hash_map_benchmark_load<GroupPortableImpl>(&heap, "portable", keys);
+#if defined(PUFFIN_HASH_MAP_SSE2)
+        hash_map_benchmark_load<GroupSse2Impl>(&heap, "SSE2", keys);
+#endif
+#if defined(PUFFIN_HASH_MAP_AVX2)
+        hash_map_benchmark_load<GroupAvx2Impl>(&heap, "AVX2", keys);
+#endif
+
+        p_print("Hash map lookups, u64 keys, half of them missing\n");
+        for(u32 entries = 1024; entries <= (1u << 22); entries *= 16) {
+            valid = hash_map_benchmark(&heap, entries, keys, iterators) && valid;
+        }
+        p_print("Hash map %s\n", valid ? "valid, find_batch matches find" : "FAILED");
+
+        heap.deallocate(iterators);
+        heap.deallocate(keys);
+        heap.shutdown();
+        return valid;
+    }
+
+    // Concurrent ////
+
+    using ConcurrentTestMap = ConcurrentFlatHashMap<u64, u64>;
+
+    static const u32            k_concurrent_test_keys_per_thread = 4096;
+    static const u32            k_concurrent_test_iterations = 200000;
+    static const u32            k_concurrent_benchmark_operations = 1 << 20;
+
+    struct ConcurrentBenchmarkWorkload {
+        cstring                 name;
+        u32                     keys;               // Power of 2
+        u32                     write_period;       // Power of 2, one operation in write_period writes
+    };
+
+    // A resource cache maps a few thousand names to resources, looked up far more often than they are created
+    static const ConcurrentBenchmarkWorkload k_concurrent_benchmark_workloads[] = {
+        { "resource cache", 4096, 1024 },
+        { "churn", 1 << 16, 16 },
+    };
+
+    // Any value found for a key must be the one inserted for it
+    static u64 concurrent_test_value(u64 key) {
+        return ~key;
+    }
+
+    // Each thread inserts and removes keys of its own and checks them exactly, while it also looks up the keys of
+    // the other threads, which can be there or not but never with another value.
+    static void concurrent_hash_map_stress_thread(ConcurrentTestMap* map, u32 thread_index, u32 thread_count,
+                                                  std::atomic<u32>* failures) {
+        bool present[k_concurrent_test_keys_per_thread] = {};
+        const u32 first_key = thread_index * k_concurrent_test_keys_per_thread;
+
+        u32 seed = 0x9e3779b9u * (thread_index + 1);
+        for(u32 i = 0; i < k_concurrent_test_iterations; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+
+            const u32 index = (seed >> 8) % k_concurrent_test_keys_per_thread;
+            const u64 key = hash_map_test_key(first_key + index);
+            u64 value = 0;
+            switch(seed & 3) {
+                case 0: {
+                    map->insert(key, concurrent_test_value(key));
+                    present[index] = true;
+                    break;
+                }
+                case 1: {
+                    if(map->remove(key) != (present[index] ? 1u : 0u)) {
+                        failures->fetch_add(1);
+                    }
+                    present[index] = false;
+                    break;
+                }
+                case 2: {
+                    const bool found = map->find(key, value);
+                    if(found != present[index] || (found && value != concurrent_test_value(key))) {
+                        failures->fetch_add(1);
+                    }
+                    break;
+                }
+                default: {
+                    const u32 other_thread = (seed >> 2) % thread_count;
+                    const u64 other_key = hash_map_test_key(other_thread * k_concurrent_test_keys_per_thread + index);
+                    if(map->find(other_key, value) && value != concurrent_test_value(other_key)) {
+                        failures->fetch_add(1);
+                    }
+                    break;
+                }
+            }
+        }
+
+        for(u32 index = 0; index < k_concurrent_test_keys_per_thread; index++) {
+            if(present[index]) {
+                map->remove(hash_map_test_key(first_key + index));
+            }
+        }
+    }
+
+    // One in write_period operations writes, the others look keys up
+    template <typename Map, typename Find, typename Write>
+    static void concurrent_hash_map_benchmark_thread(Map* map, u32 seed, ConcurrentBenchmarkWorkload workload, Find find, Write write) {
+        u64 checksum = 0;
+        for(u32 i = 0; i < k_concurrent_benchmark_operations; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            const u64 key = hash_map_test_key((seed >> 10) & (workload.keys - 1));
+            if((seed & (workload.write_period - 1)) == 0) {
+                write(map, key);
+            } else {
+                checksum += find(map, key);
+            }
+        }
+        // Keeps the lookups
+        if(checksum == 1) {
+            p_print("");
+        }
+    }
+
+    struct LockedTestMap {
+        FlatHashMap<u64, u64>   map;
+        std::mutex              mutex;
+    };
+
+    template <typename Map, typename Find, typename Write>
+    static f64 concurrent_hash_map_benchmark(Map* map, u32 thread_count, const ConcurrentBenchmarkWorkload& workload, Find find, Write write) {
+        std::thread threads[16];
+        const i64 start = time_now();
+        for(u32 t = 0; t < thread_count; t++) {
+            threads[t] = std::thread(concurrent_hash_map_benchmark_thread<Map, Find, Write>, map, 0x2545f491u * (t + 1), workload, find, write);
+        }
+        for(u32 t = 0; t < thread_count; t++) {
+            threads[t].join();
+        }
+        const f64 seconds = time_delta_seconds(start, time_now());
+        return (f64)thread_count * k_concurrent_benchmark_operations / seconds / 1000000.0;
+    }
+
+    bool concurrent_hash_map_test() {
+        // Thread caches, every shard can grow from a different thread
+        HeapAllocator heap;
+        heap.init(puffin_mega(64), true);
+
+        const u32 hardware_threads = std::thread::hardware_concurrency();
+        const u32 max_threads = hardware_threads < 2 ? 2 : (hardware_threads > 16 ? 16 : hardware_threads);
+
+        // Starts small so that shards grow and clean tombstones while being read
+        std::atomic<u32> failures{ 0 };
+        ConcurrentTestMap map;
+        map.init(&heap, 0);
+
+        std::thread threads[16];
+        for(u32 t = 0; t < max_threads; t++) {
+            threads[t] = std::thread(concurrent_hash_map_stress_thread, &map, t, max_threads, &failures);
+        }
+        for(u32 t = 0; t < max_threads; t++) {
+            threads[t].join();
+        }
+        if(map.get_size() != 0) {
+            failures.fetch_add(1);
+        }
+        map.shutdown();
+
+        p_print("Concurrent hash map stress test %s, %u threads\n", failures.load() ? "failed" : "passed", max_threads);
+
+        // Throughput against a single map behind a mutex
+        p_print("Concurrent hash map benchmark, %u operations per thread\n", k_concurrent_benchmark_operations);
+        for(const ConcurrentBenchmarkWorkload& workload : k_concurrent_benchmark_workloads) {
+            ConcurrentTestMap concurrent_map;
+            concurrent_map.init(&heap, workload.keys * 2);
+            LockedTestMap locked_map;
+            locked_map.map.init(&heap, workload.keys * 2);
+            for(u32 i = 0; i < workload.keys; i += 2) {
+                const u64 key = hash_map_test_key(i);
+                concurrent_map.insert(key, concurrent_test_value(key));
+                locked_map.map.insert(key, concurrent_test_value(key));
+            }
+
+            p_print("\t%s, %u keys, 1 in %u writes\n", workload.name, workload.keys, workload.write_period);
+            for(u32 thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+                // Best of a few runs, one core machines especially are noisy
+                f64 concurrent_rate = 0.0;
+                f64 locked_rate = 0.0;
+                for(u32 run = 0; run < 3; run++) {
+                    const f64 concurrent_run = concurrent_hash_map_benchmark(&concurrent_map, thread_count, workload,
+                            [](ConcurrentTestMap* m, u64 key) {
+                                u64 value = 0;
+                                m->find(key, value);
+                                return value;
+                            },
+                            [](ConcurrentTestMap* m, u64 key) {
+                                if(m->remove(key) == 0) {
+                                    m->insert(key, concurrent_test_value(key));
+                                }
+                            });
+
+                    const f64 locked_run = concurrent_hash_map_benchmark(&locked_map, thread_count, workload,
+                            [](LockedTestMap* m, u64 key) {
+                                std::lock_guard<std::mutex> lock(m->mutex);
+                                const FlatHashMapIterator it = m->map.find(key);
+                                return it.is_valid() ? m->map.get(it) : 0;
+                            },
+                            [](LockedTestMap* m, u64 key) {
+                                std::lock_guard<std::mutex> lock(m->mutex);
+                                if(m->map.remove(key) == 0) {
+                                    m->map.insert(key, concurrent_test_value(key));
+                                }
+                            });
+
+                    concurrent_rate = concurrent_run > concurrent_rate ? concurrent_run : concurrent_rate;
+                    locked_rate = locked_run > locked_rate ? locked_run : locked_rate;
+                }
+
+                p_print("\t\t%2u threads: sharded %6.1f M operations/s, locked %6.1f M operations/s, %.2fx\n", thread_count,
+                        concurrent_rate, locked_rate, concurrent_rate / locked_rate);
+            }
+
+            locked_map.map.shutdown();
+            concurrent_map.shutdown();
+        }
+
+        heap.shutdown();
+        return failures.load() == 0;
+    }
+
+}
@@ -8,145 +8,239 @@
 #include "assert.hpp"
 #include "bit.hpp"
 
-#include "wyhash.h"
-
-namespace puffin {
-
-    // Hash Map ////
-    static const u64        k_iterator_end = u64_max;
-
-    struct FindInfo {
-        u64                 offset;
-        u64                 probe_length;
-    };
-
-    struct FindResult {
-        u64                 index;
-        bool                free_index; // States if the index is free or used.
-    };
+#include "string.hpp"
 
-    struct FlatHashMapIterator {
-        u64                 index;
+#include "wyhash.h"
 
-        bool                is_valid() const { return index != k_iterator_end; }
-        bool                is_invalid() const { return index == k_iterator_end; }
-    };
+#include <type_traits>
 
-    // A single block of empty control bytes for tables without any slots allocated
-    // This enables removing a branch in the hot path of find()
-    i8*                     group_init_empty();
+#if !defined(PUFFIN_HASH_MAP_GROUP_PORTABLE)
+    #if defined(__AVX2__) && !defined(PUFFIN_HASH_MAP_GROUP_SSE2)
+        #define PUFFIN_HASH_MAP_AVX2
+    #endif
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define PUFFIN_HASH_MAP_SSE2
+    #endif
+#endif
 
+#if defined(PUFFIN_HASH_MAP_AVX2)
+#include <immintrin.h>
+#elif defined(PUFFIN_HASH_MAP_SSE2)
+#include <emmintrin.h>
+#endif
 
-    // Probing //////////
-    struct ProbeSequence {
-        static const u64    k_width = 16;
-        static const size_t k_engine_hash = 0x31d3a36013e;
+namespace puffin {
 
-        ProbeSequence(u64 hash, u64 mask);
+    // Hashing ////
+    template<typename T>
+    inline u64 hash_calculate(const T& value, size_t seed = 0) {
+        return wyhash(&value, sizeof(T), seed, _wyp);
+    }
 
-        u64                 get_offset() const;
-        u64                 get_offset(u64 i) const;
+    template<size_t N>
+    inline u64 hash_calculate(const char (&value)[N], size_t seed = 0) {
+        return wyhash(value, strlen(value), seed, _wyp);
+    }
 
-        // 0-based probe index. The i-th probe in the probe sequence
-        u64                 get_index() const;
+    template<>
+    inline u64 hash_calculate(const cstring& value, size_t seed) {
+        return wyhash(value, strlen(value), seed, _wyp);
+    }
 
-        void                next();
+    // Method to hash memory itself
+    inline u64 hash_bytes(void* data, size_t length, size_t seed = 0) {
+        return wyhash(data, length, seed, _wyp);
+    }
 
-        u64                 mask;
-        u64                 offset;
-        u64                 index = 0;
+    // Hasher and equality policies ////
+    // Policies are stateless. Equal takes the stored key first, the second argument can be any type the
+    // policy knows how to compare with, so lookups don't need to build a K.
+    template <typename K>
+    struct HashCalculate {
+        u64                 operator()(const K& key) const      { return hash_calculate(key); }
     };
 
-    template <typename K, typename V>
-    struct FlatHashMap {
-
-        struct KeyValue {
-            K               key;
-            V               value;
-        };
-
-        void                init(Allocator* allocator, u64 initial_capacity);
-        void                shutdown();
+    template <typename K>
+    struct HashEqual {
+        bool                operator()(const K& a, const K& b) const    { return a == b; }
+    };
 
-        // Main interface
-        FlatHashMapIterator find(const K& key);
-        void                insert(const K& key, const V& value);
-        u32                 remove(const K& key);
-        u32                 remove(const FlatHashMapIterator& it);
+    // For keys that are already a well distributed hash, like resource type hashes
+    struct HashPrecomputed {
+        u64                 operator()(u64 key) const           { return key; }
+    };
 
-        V&                  get(const K& key);
-        V&                  get(const FlatHashMapIterator& it);
+    // For plain structs without operator==, hashed with HashCalculate over the same bytes.
+    template <typename K>
+    struct HashEqualMemory {
+        bool                operator()(const K& a, const K& b) const    { return memcmp(&a, &b, sizeof(K)) == 0; }
+    };
 
-        KeyValue&           get_structure(const K& key);
-        KeyValue&           get_structure(const FlatHashMapIterator& it);
+    // Null terminated strings hashed and compared by content. The map stores the pointer, the string must
+    // outlive its entry. StringView lookups hash to the same value as the equivalent cstring.
+    struct HashString {
+        u64                 operator()(cstring key) const       { return hash_calculate(key); }
+        u64                 operator()(const StringView& key) const     { return hash_bytes(key.text, key.length); }
+    };
 
-        void                set_default_value(const V& value);
+    struct HashStringEqual {
+        bool                operator()(cstring a, cstring b) const      { return a == b || strcmp(a, b) == 0; }
+        bool                operator()(cstring a, const StringView& b) const {
+            return strncmp(a, b.text, b.length) == 0 && a[b.length] == 0;
+        }
+    };
 
-        // Iterators
-        FlatHashMapIterator iterator_begin();
-        void                iterator_advance(FlatHashMapIterator& it);
+    // Table memory access ////
+    // ConcurrentFlatHashMap readers load a table without the lock while a writer can be changing it. So the
+    // maps of its shards store their control bytes, slots and table fields with relaxed atomic stores, and the
+    // readers load them with relaxed atomic loads. Neither side is then a data race. C++17 has no atomic_ref,
+    // so these are compiler builtins on plain memory.
+    // FlatHashMap picks how it writes its table with the Access parameter: plain memory accesses by default,
+    // HashMapRelaxedAccess for the shards.
+
+#if defined(_MSC_VER) && !defined(__clang__)
+    #define PUFFIN_HASH_MAP_MAY_ALIAS
+#else
+    // Slots are copied as words, which must not be assumed apart from the keys and values they hold
+    #define PUFFIN_HASH_MAP_MAY_ALIAS __attribute__((may_alias))
+#endif
+
+    // Template arguments drop the attribute, so words are only used through the overloads below
+    typedef u64 PUFFIN_HASH_MAP_MAY_ALIAS   HashMapWord64;
+    typedef u32 PUFFIN_HASH_MAP_MAY_ALIAS   HashMapWord32;
+    typedef u16 PUFFIN_HASH_MAP_MAY_ALIAS   HashMapWord16;
+
+    template <typename T>
+    inline T hash_map_load(const T* address) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return *(const volatile T*)address;
+#else
+        return __atomic_load_n(address, __ATOMIC_RELAXED);
+#endif
+    }
 
-        void                clear();
-        void                reserve(u64 new_size);
+    template <typename T>
+    inline void hash_map_store(T* address, T value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        *(volatile T*)address = value;
+#else
+        __atomic_store_n(address, value, __ATOMIC_RELAXED);
+#endif
+    }
 
-        // Internal Methods
-        void                erase_meta(const FlatHashMapIterator& it);
+    // hash_map_read_words stores plainly, its destination is only seen by the calling thread
+#if defined(_MSC_VER) && !defined(__clang__)
+    #define PUFFIN_HASH_MAP_COPY_WORDS(Word)                                                    \
+    inline void hash_map_copy_words(Word* destination, const Word* source, size_t count) {   \
+        for(size_t i = 0; i < count; i++) {                                                 \
+            *(volatile Word*)(destination + i) = *(const volatile Word*)(source + i);       \
+        }                                                                                   \
+    }                                                                                       \
+    inline void hash_map_read_words(Word* destination, const Word* source, size_t count) {   \
+        for(size_t i = 0; i < count; i++) {                                                 \
+            destination[i] = *(const volatile Word*)(source + i);                           \
+        }                                                                                   \
+    }
+#else
+    #define PUFFIN_HASH_MAP_COPY_WORDS(Word)                                                    \
+    inline void hash_map_copy_words(Word* destination, const Word* source, size_t count) {   \
+        for(size_t i = 0; i < count; i++) {                                                 \
+            __atomic_store_n(destination + i, __atomic_load_n(source + i, __ATOMIC_RELAXED), __ATOMIC_RELAXED); \
+        }                                                                                   \
+    }                                                                                       \
+    inline void hash_map_read_words(Word* destination, const Word* source, size_t count) {   \
+        for(size_t i = 0; i < count; i++) {                                                 \
+            destination[i] = __atomic_load_n(source + i, __ATOMIC_RELAXED);                 \
+        }                                                                                   \
+    }
+#endif
 
-        FindResult          find_or_prepare_insert(const K& key);
-        FindInfo            find_first_non_full(u64 hash);
+    PUFFIN_HASH_MAP_COPY_WORDS(HashMapWord64)
+    PUFFIN_HASH_MAP_COPY_WORDS(HashMapWord32)
+    PUFFIN_HASH_MAP_COPY_WORDS(HashMapWord16)
+    PUFFIN_HASH_MAP_COPY_WORDS(i8)
 
-        u64                 prepare_insert(u64 hash);
+    #undef PUFFIN_HASH_MAP_COPY_WORDS
 
-        ProbeSequence       probe(u64 hash);
-        void                rehash_and_grow_if_necessary();
+    inline HashMapWord64 hash_map_load_word(const HashMapWord64* address) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return *(const volatile HashMapWord64*)address;
+#else
+        return __atomic_load_n(address, __ATOMIC_RELAXED);
+#endif
+    }
 
-        void                drop_deletes_without_resize();
-        u64                 calculate_size(u64 new_capacity);
+    #define PUFFIN_HASH_MAP_COPY_VALUE(copy_words)                                                                               \
+        if constexpr (alignof(T) >= 8) {                                                                                        \
+            copy_words(reinterpret_cast<HashMapWord64*>(destination), reinterpret_cast<const HashMapWord64*>(source), sizeof(T) / 8); \
+        } else if constexpr (alignof(T) == 4) {                                                                                 \
+            copy_words(reinterpret_cast<HashMapWord32*>(destination), reinterpret_cast<const HashMapWord32*>(source), sizeof(T) / 4); \
+        } else if constexpr (alignof(T) == 2) {                                                                                 \
+            copy_words(reinterpret_cast<HashMapWord16*>(destination), reinterpret_cast<const HashMapWord16*>(source), sizeof(T) / 2); \
+        } else {                                                                                                                \
+            copy_words(reinterpret_cast<i8*>(destination), reinterpret_cast<const i8*>(source), sizeof(T));                     \
+        }
 
-        void                initialize_slots();
+    // Copies a trivially copyable value with the widest words tiling it, each loaded and stored atomically
+    template <typename T>
+    inline void hash_map_copy(T* destination, const T* source) {
+        PUFFIN_HASH_MAP_COPY_VALUE(hash_map_copy_words)
+    }
 
-        void                resize(u64 new_capacity);
+    // Same, only the loads are atomic. For copies to the stack of the reading thread, which stay in registers.
+    template <typename T>
+    inline void hash_map_read(T* destination, const T* source) {
+        PUFFIN_HASH_MAP_COPY_VALUE(hash_map_read_words)
+    }
 
-        void                iterator_skip_empty_or_deleted(FlatHashMapIterator& iterator);
+    #undef PUFFIN_HASH_MAP_COPY_VALUE
 
-        // Sets the control byte, and if 'i < Group::kWidth - 1" set the cloned byte at the end too.
-        void                set_ctrl(u64 i, i8 h);
-        void                reset_ctrl();
-        void                reset_growth_remaining();
+    struct HashMapPlainAccess {
+        template <typename T>
+        static void         store(T* address, T value)                          { *address = value; }
+        template <typename T>
+        static void         copy(T* destination, const T* source)               { *destination = *source; }
+        static void         copy_bytes(i8* destination, const i8* source, size_t count)  { memcpy(destination, source, count); }
+        static void         fill_bytes(i8* destination, i8 value, size_t count)  { memset(destination, value, count); }
+    };
 
-        // Manages the state of slots in the hash map
-        i8*                 control_bytes   = group_init_empty();
-        KeyValue*           slots_          = nullptr;
+    struct HashMapRelaxedAccess {
+        template <typename T>
+        static void         store(T* address, T value)                          { hash_map_store(address, value); }
+        template <typename T>
+        static void         copy(T* destination, const T* source)               { hash_map_copy(destination, source); }
+        static void         copy_bytes(i8* destination, const i8* source, size_t count)  { hash_map_copy_words(destination, source, count); }
+        static void         fill_bytes(i8* destination, i8 value, size_t count) {
+            for(size_t i = 0; i < count; i++) {
+                hash_map_store(destination + i, value);
+            }
+        }
+    };
 
-        u64                 size            = 0;    // Occupied size
-        u64                 capacity        = 0;    // Allocated capacity
-        u64                 growth_remaining     = 0;    // Number of empty spaces we can fill
+    // Hash Map ////
+    static const u64        k_iterator_end = u64_max;
 
-        Allocator*          allocator       = nullptr;
-        KeyValue            default_key_value = {(K)-1, 0};
+    struct FindInfo {
+        u64                 offset;
+        u64                 probe_length;
+    };
 
-    }; // struct FlatHashMap
+    struct FindResult {
+        u64                 index;
+        bool                free_index; // States if the index is free or used.
+    };
 
-    // Implementation
-    template<typename T>
-    inline u64 hash_calculate(const T& value, size_t seed = 0) {
-        return wyhash(&value, sizeof(T), seed, _wyp);
-    }
+    struct FlatHashMapIterator {
+        u64                 index;
 
-    template<size_t N>
-    inline u64 hash_calculate(const char (&value)[N], size_t seed = 0) {
-        return wyhash(value, strlen(value), seed, _wyp);
-    }
+        bool                is_valid() const { return index != k_iterator_end; }
+        bool                is_invalid() const { return index == k_iterator_end; }
+    };
 
-    template<>
-    inline u64 hash_calculate(const cstring& value, size_t seed) {
-        return wyhash(value, strlen(value), seed, _wyp);
-    }
+    // A single block of empty control bytes for tables without any slots allocated
+    // This enables removing a branch in the hot path of find()
+    i8*                     group_init_empty();
 
-    // Method to hash memory itself
-    inline u64 hash_bytes(void* data, size_t length, size_t seed = 0) {
-        return wyhash(data, length, seed, _wyp);
-    }
 
     // https://gankra.github.io/blah/hashbrown-tldr/
     // https://blog.waffles.space/2018/12/07/deep-dive-into-hashbrown/
@@ -176,6 +270,13 @@ namespace puffin {
     static u64          hash_1(u64 hash, const i8* ctrl) { return (hash >> 7) ^ hash_seed(ctrl); }
     static i8           hash_2(u64 hash)                { return hash & 0x7F; }
 
+    // Groups ////
+    //
+    // A group matches kWidth control bytes at once. The implementation is picked at compile time: AVX2 when
+    // the build targets it, SSE2 on any other x86-64 build, and the portable SWAR version elsewhere.
+    // Defining PUFFIN_HASH_MAP_GROUP_SSE2 or PUFFIN_HASH_MAP_GROUP_PORTABLE forces one.
+
+#if defined(PUFFIN_HASH_MAP_SSE2)
     struct GroupSse2Impl {
         static constexpr size_t kWidth = 16; // # of slots per group
 
@@ -188,6 +289,18 @@ namespace puffin {
             ctrl = _mm_loadu_si128(reinterpret_cast< const __m128i* > (pos));
         }
 
+        explicit GroupSse2Impl(__m128i ctrl_) : ctrl(ctrl_) {}
+
+        // From the aligned words covering the group and the word after them, loaded by the caller. The group
+        // starts shift bits into the first word.
+        static GroupSse2Impl from_words(const u64* words, u32 shift) {
+            const __m128i low = _mm_set_epi64x((long long)words[1], (long long)words[0]);
+            const __m128i high = _mm_set_epi64x((long long)words[2], (long long)words[1]);
+            // Shifting by 64 gives 0, so high drops out of an aligned group
+            return GroupSse2Impl(_mm_or_si128(_mm_srl_epi64(low, _mm_cvtsi32_si128((int)shift)),
+                                              _mm_sll_epi64(high, _mm_cvtsi32_si128((int)(64 - shift)))));
+        }
+
         // Returns a bitmask representing the positions of empty slots
         BitMask<uint32_t, kWidth> Match(i8 hash) const {
             // Sets all elements of a 128-bit register to the specified 8-byte value
@@ -253,6 +366,279 @@ namespace puffin {
         }
     };
 
+#endif // PUFFIN_HASH_MAP_SSE2
+
+#if defined(PUFFIN_HASH_MAP_AVX2)
+    struct GroupAvx2Impl {
+        static constexpr size_t kWidth = 32; // # of slots per group
+
+        __m256i ctrl;
+
+        explicit GroupAvx2Impl(const i8* pos) {
+            ctrl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+        }
+
+        explicit GroupAvx2Impl(__m256i ctrl_) : ctrl(ctrl_) {}
+
+        // See GroupSse2Impl::from_words
+        static GroupAvx2Impl from_words(const u64* words, u32 shift) {
+            const __m256i low = _mm256_set_epi64x((long long)words[3], (long long)words[2], (long long)words[1], (long long)words[0]);
+            // Words 1 to 3 moved down a lane, word 4 blended in the top one
+            const __m256i high = _mm256_blend_epi32(_mm256_permute4x64_epi64(low, _MM_SHUFFLE(3, 3, 2, 1)),
+                                                    _mm256_set1_epi64x((long long)words[4]), 0xc0);
+            return GroupAvx2Impl(_mm256_or_si256(_mm256_srl_epi64(low, _mm_cvtsi32_si128((int)shift)),
+                                                 _mm256_sll_epi64(high, _mm_cvtsi32_si128((int)(64 - shift)))));
+        }
+
+        // Returns a bitmask representing the positions of slots that match hash
+        BitMask<uint32_t, kWidth> Match(i8 hash) const {
+            __m256i match = _mm256_set1_epi8(hash);
+            return BitMask<uint32_t, kWidth>(
+                    static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(match, ctrl)))
+                    );
+        }
+
+        // Returns a bitmask representing the position of empty slots
+        BitMask<uint32_t, kWidth> MatchEmpty() const {
+            return Match(static_cast<i8>(k_control_bitmask_empty));
+        }
+
+        // Returns a bitmask representing the positions of empty or deleted slots
+        BitMask<uint32_t, kWidth> MatchEmptyOrDeleted() const {
+            __m256i special = _mm256_set1_epi8(k_control_bitmask_sentinel);
+            return BitMask<uint32_t, kWidth>(
+                    static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(special, ctrl)))
+                    );
+        }
+
+        // Returns the number of trailing empty or deleted elements in the group
+        uint32_t CountLeadingEmptyOrDeleted() const {
+            __m256i special = _mm256_set1_epi8(k_control_bitmask_sentinel);
+            // All 32 bits can be set, count in 64 bits so that adding one can't wrap
+            const u64 mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(special, ctrl)));
+            return static_cast<uint32_t>(trailing_zeroes_u64(mask + 1));
+        }
+
+        void ConvertSpecialToEmptyAndFullToDeleted(i8* dst) {
+            __m256i msbs = _mm256_set1_epi8(static_cast<char>(-128));
+            __m256i x126 = _mm256_set1_epi8(126);
+            __m256i special_mask = _mm256_cmpgt_epi8(_mm256_setzero_si256(), ctrl);
+            __m256i res = _mm256_or_si256(msbs, _mm256_andnot_si256(special_mask, x126));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), res);
+        }
+    };
+#endif // PUFFIN_HASH_MAP_AVX2
+
+    // 8 control bytes in a u64, the SIMD operations emulated with integer arithmetic.
+    // Bitmasks hold 0x80 in the bytes that match, hence BitMask<uint64_t, 8, 3>.
+    struct GroupPortableImpl {
+        static constexpr size_t kWidth = 8; // # of slots per group
+
+        static constexpr u64 k_msbs = 0x8080808080808080ull;
+        static constexpr u64 k_lsbs = 0x0101010101010101ull;
+
+        u64 ctrl;
+
+        explicit GroupPortableImpl(const i8* pos) {
+            // Byte i of the group is byte i of ctrl on the little endian platforms we build for
+            memcpy(&ctrl, pos, sizeof(ctrl));
+        }
+
+        explicit GroupPortableImpl(u64 ctrl_) : ctrl(ctrl_) {}
+
+        // See GroupSse2Impl::from_words
+        static GroupPortableImpl from_words(const u64* words, u32 shift) {
+            // Two shifts, so that a shift of 0 drops words[1] instead of shifting by 64
+            return GroupPortableImpl((words[0] >> shift) | ((words[1] << 1) << (63 - shift)));
+        }
+
+        // Can report a false positive on a byte right after a real match, the caller compares the keys anyway
+        BitMask<uint64_t, kWidth, 3> Match(i8 hash) const {
+            const u64 x = ctrl ^ (k_lsbs * static_cast<u8>(hash));
+            return BitMask<uint64_t, kWidth, 3>((x - k_lsbs) & ~x & k_msbs);
+        }
+
+        // Empty is the only special value with bit 7 set and bit 1 clear
+        BitMask<uint64_t, kWidth, 3> MatchEmpty() const {
+            return BitMask<uint64_t, kWidth, 3>((ctrl & (~ctrl << 6)) & k_msbs);
+        }
+
+        // Empty and deleted have bit 7 set and bit 0 clear, the sentinel has both set
+        BitMask<uint64_t, kWidth, 3> MatchEmptyOrDeleted() const {
+            return BitMask<uint64_t, kWidth, 3>((ctrl & (~ctrl << 7)) & k_msbs);
+        }
+
+        // Returns the number of trailing empty or deleted elements in the group
+        uint32_t CountLeadingEmptyOrDeleted() const {
+            const u64 gaps = 0x00FEFEFEFEFEFEFEull;
+            return static_cast<uint32_t>((trailing_zeroes_u64(((~ctrl & (ctrl >> 7)) | gaps) + 1) + 7) >> 3);
+        }
+
+        void ConvertSpecialToEmptyAndFullToDeleted(i8* dst) {
+            const u64 x = ctrl & k_msbs;
+            const u64 res = (~x + (x >> 7)) & ~k_lsbs;
+            memcpy(dst, &res, sizeof(res));
+        }
+    };
+
+#if defined(PUFFIN_HASH_MAP_AVX2)
+    using HashMapGroup = GroupAvx2Impl;
+#elif defined(PUFFIN_HASH_MAP_SSE2)
+    using HashMapGroup = GroupSse2Impl;
+#else
+    using HashMapGroup = GroupPortableImpl;
+#endif
+
+    // Probing //////////
+    // Triangular probing over groups, visits every group once when the capacity + 1 is a power of 2
+    template <u64 Width>
+    struct ProbeSequence {
+        ProbeSequence(u64 hash, u64 mask);
+
+        u64                 get_offset() const;
+        u64                 get_offset(u64 i) const;
+
+        // 0-based probe index. The i-th probe in the probe sequence
+        u64                 get_index() const;
+
+        void                next();
+
+        u64                 mask;
+        u64                 offset;
+        u64                 index = 0;
+    };
+
+    // Value type of FlatHashSet, its slots only hold the key
+    struct FlatHashSetValue {};
+
+    template <typename K, typename V>
+    struct FlatHashSlot {
+        K                   key;
+        V                   value;
+    };
+
+    template <typename K>
+    struct FlatHashSlot<K, FlatHashSetValue> {
+        K                   key;
+    };
+
+    template <typename K, typename V, typename Hasher = HashCalculate<K>, typename Equal = HashEqual<K>,
+              typename Group = HashMapGroup, typename Access = HashMapPlainAccess>
+    struct FlatHashMap {
+
+        using KeyValue = FlatHashSlot<K, V>;
+        using Probe = ProbeSequence<Group::kWidth>;
+
+        void                init(Allocator* allocator, u64 initial_capacity);
+        void                shutdown();
+
+        // Main interface
+        FlatHashMapIterator find(const K& key);
+        void                insert(const K& key, const V& value);
+
+        // Lookups with a hash computed once by the caller with the same Hasher.
+        // The key can be of any type Equal compares with K.
+        template <typename Q>
+        FlatHashMapIterator find_with_hash(const Q& key, u64 hash);
+        void                insert_with_hash(const K& key, u64 hash, const V& value);
+
+        // Finds count keys, writing an iterator per key. Worth it on tables bigger than the caches:
+        // memory for every key of a batch is prefetched before the first probe, so the misses overlap.
+        void                find_batch(const K* keys, u32 count, FlatHashMapIterator* out_iterators);
+
+        u32                 remove(const K& key);
+        u32                 remove(const FlatHashMapIterator& it);
+
+        V&                  get(const K& key);
+        V&                  get(const FlatHashMapIterator& it);
+
+        KeyValue&           get_structure(const K& key);
+        KeyValue&           get_structure(const FlatHashMapIterator& it);
+
+        void                set_default_value(const V& value);
+
+        // Iterators
+        FlatHashMapIterator iterator_begin();
+        void                iterator_advance(FlatHashMapIterator& it);
+
+        void                clear();
+        void                reserve(u64 new_size);
+
+        // Internal Methods
+        void                erase_meta(const FlatHashMapIterator& it);
+
+        FindResult          find_or_prepare_insert(const K& key);
+        FindResult          find_or_prepare_insert_with_hash(const K& key, u64 hash);
+        FindInfo            find_first_non_full(u64 hash);
+
+        u64                 prepare_insert(u64 hash);
+
+        Probe               probe(u64 hash);
+        void                rehash_and_grow_if_necessary();
+
+        void                drop_deletes_without_resize();
+        u64                 calculate_size(u64 new_capacity);
+
+        void                initialize_slots();
+
+        void                resize(u64 new_capacity);
+
+        void                iterator_skip_empty_or_deleted(FlatHashMapIterator& iterator);
+
+        // Sets the control byte, and if 'i < Group::kWidth - 1" set the cloned byte at the end too.
+        void                set_ctrl(u64 i, i8 h);
+        void                reset_ctrl();
+        void                reset_growth_remaining();
+
+        // Manages the state of slots in the hash map
+        i8*                 control_bytes   = group_init_empty();
+        KeyValue*           slots_          = nullptr;
+
+        u64                 size            = 0;    // Occupied size
+        u64                 capacity        = 0;    // Allocated capacity
+        u64                 growth_remaining     = 0;    // Number of empty spaces we can fill
+
+        Allocator*          allocator       = nullptr;
+        KeyValue            default_key_value = {};
+
+    }; // struct FlatHashMap
+
+    // Keys only FlatHashMap, with the same probing and policies
+    template <typename K, typename Hasher = HashCalculate<K>, typename Equal = HashEqual<K>,
+              typename Group = HashMapGroup>
+    struct FlatHashSet {
+
+        void                init(Allocator* allocator, u64 initial_capacity);
+        void                shutdown();
+
+        // Returns true when the key was not in the set yet
+        bool                insert(const K& key);
+        bool                insert_with_hash(const K& key, u64 hash);
+
+        bool                contains(const K& key);
+        template <typename Q>
+        bool                contains_with_hash(const Q& key, u64 hash);
+
+        u32                 remove(const K& key);
+
+        const K&            get(const FlatHashMapIterator& it);
+
+        // Iterators
+        FlatHashMapIterator iterator_begin();
+        void                iterator_advance(FlatHashMapIterator& it);
+
+        void                clear();
+        void                reserve(u64 new_size);
+
+        u64                 get_size() const;
+
+        FlatHashMap<K, FlatHashSetValue, Hasher, Equal, Group> map;
+
+    }; // struct FlatHashSet
+
+    // Checks find_batch against find and benchmarks both on tables in and out of the caches
+    bool                    hash_map_test();
+
     static bool         capacity_is_valid(size_t n);
 
     // Rounds up capacity to the next power of 2 minus 1, with the minimum of 1
@@ -270,63 +656,74 @@ namespace puffin {
     // at which we should grow the capacity.
     // if (Group::kWidth == 8 && capacity == 7) { return 6; }
     // x-x/8 does not work when x==7
-    static u64          capacity_to_growth(u64 capacity);
-    static u64          capacity_growth_to_lower_bound(u64 growth);
+    static u64          capacity_to_growth(u64 capacity, u64 group_width);
+    static u64          capacity_growth_to_lower_bound(u64 growth, u64 group_width);
 
+    template <typename Group, typename Access>
     static void ConvertDeletedToEmptyAndFullToDeleted(i8* ctrl, size_t capacity) {
-        for(i8* pos = ctrl; pos != ctrl + capacity + 1; pos += GroupSse2Impl::kWidth) {
-            GroupSse2Impl{pos}.ConvertSpecialToEmptyAndFullToDeleted(pos);
+        alignas(32) i8 converted[Group::kWidth];
+        for(i8* pos = ctrl; pos < ctrl + capacity; pos += Group::kWidth) {
+            Group{pos}.ConvertSpecialToEmptyAndFullToDeleted(converted);
+            Access::copy_bytes(pos, converted, Group::kWidth);
         }
 
         // Copy the cloned ctrl bytes
-        puffin::memory_copy(ctrl + capacity + 1, ctrl, GroupSse2Impl::kWidth);
-        ctrl[capacity] = k_control_bitmask_sentinel;
+        Access::copy_bytes(ctrl + capacity + 1, ctrl, Group::kWidth - 1);
+        Access::store(ctrl + capacity, k_control_bitmask_sentinel);
     }
 
     // FlatHashMap
-    template <typename K, typename V>
-    void FlatHashMap<K, V>::reset_ctrl() {
-        memset(control_bytes, k_control_bitmask_empty, capacity + GroupSse2Impl::kWidth);
-        control_bytes[capacity] = k_control_bitmask_sentinel;
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::reset_ctrl() {
+        Access::fill_bytes(control_bytes, k_control_bitmask_empty, capacity + Group::kWidth);
+        Access::store(control_bytes + capacity, k_control_bitmask_sentinel);
     }
 
-    template <typename K, typename V>
-    void FlatHashMap<K, V>::reset_growth_remaining() {
-        growth_remaining = capacity_to_growth(capacity) - size;
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::reset_growth_remaining() {
+        growth_remaining = capacity_to_growth(capacity, Group::kWidth) - size;
     }
 
-    template <typename K, typename V>
-    ProbeSequence FlatHashMap<K, V>::probe(u64 hash) {
-        return ProbeSequence(hash_1(hash, control_bytes), capacity);
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    typename FlatHashMap<K, V, Hasher, Equal, Group, Access>::Probe FlatHashMap<K, V, Hasher, Equal, Group, Access>::probe(u64 hash) {
+        return Probe(hash_1(hash, control_bytes), capacity);
     }
 
-    template <typename K, typename V>
-    inline void FlatHashMap<K, V>::init(Allocator* allocator_, u64 initial_capacity) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    inline void FlatHashMap<K, V, Hasher, Equal, Group, Access>::init(Allocator* allocator_, u64 initial_capacity) {
         allocator = allocator_;
         size = capacity = growth_remaining = 0;
-        default_key_value = { (K)-1, (V)0 };
+        default_key_value = {};
+        if constexpr (std::is_arithmetic_v<K> || std::is_pointer_v<K>) {
+            default_key_value.key = (K)-1;
+        }
 
         control_bytes = group_init_empty();
         slots_ = nullptr;
         reserve(initial_capacity < 4 ? 4 : initial_capacity);
     }
 
-    template <typename K, typename V>
-    inline void FlatHashMap<K, V>::shutdown() {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    inline void FlatHashMap<K, V, Hasher, Equal, Group, Access>::shutdown() {
         puffin_free(control_bytes, allocator);
     }
 
-    template<typename K, typename V>
-    FlatHashMapIterator FlatHashMap<K, V>::find(const K& key) {
-        const u64 hash = hash_calculate(key);
-        ProbeSequence sequence = probe(hash);
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    FlatHashMapIterator FlatHashMap<K, V, Hasher, Equal, Group, Access>::find(const K& key) {
+        return find_with_hash(key, Hasher{}(key));
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    template <typename Q>
+    FlatHashMapIterator FlatHashMap<K, V, Hasher, Equal, Group, Access>::find_with_hash(const Q& key, u64 hash) {
+        Probe sequence = probe(hash);
 
         while(true) {
-            const GroupSse2Impl group { control_bytes + sequence.get_offset() };
+            const Group group { control_bytes + sequence.get_offset() };
             const i8 hash2 = hash_2(hash);
             for(int i : group.Match(hash2)) {
                 const KeyValue& key_value = *(slots_ + sequence.get_offset(i));
-                if(key_value.key == key) {
+                if(Equal{}(key_value.key, key)) {
                     return {sequence.get_offset(i)};
                 }
             }
@@ -340,27 +737,70 @@ namespace puffin {
         return { k_iterator_end };
     }
 
-    template<typename K, typename V>
-    void FlatHashMap<K, V>::insert(const K& key, const V& value) {
-        const FindResult find_result = find_or_prepare_insert(key);
+    // Keys in flight in find_batch, enough to cover the latency of a miss
+    static const u32    k_find_batch_size = 16;
+
+    inline void hash_map_prefetch(const void* address) {
+#if defined(PUFFIN_HASH_MAP_SSE2)
+        _mm_prefetch((const char*)address, _MM_HINT_T0);
+#elif defined(__GNUC__)
+        __builtin_prefetch(address);
+#endif
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::find_batch(const K* keys, u32 count, FlatHashMapIterator* out_iterators) {
+        u64 hashes[k_find_batch_size];
+
+        for(u32 batch_start = 0; batch_start < count; batch_start += k_find_batch_size) {
+            const u32 batch_count = count - batch_start < k_find_batch_size ? count - batch_start : k_find_batch_size;
+            const K* batch_keys = keys + batch_start;
+
+            // Hash everything first and prefetch the first group of control bytes of each key
+            for(u32 i = 0; i < batch_count; i++) {
+                hashes[i] = Hasher{}(batch_keys[i]);
+                hash_map_prefetch(control_bytes + probe(hashes[i]).get_offset());
+            }
+
+            // The control bytes are arriving, prefetch the slot of the first candidate
+            for(u32 i = 0; i < batch_count; i++) {
+                const Probe sequence = probe(hashes[i]);
+                const auto match = Group{ control_bytes + sequence.get_offset() }.Match(hash_2(hashes[i]));
+                if(match) {
+                    hash_map_prefetch(slots_ + sequence.get_offset(match.LowestBitSet()));
+                }
+            }
+
+            for(u32 i = 0; i < batch_count; i++) {
+                out_iterators[batch_start + i] = find_with_hash(batch_keys[i], hashes[i]);
+            }
+        }
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::insert(const K& key, const V& value) {
+        insert_with_hash(key, Hasher{}(key), value);
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::insert_with_hash(const K& key, u64 hash, const V& value) {
+        const FindResult find_result = find_or_prepare_insert_with_hash(key, hash);
         if(find_result.free_index) {
             // emplace
-            slots_[find_result.index].key = key;
-            slots_[find_result.index].value = value;
-        } else {
-            // substitute value
-            slots_[find_result.index].value = value;
+            Access::copy(&slots_[find_result.index].key, &key);
         }
+        // or substitute value
+        Access::copy(&slots_[find_result.index].value, &value);
     }
 
-    template<typename K, typename V>
-    void FlatHashMap<K, V>::erase_meta(const FlatHashMapIterator& iterator) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::erase_meta(const FlatHashMapIterator& iterator) {
         --size;
 
         const u64 index = iterator.index;
-        const u64 index_before = (index - GroupSse2Impl::kWidth) & capacity;
-        const auto empty_after = GroupSse2Impl(control_bytes + index).MatchEmpty();
-        const auto empty_before = GroupSse2Impl(control_bytes + index_before).MatchEmpty();
+        const u64 index_before = (index - Group::kWidth) & capacity;
+        const auto empty_after = Group(control_bytes + index).MatchEmpty();
+        const auto empty_before = Group(control_bytes + index_before).MatchEmpty();
 
         // We count how many consecutive non-empties we have to the right and to the
         // left of `it`. If the sum is >= kWidth then there is at least one probe
@@ -371,14 +811,14 @@ namespace puffin {
 
         // Set the control bits
         bool was_never_full = empty_before && empty_after;
-        was_never_full = was_never_full && (zeros < GroupSse2Impl::kWidth);
+        was_never_full = was_never_full && (zeros < Group::kWidth);
 
         set_ctrl(index, was_never_full ? k_control_bitmask_empty : k_control_bitmask_deleted);
         growth_remaining += was_never_full;
     }
 
-    template <typename K, typename V>
-    u32 FlatHashMap<K, V>::remove(const K& key) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    u32 FlatHashMap<K, V, Hasher, Equal, Group, Access>::remove(const K& key) {
         FlatHashMapIterator iterator = find(key);
         if(iterator.index == k_iterator_end){
             return 0;
@@ -388,8 +828,8 @@ namespace puffin {
         return 1;
     }
 
-    template <typename K, typename V>
-    u32 FlatHashMap<K, V>::remove(const FlatHashMapIterator& iterator) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    u32 FlatHashMap<K, V, Hasher, Equal, Group, Access>::remove(const FlatHashMapIterator& iterator) {
         if(iterator.index == k_iterator_end) {
             return 0;
         }
@@ -398,16 +838,20 @@ namespace puffin {
         return 1;
     }
 
-    template <typename K, typename V>
-    FindResult FlatHashMap<K, V>::find_or_prepare_insert(const K& key) {
-        u64 hash = hash_calculate(key);
-        ProbeSequence sequence = probe(hash);
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    FindResult FlatHashMap<K, V, Hasher, Equal, Group, Access>::find_or_prepare_insert(const K& key) {
+        return find_or_prepare_insert_with_hash(key, Hasher{}(key));
+    }
+
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    FindResult FlatHashMap<K, V, Hasher, Equal, Group, Access>::find_or_prepare_insert_with_hash(const K& key, u64 hash) {
+        Probe sequence = probe(hash);
 
         while(true) {
-            const GroupSse2Impl group {control_bytes + sequence.get_offset() };
+            const Group group {control_bytes + sequence.get_offset() };
             for(int i : group.Match(hash_2(hash))) {
                 const KeyValue& key_value = *(slots_ + sequence.get_offset(i));
-                if(key_value.key == key) {
+                if(Equal{}(key_value.key, key)) {
                     return { sequence.get_offset(i), false };
                 }
             }
@@ -419,12 +863,12 @@ namespace puffin {
         return { prepare_insert(hash), true };
     }
 
-    template <typename K, typename V>
-    FindInfo FlatHashMap<K, V>::find_first_non_full(u64 hash) {
-        ProbeSequence sequence = probe(hash);
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    FindInfo FlatHashMap<K, V, Hasher, Equal, Group, Access>::find_first_non_full(u64 hash) {
+        Probe sequence = probe(hash);
 
         while(true) {
-            const GroupSse2Impl group {control_bytes + sequence.get_offset()};
+            const Group group {control_bytes + sequence.get_offset()};
             auto mask = group.MatchEmptyOrDeleted();
 
             if(mask) {
@@ -437,8 +881,8 @@ namespace puffin {
         return FindInfo();
     }
 
-    template <typename K, typename V>
-    u64 FlatHashMap<K, V>::prepare_insert(u64 hash) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    u64 FlatHashMap<K, V, Hasher, Equal, Group, Access>::prepare_insert(u64 hash) {
         FindInfo find_info = find_first_non_full(hash);
         if(growth_remaining == 0 && !control_is_deleted(control_bytes[find_info.offset])) {
             rehash_and_grow_if_necessary();
@@ -451,11 +895,11 @@ namespace puffin {
         return find_info.offset;
     }
 
-    template <typename K, typename V>
-    void FlatHashMap<K, V>::rehash_and_grow_if_necessary() {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::rehash_and_grow_if_necessary() {
         if(capacity == 0) {
             resize(1);
-        } else if(size <= capacity_to_growth(capacity) / 2) {
+        } else if(size <= capacity_to_growth(capacity, Group::kWidth) / 2) {
             // Squash DELETED without growing if there is enough capacity.
             drop_deletes_without_resize();
         } else {
@@ -464,8 +908,8 @@ namespace puffin {
         }
     }
 
-    template <typename K, typename V>
-    void FlatHashMap<K, V>::drop_deletes_without_resize() {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::drop_deletes_without_resize() {
         // Algorithm
         //  - mark all DELETED slots as empty
         //  - mark all FULL slots as DELETED
@@ -484,6 +928,8 @@ namespace puffin {
         //          repeat procedure for current slot w/ moved from element (target)
         //
 
+        ConvertDeletedToEmptyAndFullToDeleted<Group, Access>(control_bytes, capacity);
+
         alignas(KeyValue) unsigned char raw[sizeof(KeyValue)];
         size_t total_probe_length = 0;
         KeyValue* slot = reinterpret_cast<KeyValue*>(&raw);
@@ -493,7 +939,7 @@ namespace puffin {
             }
 
             const KeyValue* current_slot = slots_ + i;
-            size_t hash = hash_calculate(current_slot->key);
+            size_t hash = Hasher{}(current_slot->key);
             auto target = find_first_non_full(hash);
             size_t new_i = target.offset;
             total_probe_length += target.probe_length;
@@ -501,7 +947,7 @@ namespace puffin {
             // Verify if the old and new i fall within the same group wrt the hash
             // If they do, we don't need to move the ojbect as it falls already in the best probe
             const auto probe_index = [&](size_t pos) {
-                return ((pos - probe(hash).get_offset()) & capacity) / GroupSse2Impl::kWidth;
+                return ((pos - probe(hash).get_offset()) & capacity) / Group::kWidth;
             };
 
             // Element doesn't move
@@ -514,15 +960,15 @@ namespace puffin {
                 // Transfer element to the empty slot
                 // set_ctrl poisons/unpoisons the slots so we have to call it at the right time
                 set_ctrl(new_i, hash_2(hash));
-                memcpy(slots_ + new_i, slots_ + i, sizeof(KeyValue));
+                Access::copy(slots_ + new_i, slots_ + i);
                 set_ctrl(i, k_control_bitmask_empty);
             } else {
                 set_ctrl(new_i, hash_2(hash));
                 // Until we are done rehashing, DELETED marks previously FULL slots.
                 // Swap i and new_i elements
-                memcpy(slot, slots_ + i, sizeof(KeyValue));
-                memcpy(slots_ + i, slots_ + new_i, sizeof(KeyValue));
-                memcpy(slots_ + new_i, slot, sizeof(KeyValue));
+                Access::copy(slot, slots_ + i);
+                Access::copy(slots_ + i, slots_ + new_i);
+                Access::copy(slots_ + new_i, slot);
                 i--;
             }
         }
@@ -530,29 +976,35 @@ namespace puffin {
         reset_growth_remaining();
     }
 
-    template <typename K, typename V>
-    u64 FlatHashMap<K, V>::calculate_size(u64 new_capacity) {
-        return (new_capacity + GroupSse2Impl::kWidth + new_capacity * (sizeof(KeyValue)));
+    // Slots start aligned after the control bytes
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group>
+    inline u64 hash_map_slots_offset(u64 capacity) {
+        return memory_align(capacity + Group::kWidth, alignof(FlatHashSlot<K, V>));
     }
 
-    template <typename K, typename V>
-    void FlatHashMap<K, V>::initialize_slots() {
-        char* new_memory = (char*) puffin_alloc(calculate_size(capacity), allocator);
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    u64 FlatHashMap<K, V, Hasher, Equal, Group, Access>::calculate_size(u64 new_capacity) {
+        return hash_map_slots_offset<K, V, Hasher, Equal, Group>(new_capacity) + new_capacity * sizeof(KeyValue);
+    }
 
-        control_bytes = reinterpret_cast<i8*>(new_memory);
-        slots_ = reinterpret_cast<KeyValue*>(new_memory + capacity + GroupSse2Impl::kWidth);
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::initialize_slots() {
+        char* new_memory = (char*) allocator->allocate(calculate_size(capacity), alignof(KeyValue) > 16 ? alignof(KeyValue) : 16, __FILE__, __LINE__);
+
+        Access::store(&control_bytes, reinterpret_cast<i8*>(new_memory));
+        Access::store(&slots_, reinterpret_cast<KeyValue*>(new_memory + hash_map_slots_offset<K, V, Hasher, Equal, Group>(capacity)));
 
         reset_ctrl();
         reset_growth_remaining();
     }
 
-    template <typename K, typename V>
-    void FlatHashMap<K, V>::resize(u64 new_capacity) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::resize(u64 new_capacity) {
         i8* old_control_bytes = control_bytes;
         KeyValue* old_slots = slots_;
         const u64 old_capacity = capacity;
 
-        capacity = new_capacity;
+        Access::store(&capacity, new_capacity);
 
         initialize_slots();
 
@@ -560,7 +1012,7 @@ namespace puffin {
         for(size_t i = 0; i != old_capacity; i++) {
             if(control_is_full(old_control_bytes[i])) {
                 const KeyValue* old_value = old_slots + i;
-                u64 hash = hash_calculate(old_value->key);
+                u64 hash = Hasher{}(old_value->key);
 
                 FindInfo find_info = find_first_non_full(hash);
 
@@ -569,7 +1021,7 @@ namespace puffin {
 
                 set_ctrl(new_i, hash_2(hash));
 
-                puffin::memory_copy(slots_ + new_i, old_slots + i, sizeof(KeyValue));
+                Access::copy(slots_ + new_i, old_value);
             }
         }
 
@@ -580,15 +1032,15 @@ namespace puffin {
 
     // Sets the control bytes, and if 'i <Group::kWdith-1>', set the cloned byte
     // at the end too
-    template<typename K, typename V>
-    void FlatHashMap<K, V>::set_ctrl(u64 i, i8 h) {
-        control_bytes[i] = h;
-        constexpr size_t kClonedBytes = GroupSse2Impl::kWidth - 1;
-        control_bytes[((i - kClonedBytes) & capacity) + (kClonedBytes & capacity)] = h;
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::set_ctrl(u64 i, i8 h) {
+        Access::store(control_bytes + i, h);
+        constexpr size_t kClonedBytes = Group::kWidth - 1;
+        Access::store(control_bytes + ((i - kClonedBytes) & capacity) + (kClonedBytes & capacity), h);
     }
 
-    template <typename K, typename V>
-    V& FlatHashMap<K, V>::get(const K& key) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    V& FlatHashMap<K, V, Hasher, Equal, Group, Access>::get(const K& key) {
         FlatHashMapIterator iterator = find(key);
         if(iterator.index != k_iterator_end) {
             return slots_[iterator.index].value;
@@ -596,16 +1048,16 @@ namespace puffin {
         return default_key_value.value;
     }
 
-    template<typename K, typename V>
-    V& FlatHashMap<K, V>::get(const FlatHashMapIterator& iterator) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    V& FlatHashMap<K, V, Hasher, Equal, Group, Access>::get(const FlatHashMapIterator& iterator) {
         if(iterator.index != k_iterator_end) {
             return slots_[iterator.index].value;
         }
         return default_key_value.value;
     }
 
-    template <typename K, typename V>
-    typename FlatHashMap<K, V>::KeyValue& FlatHashMap<K, V>::get_structure(const K& key) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    typename FlatHashMap<K, V, Hasher, Equal, Group, Access>::KeyValue& FlatHashMap<K, V, Hasher, Equal, Group, Access>::get_structure(const K& key) {
         FlatHashMapIterator iterator = find(key);
         if(iterator.index != k_iterator_end) {
             return slots_[iterator.index];
@@ -613,35 +1065,35 @@ namespace puffin {
         return default_key_value;
     }
 
-    template <typename K, typename V>
-    typename FlatHashMap<K, V>::KeyValue& FlatHashMap<K,V>::get_structure(const FlatHashMapIterator& iterator) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    typename FlatHashMap<K, V, Hasher, Equal, Group, Access>::KeyValue& FlatHashMap<K, V, Hasher, Equal, Group, Access>::get_structure(const FlatHashMapIterator& iterator) {
         return slots_[iterator.index];
     }
 
-    template<typename K, typename V>
-    inline void FlatHashMap<K, V>::set_default_value(const V& value) {
-        default_key_value.value = value;
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    inline void FlatHashMap<K, V, Hasher, Equal, Group, Access>::set_default_value(const V& value) {
+        Access::copy(&default_key_value.value, &value);
     }
 
-    template<typename K, typename V>
-    FlatHashMapIterator FlatHashMap<K, V>::iterator_begin() {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    FlatHashMapIterator FlatHashMap<K, V, Hasher, Equal, Group, Access>::iterator_begin() {
         FlatHashMapIterator it{0};
         iterator_skip_empty_or_deleted(it);
         return it;
     }
 
-    template<typename K, typename V>
-    void FlatHashMap<K, V>::iterator_advance(FlatHashMapIterator& iterator) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    void FlatHashMap<K, V, Hasher, Equal, Group, Access>::iterator_advance(FlatHashMapIterator& iterator) {
         iterator.index++;
         iterator_skip_empty_or_deleted(iterator);
     }
 
-    template<typename K, typename V>
-    inline void FlatHashMap<K, V>::iterator_skip_empty_or_deleted(FlatHashMapIterator& iterator) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    inline void FlatHashMap<K, V, Hasher, Equal, Group, Access>::iterator_skip_empty_or_deleted(FlatHashMapIterator& iterator) {
         i8* ctrl = control_bytes + iterator.index;
 
         while(control_is_empty_or_deleted(*ctrl)) {
-            u32 shift = GroupSse2Impl{ctrl}.CountLeadingEmptyOrDeleted();
+            u32 shift = Group{ctrl}.CountLeadingEmptyOrDeleted();
             ctrl += shift;
             iterator.index += shift;
         }
@@ -650,48 +1102,120 @@ namespace puffin {
         }
     }
 
-    template<typename K, typename V>
-    inline void FlatHashMap<K, V>::clear() {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    inline void FlatHashMap<K, V, Hasher, Equal, Group, Access>::clear() {
         size = 0;
         reset_ctrl();
         reset_growth_remaining();
     }
 
-    template<typename K, typename V>
-    inline void FlatHashMap<K, V>::reserve(u64 new_size) {
+    template <typename K, typename V, typename Hasher, typename Equal, typename Group, typename Access>
+    inline void FlatHashMap<K, V, Hasher, Equal, Group, Access>::reserve(u64 new_size) {
         if(new_size > size + growth_remaining) {
-            size_t m = capacity_growth_to_lower_bound(new_size);
+            size_t m = capacity_growth_to_lower_bound(new_size, Group::kWidth);
             resize(capacity_normalize(m));
         }
     }
 
+    // FlatHashSet
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline void FlatHashSet<K, Hasher, Equal, Group>::init(Allocator* allocator, u64 initial_capacity) {
+        map.init(allocator, initial_capacity);
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline void FlatHashSet<K, Hasher, Equal, Group>::shutdown() {
+        map.shutdown();
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline bool FlatHashSet<K, Hasher, Equal, Group>::insert(const K& key) {
+        return insert_with_hash(key, Hasher{}(key));
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline bool FlatHashSet<K, Hasher, Equal, Group>::insert_with_hash(const K& key, u64 hash) {
+        const FindResult find_result = map.find_or_prepare_insert_with_hash(key, hash);
+        if(find_result.free_index) {
+            map.slots_[find_result.index].key = key;
+        }
+        return find_result.free_index;
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline bool FlatHashSet<K, Hasher, Equal, Group>::contains(const K& key) {
+        return map.find(key).is_valid();
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    template <typename Q>
+    inline bool FlatHashSet<K, Hasher, Equal, Group>::contains_with_hash(const Q& key, u64 hash) {
+        return map.find_with_hash(key, hash).is_valid();
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline u32 FlatHashSet<K, Hasher, Equal, Group>::remove(const K& key) {
+        return map.remove(key);
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline const K& FlatHashSet<K, Hasher, Equal, Group>::get(const FlatHashMapIterator& iterator) {
+        return map.slots_[iterator.index].key;
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline FlatHashMapIterator FlatHashSet<K, Hasher, Equal, Group>::iterator_begin() {
+        return map.iterator_begin();
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline void FlatHashSet<K, Hasher, Equal, Group>::iterator_advance(FlatHashMapIterator& iterator) {
+        map.iterator_advance(iterator);
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline void FlatHashSet<K, Hasher, Equal, Group>::clear() {
+        map.clear();
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline void FlatHashSet<K, Hasher, Equal, Group>::reserve(u64 new_size) {
+        map.reserve(new_size);
+    }
+
+    template <typename K, typename Hasher, typename Equal, typename Group>
+    inline u64 FlatHashSet<K, Hasher, Equal, Group>::get_size() const {
+        return map.size;
+    }
+
     // Capacity ///
 
     // Checks n is a power of 2 minus 1
     // power of 2 minus 1 size is helpful with wraparound
     bool capacity_is_valid(size_t n)        { return ((n + 1) & n) == 0 && n > 0; }
 
-    inline u64 lzcnt_soft(u64 n) {
-        unsigned long index = 0;
-        _BitScanReverse64(&index, n);
-        u64 cnt = index ^ 63;
-        return cnt;
-    }
-
     // Rounds up capacity to the next power of 2 minus 1, with a minimum of 1
-    u64 capacity_normalize ( u64 n )        { return n ? ~u64{} >> lzcnt_soft(n) : 1; }
-
-    u64 capacity_to_growth (u64 capacity)   { return capacity - capacity / 8; }
-
+    u64 capacity_normalize ( u64 n )        { return n ? ~u64{} >> leading_zeroes_u64(n) : 1; }
 
+    // A table of 7 read by 8-wide groups only sees its own bytes and their clones, one must stay empty
+    u64 capacity_to_growth (u64 capacity, u64 group_width) {
+        if(group_width == 8 && capacity == 7) {
+            return 6;
+        }
+        return capacity - capacity / 8;
+    }
 
-    u64 capacity_growth_to_lower_bound(u64 growth) {
+    u64 capacity_growth_to_lower_bound(u64 growth, u64 group_width) {
+        if(group_width == 8 && growth == 7) {
+            return 8;
+        }
         return growth + static_cast<u64>((static_cast<i64>(growth) - 1) / 7);
     }
 
     // Grouping: implementation /////////
     inline i8* group_init_empty() {
-        alignas(16) static constexpr i8 empty_group[] = {
+        // As wide as the widest group
+        alignas(32) static constexpr i8 empty_group[] = {
                 k_control_bitmask_sentinel, k_control_bitmask_empty,
                 k_control_bitmask_empty, k_control_bitmask_empty,
                 k_control_bitmask_empty, k_control_bitmask_empty,
@@ -700,32 +1224,45 @@ namespace puffin {
                 k_control_bitmask_empty, k_control_bitmask_empty,
                 k_control_bitmask_empty, k_control_bitmask_empty,
                 k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
+                k_control_bitmask_empty, k_control_bitmask_empty,
         };
         return const_cast<i8*>(empty_group);
     }
 
     // Probing: implementation ///////
-    inline ProbeSequence::ProbeSequence(u64 hash_, u64 mask_) {
+    template <u64 Width>
+    inline ProbeSequence<Width>::ProbeSequence(u64 hash_, u64 mask_) {
         mask = mask_;
         offset = hash_ & mask_;
     }
 
-    inline u64 ProbeSequence::get_offset() const {
+    template <u64 Width>
+    inline u64 ProbeSequence<Width>::get_offset() const {
         return offset;
     }
 
-    inline u64 ProbeSequence::get_offset(u64 i) const {
+    template <u64 Width>
+    inline u64 ProbeSequence<Width>::get_offset(u64 i) const {
         return (offset + i) & mask;
     }
 
-    inline u64 ProbeSequence::get_index() const {
+    template <u64 Width>
+    inline u64 ProbeSequence<Width>::get_index() const {
         return index;
     }
 
-    inline void ProbeSequence::next() {
-        index += k_width;
+    template <u64 Width>
+    inline void ProbeSequence<Width>::next() {
+        index += Width;
         offset += index;
         offset &= mask;
     }
 
-}
+}
\ No newline at end of file
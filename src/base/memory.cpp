@@ -3,13 +3,30 @@
 //
 
 #include "memory.hpp"
+#include "memory_tracking.hpp"
+#include "array.hpp"
+#include "bit.hpp"
+#include "log.hpp"
+#include "time.hpp"
 
 #include "tlsf.h"
 #include "imgui.h"
 
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#if defined(_MSC_VER)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 namespace puffin {
 
@@ -59,11 +76,93 @@ namespace puffin {
         return (size + alignment_mask) & ~alignment_mask;
     }
 
+    // VIRTUAL MEMORY
+
+    // Commits happen in big steps to keep system calls rare, huge pages are committed whole
+    static const size_t k_virtual_commit_granularity = puffin_kilo(64);
+    static const size_t k_virtual_huge_page_size = puffin_mega(2);
+
+    void* memory_reserve(size_t size, bool huge_pages) {
+#if defined(_MSC_VER)
+        return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        if(!huge_pages) {
+            void* address = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            return address == MAP_FAILED ? nullptr : address;
+        }
+
+        // Transparent huge pages need a 2MB aligned range, reserve more and trim both ends
+        const size_t padded_size = size + k_virtual_huge_page_size;
+        void* padded_address = mmap(nullptr, padded_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(padded_address == MAP_FAILED) {
+            return nullptr;
+        }
+
+        u8* start = (u8*)padded_address;
+        u8* aligned_start = (u8*)memory_align((size_t)start, k_virtual_huge_page_size);
+        u8* padded_end = start + padded_size;
+        u8* aligned_end = aligned_start + size;
+
+        if(aligned_start > start) {
+            munmap(start, aligned_start - start);
+        }
+        if(padded_end > aligned_end) {
+            munmap(aligned_end, padded_end - aligned_end);
+        }
+
+        madvise(aligned_start, size, MADV_HUGEPAGE);
+        return aligned_start;
+#endif
+    }
+
+    bool memory_commit(void* address, size_t size) {
+#if defined(_MSC_VER)
+        return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    }
+
+    void memory_release(void* address, size_t size) {
+#if defined(_MSC_VER)
+        VirtualFree(address, 0, MEM_RELEASE);
+#else
+        munmap(address, size);
+#endif
+    }
+
+    static size_t virtual_reserve_size(size_t size, bool huge_pages) {
+        return memory_align(size, huge_pages ? k_virtual_huge_page_size : k_virtual_commit_granularity);
+    }
+
+    // Grows the committed part of a reservation so that it covers required_size.
+    // Returns false if the reservation is exhausted or the system is out of memory.
+    static bool virtual_commit_to(u8* memory, size_t required_size, size_t total_size, bool huge_pages, size_t& committed_size) {
+        if(required_size <= committed_size) {
+            return true;
+        }
+
+        if(required_size > total_size) {
+            return false;
+        }
+
+        size_t new_committed_size = memory_align(required_size, huge_pages ? k_virtual_huge_page_size : k_virtual_commit_granularity);
+        new_committed_size = new_committed_size < total_size ? new_committed_size : total_size;
+
+        if(!memory_commit(memory + committed_size, new_committed_size - committed_size)) {
+            return false;
+        }
+
+        committed_size = new_committed_size;
+        return true;
+    }
+
     // MEMORY SERVICE
     void MemoryService::init(void* configuration) {
         std::cout << "Memory Service Init" << std::endl;
         MemoryServiceConfiguration* config = (MemoryServiceConfiguration*) configuration;
-        system_allocator.init(config ? config->maximum_dynamic_size : s_size);
+        system_allocator.init(config ? config->maximum_dynamic_size : s_size, config ? config->thread_safe : false);
+        puffin_memory_tracking_register_allocator(&system_allocator, "system");
     }
 
     void MemoryService::shutdown() {
@@ -74,32 +173,435 @@ namespace puffin {
     void MemoryService::imgui_draw() {
         if(ImGui::Begin("Memory Service")) {
             system_allocator.debug_ui();
+            puffin_memory_tracking_imgui_draw();
         }
         ImGui::End();
     }
 
+    // Allocation benchmark //////////////////////////////////////
+
+    static const u32            k_heap_benchmark_iterations = 500000;
+    static const u32            k_heap_benchmark_live_blocks = 256;
+
+    struct HeapBenchmarkContext {
+        HeapAllocator*          heap;
+        std::mutex*             heap_mutex;     // Serializes a plain heap, nullptr with thread caches
+        std::atomic<void*>*     mailboxes;      // One per thread, blocks are freed by the next thread
+        u32                     thread_count;
+    };
+
+    static void* heap_benchmark_allocate(HeapBenchmarkContext& context, size_t size) {
+        if(context.heap_mutex) {
+            std::lock_guard<std::mutex> lock(*context.heap_mutex);
+            return puffin_alloc(size, context.heap);
+        }
+        return puffin_alloc(size, context.heap);
+    }
+
+    static void heap_benchmark_free(HeapBenchmarkContext& context, void* pointer) {
+        if(pointer == nullptr) {
+            return;
+        }
+
+        if(context.heap_mutex) {
+            std::lock_guard<std::mutex> lock(*context.heap_mutex);
+            puffin_free(pointer, context.heap);
+            return;
+        }
+        puffin_free(pointer, context.heap);
+    }
+
+    static void heap_benchmark_thread(HeapBenchmarkContext* context, u32 thread_index) {
+        void* live_blocks[k_heap_benchmark_live_blocks] = {};
+        u32 seed = 0x9e3779b9u * (thread_index + 1);
+
+        std::atomic<void*>& outgoing = context->mailboxes[thread_index];
+        std::atomic<void*>& incoming = context->mailboxes[(thread_index + context->thread_count - 1) % context->thread_count];
+
+        for(u32 i = 0; i < k_heap_benchmark_iterations; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+
+            const u32 slot = seed % k_heap_benchmark_live_blocks;
+            heap_benchmark_free(*context, live_blocks[slot]);
+            live_blocks[slot] = nullptr;
+
+            // Mostly small blocks, with the odd one too big for the thread caches
+            const size_t size = (seed & 1023) == 0 ? puffin_kilo(256) : 16 + (seed >> 10) % 1024;
+            u8* block = (u8*)heap_benchmark_allocate(*context, size);
+            block[0] = block[size - 1] = (u8)i;
+
+            if((i & 15) == 0) {
+                // Cross thread frees
+                heap_benchmark_free(*context, outgoing.exchange(block));
+                heap_benchmark_free(*context, incoming.exchange(nullptr));
+            } else {
+                live_blocks[slot] = block;
+            }
+        }
+
+        for(u32 i = 0; i < k_heap_benchmark_live_blocks; i++) {
+            heap_benchmark_free(*context, live_blocks[i]);
+        }
+    }
+
     void MemoryService::test() {
-        // No tests currently
+        const u32 hardware_threads = std::thread::hardware_concurrency();
+        // Threads past the hardware ones would only measure time slicing
+        const u32 max_threads = hardware_threads < 32 ? (hardware_threads ? hardware_threads : 1) : 32;
+
+        std::cout << "Heap allocator benchmark, " << k_heap_benchmark_iterations << " allocations per thread, "
+                  << hardware_threads << " hardware threads" << std::endl;
+
+        for(u32 thread_safe = 0; thread_safe < 2; thread_safe++) {
+            HeapAllocator heap;
+            heap.init(puffin_mega(512), thread_safe);
+
+            std::mutex heap_mutex;
+            std::atomic<void*> mailboxes[32];
+
+            std::thread threads[32];
+
+            for(u32 thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+                for(u32 i = 0; i < thread_count; i++) {
+                    mailboxes[i].store(nullptr, std::memory_order_relaxed);
+                }
+
+                HeapBenchmarkContext context{ &heap, thread_safe ? nullptr : &heap_mutex, mailboxes, thread_count };
+
+                const i64 start = time_now();
+                for(u32 i = 0; i < thread_count; i++) {
+                    threads[i] = std::thread(heap_benchmark_thread, &context, i);
+                }
+                for(u32 i = 0; i < thread_count; i++) {
+                    threads[i].join();
+                }
+                const f64 elapsed_seconds = time_from_seconds(start);
+
+                for(u32 i = 0; i < thread_count; i++) {
+                    heap_benchmark_free(context, mailboxes[i].load(std::memory_order_relaxed));
+                }
+
+                // An allocation and a free per iteration
+                const f64 operations = 2.0 * k_heap_benchmark_iterations * thread_count;
+                p_print("\t%s %2u threads: %7.1f M operations/s\n", thread_safe ? "thread caches" : "locked heap  ",
+                        thread_count, operations / elapsed_seconds / 1000000.0);
+            }
+
+            // Reports any block that was not freed
+            heap.shutdown();
+        }
+
+        // SmallArray stays off the heap until it outgrows its inline storage
+        {
+            HeapAllocator heap;
+            heap.init(puffin_mega(1));
+
+            SmallArray<u32, 8> small_array;
+            small_array.init(&heap, 4);
+
+            const u64 allocation_start = heap.get_allocation_count();
+            for(u32 i = 0; i < 8; i++) {
+                small_array.push(i);
+            }
+            const u64 inline_allocations = heap.get_allocation_count() - allocation_start;
+
+            small_array.push(8);
+            const u64 spill_allocations = heap.get_allocation_count() - allocation_start - inline_allocations;
+
+            bool contents_valid = !small_array.is_inline() && small_array.size == 9;
+            for(u32 i = 0; i < small_array.size; i++) {
+                contents_valid = contents_valid && small_array[i] == i;
+            }
+
+            p_print("SmallArray: %llu allocations inline, %llu on spill, contents %s\n", inline_allocations,
+                    spill_allocations, contents_valid ? "valid" : "INVALID");
+
+            small_array.shutdown();
+            heap.shutdown();
+        }
+    }
+
+    // HEAP THREAD CACHES
+    //
+    // In thread safe mode every thread allocates from a TLSF instance of its own, whose pools are chunks
+    // taken from the shared TLSF pool. The shared pool is locked only when a cache needs a new chunk and for
+    // blocks too big to be cached.
+    // Every block is preceded by a header naming the cache it comes from. Blocks freed by another thread are
+    // pushed on the remote free list of their cache and released by the owner on its next allocation.
+
+    static const u32        k_heap_max_threads = 64;
+    static const u32        k_heap_invalid_thread = u32_max;
+    static const size_t     k_heap_cache_chunk_size = puffin_mega(1);
+    static const size_t     k_heap_cache_max_block_size = puffin_kilo(128);
+
+    struct HeapThreadCache;
+
+    struct HeapBlockHeader {
+        union {
+            HeapThreadCache*    owner;              // nullptr for blocks of the shared pool
+            HeapBlockHeader*    next_remote_free;   // Replaces the owner while the block waits on the remote free list
+        };
+        u32                     offset;             // From the TLSF block to the user memory
+        u32                     padding;
+    };
+
+    static const size_t     k_heap_block_header_size = sizeof(HeapBlockHeader);
+    static_assert(k_heap_block_header_size == 16, "The block header must keep user memory 16 bytes aligned");
+
+    struct HeapCacheChunk {
+        HeapCacheChunk*         next;
+        pool_t                  pool;
+    };
+
+    // Counters are only written by the owner thread, atomics so that statistics can read them from any thread
+    static void heap_counter_add(std::atomic<size_t>& counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void heap_counter_subtract(std::atomic<size_t>& counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+    }
+
+    struct HeapThreadCache {
+        void*                   tlsf_handle;
+        HeapCacheChunk*         chunks;
+        std::atomic<size_t>     allocated_size;
+        std::atomic<size_t>     allocation_count;
+
+        // Written by every thread, kept away from the owner data
+        alignas(64) std::atomic<HeapBlockHeader*> remote_free_head;
+    };
+
+    struct HeapThreadCaches {
+        std::mutex              shared_mutex;
+        std::atomic<HeapThreadCache*> caches[k_heap_max_threads];     // Published once created
+    };
+
+    // Thread slots are shared by all heap allocators. A slot is given back when its thread exits, the next
+    // thread taking it inherits its caches together with the pending remote frees.
+    static std::atomic<u64>     s_heap_thread_slots{ 0 };
+
+    struct HeapThreadSlot {
+        HeapThreadSlot() {
+            u64 slots = s_heap_thread_slots.load(std::memory_order_relaxed);
+            do {
+                if(slots == u64_max) {
+                    // Threads past the limit always use the shared pool
+                    index = k_heap_invalid_thread;
+                    return;
+                }
+                index = (u32)trailing_zeroes_u64(~slots);
+            } while(!s_heap_thread_slots.compare_exchange_weak(slots, slots | (1ull << index), std::memory_order_acquire,
+                                                                std::memory_order_relaxed));
+        }
+
+        ~HeapThreadSlot() {
+            if(index != k_heap_invalid_thread) {
+                s_heap_thread_slots.fetch_and(~(1ull << index), std::memory_order_release);
+            }
+        }
+
+        u32                     index;
+    };
+
+    static thread_local HeapThreadSlot t_heap_thread_slot;
+
+    static HeapThreadCache* heap_cache_create(void* shared_tlsf) {
+        void* cache_memory = tlsf_memalign(shared_tlsf, 64, sizeof(HeapThreadCache));
+        void* control_memory = tlsf_memalign(shared_tlsf, 64, tlsf_size());
+        if(cache_memory == nullptr || control_memory == nullptr) {
+            tlsf_free(shared_tlsf, cache_memory);
+            tlsf_free(shared_tlsf, control_memory);
+            return nullptr;
+        }
+
+        HeapThreadCache* cache = new(cache_memory) HeapThreadCache();
+        cache->tlsf_handle = tlsf_create(control_memory);
+        cache->chunks = nullptr;
+        cache->allocated_size.store(0, std::memory_order_relaxed);
+        cache->allocation_count.store(0, std::memory_order_relaxed);
+        cache->remote_free_head.store(nullptr, std::memory_order_relaxed);
+        return cache;
+    }
+
+    // Cached blocks are capped well below the chunk size, a new chunk always fits the block that needed it
+    static bool heap_cache_grow(HeapAllocator& heap, HeapThreadCache* cache) {
+        u8* chunk_memory;
+        {
+            std::lock_guard<std::mutex> lock(heap.thread_caches->shared_mutex);
+            chunk_memory = (u8*)tlsf_memalign(heap.tlsf_handle, 64, sizeof(HeapCacheChunk) + k_heap_cache_chunk_size);
+        }
+
+        if(chunk_memory == nullptr) {
+            return false;
+        }
+
+        HeapCacheChunk* chunk = (HeapCacheChunk*)chunk_memory;
+        chunk->pool = tlsf_add_pool(cache->tlsf_handle, chunk_memory + sizeof(HeapCacheChunk), k_heap_cache_chunk_size);
+        chunk->next = cache->chunks;
+        cache->chunks = chunk;
+        return chunk->pool != nullptr;
+    }
+
+    static void heap_cache_free_remote(HeapThreadCache* cache) {
+        HeapBlockHeader* header = cache->remote_free_head.exchange(nullptr, std::memory_order_acquire);
+        while(header) {
+            HeapBlockHeader* next = header->next_remote_free;
+
+            u8* block = (u8*)(header + 1) - header->offset;
+            heap_counter_subtract(cache->allocated_size, tlsf_block_size(block));
+            tlsf_free(cache->tlsf_handle, block);
+
+            header = next;
+        }
+    }
+
+    static void heap_cache_destroy(HeapAllocator& heap, HeapThreadCache* cache, MemoryStatistics& stats) {
+        heap_cache_free_remote(cache);
+
+        // Report leaks, then give everything back so the shared pool walk only shows its own blocks
+        HeapCacheChunk* chunk = cache->chunks;
+        while(chunk) {
+            HeapCacheChunk* next = chunk->next;
+            tlsf_walk_pool(chunk->pool, exit_walker, (void*) &stats);
+            tlsf_free(heap.tlsf_handle, chunk);
+            chunk = next;
+        }
+
+        tlsf_destroy(cache->tlsf_handle);
+        tlsf_free(heap.tlsf_handle, cache->tlsf_handle);
+
+        cache->~HeapThreadCache();
+        tlsf_free(heap.tlsf_handle, cache);
+    }
+
+    static void* heap_allocate_thread_safe(HeapAllocator& heap, size_t size, size_t alignment) {
+        // The header sits right before the user memory and keeps its alignment
+        const size_t offset = alignment > k_heap_block_header_size ? alignment : k_heap_block_header_size;
+        const size_t block_size = size + offset;
+        const u32 thread_index = t_heap_thread_slot.index;
+
+        HeapThreadCache* cache = nullptr;
+        u8* block = nullptr;
+
+        if(thread_index != k_heap_invalid_thread && block_size <= k_heap_cache_max_block_size) {
+            std::atomic<HeapThreadCache*>& thread_cache = heap.thread_caches->caches[thread_index];
+            cache = thread_cache.load(std::memory_order_relaxed);
+            if(cache == nullptr) {
+                std::lock_guard<std::mutex> lock(heap.thread_caches->shared_mutex);
+                cache = heap_cache_create(heap.tlsf_handle);
+                thread_cache.store(cache, std::memory_order_release);
+            }
+        }
+
+        if(cache) {
+            if(cache->remote_free_head.load(std::memory_order_relaxed) != nullptr) {
+                heap_cache_free_remote(cache);
+            }
+
+            block = (u8*)tlsf_memalign(cache->tlsf_handle, offset, block_size);
+            if(block == nullptr && heap_cache_grow(heap, cache)) {
+                block = (u8*)tlsf_memalign(cache->tlsf_handle, offset, block_size);
+            }
+
+            if(block) {
+                heap_counter_add(cache->allocated_size, tlsf_block_size(block));
+                heap_counter_add(cache->allocation_count, 1);
+            } else {
+                cache = nullptr;
+            }
+        }
+
+        if(block == nullptr) {
+            std::lock_guard<std::mutex> lock(heap.thread_caches->shared_mutex);
+            block = (u8*)tlsf_memalign(heap.tlsf_handle, offset, block_size);
+            if(block == nullptr) {
+                return nullptr;
+            }
+            heap.allocated_size += tlsf_block_size(block);
+            heap.allocation_count++;
+        }
+
+        HeapBlockHeader* header = (HeapBlockHeader*)(block + offset) - 1;
+        header->owner = cache;
+        header->offset = (u32)offset;
+        return block + offset;
+    }
+
+    static void heap_deallocate_thread_safe(HeapAllocator& heap, void* pointer) {
+        if(pointer == nullptr) {
+            return;
+        }
+
+        HeapBlockHeader* header = (HeapBlockHeader*)pointer - 1;
+        HeapThreadCache* owner = header->owner;
+        u8* block = (u8*)pointer - header->offset;
+
+        if(owner == nullptr) {
+            std::lock_guard<std::mutex> lock(heap.thread_caches->shared_mutex);
+            heap.allocated_size -= tlsf_block_size(block);
+            tlsf_free(heap.tlsf_handle, block);
+            return;
+        }
+
+        const u32 thread_index = t_heap_thread_slot.index;
+        if(thread_index != k_heap_invalid_thread && heap.thread_caches->caches[thread_index].load(std::memory_order_relaxed) == owner) {
+            heap_counter_subtract(owner->allocated_size, tlsf_block_size(block));
+            tlsf_free(owner->tlsf_handle, block);
+            return;
+        }
+
+        // The block belongs to another thread cache, hand it over
+        HeapBlockHeader* head = owner->remote_free_head.load(std::memory_order_relaxed);
+        do {
+            header->next_remote_free = head;
+        } while(!owner->remote_free_head.compare_exchange_weak(head, header, std::memory_order_release,
+                                                              std::memory_order_relaxed));
     }
 
     // HEAP ALLOCATOR
 
     HeapAllocator::~HeapAllocator() {}
 
-    void HeapAllocator::init(size_t size) {
+    void HeapAllocator::init(size_t size, bool thread_safe) {
         // Allocate
         memory = malloc(size);
         max_size = size;
         allocated_size = 0;
+        allocation_count = 0;
 
         tlsf_handle = tlsf_create_with_pool(memory, size);
 
-        std::cout << "HeapAllocator of size [" << size << "] created" << std::endl;
+        if(thread_safe) {
+            void* caches_memory = tlsf_memalign(tlsf_handle, 64, sizeof(HeapThreadCaches));
+            thread_caches = new(caches_memory) HeapThreadCaches();
+            for(u32 i = 0; i < k_heap_max_threads; i++) {
+                thread_caches->caches[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        std::cout << "HeapAllocator of size [" << size << "] created" << (thread_safe ? " with thread caches" : "") << std::endl;
     }
 
     void HeapAllocator::shutdown() {
         // Check for memory at application exit
         MemoryStatistics stats {0, max_size};
+
+        if(thread_caches) {
+            for(u32 i = 0; i < k_heap_max_threads; i++) {
+                HeapThreadCache* cache = thread_caches->caches[i].load(std::memory_order_acquire);
+                if(cache) {
+                    heap_cache_destroy(*this, cache, stats);
+                }
+            }
+
+            thread_caches->~HeapThreadCaches();
+            tlsf_free(tlsf_handle, thread_caches);
+            thread_caches = nullptr;
+        }
+
         pool_t pool = tlsf_get_pool(tlsf_handle);
 
         tlsf_walk_pool(pool, exit_walker, (void*) &stats);
@@ -114,7 +616,12 @@ namespace puffin {
         ImGui::Separator();
         MemoryStatistics stats{0, max_size};
         pool_t pool = tlsf_get_pool(tlsf_handle);
-        tlsf_walk_pool(pool, imgui_walker, (void*) &stats);
+        if(thread_caches) {
+            std::lock_guard<std::mutex> lock(thread_caches->shared_mutex);
+            tlsf_walk_pool(pool, imgui_walker, (void*) &stats);
+        } else {
+            tlsf_walk_pool(pool, imgui_walker, (void*) &stats);
+        }
 
         ImGui::Separator();
         ImGui::Text("\tAllocation count %d", stats.allocation_count);
@@ -122,25 +629,97 @@ namespace puffin {
                     stats.allocated_bytes / (1024 * 1024),
                     (max_size - stats.allocated_bytes) / (1024 * 1024),
                     max_size / (1024 * 1024));
+
+        if(thread_caches) {
+            // Cache chunks show up as used blocks of the shared pool above
+            for(u32 i = 0; i < k_heap_max_threads; i++) {
+                const HeapThreadCache* cache = thread_caches->caches[i].load(std::memory_order_acquire);
+                if(cache) {
+                    ImGui::Text("\tThread cache %u allocated %llu K", i, (u64)(cache->allocated_size.load(std::memory_order_relaxed) / 1024));
+                }
+            }
+        }
     }
 
-    void* HeapAllocator::allocate(size_t size, size_t alignment) {
-        void* allocated_memory = alignment == 1 ? tlsf_malloc(tlsf_handle, size)
-                : tlsf_memalign(tlsf_handle, alignment, size);
+    bool HeapAllocator::is_thread_safe() const {
+        return thread_caches != nullptr;
+    }
+
+    u64 HeapAllocator::get_allocation_count() const {
+        if(thread_caches == nullptr) {
+            return allocation_count;
+        }
+
+        u64 count;
+        {
+            std::lock_guard<std::mutex> lock(thread_caches->shared_mutex);
+            count = allocation_count;
+        }
+
+        // Other threads may be counting meanwhile, good enough for a sample around code running on this thread
+        for(u32 i = 0; i < k_heap_max_threads; i++) {
+            const HeapThreadCache* cache = thread_caches->caches[i].load(std::memory_order_acquire);
+            if(cache) {
+                count += cache->allocation_count.load(std::memory_order_relaxed);
+            }
+        }
+        return count;
+    }
+
+    static void* heap_allocate(HeapAllocator& heap, size_t size, size_t alignment) {
+        if(heap.thread_caches) {
+            return heap_allocate_thread_safe(heap, size, alignment);
+        }
+
+        void* allocated_memory = alignment == 1 ? tlsf_malloc(heap.tlsf_handle, size)
+                : tlsf_memalign(heap.tlsf_handle, alignment, size);
 
         size_t actual_size = tlsf_block_size(allocated_memory);
-        allocated_size += actual_size;
+        heap.allocated_size += actual_size;
+        heap.allocation_count++;
         return allocated_memory;
     }
 
+    static void heap_deallocate(HeapAllocator& heap, void* pointer) {
+        if(heap.thread_caches) {
+            heap_deallocate_thread_safe(heap, pointer);
+            return;
+        }
+
+        size_t actual_size = tlsf_block_size(pointer);
+        heap.allocated_size -= actual_size;
+        tlsf_free(heap.tlsf_handle, pointer);
+    }
+
+    void* HeapAllocator::allocate(size_t size, size_t alignment) {
+#if defined(PUFFIN_MEMORY_TRACKING)
+        return allocate(size, alignment, nullptr, 0);
+#else
+        return heap_allocate(*this, size, alignment);
+#endif // PUFFIN_MEMORY_TRACKING
+    }
+
     void* HeapAllocator::allocate(size_t size, size_t alignment, cstring file, i32 line) {
-        return allocate(size, alignment);
+#if defined(PUFFIN_MEMORY_TRACKING)
+        void* allocated_memory = heap_allocate(*this, size, alignment);
+        if(allocated_memory) {
+            memory_tracking_allocate(this, allocated_memory, size, file, line);
+        }
+        return allocated_memory;
+#else
+        return heap_allocate(*this, size, alignment);
+#endif // PUFFIN_MEMORY_TRACKING
     }
 
     void HeapAllocator::deallocate(void *pointer) {
-        size_t actual_size = tlsf_block_size(pointer);
-        allocated_size -= actual_size;
-        tlsf_free(tlsf_handle, pointer);
+#if defined(PUFFIN_MEMORY_TRACKING)
+        if(pointer == nullptr) {
+            return;
+        }
+        memory_tracking_free(this, pointer);
+#endif // PUFFIN_MEMORY_TRACKING
+
+        heap_deallocate(*this, pointer);
     }
 
     // LINEAR ALLOCATOR
@@ -151,11 +730,30 @@ namespace puffin {
         memory = (u8*)malloc(size);
         total_size = size;
         allocated_size = 0;
+        committed_size = size;
+        virtual_memory = false;
+        huge_pages = false;
+    }
+
+    void LinearAllocator::init_virtual(size_t size, bool huge_pages_) {
+        total_size = virtual_reserve_size(size, huge_pages_);
+        memory = (u8*)memory_reserve(total_size, huge_pages_);
+        assert(memory && "Linear allocator could not reserve its address space");
+        allocated_size = 0;
+        committed_size = 0;
+        virtual_memory = true;
+        huge_pages = huge_pages_;
     }
 
     void LinearAllocator::shutdown() {
         clear();
-        free(memory);
+        if(virtual_memory) {
+            memory_release(memory, total_size);
+        } else {
+            free(memory);
+        }
+        memory = nullptr;
+        committed_size = 0;
     }
 
     void* LinearAllocator::allocate(size_t size, size_t alignment) {
@@ -164,6 +762,12 @@ namespace puffin {
         assert(new_start < total_size);
         const size_t new_allocated_size = new_start + size;
         assert(new_allocated_size < total_size);
+
+        if(!virtual_commit_to(memory, new_allocated_size, total_size, huge_pages, committed_size)) {
+            std::cout << "Linear allocator could not commit " << new_allocated_size << " bytes" << std::endl;
+            return nullptr;
+        }
+
         allocated_size = new_allocated_size;
         return memory + new_start;
     }
@@ -186,10 +790,27 @@ namespace puffin {
         memory = (u8*) malloc(size);
         allocated_size = 0;
         total_size = size;
+        committed_size = size;
+        virtual_memory = false;
+        huge_pages = false;
+    }
+
+    void StackAllocator::init_virtual(size_t size, bool huge_pages_) {
+        total_size = virtual_reserve_size(size, huge_pages_);
+        memory = (u8*)memory_reserve(total_size, huge_pages_);
+        assert(memory && "Stack allocator could not reserve its address space");
+        allocated_size = 0;
+        committed_size = 0;
+        virtual_memory = true;
+        huge_pages = huge_pages_;
     }
 
     void StackAllocator::shutdown() const {
-        free(memory);
+        if(virtual_memory) {
+            memory_release(memory, total_size);
+        } else {
+            free(memory);
+        }
     }
 
     void* StackAllocator::allocate(size_t size, size_t alignment) {
@@ -201,6 +822,12 @@ namespace puffin {
         const size_t new_allocated_size = new_start + size;
         assert(new_allocated_size < total_size);
 
+        // Memory popped off the stack stays committed and is reused
+        if(!virtual_commit_to(memory, new_allocated_size, total_size, huge_pages, committed_size)) {
+            std::cout << "Stack allocator could not commit " << new_allocated_size << " bytes" << std::endl;
+            return nullptr;
+        }
+
         allocated_size = new_allocated_size;
         return memory + new_start;
     }
@@ -232,4 +859,44 @@ namespace puffin {
     void StackAllocator::clear() {
         allocated_size = 0;
     }
+
+    // DEFERRED FREE ALLOCATOR
+
+    struct DeferredFreeNode {
+        void*               pointer;
+        DeferredFreeNode*   next;
+    };
+
+    void DeferredFreeAllocator::init(Allocator* backing_) {
+        backing = backing_;
+        retired = nullptr;
+    }
+
+    void DeferredFreeAllocator::shutdown() {
+        release();
+    }
+
+    void* DeferredFreeAllocator::allocate(size_t size, size_t alignment) {
+        return backing->allocate(size, alignment);
+    }
+
+    void* DeferredFreeAllocator::allocate(size_t size, size_t alignment, cstring file, i32 line) {
+        return backing->allocate(size, alignment, file, line);
+    }
+
+    void DeferredFreeAllocator::deallocate(void* pointer) {
+        DeferredFreeNode* node = (DeferredFreeNode*)puffin_alloc(sizeof(DeferredFreeNode), backing);
+        node->pointer = pointer;
+        node->next = retired;
+        retired = node;
+    }
+
+    void DeferredFreeAllocator::release() {
+        while(retired) {
+            DeferredFreeNode* next = retired->next;
+            backing->deallocate(retired->pointer);
+            backing->deallocate(retired);
+            retired = next;
+        }
+    }
 }
\ No newline at end of file
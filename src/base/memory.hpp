@@ -16,6 +16,16 @@ namespace puffin {
     // Calculate aligned memory size
     size_t                  memory_align(size_t size, size_t alignment);
 
+    // Virtual Memory ///////////////////
+    //
+    // Address space is reserved up front and committed in pieces when it is needed.
+    // Reserved memory costs no physical memory until it is committed and touched.
+    // Huge pages are transparent huge pages on Linux and are ignored on Windows,
+    // where large pages can only be committed together with the reservation.
+    void*                   memory_reserve(size_t size, bool huge_pages);
+    bool                    memory_commit(void* address, size_t size);
+    void                    memory_release(void* address, size_t size);
+
 
     struct MemoryStatistics {
         size_t              allocated_bytes;
@@ -39,11 +49,14 @@ namespace puffin {
         virtual void        deallocate(void* pointer) = 0;
     };
 
+    struct HeapThreadCaches;
+
     // A Heap Allocator is useful allocations lasting more than a frame
+    // In thread safe mode every thread allocates from a cache of its own, memory can be freed from any thread.
     struct HeapAllocator : public Allocator {
         ~HeapAllocator() override;
 
-        void                init(size_t size);
+        void                init(size_t size, bool thread_safe = false);
         void                shutdown();
 
         void                debug_ui();
@@ -53,14 +66,24 @@ namespace puffin {
 
         void                deallocate(void* pointer) override;
 
+        // Allocations made since init, thread caches included. Sample it around a block of code to count its allocations.
+        u64                 get_allocation_count() const;
+        // Set by init with thread_safe, the heap can then be used from any thread
+        bool                is_thread_safe() const;
+
         void*               tlsf_handle;
         void*               memory;
         size_t              allocated_size = 0;
         size_t              max_size = 0;
+        u64                 allocation_count = 0;
+
+        HeapThreadCaches*   thread_caches = nullptr;
     };
 
     struct StackAllocator : public Allocator {
         void                init(size_t size);
+        // Reserves size bytes and commits them as the stack grows, pointers never move
+        void                init_virtual(size_t size, bool huge_pages = false);
         void                shutdown() const;
 
         void*               allocate(size_t size, size_t alignment) override;
@@ -76,6 +99,9 @@ namespace puffin {
         u8*                 memory = nullptr;
         size_t              total_size = 0;
         size_t              allocated_size = 0;
+        size_t              committed_size = 0;
+        bool                virtual_memory = false;
+        bool                huge_pages = false;
     };
 
     // A Linear Allocator could be useful for resources with a frame-level lifetime
@@ -83,6 +109,8 @@ namespace puffin {
         ~LinearAllocator();
 
         void                init(size_t size);
+        // Reserves size bytes and commits them as allocations grow, pointers never move
+        void                init_virtual(size_t size, bool huge_pages = false);
         void                shutdown();
 
         void*               allocate(const size_t size, size_t alignment) override;
@@ -95,11 +123,36 @@ namespace puffin {
         u8*                 memory = nullptr;
         size_t              total_size = 0;
         size_t              allocated_size = 0;
+        size_t              committed_size = 0;
+        bool                virtual_memory = false;
+        bool                huge_pages = false;
+    };
+
+    struct DeferredFreeNode;
+
+    // Forwards allocations to a backing allocator and keeps what is freed through it until release(),
+    // for memory that lock free readers can still be looking at
+    struct DeferredFreeAllocator : public Allocator {
+        void                init(Allocator* backing);
+        void                shutdown();
+
+        void*               allocate(size_t size, size_t alignment) override;
+        void*               allocate(size_t size, size_t alignment, cstring file, i32 line) override;
+
+        void                deallocate(void* pointer) override;
+
+        // Frees everything deallocated so far, nobody can be reading it anymore
+        void                release();
+
+        Allocator*          backing = nullptr;
+        DeferredFreeNode*   retired = nullptr;
     };
 
     struct MemoryServiceConfiguration {
         // Defaults to max 32MB of dynamic memory.
         size_t              maximum_dynamic_size = 32 * 1024 * 1024;
+        // Needed as soon as more than one thread uses the system allocator
+        bool                thread_safe = false;
     };
 
     struct MemoryService : public Service {
@@ -116,6 +169,7 @@ namespace puffin {
         // System Allocator
         HeapAllocator system_allocator;
 
+        // Multithreaded allocation benchmark of the heap allocator
         void test();
     };
 
@@ -127,8 +181,8 @@ namespace puffin {
 
     #define puffin_free(pointer, allocator)                   (allocator)->deallocate(pointer)
 
-    #define puffin_kilo(size)                                 (size * 1024)
-    #define puffin_mega(size)                                 (size * 1024 * 1024)
-    #define puffin_giga(size)                                 (size * 1024 * 1024 * 1024)
+    #define puffin_kilo(size)                                 ((size_t)(size) * 1024)
+    #define puffin_mega(size)                                 ((size_t)(size) * 1024 * 1024)
+    #define puffin_giga(size)                                 ((size_t)(size) * 1024 * 1024 * 1024)
 
 }
\ No newline at end of file
@@ -0,0 +1,478 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "memory_tracking.hpp"
+
+#if defined(PUFFIN_MEMORY_TRACKING)
+
+#include "memory.hpp"
+#include "log.hpp"
+
+#include "imgui.h"
+#include "tracy/Tracy.hpp"
+
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace puffin {
+
+    // The side tables are malloc backed, they must never allocate from the allocators they track.
+    //
+    // Sampling follows the scheme of sampling heap profilers: every thread counts its allocated bytes down
+    // from an exponentially distributed interval, the allocation that crosses zero is sampled. An allocation
+    // of size bytes is then sampled with probability p = 1 - exp(-size / interval), so counting it as 1 / p
+    // allocations and size / p bytes keeps the estimates unbiased. Big allocations are nearly always sampled,
+    // small ones are sampled rarely and weigh more.
+    //
+    // Samples are kept in a pointer keyed open addressing table, so their frees find the callsite and the
+    // weight again. Everything past the inlined hot paths happens under a single mutex, samples are rare.
+
+    static const u32        k_tracking_max_allocators = 32;
+    static const u32        k_tracking_max_callsites = 8192;            // Power of 2
+    static const u32        k_tracking_initial_samples = 4096;          // Power of 2
+
+    // Estimates, hence fractional
+    struct TrackingCounters {
+        f64                     live_bytes;
+        f64                     live_allocations;
+        f64                     peak_bytes;
+        f64                     total_allocations;
+
+        void                    add(f64 bytes, f64 allocations, f64 total) {
+            live_bytes += bytes;
+            live_allocations += allocations;
+            total_allocations += total;
+            peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+        }
+    };
+
+    // Rounded counters for reports
+    struct TrackingSnapshot {
+        i64                     live_bytes;
+        i64                     live_allocations;
+        i64                     peak_bytes;
+        i64                     total_allocations;
+    };
+
+    struct TrackedAllocator {
+        std::atomic<Allocator*> allocator;
+        cstring                 name;
+        TrackingCounters        counters;
+    };
+
+    struct TrackedCallsite {
+        cstring                 file;           // nullptr while the entry is free
+        i32                     line;
+        u32                     allocator_index;
+        Allocator*              allocator;
+        TrackingCounters        counters;
+    };
+
+    struct TrackedSample {
+        uintptr_t               pointer;        // 0 while the entry is free
+        u64                     size;
+        f64                     weight;         // Allocations the sample stands for
+        u32                     callsite;
+    };
+
+    struct MemoryTracking {
+        TrackedAllocator        allocators[k_tracking_max_allocators];
+        std::atomic<u32>        allocator_count;
+
+        TrackedCallsite         callsites[k_tracking_max_callsites];
+
+        TrackedSample*          samples;
+        u32                     sample_capacity;
+        u32                     sample_count;
+
+        // Samples per slot of memory_tracking_filter
+        u32                     filter_counts[k_memory_tracking_filter_size];
+
+        std::atomic<i64>        sample_interval;        // 0 for the default one
+        std::mutex              mutex;
+    };
+
+    // Zero initialized static storage, allocated before any tracked allocator runs
+    static MemoryTracking s_tracking;
+
+    static u64 tracking_hash_pointer(const void* pointer) {
+        return ((u64)(uintptr_t)pointer >> 4) * 0x9E3779B97F4A7C15ull;
+    }
+
+    // Allocators ////////////////////////////////////////////////////
+
+    // Lock free for already registered allocators, Tracy looks them up on every allocation
+    static u32 tracking_allocator_index(Allocator* allocator, cstring name) {
+        const u32 count = s_tracking.allocator_count.load(std::memory_order_acquire);
+        for(u32 i = 0; i < count; i++) {
+            if(s_tracking.allocators[i].allocator.load(std::memory_order_relaxed) == allocator) {
+                return i;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(s_tracking.mutex);
+        const u32 locked_count = s_tracking.allocator_count.load(std::memory_order_relaxed);
+        for(u32 i = count; i < locked_count; i++) {
+            if(s_tracking.allocators[i].allocator.load(std::memory_order_relaxed) == allocator) {
+                return i;
+            }
+        }
+
+        if(locked_count == k_tracking_max_allocators) {
+            // Everything past the limit is reported under the last allocator
+            return k_tracking_max_allocators - 1;
+        }
+
+        TrackedAllocator& tracked_allocator = s_tracking.allocators[locked_count];
+        tracked_allocator.name = name;
+        tracked_allocator.allocator.store(allocator, std::memory_order_relaxed);
+        s_tracking.allocator_count.store(locked_count + 1, std::memory_order_release);
+        return locked_count;
+    }
+
+    void memory_tracking_register_allocator(Allocator* allocator, cstring name) {
+        const u32 index = tracking_allocator_index(allocator, name);
+        s_tracking.allocators[index].name = name;
+    }
+
+    // Callsites /////////////////////////////////////////////////////
+
+    // Called with the mutex held
+    static u32 tracking_callsite_index(Allocator* allocator, u32 allocator_index, cstring file, i32 line) {
+        const u64 hash = (tracking_hash_pointer(file) ^ ((u64)line * 0xC2B2AE3D27D4EB4Full)) + tracking_hash_pointer(allocator);
+        const u32 mask = k_tracking_max_callsites - 1;
+        const u32 start = (u32)(hash >> 32) & mask;
+
+        for(u32 i = start, probes = 0; probes < k_tracking_max_callsites; i = (i + 1) & mask, probes++) {
+            TrackedCallsite& callsite = s_tracking.callsites[i];
+            if(callsite.file == nullptr) {
+                callsite.file = file;
+                callsite.line = line;
+                callsite.allocator = allocator;
+                callsite.allocator_index = allocator_index;
+                return i;
+            }
+            if(callsite.file == file && callsite.line == line && callsite.allocator == allocator) {
+                return i;
+            }
+        }
+
+        // Table full, this should never happen with the fixed number of callsites in the code
+        return start;
+    }
+
+    // Samples ///////////////////////////////////////////////////////
+
+    // Linear probing with backward shift deletion, the table is at most half full. Called with the mutex held.
+    static u32 tracking_sample_slot(uintptr_t pointer) {
+        const u32 mask = s_tracking.sample_capacity - 1;
+        u32 i = (u32)(tracking_hash_pointer((const void*)pointer) >> 32) & mask;
+        while(s_tracking.samples[i].pointer != 0 && s_tracking.samples[i].pointer != pointer) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    static bool tracking_samples_grow() {
+        const u32 capacity = s_tracking.sample_capacity ? s_tracking.sample_capacity * 2 : k_tracking_initial_samples;
+        TrackedSample* samples = (TrackedSample*)calloc(capacity, sizeof(TrackedSample));
+        if(samples == nullptr) {
+            return false;
+        }
+
+        TrackedSample* old_samples = s_tracking.samples;
+        const u32 old_capacity = s_tracking.sample_capacity;
+        s_tracking.samples = samples;
+        s_tracking.sample_capacity = capacity;
+
+        for(u32 i = 0; i < old_capacity; i++) {
+            if(old_samples[i].pointer) {
+                s_tracking.samples[tracking_sample_slot(old_samples[i].pointer)] = old_samples[i];
+            }
+        }
+        free(old_samples);
+        return true;
+    }
+
+    static void tracking_sample_remove(u32 slot) {
+        const u32 mask = s_tracking.sample_capacity - 1;
+        for(u32 next = (slot + 1) & mask; s_tracking.samples[next].pointer; next = (next + 1) & mask) {
+            // Moves back every entry that the free slot would make unreachable
+            const u32 home = (u32)(tracking_hash_pointer((const void*)s_tracking.samples[next].pointer) >> 32) & mask;
+            if(((next - home) & mask) >= ((next - slot) & mask)) {
+                s_tracking.samples[slot] = s_tracking.samples[next];
+                slot = next;
+            }
+        }
+        s_tracking.samples[slot].pointer = 0;
+    }
+
+    static void tracking_filter_add(uintptr_t pointer) {
+        std::atomic<uintptr_t>& slot = memory_tracking_filter_slot((const void*)pointer);
+        u32& count = s_tracking.filter_counts[&slot - memory_tracking_filter];
+        count++;
+        slot.store(count == 1 ? pointer : k_memory_tracking_filter_many, std::memory_order_relaxed);
+    }
+
+    static void tracking_filter_remove(uintptr_t pointer) {
+        std::atomic<uintptr_t>& slot = memory_tracking_filter_slot((const void*)pointer);
+        u32& count = s_tracking.filter_counts[&slot - memory_tracking_filter];
+        count--;
+        // Which sample is left is not known, the slot stays shared until the last one is freed
+        slot.store(count == 0 ? 0 : k_memory_tracking_filter_many, std::memory_order_relaxed);
+    }
+
+    static i64 tracking_sample_interval() {
+        const i64 interval = s_tracking.sample_interval.load(std::memory_order_relaxed);
+        return interval ? interval : (i64)k_memory_tracking_default_sample_interval;
+    }
+
+    void memory_tracking_set_sample_interval(size_t bytes) {
+        s_tracking.sample_interval.store(bytes ? (i64)bytes : 1, std::memory_order_relaxed);
+    }
+
+    // Exponentially distributed, the waiting time between samples then does not depend on the sizes before
+    static i64 tracking_next_interval(MemoryTrackingThread& thread, i64 interval) {
+        if(interval <= 1) {
+            return 0;
+        }
+
+        // xorshift64, seeded per thread on first use
+        u64 x = thread.random_state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        thread.random_state = x;
+
+        const f64 uniform = (f64)((x >> 11) + 1) * (1.0 / 9007199254740992.0);     // (0, 1]
+        return (i64)(-log(uniform) * (f64)interval) + 1;
+    }
+
+    void memory_tracking_sample(Allocator* allocator, void* pointer, size_t size, cstring file, i32 line) {
+        MemoryTrackingThread& thread = t_memory_tracking_thread;
+        const i64 interval = tracking_sample_interval();
+
+        if(thread.random_state == 0) {
+            // First allocation of the thread, it only starts the countdown
+            thread.random_state = tracking_hash_pointer(&thread) | 1;
+            thread.bytes_until_sample += tracking_next_interval(thread, interval);
+            if(thread.bytes_until_sample >= 0) {
+                return;
+            }
+        }
+        thread.bytes_until_sample = tracking_next_interval(thread, interval);
+
+        const f64 weight = interval <= 1 ? 1.0 : 1.0 / -expm1(-(f64)size / (f64)interval);
+        const u32 allocator_index = tracking_allocator_index(allocator, "heap");
+
+        std::lock_guard<std::mutex> lock(s_tracking.mutex);
+        if(s_tracking.sample_count * 2 >= s_tracking.sample_capacity && !tracking_samples_grow()) {
+            return;
+        }
+
+        TrackedSample& sample = s_tracking.samples[tracking_sample_slot((uintptr_t)pointer)];
+        if(sample.pointer == 0) {
+            s_tracking.sample_count++;
+            tracking_filter_add((uintptr_t)pointer);
+        }
+        sample.pointer = (uintptr_t)pointer;
+        sample.size = size;
+        sample.weight = weight;
+        sample.callsite = tracking_callsite_index(allocator, allocator_index, file ? file : "unknown", line);
+
+        s_tracking.callsites[sample.callsite].counters.add((f64)size * weight, weight, weight);
+        s_tracking.allocators[allocator_index].counters.add((f64)size * weight, weight, weight);
+    }
+
+    void memory_tracking_sample_free(void* pointer) {
+        std::lock_guard<std::mutex> lock(s_tracking.mutex);
+        if(s_tracking.sample_count == 0) {
+            return;
+        }
+
+        const u32 slot = tracking_sample_slot((uintptr_t)pointer);
+        const TrackedSample sample = s_tracking.samples[slot];
+        if(sample.pointer == 0) {
+            // Another allocation sharing the filter slot
+            return;
+        }
+
+        tracking_sample_remove(slot);
+        tracking_filter_remove(sample.pointer);
+        s_tracking.sample_count--;
+
+        TrackedCallsite& callsite = s_tracking.callsites[sample.callsite];
+        callsite.counters.add(-(f64)sample.size * sample.weight, -sample.weight, 0.0);
+        s_tracking.allocators[callsite.allocator_index].counters.add(-(f64)sample.size * sample.weight, -sample.weight, 0.0);
+    }
+
+#if defined(TRACY_ENABLE)
+    void memory_tracking_tracy_allocate(Allocator* allocator, void* pointer, size_t size) {
+        TracyAllocN(pointer, size, s_tracking.allocators[tracking_allocator_index(allocator, "heap")].name);
+    }
+
+    void memory_tracking_tracy_free(Allocator* allocator, void* pointer) {
+        TracyFreeN(pointer, s_tracking.allocators[tracking_allocator_index(allocator, "heap")].name);
+    }
+#endif // TRACY_ENABLE
+
+    // Reports ///////////////////////////////////////////////////////
+
+    static void tracking_write_json_string(FILE* file, cstring string) {
+        fputc('"', file);
+        for(cstring c = string; *c; c++) {
+            if(*c == '"' || *c == '\\') {
+                fputc('\\', file);
+            }
+            fputc(*c, file);
+        }
+        fputc('"', file);
+    }
+
+    struct TrackingReport {
+        TrackingSnapshot        allocators[k_tracking_max_allocators];
+        TrackingSnapshot        callsites[k_tracking_max_callsites];
+        TrackedCallsite         callsite_names[k_tracking_max_callsites];  // Counters unused
+        u32                     allocator_count;
+        i64                     sample_interval;
+    };
+
+    static void tracking_snapshot_set(TrackingSnapshot& snapshot, const TrackingCounters& counters) {
+        snapshot.live_bytes = llround(counters.live_bytes);
+        snapshot.live_allocations = llround(counters.live_allocations);
+        snapshot.peak_bytes = llround(counters.peak_bytes);
+        snapshot.total_allocations = llround(counters.total_allocations);
+    }
+
+    static TrackingReport* tracking_report_create() {
+        TrackingReport* report = (TrackingReport*)calloc(1, sizeof(TrackingReport));
+        if(report == nullptr) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(s_tracking.mutex);
+        report->allocator_count = s_tracking.allocator_count.load(std::memory_order_relaxed);
+        report->sample_interval = tracking_sample_interval();
+        for(u32 i = 0; i < report->allocator_count; i++) {
+            tracking_snapshot_set(report->allocators[i], s_tracking.allocators[i].counters);
+        }
+
+        for(u32 i = 0; i < k_tracking_max_callsites; i++) {
+            const TrackedCallsite& callsite = s_tracking.callsites[i];
+            if(callsite.file != nullptr) {
+                report->callsite_names[i] = callsite;
+                tracking_snapshot_set(report->callsites[i], callsite.counters);
+            }
+        }
+
+        return report;
+    }
+
+    static void tracking_write_json_snapshot(FILE* file, const TrackingSnapshot& snapshot) {
+        fprintf(file, "\"live_bytes\": %lld, \"live_allocations\": %lld, \"peak_bytes\": %lld, \"total_allocations\": %lld",
+                (long long)snapshot.live_bytes, (long long)snapshot.live_allocations,
+                (long long)snapshot.peak_bytes, (long long)snapshot.total_allocations);
+    }
+
+    bool memory_tracking_dump_json(cstring filename) {
+        TrackingReport* report = tracking_report_create();
+        FILE* file = report ? fopen(filename, "w") : nullptr;
+        if(file == nullptr) {
+            p_print("Cannot write memory tracking report %s\n", filename);
+            free(report);
+            return false;
+        }
+
+        fprintf(file, "{\n  \"sample_interval\": %lld,\n  \"allocators\": [", (long long)report->sample_interval);
+        for(u32 i = 0; i < report->allocator_count; i++) {
+            fprintf(file, "%s\n    { \"name\": ", i ? "," : "");
+            tracking_write_json_string(file, s_tracking.allocators[i].name);
+            fprintf(file, ", ");
+            tracking_write_json_snapshot(file, report->allocators[i]);
+            fprintf(file, " }");
+        }
+
+        fprintf(file, "\n  ],\n  \"callsites\": [");
+        bool first = true;
+        for(u32 i = 0; i < k_tracking_max_callsites; i++) {
+            const TrackedCallsite& callsite = report->callsite_names[i];
+            if(callsite.file == nullptr) {
+                continue;
+            }
+
+            fprintf(file, "%s\n    { \"file\": ", first ? "" : ",");
+            tracking_write_json_string(file, callsite.file);
+            fprintf(file, ", \"line\": %d, \"allocator\": ", callsite.line);
+            tracking_write_json_string(file, s_tracking.allocators[callsite.allocator_index].name);
+            fprintf(file, ", ");
+            tracking_write_json_snapshot(file, report->callsites[i]);
+            fprintf(file, " }");
+            first = false;
+        }
+
+        fprintf(file, "\n  ]\n}\n");
+        fclose(file);
+        free(report);
+        return true;
+    }
+
+    void memory_tracking_imgui_draw() {
+        static const u32 k_top_callsites = 16;
+
+        ImGui::Separator();
+        ImGui::Text("Allocation Tracking");
+        ImGui::Separator();
+
+        TrackingReport* report = tracking_report_create();
+        if(report == nullptr) {
+            return;
+        }
+
+        ImGui::Text("\tEstimated from one sample every %lld K", (long long)(report->sample_interval / 1024));
+        for(u32 i = 0; i < report->allocator_count; i++) {
+            const TrackingSnapshot& snapshot = report->allocators[i];
+            ImGui::Text("\t%s: live %lld K in %lld allocations, peak %lld K", s_tracking.allocators[i].name,
+                        (long long)(snapshot.live_bytes / 1024), (long long)snapshot.live_allocations,
+                        (long long)(snapshot.peak_bytes / 1024));
+        }
+
+        // Biggest callsites by live bytes, a small insertion sort is enough for the UI
+        u32 top[k_top_callsites];
+        i64 top_bytes[k_top_callsites];
+        u32 top_count = 0;
+
+        for(u32 i = 0; i < k_tracking_max_callsites; i++) {
+            if(report->callsite_names[i].file == nullptr) {
+                continue;
+            }
+
+            const i64 live_bytes = report->callsites[i].live_bytes;
+            u32 position = top_count < k_top_callsites ? top_count++ : k_top_callsites;
+            while(position > 0 && top_bytes[position - 1] < live_bytes) {
+                if(position < k_top_callsites) {
+                    top[position] = top[position - 1];
+                    top_bytes[position] = top_bytes[position - 1];
+                }
+                position--;
+            }
+            if(position < k_top_callsites) {
+                top[position] = i;
+                top_bytes[position] = live_bytes;
+            }
+        }
+
+        for(u32 i = 0; i < top_count; i++) {
+            const TrackedCallsite& callsite = report->callsite_names[top[i]];
+            ImGui::Text("\t%6lld K %s:%d", (long long)(top_bytes[i] / 1024), callsite.file, callsite.line);
+        }
+
+        free(report);
+    }
+
+} // namespace puffin
+
+#endif // PUFFIN_MEMORY_TRACKING
@@ -0,0 +1,117 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "platform.hpp"
+
+#if defined(PUFFIN_MEMORY_TRACKING)
+#include <atomic>
+#endif // PUFFIN_MEMORY_TRACKING
+
+namespace puffin {
+
+    struct Allocator;
+
+    // Allocation tracking ///////////////////////////////////////////
+    //
+    // Compiled in with PUFFIN_MEMORY_TRACKING, otherwise the macros below are empty.
+    // Allocations made through the puffin_alloc macros are sampled: each thread records about one allocation
+    // per sample interval of bytes it allocates, with its callsite, in a side table that lives outside of the
+    // tracked allocators. Live bytes, live allocations, total allocations and the high water mark per
+    // callsite and per allocator are estimated from the samples, each one standing for all the allocations
+    // it was drawn from. Tracy still sees every allocation.
+    //
+    // The default interval keeps the cost on a small allocation under 5%. An interval of 1 records every
+    // allocation and makes the counts exact, at the price of a lock per allocation and free.
+
+#if defined(PUFFIN_MEMORY_TRACKING)
+
+    static const size_t     k_memory_tracking_default_sample_interval = 512 * 1024;
+
+    // Names the allocator in reports, the name must outlive the allocator
+    void                    memory_tracking_register_allocator(Allocator* allocator, cstring name);
+    // Mean number of bytes between two samples, applies to what is allocated from then on
+    void                    memory_tracking_set_sample_interval(size_t bytes);
+
+    // Called by the allocators right after allocating and right before freeing the memory
+    inline void             memory_tracking_allocate(Allocator* allocator, void* pointer, size_t size, cstring file, i32 line);
+    inline void             memory_tracking_free(Allocator* allocator, void* pointer);
+
+    bool                    memory_tracking_dump_json(cstring filename);
+    void                    memory_tracking_imgui_draw();
+
+    // Hot path //////////////////////////////////////////////////////
+    //
+    // Inlined in the allocators. An allocation only counts its bytes down to the next sample, a free only
+    // checks the filter slot of its page. Sampled allocations and their frees take the slow paths in
+    // memory_tracking.cpp.
+
+    struct MemoryTrackingThread {
+        i64                     bytes_until_sample;     // Zero until the thread first allocates
+        u64                     random_state;
+    };
+
+    // Zero initialized, accesses need no initialization check
+    inline thread_local MemoryTrackingThread t_memory_tracking_thread;
+
+    // Pages are hashed into the filter. A slot holds the pointer of the only sampled allocation starting in
+    // its pages, k_memory_tracking_filter_many when there are more, 0 when there are none.
+    static const u32        k_memory_tracking_filter_size = 64 * 1024;         // Power of 2
+    static const u32        k_memory_tracking_filter_page_shift = 12;
+    static const uintptr_t  k_memory_tracking_filter_many = 1;
+
+    inline std::atomic<uintptr_t> memory_tracking_filter[k_memory_tracking_filter_size];
+
+    inline std::atomic<uintptr_t>& memory_tracking_filter_slot(const void* pointer) {
+        return memory_tracking_filter[((uintptr_t)pointer >> k_memory_tracking_filter_page_shift) & (k_memory_tracking_filter_size - 1)];
+    }
+
+    void                    memory_tracking_sample(Allocator* allocator, void* pointer, size_t size, cstring file, i32 line);
+    void                    memory_tracking_sample_free(void* pointer);
+#if defined(TRACY_ENABLE)
+    void                    memory_tracking_tracy_allocate(Allocator* allocator, void* pointer, size_t size);
+    void                    memory_tracking_tracy_free(Allocator* allocator, void* pointer);
+#endif // TRACY_ENABLE
+
+    inline void memory_tracking_allocate(Allocator* allocator, void* pointer, size_t size, cstring file, i32 line) {
+        MemoryTrackingThread& thread = t_memory_tracking_thread;
+        thread.bytes_until_sample -= (i64)size;
+        if(thread.bytes_until_sample < 0) {
+            memory_tracking_sample(allocator, pointer, size, file, line);
+        }
+
+#if defined(TRACY_ENABLE)
+        memory_tracking_tracy_allocate(allocator, pointer, size);
+#endif // TRACY_ENABLE
+    }
+
+    inline void memory_tracking_free(Allocator* allocator, void* pointer) {
+        const uintptr_t sampled = memory_tracking_filter_slot(pointer).load(std::memory_order_relaxed);
+        if(sampled == (uintptr_t)pointer || sampled == k_memory_tracking_filter_many) {
+            memory_tracking_sample_free(pointer);
+        }
+
+#if defined(TRACY_ENABLE)
+        memory_tracking_tracy_free(allocator, pointer);
+#else
+        (void)allocator;
+#endif // TRACY_ENABLE
+    }
+
+    #define puffin_memory_tracking_register_allocator(allocator, name)           puffin::memory_tracking_register_allocator(allocator, name)
+    #define puffin_memory_tracking_set_sample_interval(bytes)                    puffin::memory_tracking_set_sample_interval(bytes)
+    #define puffin_memory_tracking_dump_json(filename)                           puffin::memory_tracking_dump_json(filename)
+    #define puffin_memory_tracking_imgui_draw()                                  puffin::memory_tracking_imgui_draw()
+
+#else
+
+    #define puffin_memory_tracking_register_allocator(allocator, name)
+    #define puffin_memory_tracking_set_sample_interval(bytes)
+    #define puffin_memory_tracking_dump_json(filename)
+    #define puffin_memory_tracking_imgui_draw()
+
+#endif // PUFFIN_MEMORY_TRACKING
+
+} // namespace puffin
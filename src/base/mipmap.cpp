@@ -0,0 +1,284 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "mipmap.hpp"
+#include "memory.hpp"
+#include "log.hpp"
+#include "numerics.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PUFFIN_MIPMAP_SSE2
+#endif
+
+namespace puffin {
+
+    // sRGB conversion ///////////////////////////////////////////////
+
+    static const u32    k_linear_to_srgb_table_size = 4096;
+
+    static f32 srgb_to_linear(f32 c) {
+        return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static f32 linear_to_srgb(f32 c) {
+        return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+    }
+
+    struct SrgbTables {
+        SrgbTables();
+
+        f32             to_linear[256];
+        // Linear values quantized to 12 bits, precise enough to stay within one step of the exact conversion
+        u8              to_srgb[k_linear_to_srgb_table_size];
+    };
+
+    SrgbTables::SrgbTables() {
+        for(u32 i = 0; i < 256; i++) {
+            to_linear[i] = srgb_to_linear(i / 255.f);
+        }
+
+        for(u32 i = 0; i < k_linear_to_srgb_table_size; i++) {
+            to_srgb[i] = (u8)(linear_to_srgb(i / (f32)(k_linear_to_srgb_table_size - 1)) * 255.f + 0.5f);
+        }
+    }
+
+    // Built on first use, local static initialization is thread safe
+    static const SrgbTables& srgb_tables() {
+        static SrgbTables s_tables;
+        return s_tables;
+    }
+
+    // Mip chain /////////////////////////////////////////////////////
+
+    static u32 mip_dimension(u32 size, u32 level) {
+        const u32 result = size >> level;
+        return result ? result : 1;
+    }
+
+    u32 mipmap_level_count(u32 width, u32 height) {
+        u32 size = width > height ? width : height;
+        u32 levels = 1;
+        while(size > 1) {
+            size >>= 1;
+            levels++;
+        }
+        return levels;
+    }
+
+    size_t mipmap_level_size(u32 width, u32 height, u32 level) {
+        return (size_t)mip_dimension(width, level) * mip_dimension(height, level) * 4;
+    }
+
+    size_t mipmap_chain_size(u32 width, u32 height, u32 levels) {
+        size_t size = 0;
+        for(u32 level = 0; level < levels; level++) {
+            size += mipmap_level_size(width, height, level);
+        }
+        return size;
+    }
+
+    void mipmap_generate_rgba8(u8* chain, u32 width, u32 height, u32 levels, bool srgb) {
+        u8* source = chain;
+
+        for(u32 level = 1; level < levels; level++) {
+            const u32 source_width = mip_dimension(width, level - 1);
+            const u32 source_height = mip_dimension(height, level - 1);
+
+            u8* destination = source + (size_t)source_width * source_height * 4;
+            mipmap_downsample_rgba8(source, source_width, source_height, destination, srgb);
+
+            source = destination;
+        }
+    }
+
+    // Downsample ////////////////////////////////////////////////////
+
+    // Box filters the 2x2 footprint of destination texel x. Columns and rows are clamped for 1 wide levels.
+    static void downsample_texel_scalar(const u8* row0, const u8* row1, u32 x, u32 source_width, u8* out, bool srgb) {
+        const u32 x0 = min(x * 2, source_width - 1) * 4;
+        const u32 x1 = min(x * 2 + 1, source_width - 1) * 4;
+
+        const SrgbTables& tables = srgb_tables();
+
+        for(u32 c = 0; c < 3; c++) {
+            if(srgb) {
+                const f32 linear = (tables.to_linear[row0[x0 + c]] + tables.to_linear[row0[x1 + c]] +
+                                    tables.to_linear[row1[x0 + c]] + tables.to_linear[row1[x1 + c]]) * 0.25f;
+                out[c] = (u8)(linear_to_srgb(linear) * 255.f + 0.5f);
+            } else {
+                out[c] = (u8)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+            }
+        }
+
+        out[3] = (u8)((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2);
+    }
+
+    void mipmap_downsample_rgba8_scalar(const u8* source, u32 source_width, u32 source_height, u8* destination, bool srgb) {
+        const u32 destination_width = mip_dimension(source_width, 1);
+        const u32 destination_height = mip_dimension(source_height, 1);
+
+        for(u32 y = 0; y < destination_height; y++) {
+            const u8* row0 = source + (size_t)min(y * 2, source_height - 1) * source_width * 4;
+            const u8* row1 = source + (size_t)min(y * 2 + 1, source_height - 1) * source_width * 4;
+            u8* out = destination + (size_t)y * destination_width * 4;
+
+            for(u32 x = 0; x < destination_width; x++) {
+                downsample_texel_scalar(row0, row1, x, source_width, out + x * 4, srgb);
+            }
+        }
+    }
+
+#if defined(PUFFIN_MIPMAP_SSE2)
+
+    // Two destination texels per iteration, all channels averaged in 16 bit lanes.
+    // Rounds exactly like the scalar version.
+    static u32 downsample_row_linear_sse2(const u8* row0, const u8* row1, u32 destination_width, u8* out) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(2);
+
+        u32 x = 0;
+        for(; x + 2 <= destination_width; x += 2) {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+
+            // Vertical sums, low holds source texels 0 and 1, high texels 2 and 3
+            const __m128i sum_low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            const __m128i sum_high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+            // Horizontal sums end up in the low 4 lanes
+            const __m128i texel0 = _mm_add_epi16(sum_low, _mm_srli_si128(sum_low, 8));
+            const __m128i texel1 = _mm_add_epi16(sum_high, _mm_srli_si128(sum_high, 8));
+
+            __m128i result = _mm_unpacklo_epi64(texel0, texel1);
+            result = _mm_srli_epi16(_mm_add_epi16(result, round), 2);
+
+            _mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(result, result));
+        }
+
+        return x;
+    }
+
+    // One destination texel per iteration, color averaged in linear space as 4 floats.
+    static u32 downsample_row_srgb_sse2(const u8* row0, const u8* row1, u32 destination_width, u8* out) {
+        const SrgbTables& tables = srgb_tables();
+        const f32* to_linear = tables.to_linear;
+
+        const __m128 quarter_scale = _mm_set1_ps(0.25f * (k_linear_to_srgb_table_size - 1));
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        alignas(16) i32 indices[4];
+
+        u32 x = 0;
+        for(; x < destination_width; x++) {
+            const u8* a0 = row0 + x * 8;
+            const u8* a1 = a0 + 4;
+            const u8* b0 = row1 + x * 8;
+            const u8* b1 = b0 + 4;
+
+            __m128 sum = _mm_add_ps(_mm_setr_ps(to_linear[a0[0]], to_linear[a0[1]], to_linear[a0[2]], 0.f),
+                                    _mm_setr_ps(to_linear[a1[0]], to_linear[a1[1]], to_linear[a1[2]], 0.f));
+            sum = _mm_add_ps(sum, _mm_setr_ps(to_linear[b0[0]], to_linear[b0[1]], to_linear[b0[2]], 0.f));
+            sum = _mm_add_ps(sum, _mm_setr_ps(to_linear[b1[0]], to_linear[b1[1]], to_linear[b1[2]], 0.f));
+
+            // Average and quantize to the table size in one go
+            _mm_store_si128((__m128i*)indices, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, quarter_scale), half)));
+
+            u8* texel = out + x * 4;
+            texel[0] = tables.to_srgb[indices[0]];
+            texel[1] = tables.to_srgb[indices[1]];
+            texel[2] = tables.to_srgb[indices[2]];
+            texel[3] = (u8)((a0[3] + a1[3] + b0[3] + b1[3] + 2) >> 2);
+        }
+
+        return x;
+    }
+
+#endif // PUFFIN_MIPMAP_SSE2
+
+    void mipmap_downsample_rgba8(const u8* source, u32 source_width, u32 source_height, u8* destination, bool srgb) {
+#if defined(PUFFIN_MIPMAP_SSE2)
+        // Clamped footprints only happen on 1 wide or 1 tall levels, leave those to the scalar path
+        if(source_width < 2 || source_height < 2) {
+            mipmap_downsample_rgba8_scalar(source, source_width, source_height, destination, srgb);
+            return;
+        }
+
+        const u32 destination_width = source_width / 2;
+        const u32 destination_height = source_height / 2;
+
+        for(u32 y = 0; y < destination_height; y++) {
+            const u8* row0 = source + (size_t)(y * 2) * source_width * 4;
+            const u8* row1 = row0 + (size_t)source_width * 4;
+            u8* out = destination + (size_t)y * destination_width * 4;
+
+            u32 x = srgb ? downsample_row_srgb_sse2(row0, row1, destination_width, out) :
+                           downsample_row_linear_sse2(row0, row1, destination_width, out);
+
+            for(; x < destination_width; x++) {
+                downsample_texel_scalar(row0, row1, x, source_width, out + x * 4, srgb);
+            }
+        }
+#else
+        mipmap_downsample_rgba8_scalar(source, source_width, source_height, destination, srgb);
+#endif // PUFFIN_MIPMAP_SSE2
+    }
+
+    // Test //////////////////////////////////////////////////////////
+
+    bool mipmap_test() {
+        struct Size { u32 width; u32 height; };
+        static const Size k_sizes[] = { {1, 1}, {2, 2}, {1, 9}, {9, 1}, {7, 5}, {64, 64}, {257, 129} };
+
+        Allocator* allocator = &MemoryService::instance()->system_allocator;
+
+        u32 failures = 0;
+        u32 seed = 0x9e3779b9;
+
+        for(const Size& size : k_sizes) {
+            const size_t source_size = mipmap_level_size(size.width, size.height, 0);
+            const size_t destination_size = mipmap_level_size(size.width, size.height, 1);
+
+            u8* source = puffin_alloc_return_mem_pointer(source_size, allocator);
+            u8* expected = puffin_alloc_return_mem_pointer(destination_size, allocator);
+            u8* result = puffin_alloc_return_mem_pointer(destination_size, allocator);
+
+            // Xorshift noise covers the whole range, including the linear segment of the sRGB curve
+            for(size_t i = 0; i < source_size; i++) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                source[i] = (u8)seed;
+            }
+
+            for(u32 srgb = 0; srgb < 2; srgb++) {
+                mipmap_downsample_rgba8_scalar(source, size.width, size.height, expected, srgb);
+                mipmap_downsample_rgba8(source, size.width, size.height, result, srgb);
+
+                // Linear filtering is exact, the sRGB table conversion can be one step off
+                const i32 tolerance = srgb ? 1 : 0;
+                for(size_t i = 0; i < destination_size; i++) {
+                    const i32 difference = (i32)expected[i] - (i32)result[i];
+                    if(difference > tolerance || difference < -tolerance) {
+                        p_print("Mipmap test failed: %ux%u %s, byte %llu expected %u got %u\n", size.width, size.height,
+                                srgb ? "srgb" : "linear", (u64)i, expected[i], result[i]);
+                        failures++;
+                        break;
+                    }
+                }
+            }
+
+            puffin_free(result, allocator);
+            puffin_free(expected, allocator);
+            puffin_free(source, allocator);
+        }
+
+        p_print("Mipmap test %s\n", failures ? "failed" : "passed");
+        return failures == 0;
+    }
+
+} // namespace puffin
@@ -0,0 +1,32 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "platform.hpp"
+
+namespace puffin {
+
+    // CPU mip chain generation for 8 bit RGBA images ///////////////////
+    //
+    // A chain stores its levels tightly packed one after the other, starting with level 0.
+    // Levels are halved in each dimension (clamped to 1) and filtered with a 2x2 box filter.
+    // sRGB encoded images are filtered in linear space, alpha is always linear.
+
+    u32             mipmap_level_count(u32 width, u32 height);
+    size_t          mipmap_level_size(u32 width, u32 height, u32 level);
+    size_t          mipmap_chain_size(u32 width, u32 height, u32 levels);
+
+    // Fills levels 1 to levels - 1 of the chain. Level 0 must already be present.
+    void            mipmap_generate_rgba8(u8* chain, u32 width, u32 height, u32 levels, bool srgb);
+
+    // Single level downsample. The scalar version is the reference implementation.
+    void            mipmap_downsample_rgba8(const u8* source, u32 source_width, u32 source_height, u8* destination, bool srgb);
+    void            mipmap_downsample_rgba8_scalar(const u8* source, u32 source_width, u32 source_height, u8* destination, bool srgb);
+
+    // Pure CPU check of the SIMD downsampler against the scalar reference on synthetic images.
+    // Returns true if every texel is within tolerance.
+    bool            mipmap_test();
+
+} // namespace puffin
@@ -0,0 +1,299 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "queue.hpp"
+#include "log.hpp"
+#include "time.hpp"
+
+#include <mutex>
+#include <thread>
+
+namespace puffin {
+
+    // Test //////////////////////////////////////////////////////////
+
+    static const u32        k_queue_test_elements = 1000000;     // Per producer
+    static const u32        k_queue_test_capacity = 1024;
+    static const u32        k_queue_test_batch = 32;
+    static const u32        k_queue_test_max_threads = 8;
+
+    // Producer in the high 32 bits, its sequence number from 1 in the low 32
+    static u64 queue_test_element(u32 producer, u32 sequence) {
+        return ((u64)producer << 32) | sequence;
+    }
+
+    // Baseline for the benchmark, the same ring behind a mutex
+    struct MutexQueue {
+        void                init(Allocator* allocator_, u32 capacity) {
+            allocator = allocator_;
+            mask = queue_capacity_round(capacity) - 1;
+            elements = (u64*)puffin_alloc((mask + 1) * sizeof(u64), allocator);
+        }
+        void                shutdown()                      { puffin_free(elements, allocator); }
+
+        bool                push(const u64& element) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(write - read > mask) {
+                return false;
+            }
+            elements[write++ & mask] = element;
+            return true;
+        }
+
+        bool                pop(u64& out_element) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(read == write) {
+                return false;
+            }
+            out_element = elements[read++ & mask];
+            return true;
+        }
+
+        std::mutex          mutex;
+        u64*                elements    = nullptr;
+        u64                 read        = 0;
+        u64                 write       = 0;
+        u64                 mask        = 0;
+        Allocator*          allocator   = nullptr;
+    };
+
+    template <typename Queue>
+    static bool queue_test_push(Queue* queue, u64 element) {
+        return queue->push(element);
+    }
+
+    static bool queue_test_push(MpscQueue<u64>* queue, u64 element) {
+        queue->push(element);
+        return true;
+    }
+
+    template <typename Queue>
+    static void queue_test_producer(Queue* queue, u32 producer) {
+        for(u32 i = 1; i <= k_queue_test_elements; i++) {
+            while(!queue_test_push(queue, queue_test_element(producer, i))) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Pops until all the elements are out. Elements of a producer must come out in order, every consumer sees
+    // an increasing subsequence of them.
+    template <typename Queue>
+    static void queue_test_consumer(Queue* queue, std::atomic<u64>* consumed, u64 total, u64* out_sum, bool* out_valid) {
+        u32 last_sequence[k_queue_test_max_threads] = {};
+        u64 sum = 0;
+        bool valid = true;
+
+        while(consumed->load(std::memory_order_relaxed) < total) {
+            u64 element;
+            if(!queue->pop(element)) {
+                std::this_thread::yield();
+                continue;
+            }
+            consumed->fetch_add(1, std::memory_order_relaxed);
+
+            const u32 producer = (u32)(element >> 32);
+            const u32 sequence = (u32)element;
+            valid = valid && producer < k_queue_test_max_threads && sequence > last_sequence[producer];
+            last_sequence[producer] = producer < k_queue_test_max_threads ? sequence : 0;
+            sum += element;
+        }
+
+        *out_sum = sum;
+        *out_valid = valid;
+    }
+
+    // Runs producer_count producers against consumer_count consumers, returns elements per second.
+    // valid is cleared if an element is lost, duplicated or out of order.
+    template <typename Queue>
+    static f64 queue_test_run(Queue& queue, u32 producer_count, u32 consumer_count, bool& valid) {
+        std::thread producers[k_queue_test_max_threads];
+        std::thread consumers[k_queue_test_max_threads];
+        u64 sums[k_queue_test_max_threads] = {};
+        bool consumer_valid[k_queue_test_max_threads] = {};
+        std::atomic<u64> consumed{ 0 };
+        const u64 total = (u64)producer_count * k_queue_test_elements;
+
+        const i64 start = time_now();
+        for(u32 c = 0; c < consumer_count; c++) {
+            consumers[c] = std::thread(queue_test_consumer<Queue>, &queue, &consumed, total, sums + c, consumer_valid + c);
+        }
+        for(u32 p = 0; p < producer_count; p++) {
+            producers[p] = std::thread(queue_test_producer<Queue>, &queue, p);
+        }
+        for(u32 p = 0; p < producer_count; p++) {
+            producers[p].join();
+        }
+        for(u32 c = 0; c < consumer_count; c++) {
+            consumers[c].join();
+        }
+        const f64 seconds = time_delta_seconds(start, time_now());
+
+        // Every element exactly once: sum over producers of (p << 32) * n + n * (n + 1) / 2
+        u64 expected_sum = 0;
+        for(u32 p = 0; p < producer_count; p++) {
+            expected_sum += queue_test_element(p, 0) * k_queue_test_elements + (u64)k_queue_test_elements * (k_queue_test_elements + 1) / 2;
+        }
+        u64 sum = 0;
+        for(u32 c = 0; c < consumer_count; c++) {
+            sum += sums[c];
+            valid = valid && consumer_valid[c];
+        }
+        valid = valid && sum == expected_sum;
+
+        return total / seconds;
+    }
+
+    static bool queue_test_spsc_single_thread(Allocator* allocator) {
+        SpscQueue<u64> queue;
+        queue.init(allocator, 100);     // 128
+
+        bool valid = true;
+        u64 element = 0;
+        valid = valid && !queue.pop(element);
+
+        // Fill, check full, then wrap around with batches
+        u32 pushed = 0;
+        while(queue.push(queue_test_element(0, pushed + 1))) {
+            pushed++;
+        }
+        valid = valid && pushed == 128 && queue.get_size() == 128;
+
+        u64 batch[k_queue_test_batch];
+        u32 expected = 1;
+        for(u32 round = 0; round < 100; round++) {
+            const u32 popped = queue.pop(batch, k_queue_test_batch);
+            for(u32 i = 0; i < popped; i++) {
+                valid = valid && batch[i] == queue_test_element(0, expected++);
+            }
+            for(u32 i = 0; i < popped; i++) {
+                batch[i] = queue_test_element(0, pushed + 1 + i);
+            }
+            valid = valid && queue.push(batch, popped) == popped;
+            pushed += popped;
+        }
+        valid = valid && queue.push(batch, 1) == 0;
+
+        while(queue.pop(element)) {
+            valid = valid && element == queue_test_element(0, expected++);
+        }
+        valid = valid && expected == pushed + 1;
+
+        queue.shutdown();
+        return valid;
+    }
+
+    static void queue_test_spsc_producer(SpscQueue<u64>* queue) {
+        u64 batch[k_queue_test_batch];
+        u32 sequence = 1;
+        while(sequence <= k_queue_test_elements) {
+            // Alternate single and batched pushes
+            if(sequence & 1) {
+                if(!queue->push(queue_test_element(0, sequence))) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                sequence++;
+            } else {
+                u32 count = 0;
+                while(count < k_queue_test_batch && sequence + count <= k_queue_test_elements) {
+                    batch[count] = queue_test_element(0, sequence + count);
+                    count++;
+                }
+                const u32 pushed = queue->push(batch, count);
+                if(pushed == 0) {
+                    std::this_thread::yield();
+                }
+                sequence += pushed;
+            }
+        }
+    }
+
+    bool queue_test() {
+        // Thread caches, the MPSC queue allocates nodes from the producers and frees them from the consumer
+        HeapAllocator heap;
+        heap.init(puffin_mega(64), true);
+
+        const u32 hardware_threads = std::thread::hardware_concurrency();
+        const u32 max_threads = hardware_threads < 2 ? 2 : (hardware_threads > k_queue_test_max_threads ? k_queue_test_max_threads : hardware_threads);
+        const u32 half_threads = max_threads / 2 > 1 ? max_threads / 2 : 2;
+
+        bool valid = queue_test_spsc_single_thread(&heap);
+
+        // SPSC, ordered with single and batched pushes
+        SpscQueue<u64> spsc;
+        spsc.init(&heap, k_queue_test_capacity);
+        {
+            std::thread producer(queue_test_spsc_producer, &spsc);
+            u64 batch[k_queue_test_batch];
+            u32 expected = 1;
+            while(expected <= k_queue_test_elements) {
+                const u32 popped = spsc.pop(batch, (expected & 1) ? 1 : k_queue_test_batch);
+                if(popped == 0) {
+                    std::this_thread::yield();
+                }
+                for(u32 i = 0; i < popped; i++) {
+                    valid = valid && batch[i] == queue_test_element(0, expected++);
+                }
+            }
+            producer.join();
+            valid = valid && spsc.get_size() == 0;
+        }
+
+        // MPMC, a tiny ring so that producers and consumers keep lapping each other
+        MpmcQueue<u64> mpmc;
+        mpmc.init(&heap, 4);
+        queue_test_run(mpmc, half_threads, half_threads, valid);
+        valid = valid && mpmc.get_size() == 0;
+        mpmc.shutdown();
+
+        MpscQueue<u64> mpsc;
+        mpsc.init(&heap);
+        queue_test_run(mpsc, half_threads, 1, valid);
+        valid = valid && mpsc.is_empty();
+        mpsc.shutdown();
+
+        p_print("Queue test %s, %u producers and consumers, %u elements each\n", valid ? "passed" : "failed", half_threads, k_queue_test_elements);
+
+        // Throughput under contention, against the same ring under a mutex
+        p_print("Queue benchmark, M elements/s\n");
+        {
+            MutexQueue locked;
+            locked.init(&heap, k_queue_test_capacity);
+            const f64 spsc_rate = queue_test_run(spsc, 1, 1, valid);
+            const f64 locked_rate = queue_test_run(locked, 1, 1, valid);
+            p_print("\t1 to 1: spsc %6.2f, mutex %6.2f\n", spsc_rate / 1000000.0, locked_rate / 1000000.0);
+            locked.shutdown();
+        }
+        for(u32 thread_count = 1; thread_count <= half_threads; thread_count *= 2) {
+            MutexQueue locked;
+            locked.init(&heap, k_queue_test_capacity);
+            mpmc.init(&heap, k_queue_test_capacity);
+
+            const f64 mpmc_rate = queue_test_run(mpmc, thread_count, thread_count, valid);
+            const f64 locked_rate = queue_test_run(locked, thread_count, thread_count, valid);
+            p_print("\t%u to %u: mpmc %6.2f, mutex %6.2f\n", thread_count, thread_count, mpmc_rate / 1000000.0, locked_rate / 1000000.0);
+
+            mpmc.shutdown();
+            locked.shutdown();
+        }
+        for(u32 thread_count = 1; thread_count <= half_threads; thread_count *= 2) {
+            MutexQueue locked;
+            locked.init(&heap, k_queue_test_capacity);
+            mpsc.init(&heap);
+
+            const f64 mpsc_rate = queue_test_run(mpsc, thread_count, 1, valid);
+            const f64 locked_rate = queue_test_run(locked, thread_count, 1, valid);
+            p_print("\t%u to 1: mpsc %6.2f, mutex %6.2f\n", thread_count, mpsc_rate / 1000000.0, locked_rate / 1000000.0);
+
+            mpsc.shutdown();
+            locked.shutdown();
+        }
+        spsc.shutdown();
+
+        heap.shutdown();
+        return valid;
+    }
+
+}
@@ -0,0 +1,375 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "memory.hpp"
+#include "assert.hpp"
+
+#include <atomic>
+#include <type_traits>
+
+namespace puffin {
+
+    // Concurrent Queues /////////////////////////////////////////////
+    //
+    // SpscQueue    bounded ring, one producer and one consumer thread. Each side caches the index of the other
+    //              one and only reloads it when the ring looks full or empty.
+    // MpmcQueue    bounded ring, any number of producers and consumers. Every cell has a sequence number that
+    //              tells whether it is ready to be written or read for the current lap (Vyukov's queue).
+    // MpscQueue    unbounded linked list, any number of producers and one consumer. Push never fails, it takes
+    //              a node from the allocator, which has to be thread safe.
+    //
+    // Indices written by different threads live on their own cache line. Push and pop are lock free and never
+    // wait: a full bounded queue fails the push, an empty queue fails the pop.
+    // Elements are copied in and out, they must be trivially copyable.
+
+    static const u32        k_queue_cache_line_size = 64;
+
+    // Queue index alone on its cache line
+    struct alignas(k_queue_cache_line_size) QueueIndex {
+        std::atomic<u64>    value{ 0 };
+        u64                 cached = 0;         // Last value seen of the opposite index, SpscQueue only
+    };
+
+    // SPSC Queue ///////////////////////////////////////////////////
+    template <typename T>
+    struct SpscQueue {
+        static_assert(std::is_trivially_copyable_v<T>, "Elements are copied in and out of the ring");
+
+        // Capacity is rounded up to a power of 2
+        void                init(Allocator* allocator, u32 capacity);
+        void                shutdown();
+
+        // Producer thread only. False if the queue is full.
+        bool                push(const T& element);
+        // Pushes as many as fit, returns how many
+        u32                 push(const T* elements, u32 count);
+
+        // Consumer thread only. False if the queue is empty.
+        bool                pop(T& out_element);
+        // Pops up to max_count, returns how many
+        u32                 pop(T* out_elements, u32 max_count);
+
+        // Exact only when called from one of the two threads with the other one idle
+        u32                 get_size() const;
+
+        QueueIndex          head;               // Written by the consumer, cached = tail
+        QueueIndex          tail;               // Written by the producer, cached = head
+
+        T*                  elements    = nullptr;
+        u64                 mask        = 0;
+        Allocator*          allocator   = nullptr;
+
+    }; // struct SpscQueue
+
+    // MPMC Queue ///////////////////////////////////////////////////
+    template <typename T>
+    struct MpmcQueueCell {
+        std::atomic<u64>    sequence;
+        T                   element;
+    };
+
+    template <typename T>
+    struct MpmcQueue {
+        static_assert(std::is_trivially_copyable_v<T>, "Elements are copied in and out of the ring");
+
+        using Cell = MpmcQueueCell<T>;
+
+        // Capacity is rounded up to a power of 2, at least 2
+        void                init(Allocator* allocator, u32 capacity);
+        void                shutdown();
+
+        // Any thread. False if the queue is full.
+        bool                push(const T& element);
+        // Any thread. False if the queue is empty.
+        bool                pop(T& out_element);
+
+        // Approximate while other threads use the queue
+        u32                 get_size() const;
+
+        QueueIndex          enqueue_position;
+        QueueIndex          dequeue_position;
+
+        Cell*               cells       = nullptr;
+        u64                 mask        = 0;
+        Allocator*          allocator   = nullptr;
+
+    }; // struct MpmcQueue
+
+    // MPSC Queue ///////////////////////////////////////////////////
+    //
+    // The consumer owns the oldest node, a stub at first, and frees it when it moves past it. A producer swaps
+    // itself in as the newest node and then links the previous one to it: until it does, the consumer sees
+    // the queue end there, so pop can fail while a push is halfway.
+    template <typename T>
+    struct MpscQueueNode {
+        std::atomic<MpscQueueNode*> next;
+        T                   element;
+    };
+
+    template <typename T>
+    struct MpscQueue {
+        static_assert(std::is_trivially_copyable_v<T>, "Elements are copied in and out of the nodes");
+
+        using Node = MpscQueueNode<T>;
+
+        void                init(Allocator* allocator);
+        // Frees the elements still queued
+        void                shutdown();
+
+        // Any thread
+        void                push(const T& element);
+        // Consumer thread only. False if the queue is empty.
+        bool                pop(T& out_element);
+
+        // Consumer thread only
+        bool                is_empty() const;
+
+        alignas(k_queue_cache_line_size) std::atomic<Node*> newest{ nullptr };      // Written by producers
+        alignas(k_queue_cache_line_size) Node* oldest = nullptr;                    // Written by the consumer
+
+        Allocator*          allocator   = nullptr;
+
+    }; // struct MpscQueue
+
+    // Multithreaded stress tests of the three queues, checking that every element comes out once and in the
+    // order its producer pushed it, followed by a throughput benchmark against a ring under a mutex.
+    bool                    queue_test();
+
+    // Implementation /////////////////////////////////////////////////
+
+    inline u64 queue_capacity_round(u32 capacity) {
+        u64 rounded = 2;
+        while(rounded < capacity) {
+            rounded <<= 1;
+        }
+        return rounded;
+    }
+
+    // SPSC Queue ///////////////////////////////////////////////////
+    template <typename T>
+    inline void SpscQueue<T>::init(Allocator* allocator_, u32 capacity) {
+        allocator = allocator_;
+
+        const u64 size = queue_capacity_round(capacity);
+        mask = size - 1;
+        elements = (T*)allocator->allocate(size * sizeof(T), k_queue_cache_line_size, __FILE__, __LINE__);
+
+        head.value.store(0, std::memory_order_relaxed);
+        head.cached = 0;
+        tail.value.store(0, std::memory_order_relaxed);
+        tail.cached = 0;
+    }
+
+    template <typename T>
+    inline void SpscQueue<T>::shutdown() {
+        if(elements) {
+            puffin_free(elements, allocator);
+            elements = nullptr;
+        }
+    }
+
+    template <typename T>
+    inline bool SpscQueue<T>::push(const T& element) {
+        const u64 write = tail.value.load(std::memory_order_relaxed);
+        if(write - tail.cached > mask) {
+            tail.cached = head.value.load(std::memory_order_acquire);
+            if(write - tail.cached > mask) {
+                return false;
+            }
+        }
+
+        elements[write & mask] = element;
+        tail.value.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T>
+    inline u32 SpscQueue<T>::push(const T* elements_, u32 count) {
+        const u64 write = tail.value.load(std::memory_order_relaxed);
+        if(write + count - tail.cached > mask + 1) {
+            tail.cached = head.value.load(std::memory_order_acquire);
+        }
+
+        const u64 free_slots = mask + 1 - (write - tail.cached);
+        const u32 pushed = count < free_slots ? count : (u32)free_slots;
+        for(u32 i = 0; i < pushed; i++) {
+            elements[(write + i) & mask] = elements_[i];
+        }
+        tail.value.store(write + pushed, std::memory_order_release);
+        return pushed;
+    }
+
+    template <typename T>
+    inline bool SpscQueue<T>::pop(T& out_element) {
+        const u64 read = head.value.load(std::memory_order_relaxed);
+        if(read == head.cached) {
+            head.cached = tail.value.load(std::memory_order_acquire);
+            if(read == head.cached) {
+                return false;
+            }
+        }
+
+        out_element = elements[read & mask];
+        head.value.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T>
+    inline u32 SpscQueue<T>::pop(T* out_elements, u32 max_count) {
+        const u64 read = head.value.load(std::memory_order_relaxed);
+        if(head.cached - read < max_count) {
+            head.cached = tail.value.load(std::memory_order_acquire);
+        }
+
+        const u64 available = head.cached - read;
+        const u32 popped = max_count < available ? max_count : (u32)available;
+        for(u32 i = 0; i < popped; i++) {
+            out_elements[i] = elements[(read + i) & mask];
+        }
+        head.value.store(read + popped, std::memory_order_release);
+        return popped;
+    }
+
+    template <typename T>
+    inline u32 SpscQueue<T>::get_size() const {
+        const u64 read = head.value.load(std::memory_order_acquire);
+        const u64 write = tail.value.load(std::memory_order_acquire);
+        return write > read ? (u32)(write - read) : 0;
+    }
+
+    // MPMC Queue ///////////////////////////////////////////////////
+    template <typename T>
+    inline void MpmcQueue<T>::init(Allocator* allocator_, u32 capacity) {
+        allocator = allocator_;
+
+        const u64 size = queue_capacity_round(capacity);
+        mask = size - 1;
+        cells = (Cell*)allocator->allocate(size * sizeof(Cell), k_queue_cache_line_size, __FILE__, __LINE__);
+
+        // Cell i is ready to be written at position i
+        for(u64 i = 0; i < size; i++) {
+            new (&cells[i].sequence) std::atomic<u64>(i);
+        }
+        enqueue_position.value.store(0, std::memory_order_relaxed);
+        dequeue_position.value.store(0, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    inline void MpmcQueue<T>::shutdown() {
+        if(cells) {
+            puffin_free(cells, allocator);
+            cells = nullptr;
+        }
+    }
+
+    template <typename T>
+    inline bool MpmcQueue<T>::push(const T& element) {
+        u64 position = enqueue_position.value.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell& cell = cells[position & mask];
+            const u64 sequence = cell.sequence.load(std::memory_order_acquire);
+            const i64 difference = (i64)sequence - (i64)position;
+
+            if(difference == 0) {
+                // The cell is free for this lap, claim the position
+                if(enqueue_position.value.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.element = element;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(difference < 0) {
+                // Still holds the element of the previous lap
+                return false;
+            } else {
+                position = enqueue_position.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename T>
+    inline bool MpmcQueue<T>::pop(T& out_element) {
+        u64 position = dequeue_position.value.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell& cell = cells[position & mask];
+            const u64 sequence = cell.sequence.load(std::memory_order_acquire);
+            const i64 difference = (i64)sequence - (i64)(position + 1);
+
+            if(difference == 0) {
+                if(dequeue_position.value.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    out_element = cell.element;
+                    // Ready to be written on the next lap
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(difference < 0) {
+                // Not written yet
+                return false;
+            } else {
+                position = dequeue_position.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename T>
+    inline u32 MpmcQueue<T>::get_size() const {
+        const u64 read = dequeue_position.value.load(std::memory_order_acquire);
+        const u64 write = enqueue_position.value.load(std::memory_order_acquire);
+        return write > read ? (u32)(write - read) : 0;
+    }
+
+    // MPSC Queue ///////////////////////////////////////////////////
+    template <typename T>
+    inline void MpscQueue<T>::init(Allocator* allocator_) {
+        allocator = allocator_;
+
+        Node* stub = (Node*)puffin_alloc(sizeof(Node), allocator);
+        stub->next.store(nullptr, std::memory_order_relaxed);
+        oldest = stub;
+        newest.store(stub, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    inline void MpscQueue<T>::shutdown() {
+        Node* node = oldest;
+        while(node) {
+            Node* next = node->next.load(std::memory_order_relaxed);
+            puffin_free(node, allocator);
+            node = next;
+        }
+        oldest = nullptr;
+        newest.store(nullptr, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    inline void MpscQueue<T>::push(const T& element) {
+        Node* node = (Node*)puffin_alloc(sizeof(Node), allocator);
+        node->element = element;
+        node->next.store(nullptr, std::memory_order_relaxed);
+
+        Node* previous = newest.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    template <typename T>
+    inline bool MpscQueue<T>::pop(T& out_element) {
+        Node* next = oldest->next.load(std::memory_order_acquire);
+        if(next == nullptr) {
+            return false;
+        }
+
+        // next becomes the stub, its element has been read
+        out_element = next->element;
+        puffin_free(oldest, allocator);
+        oldest = next;
+        return true;
+    }
+
+    template <typename T>
+    inline bool MpscQueue<T>::is_empty() const {
+        return oldest->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+}
@@ -6,7 +6,7 @@
 
 #include "platform.hpp"
 #include "assert.hpp"
-#include "hash_map.hpp"
+#include "concurrent_hash_map.hpp"
 
 namespace puffin {
 
@@ -28,7 +28,8 @@ struct ResourceCompiler {
 
 struct ResourceLoader {
     virtual     Resource*           get(cstring name) = 0;
-    virtual     Resource*           get(u64 hashed_name) = 0;
+    // hashed_name comes from hash_calculate(name), for callers that look the same name up often
+    virtual     Resource*           get(cstring name, u64 hashed_name) = 0;
 
     virtual     Resource*           unload(cstring name) = 0;
 
@@ -50,7 +51,7 @@ struct ResourceManager {
     T*          get(cstring name);
 
     template <typename T>
-    T*          get(u64 hashed_name);
+    T*          get(cstring name, u64 hashed_name);
 
     template <typename T>
     T*          reload(cstring name);
@@ -58,8 +59,9 @@ struct ResourceManager {
     void        set_loader(cstring resource_type, ResourceLoader* loader);
     void        set_compiler(cstring resource_type, ResourceCompiler* compiler);
 
-    FlatHashMap<u64, ResourceLoader*>   loaders;
-    FlatHashMap<u64, ResourceCompiler*> compilers;
+    // Keyed by the type hash, which is already a hash. Loading threads look loaders up while they are registered.
+    ConcurrentFlatHashMap<u64, ResourceLoader*, HashPrecomputed>    loaders;
+    ConcurrentFlatHashMap<u64, ResourceCompiler*, HashPrecomputed>  compilers;
 
     Allocator*                          allocator;
     ResourceFilenameResolver*           filename_resolver;
@@ -92,10 +94,10 @@ inline T* ResourceManager::get(cstring name) {
 }
 
 template <typename T>
-inline T* ResourceManager::get(u64 hashed_name) {
+inline T* ResourceManager::get(cstring name, u64 hashed_name) {
     ResourceLoader* loader = loaders.get(T::k_type_hash);
     if(loader) {
-        return (T*) loader->get(hashed_name);
+        return (T*) loader->get(name, hashed_name);
     }
     return nullptr;
 }
@@ -210,26 +210,29 @@ namespace puffin {
     }
 
     // String Array ////
+    struct StringIndexMap : FlatHashMap<cstring, u32, HashString, HashStringEqual> { };
+
     void StringArray::init(Allocator* allocator_, size_t size) {
         allocator = allocator_;
 
         // Allocate also memory for the hash map
-        size_t mem_size = size +  sizeof(FlatHashMap<u64, u32>) + sizeof(FlatHashMapIterator);
+        size_t mem_size = size +  sizeof(StringIndexMap) + sizeof(FlatHashMapIterator);
         char* allocated_memory = (char*)allocator->allocate(mem_size, 1);
-        string_to_index = (FlatHashMap<u64, u32>*)allocated_memory;
+        string_to_index = (StringIndexMap*)allocated_memory;
         string_to_index->init(allocator, 8);
         string_to_index->set_default_value(u32_max);
 
-        strings_iterator = (FlatHashMapIterator*)(allocated_memory + sizeof(FlatHashMap<u64, u32>));
+        strings_iterator = (FlatHashMapIterator*)(allocated_memory + sizeof(StringIndexMap));
 
-        data = allocated_memory + sizeof(FlatHashMap<u64, u32>) + sizeof(FlatHashMapIterator);
+        data = allocated_memory + sizeof(StringIndexMap) + sizeof(FlatHashMapIterator);
 
         buffer_size = size;
         current_size = 0;
     }
 
     void StringArray::shutdown() {
-        // string_to_index contains ALL the memory including data
+        // string_to_index contains ALL the memory including data, its slots are allocated apart
+        string_to_index->shutdown();
         puffin_free(string_to_index, allocator);
         buffer_size = current_size = 0;
     }
@@ -268,21 +271,27 @@ namespace puffin {
     }
 
     cstring StringArray::intern(cstring string) {
-        static size_t seed = 0xf2ea4ffad;
+        // Keys point into data, lookups compare the content so different strings never share an index
         const size_t length = strlen(string);
-        const size_t hashed_string = puffin::hash_bytes((void*)string, length, seed);
+        const u64 hashed_string = puffin::hash_bytes((void*)string, length);
+
+        FlatHashMapIterator it = string_to_index->find_with_hash(string, hashed_string);
+        if(it.is_valid()) {
+            return data + string_to_index->get(it);
+        }
 
-        u32 string_index = string_to_index->get(hashed_string);
-        if(string_index != u32_max) {
-            return data + string_index;
+        // data can't grow, the strings already returned point into it. AtomTable has paged storage.
+        if(current_size + length + 1 > buffer_size) {
+            p_print("StringArray is full, %u bytes, could not intern %s\n", buffer_size, string);
+            return nullptr;
         }
 
-        string_index = current_size;
+        const u32 string_index = current_size;
         // Increase current buffer w/ interned string
         current_size += (u32)length + 1;
         strcpy(data + string_index, string);
 
-        string_to_index->insert(hashed_string, string_index);
+        string_to_index->insert_with_hash(data + string_index, hashed_string, string_index);
 
         return data + string_index;
     }
@@ -10,8 +10,8 @@ namespace puffin {
     // Forward Declarations
     struct Allocator;
 
-    template <typename K, typename V>
-    struct FlatHashMap;
+    // FlatHashMap<cstring, u32, HashString, HashStringEqual>, defined in string.cpp
+    struct StringIndexMap;
 
     struct FlatHashMapIterator;
 
@@ -73,7 +73,8 @@ namespace puffin {
 
         cstring                 intern(cstring string);
 
-        FlatHashMap<u64, u32>*  string_to_index; // Attempt to avoid include the hash map header
+        // Interned strings by content, to their index. Attempt to avoid include the hash map header
+        StringIndexMap*         string_to_index;
         FlatHashMapIterator*    strings_iterator;
 
         char*                   data            = nullptr;
@@ -0,0 +1,717 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "task_scheduler.hpp"
+#include "assert.hpp"
+#include "log.hpp"
+#include "time.hpp"
+
+#include <new>
+#include <string.h>
+
+namespace puffin {
+
+    static const u32        k_task_deque_capacity = 1024;
+    static const u32        k_task_pool_page_size = 1024;
+    static const u32        k_task_external_capacity = 4096;
+    // Slots kept free in a task pool for threads that obtain from it at the same time
+    static const u32        k_task_pool_headroom = 256;
+    // Rounds of looking for work before a worker goes to sleep
+    static const u32        k_task_idle_rounds = 64;
+
+    // Task Deque ////////////////////////////////////////////////////
+
+    static TaskDequeArray* task_deque_array_create(Allocator* allocator, i64 capacity) {
+        TaskDequeArray* array = (TaskDequeArray*)allocator->allocate(sizeof(TaskDequeArray) + capacity * sizeof(std::atomic<u64>),
+                                                                      alignof(TaskDequeArray), __FILE__, __LINE__);
+        array->mask = capacity - 1;
+        array->entries = (std::atomic<u64>*)(array + 1);
+        for(i64 i = 0; i < capacity; i++) {
+            new (&array->entries[i]) std::atomic<u64>(k_task_invalid);
+        }
+        return array;
+    }
+
+    void TaskDeque::init(Allocator* allocator, u32 capacity) {
+        array_allocator.init(allocator);
+        array.store(task_deque_array_create(&array_allocator, queue_capacity_round(capacity)), std::memory_order_relaxed);
+        top.value.store(0, std::memory_order_relaxed);
+        bottom.value.store(0, std::memory_order_relaxed);
+    }
+
+    void TaskDeque::shutdown() {
+        array_allocator.deallocate(array.load(std::memory_order_relaxed));
+        array.store(nullptr, std::memory_order_relaxed);
+        array_allocator.shutdown();
+    }
+
+    void TaskDeque::push(u64 task) {
+        const i64 b = bottom.value.load(std::memory_order_relaxed);
+        const i64 t = top.value.load(std::memory_order_acquire);
+        TaskDequeArray* a = array.load(std::memory_order_relaxed);
+
+        if(b - t > a->mask) {
+            TaskDequeArray* grown = task_deque_array_create(&array_allocator, (a->mask + 1) * 2);
+            for(i64 i = t; i < b; i++) {
+                grown->entries[i & grown->mask].store(a->entries[i & a->mask].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            array.store(grown, std::memory_order_release);
+            array_allocator.deallocate(a);
+            a = grown;
+        }
+
+        a->entries[b & a->mask].store(task, std::memory_order_relaxed);
+        // Thieves reading the new bottom see the task
+        bottom.value.store(b + 1, std::memory_order_release);
+    }
+
+    u64 TaskDeque::pop() {
+        const i64 b = bottom.value.load(std::memory_order_relaxed) - 1;
+        TaskDequeArray* a = array.load(std::memory_order_relaxed);
+        bottom.value.store(b, std::memory_order_release);
+        // Thieves have to see the reservation before the owner looks at top
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        i64 t = top.value.load(std::memory_order_relaxed);
+
+        u64 task = k_task_invalid;
+        if(t <= b) {
+            task = a->entries[b & a->mask].load(std::memory_order_relaxed);
+            if(t == b) {
+                // Last task, race the thieves for it
+                if(!top.value.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    task = k_task_invalid;
+                }
+                bottom.value.store(b + 1, std::memory_order_release);
+            }
+        } else {
+            bottom.value.store(b + 1, std::memory_order_release);
+        }
+        return task;
+    }
+
+    u64 TaskDeque::steal() {
+        i64 t = top.value.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const i64 b = bottom.value.load(std::memory_order_acquire);
+
+        if(t >= b) {
+            return k_task_invalid;
+        }
+
+        TaskDequeArray* a = array.load(std::memory_order_acquire);
+        const u64 task = a->entries[t & a->mask].load(std::memory_order_relaxed);
+        if(!top.value.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return k_task_invalid;
+        }
+        return task;
+    }
+
+    bool TaskDeque::is_empty() const {
+        return bottom.value.load(std::memory_order_acquire) <= top.value.load(std::memory_order_acquire);
+    }
+
+    // Task Scheduler ////////////////////////////////////////////////
+
+    static TaskScheduler s_task_scheduler;
+    TaskScheduler* TaskScheduler::instance() {
+        return &s_task_scheduler;
+    }
+
+    // Set on worker threads, the thread that called init is recognized by its id
+    static thread_local TaskScheduler*  s_current_scheduler = nullptr;
+    static thread_local u32             s_current_worker_index = k_task_external_thread;
+
+    static void task_worker_main(TaskScheduler* scheduler, u32 worker_index) {
+        s_current_scheduler = scheduler;
+        s_current_worker_index = worker_index;
+        scheduler->worker_loop(worker_index);
+    }
+
+    void TaskScheduler::init(void* configuration) {
+        TaskSchedulerConfiguration default_configuration;
+        TaskSchedulerConfiguration* config = configuration ? (TaskSchedulerConfiguration*)configuration : &default_configuration;
+
+        allocator = config->allocator ? config->allocator : &MemoryService::instance()->system_allocator;
+        // Tasks allocate and free from any worker, the system allocator included
+        PASSERTM(MemoryService::instance()->system_allocator.is_thread_safe(), "Workers need a thread safe system allocator, init the memory service with thread_safe");
+
+        u32 worker_threads = config->worker_threads;
+        if(worker_threads == 0) {
+            const u32 hardware_threads = std::thread::hardware_concurrency();
+            worker_threads = hardware_threads > 1 ? hardware_threads - 1 : 1;
+        }
+        worker_count = worker_threads + 1 < k_task_max_workers ? worker_threads + 1 : k_task_max_workers;
+
+        main_thread = std::this_thread::get_id();
+        stop.store(false, std::memory_order_relaxed);
+        sleeping.store(0, std::memory_order_relaxed);
+        wake_signals = 0;
+
+        workers = (TaskWorker*)allocator->allocate(worker_count * sizeof(TaskWorker), alignof(TaskWorker), __FILE__, __LINE__);
+        for(u32 i = 0; i < worker_count; i++) {
+            TaskWorker* worker = new (&workers[i]) TaskWorker();
+            worker->deque.init(allocator, k_task_deque_capacity);
+            worker->task_pool.init(allocator, k_task_pool_page_size, sizeof(Task));
+            worker->scratch_allocator.init_virtual(config->scratch_size);
+            worker->steal_seed = i * 0x9E3779B9u + 1;
+        }
+
+        external_task_pool.init(allocator, k_task_pool_page_size, sizeof(Task));
+        external_tasks.init(allocator, k_task_external_capacity);
+
+        // Everything is in place before the first worker looks for tasks
+        for(u32 i = 1; i < worker_count; i++) {
+            workers[i].thread = std::thread(task_worker_main, this, i);
+        }
+
+        p_print("Task scheduler started with %u workers\n", worker_count);
+    }
+
+    void TaskScheduler::shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop.store(true, std::memory_order_release);
+        }
+        sleep_condition.notify_all();
+
+        for(u32 i = 1; i < worker_count; i++) {
+            workers[i].thread.join();
+        }
+
+        for(u32 i = 0; i < worker_count; i++) {
+            TaskWorker& worker = workers[i];
+            worker.deque.shutdown();
+            worker.task_pool.shutdown();
+            worker.scratch_allocator.shutdown();
+            worker.~TaskWorker();
+        }
+        puffin_free(workers, allocator);
+        workers = nullptr;
+        worker_count = 0;
+
+        external_tasks.shutdown();
+        external_task_pool.shutdown();
+    }
+
+    u32 TaskScheduler::get_worker_index() const {
+        if(s_current_scheduler == this) {
+            return s_current_worker_index;
+        }
+        return std::this_thread::get_id() == main_thread ? 0 : k_task_external_thread;
+    }
+
+    u32 TaskScheduler::get_worker_count() const {
+        return worker_count;
+    }
+
+    StackAllocator* TaskScheduler::get_scratch_allocator() {
+        const u32 worker_index = get_worker_index();
+        return worker_index != k_task_external_thread ? &workers[worker_index].scratch_allocator : nullptr;
+    }
+
+    u32 TaskScheduler::get_grain_size(u32 count, u32 grain_size) const {
+        if(grain_size > 0) {
+            return grain_size;
+        }
+        // A few chunks per worker, so that thieves can even out uneven chunks
+        const u32 chunks = worker_count * 8;
+        return count > chunks ? (count + chunks - 1) / chunks : 1;
+    }
+
+    u64 TaskScheduler::obtain_task(u32 worker_index, TaskFunction function, void* data, u32 begin, u32 end, TaskCounter* counter) {
+        const u32 pool = worker_index != k_task_external_thread ? worker_index : worker_count;
+        ResourcePool& task_pool = pool < worker_count ? workers[pool].task_pool : external_task_pool;
+
+        // Submitting faster than tasks run fills the pool, a worker runs tasks until it drains, other threads wait
+        while(task_pool.used_indices.load(std::memory_order_relaxed) >= task_pool.max_resources - k_task_pool_headroom) {
+            if(!run_pending_task()) {
+                std::this_thread::yield();
+            }
+        }
+
+        const u32 handle = task_pool.obtain_resource();
+        Task* task = (Task*)task_pool.access_resource(handle);
+        task->function = function;
+        task->data = data;
+        task->begin = begin;
+        task->end = end;
+        task->counter = counter;
+        task->next_continuation = k_task_invalid;
+
+        return ((u64)pool << 32) | handle;
+    }
+
+    Task* TaskScheduler::access_task(u64 task) {
+        const u32 pool = (u32)(task >> 32);
+        ResourcePool& task_pool = pool < worker_count ? workers[pool].task_pool : external_task_pool;
+        return (Task*)task_pool.access_resource((u32)task);
+    }
+
+    void TaskScheduler::schedule(u64 task, u32 worker_index) {
+        if(worker_index != k_task_external_thread) {
+            workers[worker_index].deque.push(task);
+        } else {
+            while(!external_tasks.push(task)) {
+                std::this_thread::yield();
+            }
+        }
+
+        // Pairs with the sleeping increment of a worker that then looks for tasks one last time
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_relaxed) > 0) {
+            wake_worker();
+        }
+    }
+
+    void TaskScheduler::submit(TaskFunction function, void* data, u32 begin, u32 end, TaskCounter* counter) {
+        if(counter) {
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const u32 worker_index = get_worker_index();
+        schedule(obtain_task(worker_index, function, data, begin, end, counter), worker_index);
+    }
+
+    void TaskScheduler::submit_after(TaskCounter* dependency, TaskFunction function, void* data, u32 begin, u32 end, TaskCounter* counter) {
+        if(counter) {
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const u32 worker_index = get_worker_index();
+        const u64 task = obtain_task(worker_index, function, data, begin, end, counter);
+
+        {
+            // pending only goes to zero with the mutex held
+            std::lock_guard<std::mutex> lock(dependency->mutex);
+            if(dependency->pending.load(std::memory_order_acquire) > 0) {
+                access_task(task)->next_continuation = dependency->continuations;
+                dependency->continuations = task;
+                return;
+            }
+        }
+
+        schedule(task, worker_index);
+    }
+
+    void TaskScheduler::complete(TaskCounter* counter) {
+        // Counting down to anything but zero needs no lock
+        u32 pending = counter->pending.load(std::memory_order_relaxed);
+        while(pending > 1) {
+            if(counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+
+        u64 continuation = k_task_invalid;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex);
+            // A task submitted meanwhile can keep it above zero
+            if(counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                continuation = counter->continuations;
+                counter->continuations = k_task_invalid;
+            }
+        }
+        // The counter can be gone from here on
+
+        const u32 worker_index = get_worker_index();
+        while(continuation != k_task_invalid) {
+            const u64 next = access_task(continuation)->next_continuation;
+            schedule(continuation, worker_index);
+            continuation = next;
+        }
+    }
+
+    bool TaskScheduler::find_task(u32 worker_index, u64& out_task) {
+        out_task = workers[worker_index].deque.pop();
+        if(out_task != k_task_invalid) {
+            return true;
+        }
+
+        if(external_tasks.pop(out_task)) {
+            return true;
+        }
+
+        // Steal, starting from a different worker every time
+        u32& seed = workers[worker_index].steal_seed;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        const u32 start = seed % worker_count;
+        for(u32 i = 0; i < worker_count; i++) {
+            const u32 victim = (start + i) % worker_count;
+            if(victim == worker_index) {
+                continue;
+            }
+
+            out_task = workers[victim].deque.steal();
+            if(out_task != k_task_invalid) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TaskScheduler::execute(u64 task_id, u32 worker_index) {
+        // The function can submit, the task goes back to its pool first
+        Task* task = access_task(task_id);
+        const Task copy = *task;
+        const u32 pool = (u32)(task_id >> 32);
+        ResourcePool& task_pool = pool < worker_count ? workers[pool].task_pool : external_task_pool;
+        task_pool.release_resource((u32)task_id);
+
+        StackAllocator& scratch_allocator = workers[worker_index].scratch_allocator;
+        const size_t scratch_marker = scratch_allocator.get_marker();
+
+        copy.function(copy.data, copy.begin, copy.end, worker_index);
+
+        scratch_allocator.free_marker(scratch_marker);
+
+        if(copy.counter) {
+            complete(copy.counter);
+        }
+    }
+
+    bool TaskScheduler::run_pending_task() {
+        const u32 worker_index = get_worker_index();
+        if(worker_index == k_task_external_thread) {
+            return false;
+        }
+
+        u64 task;
+        if(!find_task(worker_index, task)) {
+            return false;
+        }
+        execute(task, worker_index);
+        return true;
+    }
+
+    void TaskScheduler::wait(TaskCounter* counter) {
+        while(counter->pending.load(std::memory_order_acquire) > 0) {
+            if(!run_pending_task()) {
+                std::this_thread::yield();
+            }
+        }
+
+        // The last task can still be releasing the lock
+        std::lock_guard<std::mutex> lock(counter->mutex);
+    }
+
+    void TaskScheduler::wait_blocking(TaskCounter* counter) {
+        // Tasks queued on the calling worker are stolen by the others
+        wake_worker();
+        while(counter->pending.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+
+        std::lock_guard<std::mutex> lock(counter->mutex);
+    }
+
+    bool TaskScheduler::has_pending_tasks() const {
+        for(u32 i = 0; i < worker_count; i++) {
+            if(!workers[i].deque.is_empty()) {
+                return true;
+            }
+        }
+        return external_tasks.get_size() > 0;
+    }
+
+    void TaskScheduler::wake_worker() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            if(wake_signals >= sleeping.load(std::memory_order_relaxed)) {
+                return;
+            }
+            wake_signals++;
+        }
+        sleep_condition.notify_one();
+    }
+
+    void TaskScheduler::worker_loop(u32 worker_index) {
+        u32 idle_rounds = 0;
+
+        while(!stop.load(std::memory_order_acquire)) {
+            u64 task;
+            if(find_task(worker_index, task)) {
+                execute(task, worker_index);
+                idle_rounds = 0;
+                continue;
+            }
+
+            if(++idle_rounds < k_task_idle_rounds) {
+                std::this_thread::yield();
+                continue;
+            }
+            idle_rounds = 0;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            // A task scheduled before the increment is seen here, one scheduled after it wakes a worker
+            if(!has_pending_tasks()) {
+                sleep_condition.wait(lock, [&]() { return wake_signals > 0 || stop.load(std::memory_order_acquire); });
+                if(wake_signals > 0) {
+                    wake_signals--;
+                }
+            }
+            sleeping.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Test //////////////////////////////////////////////////////////
+
+    static const u32        k_task_test_count = 1000003;        // Not a multiple of any grain size
+    static const u32        k_task_test_chain = 16;
+    static const u32        k_task_benchmark_count = 1 << 22;
+    static const u32        k_task_benchmark_work = 64;
+    static const u32        k_task_benchmark_tiny_tasks = 1 << 20;
+    static const u32        k_task_benchmark_runs = 3;
+
+    struct TaskTestChain {
+        std::atomic<u32>    step{ 0 };
+        u32                 order[k_task_test_chain];
+        TaskCounter         counters[k_task_test_chain];
+    };
+
+    // Link begin of the chain runs after link begin - 1, and records the step it saw
+    static void task_test_chain_link(void* data, u32 begin, u32 /*end*/, u32 /*worker_index*/) {
+        TaskTestChain* chain = (TaskTestChain*)data;
+        chain->order[begin] = chain->step.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct TaskTestFanIn {
+        std::atomic<u32>    done{ 0 };
+        u32                 seen_at_join = 0;
+    };
+
+    static void task_test_fan_in_work(void* data, u32 begin, u32 end, u32 /*worker_index*/) {
+        TaskTestFanIn* fan_in = (TaskTestFanIn*)data;
+        fan_in->done.fetch_add(end - begin, std::memory_order_relaxed);
+    }
+
+    static void task_test_fan_in_join(void* data, u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {
+        TaskTestFanIn* fan_in = (TaskTestFanIn*)data;
+        fan_in->seen_at_join = fan_in->done.load(std::memory_order_relaxed);
+    }
+
+    static void task_test_tiny(void* /*data*/, u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {
+    }
+
+    // Some integer work per element, uneven so that the loop is not vectorized in one place and not the other
+    static void task_test_work(u32* values, u32 begin, u32 end) {
+        for(u32 i = begin; i < end; i++) {
+            u32 value = i;
+            const u32 rounds = k_task_benchmark_work + (i & 31);
+            for(u32 j = 0; j < rounds; j++) {
+                value ^= value << 13;
+                value ^= value >> 17;
+                value ^= value << 5;
+            }
+            values[i] = value;
+        }
+    }
+
+    static bool task_scheduler_test_run(TaskScheduler& scheduler, Allocator* allocator) {
+        bool valid = true;
+
+        // Every index once, with several grain sizes
+        u8* visits = (u8*)puffin_alloc(k_task_test_count, allocator);
+        const u32 grain_sizes[] = { 0, 1, 7, 1000, k_task_test_count, k_task_test_count * 2 };
+        for(u32 grain_size : grain_sizes) {
+            // Grain 1 splits down to single elements, keep it short
+            const u32 count = grain_size == 1 ? 10007 : k_task_test_count;
+            memset(visits, 0, count);
+            scheduler.parallel_for(count, grain_size, [&](u32 begin, u32 end, u32 /*worker_index*/) {
+                for(u32 i = begin; i < end; i++) {
+                    visits[i]++;
+                }
+            });
+            for(u32 i = 0; i < count; i++) {
+                valid = valid && visits[i] == 1;
+            }
+        }
+        scheduler.parallel_for(0, 0, [&](u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) { valid = false; });
+        puffin_free(visits, allocator);
+
+        // Reductions match the serial sum, floats included since chunks are reduced in order
+        const u64 sum = scheduler.parallel_reduce<u64>(k_task_test_count, 0, 0,
+            [](u32 begin, u32 end, u32 /*worker_index*/) {
+                u64 chunk_sum = 0;
+                for(u32 i = begin; i < end; i++) {
+                    chunk_sum += i;
+                }
+                return chunk_sum;
+            },
+            [](u64 a, u64 b) { return a + b; });
+        valid = valid && sum == (u64)k_task_test_count * (k_task_test_count - 1) / 2;
+
+        const u32 float_grain = 4096;
+        auto float_chunk = [](u32 begin, u32 end, u32 /*worker_index*/) {
+            f32 chunk_sum = 0.f;
+            for(u32 i = begin; i < end; i++) {
+                chunk_sum += 1.f / (f32)(i + 1);
+            }
+            return chunk_sum;
+        };
+        f32 serial_sum = 0.f;
+        for(u32 begin = 0; begin < k_task_test_count; begin += float_grain) {
+            const u32 end = begin + float_grain < k_task_test_count ? begin + float_grain : k_task_test_count;
+            serial_sum = serial_sum + float_chunk(begin, end, 0);
+        }
+        for(u32 run = 0; run < 4; run++) {
+            const f32 parallel_sum = scheduler.parallel_reduce<f32>(k_task_test_count, float_grain, 0.f, float_chunk,
+                                                                    [](f32 a, f32 b) { return a + b; });
+            valid = valid && parallel_sum == serial_sum;
+        }
+
+        // Dependencies: a chain where each link waits on the previous one
+        TaskTestChain chain;
+        scheduler.submit(task_test_chain_link, &chain, 0, 1, &chain.counters[0]);
+        for(u32 i = 1; i < k_task_test_chain; i++) {
+            scheduler.submit_after(&chain.counters[i - 1], task_test_chain_link, &chain, i, i + 1, &chain.counters[i]);
+        }
+        scheduler.wait(&chain.counters[k_task_test_chain - 1]);
+        for(u32 i = 0; i < k_task_test_chain; i++) {
+            scheduler.wait(&chain.counters[i]);
+            valid = valid && chain.order[i] == i;
+        }
+
+        // Fan in: the join runs after all of the work tasks
+        for(u32 run = 0; run < 100; run++) {
+            TaskTestFanIn fan_in;
+            TaskCounter work;
+            TaskCounter join;
+            for(u32 i = 0; i < 64; i++) {
+                scheduler.submit(task_test_fan_in_work, &fan_in, i * 10, i * 10 + 10, &work);
+            }
+            scheduler.submit_after(&work, task_test_fan_in_join, &fan_in, 0, 0, &join);
+            scheduler.wait(&join);
+            scheduler.wait(&work);
+            valid = valid && fan_in.seen_at_join == 640;
+        }
+
+        // Nested loops wait inside tasks, scratch is given back when tasks return
+        std::atomic<u64> nested_sum{ 0 };
+        scheduler.parallel_for(64, 1, [&](u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {
+            StackAllocator* scratch_allocator = scheduler.get_scratch_allocator();
+            u32* values = (u32*)scratch_allocator->allocate(1000 * sizeof(u32), alignof(u32));
+            scheduler.parallel_for(1000, 10, [&](u32 inner_begin, u32 inner_end, u32 /*inner_worker*/) {
+                scheduler.get_scratch_allocator()->allocate(256, 16);
+                for(u32 i = inner_begin; i < inner_end; i++) {
+                    values[i] = i;
+                }
+            });
+            u64 outer_sum = 0;
+            for(u32 i = 0; i < 1000; i++) {
+                outer_sum += values[i];
+            }
+            nested_sum.fetch_add(outer_sum, std::memory_order_relaxed);
+        });
+        valid = valid && nested_sum.load() == 64ull * 999 * 1000 / 2;
+        for(u32 i = 0; i < scheduler.get_worker_count(); i++) {
+            valid = valid && scheduler.workers[i].scratch_allocator.get_marker() == 0;
+        }
+
+        // Threads that are not workers submit through the shared queue and wait without running tasks
+        std::atomic<u32> external_sum{ 0 };
+        std::atomic<u32> external_workers{ 0 };
+        std::thread external_threads[2];
+        for(std::thread& external_thread : external_threads) {
+            external_thread = std::thread([&]() {
+                external_workers.fetch_add(scheduler.get_worker_index() != k_task_external_thread, std::memory_order_relaxed);
+                scheduler.parallel_for(10000, 100, [&](u32 begin, u32 end, u32 /*worker_index*/) {
+                    external_sum.fetch_add(end - begin, std::memory_order_relaxed);
+                });
+            });
+        }
+        for(std::thread& external_thread : external_threads) {
+            external_thread.join();
+        }
+        valid = valid && external_sum.load() == 20000 && external_workers.load() == 0;
+
+        return valid;
+    }
+
+    bool task_scheduler_test() {
+        HeapAllocator heap;
+        heap.init(puffin_mega(64), true);
+
+        const u32 hardware_threads = std::thread::hardware_concurrency();
+        const u32 max_threads = hardware_threads < 2 ? 2 : (hardware_threads > 16 ? 16 : hardware_threads);
+
+        bool valid = true;
+        for(u32 worker_threads = 1; worker_threads < max_threads * 2; worker_threads *= 2) {
+            TaskSchedulerConfiguration configuration;
+            configuration.worker_threads = worker_threads;
+            configuration.allocator = &heap;
+            configuration.scratch_size = puffin_mega(16);
+
+            TaskScheduler scheduler;
+            scheduler.init(&configuration);
+            valid = task_scheduler_test_run(scheduler, &heap) && valid;
+            scheduler.shutdown();
+        }
+        p_print("Task scheduler test %s\n", valid ? "passed" : "failed");
+
+        // Scaling of a loop with no sharing, against the same loop on one thread
+        u32* values = (u32*)puffin_alloc(k_task_benchmark_count * sizeof(u32), &heap);
+        f64 serial_seconds = 1e9;
+        for(u32 run = 0; run < k_task_benchmark_runs; run++) {
+            const i64 start = time_now();
+            task_test_work(values, 0, k_task_benchmark_count);
+            const f64 seconds = time_delta_seconds(start, time_now());
+            serial_seconds = seconds < serial_seconds ? seconds : serial_seconds;
+        }
+        const u32 checksum = values[k_task_benchmark_count / 3];
+
+        p_print("Task scheduler benchmark, %u elements, serial %.2fms\n", k_task_benchmark_count, serial_seconds * 1000.0);
+        for(u32 thread_count = 2; thread_count <= max_threads; thread_count *= 2) {
+            TaskSchedulerConfiguration configuration;
+            configuration.worker_threads = thread_count - 1;
+            configuration.allocator = &heap;
+            configuration.scratch_size = puffin_mega(16);
+
+            TaskScheduler scheduler;
+            scheduler.init(&configuration);
+
+            f64 loop_seconds = 1e9;
+            for(u32 run = 0; run < k_task_benchmark_runs; run++) {
+                const i64 start = time_now();
+                scheduler.parallel_for(k_task_benchmark_count, 0, [&](u32 begin, u32 end, u32 /*worker_index*/) {
+                    task_test_work(values, begin, end);
+                });
+                const f64 seconds = time_delta_seconds(start, time_now());
+                loop_seconds = seconds < loop_seconds ? seconds : loop_seconds;
+            }
+            valid = valid && values[k_task_benchmark_count / 3] == checksum;
+
+            // Cost of a task that does nothing, split by parallel_for or submitted one by one
+            f64 split_seconds = 1e9;
+            f64 submit_seconds = 1e9;
+            for(u32 run = 0; run < k_task_benchmark_runs; run++) {
+                i64 start = time_now();
+                scheduler.parallel_for(k_task_benchmark_tiny_tasks, 1, [](u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {});
+                f64 seconds = time_delta_seconds(start, time_now());
+                split_seconds = seconds < split_seconds ? seconds : split_seconds;
+
+                TaskCounter counter;
+                start = time_now();
+                for(u32 i = 0; i < k_task_benchmark_tiny_tasks; i++) {
+                    scheduler.submit(task_test_tiny, nullptr, i, i + 1, &counter);
+                }
+                scheduler.wait(&counter);
+                seconds = time_delta_seconds(start, time_now());
+                submit_seconds = seconds < submit_seconds ? seconds : submit_seconds;
+            }
+
+            p_print("\t%2u workers: loop %7.2fms, speedup %5.2fx, tiny tasks %5.1fns split, %5.1fns submitted\n",
+                    scheduler.get_worker_count(), loop_seconds * 1000.0, serial_seconds / loop_seconds,
+                    split_seconds * 1e9 / k_task_benchmark_tiny_tasks, submit_seconds * 1e9 / k_task_benchmark_tiny_tasks);
+            scheduler.shutdown();
+        }
+        puffin_free(values, &heap);
+
+        heap.shutdown();
+        return valid;
+    }
+
+}
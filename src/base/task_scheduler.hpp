@@ -0,0 +1,256 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "service.hpp"
+#include "memory.hpp"
+#include "data_structures.hpp"
+#include "queue.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace puffin {
+
+    // Task Scheduler ////////////////////////////////////////////////
+    //
+    // Every worker owns a Chase-Lev deque: it pushes and pops its own tasks at the bottom, idle workers steal
+    // from the top of the others. The thread that calls init is worker 0, it runs tasks only while it waits.
+    // Threads that are not workers can submit and wait too, their tasks go through a shared MpmcQueue.
+    //
+    // Tasks are obtained from a ResourcePool of the submitting worker, deques hold (pool << 32 | handle).
+    // Submitting to a full pool runs pending tasks first, or waits on threads that are not workers.
+    // A finished task counts its TaskCounter down. Waiting on a counter runs other tasks meanwhile, a task
+    // submitted after a counter is held by the counter until it reaches zero.
+    // Each worker has a scratch stack, whatever a task allocates from it is freed when the task returns.
+
+    struct TaskScheduler;
+
+    // Runs [begin, end) of data. worker_index picks the scratch allocator and per worker data.
+    typedef void            (*TaskFunction)(void* data, u32 begin, u32 end, u32 worker_index);
+
+    static const u32        k_task_external_thread = u32_max;   // Worker index of threads that are not workers
+    static const u64        k_task_invalid = u64_max;
+    static const u32        k_task_max_workers = 64;
+
+    // Tasks still pending, and the tasks to submit once none is
+    struct TaskCounter {
+        std::atomic<u32>    pending{ 0 };
+        std::mutex          mutex;                          // Held while pending goes to zero
+        u64                 continuations = k_task_invalid;
+    };
+
+    struct Task {
+        TaskFunction        function;
+        void*               data;
+        u32                 begin;
+        u32                 end;
+        TaskCounter*        counter;
+        u64                 next_continuation;
+    };
+
+    struct alignas(k_queue_cache_line_size) TaskDequeIndex {
+        std::atomic<i64>    value{ 0 };
+    };
+
+    struct TaskDequeArray {
+        i64                 mask;
+        std::atomic<u64>*   entries;                        // Follow the struct
+    };
+
+    struct TaskDeque {
+        void                init(Allocator* allocator, u32 capacity);
+        void                shutdown();
+
+        // Owner only, grows when full
+        void                push(u64 task);
+        // Owner only, newest task first. k_task_invalid if empty.
+        u64                 pop();
+        // Any thread, oldest task first. k_task_invalid if empty or lost to another thief.
+        u64                 steal();
+
+        bool                is_empty() const;
+
+        TaskDequeIndex      top;                            // Next to steal
+        TaskDequeIndex      bottom;                         // Next to push
+        std::atomic<TaskDequeArray*> array{ nullptr };
+
+        // Thieves can still read an array replaced by a bigger one, it is freed at shutdown
+        DeferredFreeAllocator array_allocator;
+    };
+
+    struct alignas(k_queue_cache_line_size) TaskWorker {
+        TaskDeque           deque;
+        ResourcePool        task_pool;
+        StackAllocator      scratch_allocator;
+        std::thread         thread;
+        u32                 steal_seed      = 0;
+    };
+
+    // Loop state of parallel_for_async, it must live until the counter is waited on
+    template <typename Function>
+    struct ParallelForTask {
+        TaskScheduler*      scheduler       = nullptr;
+        Function*           function        = nullptr;
+        u32                 grain_size      = 1;
+        TaskCounter         counter;
+    };
+
+    struct TaskSchedulerConfiguration {
+        // Threads besides the one calling init, 0 for one per remaining hardware thread
+        u32                 worker_threads  = 0;
+        // Address space of each scratch stack, committed as it grows
+        size_t              scratch_size    = puffin_mega(64);
+        // Must be thread safe, defaults to the system allocator
+        Allocator*          allocator       = nullptr;
+    };
+
+    struct TaskScheduler : public Service {
+
+        PUFFIN_DECLARE_SERVICE(TaskScheduler);
+
+        void                init(void* configuration) override;
+        void                shutdown() override;
+
+        // counter can be null
+        void                submit(TaskFunction function, void* data, u32 begin, u32 end, TaskCounter* counter);
+        // Held until dependency reaches zero
+        void                submit_after(TaskCounter* dependency, TaskFunction function, void* data, u32 begin, u32 end, TaskCounter* counter);
+
+        // Runs other tasks until the counter reaches zero, then the counter can be reused or destroyed.
+        // Threads that are not workers just yield.
+        void                wait(TaskCounter* counter);
+        // Waits without running any task, so that the caller is not held up by unrelated long tasks. The
+        // counted tasks are left to the other workers, there is always at least one.
+        void                wait_blocking(TaskCounter* counter);
+        // Runs one pending task, false if there was none or the caller is not a worker
+        bool                run_pending_task();
+
+        // function(begin, end, worker_index) over [0, count), split in halves down to chunks of grain_size.
+        // 0 picks a grain size. The function must live until parallel_for.counter is waited on.
+        template <typename Function>
+        void                parallel_for_async(ParallelForTask<Function>& parallel_for, u32 count, u32 grain_size, Function& function);
+        template <typename Function>
+        void                parallel_for(u32 count, u32 grain_size, Function&& function);
+
+        // map(begin, end, worker_index) returns the T of a chunk. Chunks are reduced in order on the calling
+        // thread, the result does not depend on which worker ran what.
+        template <typename T, typename Map, typename Reduce>
+        T                   parallel_reduce(u32 count, u32 grain_size, const T& identity, Map&& map, Reduce&& reduce);
+
+        // 0 for the thread that called init, k_task_external_thread for threads that are not workers
+        u32                 get_worker_index() const;
+        u32                 get_worker_count() const;
+        // Scratch of the calling worker, nullptr outside of workers
+        StackAllocator*     get_scratch_allocator();
+
+        u32                 get_grain_size(u32 count, u32 grain_size) const;
+
+        // Internal
+        u64                 obtain_task(u32 worker_index, TaskFunction function, void* data, u32 begin, u32 end, TaskCounter* counter);
+        Task*               access_task(u64 task);
+        void                schedule(u64 task, u32 worker_index);
+        bool                find_task(u32 worker_index, u64& out_task);
+        void                execute(u64 task, u32 worker_index);
+        void                complete(TaskCounter* counter);
+        bool                has_pending_tasks() const;
+        void                wake_worker();
+        void                worker_loop(u32 worker_index);
+
+        TaskWorker*         workers         = nullptr;
+        u32                 worker_count    = 0;            // Thread that called init included
+
+        // Tasks submitted by threads that are not workers
+        ResourcePool        external_task_pool;
+        MpmcQueue<u64>      external_tasks;
+
+        std::thread::id     main_thread;
+        std::atomic<bool>   stop{ false };
+
+        // Idle workers sleep, wake_signals counts the pending wake ups
+        std::atomic<u32>    sleeping{ 0 };
+        u32                 wake_signals    = 0;
+        std::mutex          sleep_mutex;
+        std::condition_variable sleep_condition;
+
+        Allocator*          allocator       = nullptr;
+
+        static constexpr cstring k_name     = "puffin_task_scheduler_service";
+
+    }; // struct TaskScheduler
+
+    // Checks loops, reductions, dependencies, nested waits and scratch usage, followed by a scaling benchmark
+    // over worker counts and a benchmark of the cost of tiny tasks. Returns true if every check passed.
+    bool                    task_scheduler_test();
+
+    // Implementation /////////////////////////////////////////////////
+
+    // Splits off the upper half until a single chunk is left, thieves take the big halves.
+    // Chunks start at multiples of the grain size.
+    template <typename Function>
+    void task_parallel_for_range(void* data, u32 begin, u32 end, u32 worker_index) {
+        ParallelForTask<Function>* parallel_for = (ParallelForTask<Function>*)data;
+        const u32 grain_size = parallel_for->grain_size;
+
+        while(end - begin > grain_size) {
+            const u32 chunks = (end - begin + grain_size - 1) / grain_size;
+            const u32 middle = begin + (chunks / 2) * grain_size;
+            parallel_for->scheduler->submit(task_parallel_for_range<Function>, data, middle, end, &parallel_for->counter);
+            end = middle;
+        }
+
+        (*parallel_for->function)(begin, end, worker_index);
+    }
+
+    template <typename Function>
+    inline void TaskScheduler::parallel_for_async(ParallelForTask<Function>& parallel_for, u32 count, u32 grain_size, Function& function) {
+        parallel_for.scheduler = this;
+        parallel_for.function = &function;
+        parallel_for.grain_size = get_grain_size(count, grain_size);
+
+        if(count > 0) {
+            submit(task_parallel_for_range<Function>, &parallel_for, 0, count, &parallel_for.counter);
+        }
+    }
+
+    template <typename Function>
+    inline void TaskScheduler::parallel_for(u32 count, u32 grain_size, Function&& function) {
+        ParallelForTask<std::remove_reference_t<Function>> parallel_for;
+        parallel_for_async(parallel_for, count, grain_size, function);
+        wait(&parallel_for.counter);
+    }
+
+    template <typename T, typename Map, typename Reduce>
+    inline T TaskScheduler::parallel_reduce(u32 count, u32 grain_size, const T& identity, Map&& map, Reduce&& reduce) {
+        grain_size = get_grain_size(count, grain_size);
+        const u32 chunks = (count + grain_size - 1) / grain_size;
+
+        // Chunk results live on the scratch of the caller, or the allocator outside of workers
+        StackAllocator* scratch_allocator = get_scratch_allocator();
+        Allocator* results_allocator = scratch_allocator ? (Allocator*)scratch_allocator : allocator;
+        const size_t scratch_marker = scratch_allocator ? scratch_allocator->get_marker() : 0;
+        T* results = (T*)results_allocator->allocate((chunks ? chunks : 1) * sizeof(T), alignof(T), __FILE__, __LINE__);
+
+        parallel_for(count, grain_size, [&](u32 begin, u32 end, u32 worker_index) {
+            results[begin / grain_size] = map(begin, end, worker_index);
+        });
+
+        T result = identity;
+        for(u32 i = 0; i < chunks; i++) {
+            result = reduce(result, results[i]);
+        }
+
+        if(scratch_allocator) {
+            scratch_allocator->free_marker(scratch_marker);
+        } else {
+            results_allocator->deallocate(results);
+        }
+        return result;
+    }
+
+}
@@ -57,7 +57,7 @@ i64 time_now() {
     timespec tp;
     clock_gettime(CLOCK_MONOTONIC, &tp);
 
-    const u64 now = tp.tv_sec * 100000000 + tp.tv_nsec;
+    const u64 now = tp.tv_sec * 1000000000ull + tp.tv_nsec;
     const i64 microseconds = now / 1000;
 #endif
     return microseconds;
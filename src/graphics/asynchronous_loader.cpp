@@ -0,0 +1,504 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "asynchronous_loader.hpp"
+
+#include "file_system.hpp"
+#include "numerics.hpp"
+
+#include <chrono>
+#include <string.h>
+
+namespace puffin {
+
+#define                 check(result) PASSERTM(result == VK_SUCCESS, "Vulkan assert code %u", result)
+
+// Encoded image handed to a decode task, freed by it
+struct AsynchronousDecode {
+    AsynchronousLoader*     loader;
+    FileLoadRequest         request;
+    char*                   file_data;      // Read by the loader thread, nullptr for requests from memory
+    size_t                  file_size;
+};
+
+static void asynchronous_loader_decode(AsynchronousDecode* decode) {
+    AsynchronousLoader* loader = decode->loader;
+    const FileLoadRequest& request = decode->request;
+
+    const u8* memory = decode->file_data ? (const u8*)decode->file_data : request.memory;
+    const u32 memory_size = decode->file_data ? (u32)decode->file_size : request.memory_size;
+
+    UploadRequest upload_request;
+    upload_request.target = request.target;
+    if(!texture_data_load_from_memory(memory, memory_size, request.target.mipmaps > 1, request.srgb, upload_request.data)) {
+        p_print("Error decoding texture %s\n", request.memory ? "from memory" : request.path);
+    }
+
+    if(decode->file_data) {
+        puffin_free(decode->file_data, loader->allocator);
+    }
+    puffin_free(decode, loader->allocator);
+
+    // Failed decodes are pushed too, the loader completes them
+    loader->upload_requests.push(upload_request);
+    loader->wake();
+}
+
+static void asynchronous_loader_decode_task(void* data, u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {
+    asynchronous_loader_decode((AsynchronousDecode*)data);
+}
+
+// Decoding takes far longer than reading or copying, it is spread over the workers
+static void asynchronous_loader_submit_decode(AsynchronousDecode* decode) {
+    AsynchronousLoader* loader = decode->loader;
+    if(loader->task_scheduler) {
+        loader->task_scheduler->submit(asynchronous_loader_decode_task, decode, 0, 1, &loader->decode_counter);
+    } else {
+        asynchronous_loader_decode(decode);
+    }
+}
+
+// Runs on a FileReadService thread
+static void asynchronous_loader_file_read(const FileReadResult& result, void* user_data) {
+    AsynchronousDecode* decode = (AsynchronousDecode*)user_data;
+    AsynchronousLoader* loader = decode->loader;
+
+    if(result.data == nullptr) {
+        p_print("Error reading texture %s\n", decode->request.path);
+        puffin_free(decode, loader->allocator);
+        loader->complete_request();
+        return;
+    }
+
+    decode->file_data = result.data;
+    decode->file_size = result.size;
+    asynchronous_loader_submit_decode(decode);
+}
+
+static void asynchronous_loader_image_barrier(VkCommandBuffer command_buffer, const TextureUploadTarget& target,
+                                              VkImageLayout old_layout, VkImageLayout new_layout,
+                                              VkAccessFlags src_access, VkAccessFlags dst_access,
+                                              VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+                                              u32 src_family, u32 dst_family) {
+    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = src_family;
+    barrier.dstQueueFamilyIndex = dst_family;
+    barrier.image = target.vk_image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, target.mipmaps, 0, 1 };
+
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// Asynchronous Loader ///////////////////////////////////////////
+
+void AsynchronousLoader::init(GpuDevice* gpu_, FileReadService* file_read_service_, TaskScheduler* task_scheduler_, Allocator* allocator_,
+                              u32 staging_size) {
+    gpu = gpu_;
+    file_read_service = file_read_service_;
+    task_scheduler = task_scheduler_;
+    allocator = allocator_;
+
+    file_requests.init(allocator);
+    upload_requests.init(allocator);
+
+    VkCommandPoolCreateInfo pool_info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = gpu->vulkan_transfer_queue_family;
+    check(vkCreateCommandPool(gpu->vulkan_device, &pool_info, gpu->vulkan_allocation_callbacks, &vulkan_command_pool));
+
+    VkCommandBufferAllocateInfo command_buffer_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+    command_buffer_info.commandPool = vulkan_command_pool;
+    command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_info.commandBufferCount = 1;
+
+    VkFenceCreateInfo fence_info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+
+    for(u32 i = 0; i < k_asynchronous_loader_batches; i++) {
+        AsynchronousLoaderBatch& batch = batches[i];
+        check(vkAllocateCommandBuffers(gpu->vulkan_device, &command_buffer_info, &batch.vk_command_buffer));
+        check(vkCreateFence(gpu->vulkan_device, &fence_info, gpu->vulkan_allocation_callbacks, &batch.vk_fence));
+        batch.staging_used = 0;
+        batch.recording = false;
+        batch.in_flight = false;
+        batch.textures.init(allocator, 16);
+    }
+    batch_current = 0;
+    batches_in_flight = 0;
+
+    staging_batch_size = staging_size / k_asynchronous_loader_batches;
+
+    VkBufferCreateInfo staging_buffer_info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    staging_buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    staging_buffer_info.size = (VkDeviceSize)staging_batch_size * k_asynchronous_loader_batches;
+
+    VmaAllocationCreateInfo staging_memory_info{};
+    staging_memory_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    staging_memory_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+    VmaAllocationInfo staging_allocation_info{};
+    check(vmaCreateBuffer(gpu->vma_allocator, &staging_buffer_info, &staging_memory_info, &vulkan_staging_buffer,
+                          &vma_staging_allocation, &staging_allocation_info));
+    staging_mapped_memory = (u8*)staging_allocation_info.pMappedData;
+
+    gpu->set_resource_name(VK_OBJECT_TYPE_BUFFER, (u64)vulkan_staging_buffer, "Asynchronous_Loader_Staging");
+
+    upload_statistics = {};
+    pending_requests = 0;
+    wake_signals = 0;
+    stop = false;
+    thread = std::thread([this]() { loader_loop(); });
+}
+
+void AsynchronousLoader::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stop = true;
+        wake_signals++;
+    }
+    wake_condition.notify_one();
+    thread.join();
+
+    // Reads and decodes still running push to upload_requests
+    if(file_read_service) {
+        file_read_service->wait_idle();
+    }
+    if(task_scheduler) {
+        task_scheduler->wait(&decode_counter);
+    }
+
+    UploadRequest upload_request;
+    while(upload_requests.pop(upload_request)) {
+        texture_data_free(upload_request.data);
+    }
+    upload_requests.shutdown();
+    file_requests.shutdown();
+
+    for(u32 i = 0; i < k_asynchronous_loader_batches; i++) {
+        AsynchronousLoaderBatch& batch = batches[i];
+        vkDestroyFence(gpu->vulkan_device, batch.vk_fence, gpu->vulkan_allocation_callbacks);
+        batch.textures.shutdown();
+    }
+    vkDestroyCommandPool(gpu->vulkan_device, vulkan_command_pool, gpu->vulkan_allocation_callbacks);
+
+    vmaDestroyBuffer(gpu->vma_allocator, vulkan_staging_buffer, vma_staging_allocation);
+    staging_mapped_memory = nullptr;
+
+    p_print("Asynchronous loader: %u textures, %llu KB in %u batches, %u fence waits\n", upload_statistics.uploads,
+            upload_statistics.bytes_uploaded / 1024, upload_statistics.batches_submitted, upload_statistics.fence_waits);
+}
+
+TextureUploadTarget AsynchronousLoader::get_upload_target(TextureHandle texture) {
+    TextureUploadTarget target{};
+    target.texture = texture;
+
+    Texture* vk_texture = gpu->access_texture(texture);
+    if(vk_texture) {
+        target.vk_image = vk_texture->vk_image;
+        target.width = vk_texture->width;
+        target.height = vk_texture->height;
+        target.mipmaps = vk_texture->mipmaps;
+    }
+    return target;
+}
+
+void AsynchronousLoader::request_texture_data(cstring filename, TextureHandle texture, bool srgb) {
+    FileLoadRequest request;
+    strncpy(request.path, filename, sizeof(request.path) - 1);
+    request.path[sizeof(request.path) - 1] = 0;
+    request.target = get_upload_target(texture);
+    request.srgb = srgb;
+
+    pending_requests.fetch_add(1);
+    file_requests.push(request);
+    wake();
+}
+
+void AsynchronousLoader::request_texture_data(const u8* memory, u32 size, TextureHandle texture, bool srgb) {
+    FileLoadRequest request;
+    request.path[0] = 0;
+    request.memory = memory;
+    request.memory_size = size;
+    request.target = get_upload_target(texture);
+    request.srgb = srgb;
+
+    pending_requests.fetch_add(1);
+    file_requests.push(request);
+    wake();
+}
+
+void AsynchronousLoader::request_texture_upload(const TextureData& data, TextureHandle texture) {
+    UploadRequest request;
+    request.data = data;
+    request.target = get_upload_target(texture);
+
+    pending_requests.fetch_add(1);
+    upload_requests.push(request);
+    wake();
+}
+
+u32 AsynchronousLoader::get_pending_count() const {
+    return pending_requests.load(std::memory_order_relaxed);
+}
+
+void AsynchronousLoader::wake() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake_signals++;
+    }
+    wake_condition.notify_one();
+}
+
+void AsynchronousLoader::complete_request() {
+    pending_requests.fetch_sub(1);
+}
+
+// Loader thread /////////////////////////////////////////////////
+
+void AsynchronousLoader::loader_loop() {
+    while(true) {
+        bool processed = false;
+
+        FileLoadRequest file_request;
+        while(file_requests.pop(file_request)) {
+            process_file_request(file_request);
+            processed = true;
+        }
+
+        UploadRequest upload_request;
+        while(upload_requests.pop(upload_request)) {
+            process_upload_request(upload_request);
+            processed = true;
+        }
+
+        // Nothing left to add, start the copies so that textures appear as soon as possible
+        if(batches[batch_current].recording) {
+            submit_batch();
+        }
+        retire_batches(false);
+
+        if(processed) {
+            continue;
+        }
+
+        if(stop.load()) {
+            break;
+        }
+
+        // Poll the oldest batch while waiting for requests
+        if(batches_in_flight) {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake_condition.wait_for(lock, std::chrono::milliseconds(1), [this]() { return wake_signals > 0; });
+            wake_signals = 0;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_condition.wait(lock, [this]() { return wake_signals > 0; });
+        wake_signals = 0;
+    }
+
+    // Requests still queued are dropped, the submitted batches are finished
+    if(batches[batch_current].recording) {
+        submit_batch();
+    }
+    while(batches_in_flight) {
+        retire_batches(true);
+    }
+}
+
+void AsynchronousLoader::process_file_request(const FileLoadRequest& request) {
+    AsynchronousDecode* decode = (AsynchronousDecode*)puffin_alloc(sizeof(AsynchronousDecode), allocator);
+    decode->loader = this;
+    decode->request = request;
+    decode->file_data = nullptr;
+    decode->file_size = 0;
+
+    if(request.memory) {
+        asynchronous_loader_submit_decode(decode);
+        return;
+    }
+
+    // Files are decoded as soon as they are read, in any order
+    if(file_read_service) {
+        file_read_service->read(request.path, allocator, asynchronous_loader_file_read, decode);
+        return;
+    }
+
+    FileReadResult file = file_read_binary(request.path, allocator);
+    asynchronous_loader_file_read(file, decode);
+}
+
+void AsynchronousLoader::process_upload_request(UploadRequest& request) {
+    const TextureUploadTarget& target = request.target;
+    const TextureData& data = request.data;
+
+    if(data.data == nullptr) {
+        complete_request();
+        return;
+    }
+    if(target.vk_image == VK_NULL_HANDLE || data.width != target.width || data.height != target.height || data.mip_levels != target.mipmaps) {
+        p_print("Texture %u does not match its data, upload skipped\n", target.texture.index);
+        texture_data_free(request.data);
+        complete_request();
+        return;
+    }
+
+    // Only 8 bit RGBA data is uploaded for now
+    const u32 texel_size = 4;
+    const u32 graphics_family = gpu->vulkan_queue_family;
+    const u32 transfer_family = gpu->vulkan_transfer_queue_family;
+
+    VkCommandBuffer command_buffer = get_command_buffer();
+    asynchronous_loader_image_barrier(command_buffer, target, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                      VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+
+    const u8* source = data.data;
+    for(u32 mip = 0; mip < target.mipmaps; mip++) {
+        const u32 mip_width = max(1u, (u32)target.width >> mip);
+        const u32 mip_height = max(1u, (u32)target.height >> mip);
+        const u32 row_pitch = mip_width * texel_size;
+        const u32 max_rows_per_band = max(1u, staging_batch_size / row_pitch);
+
+        for(u32 row = 0; row < mip_height; row += max_rows_per_band) {
+            const u32 band_rows = min(max_rows_per_band, mip_height - row);
+            const u32 band_size = band_rows * row_pitch;
+
+            u32 staging_offset = 0;
+            u8* staging_memory = staging_allocate(band_size, staging_offset);
+            memcpy(staging_memory, source + (size_t)row * row_pitch, band_size);
+            vmaFlushAllocation(gpu->vma_allocator, vma_staging_allocation, staging_offset, band_size);
+
+            VkBufferImageCopy region = {};
+            region.bufferOffset = staging_offset;
+            region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+            region.imageOffset = { 0, (i32)row, 0 };
+            region.imageExtent = { mip_width, band_rows, 1 };
+
+            // A full batch is submitted by staging_allocate, the copy goes to the next one
+            command_buffer = get_command_buffer();
+            vkCmdCopyBufferToImage(command_buffer, vulkan_staging_buffer, target.vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+            upload_statistics.bytes_uploaded += band_size;
+        }
+
+        source += (size_t)mip_height * row_pitch;
+    }
+
+    if(transfer_family != graphics_family) {
+        // Release to the graphics family, GpuDevice records the matching acquire. The destination masks are ignored.
+        asynchronous_loader_image_barrier(command_buffer, target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                          VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+                                          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                          transfer_family, graphics_family);
+    } else {
+        asynchronous_loader_image_barrier(command_buffer, target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                          VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                          VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+    }
+
+    batches[batch_current].textures.push(target.texture);
+    upload_statistics.uploads++;
+
+    texture_data_free(request.data);
+}
+
+// Begins the current batch if needed, once its previous submission has retired
+VkCommandBuffer AsynchronousLoader::get_command_buffer() {
+    AsynchronousLoaderBatch& batch = batches[batch_current];
+    if(batch.recording) {
+        return batch.vk_command_buffer;
+    }
+
+    while(batch.in_flight) {
+        retire_batches(true);
+    }
+
+    VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    check(vkBeginCommandBuffer(batch.vk_command_buffer, &begin_info));
+
+    batch.staging_used = 0;
+    batch.recording = true;
+    return batch.vk_command_buffer;
+}
+
+// Returns memory in the region of the current batch, size must fit in a region
+u8* AsynchronousLoader::staging_allocate(u32 size, u32& out_offset) {
+    PASSERT(size <= staging_batch_size);
+
+    get_command_buffer();
+    u32 offset = (u32)memory_align(batches[batch_current].staging_used, 16);
+    if(offset + size > staging_batch_size) {
+        submit_batch();
+        get_command_buffer();
+        offset = 0;
+    }
+
+    AsynchronousLoaderBatch& batch = batches[batch_current];
+    batch.staging_used = offset + size;
+
+    out_offset = batch_current * staging_batch_size + offset;
+    return staging_mapped_memory + out_offset;
+}
+
+void AsynchronousLoader::submit_batch() {
+    AsynchronousLoaderBatch& batch = batches[batch_current];
+    PASSERT(batch.recording);
+
+    check(vkEndCommandBuffer(batch.vk_command_buffer));
+    check(vkResetFences(gpu->vulkan_device, 1, &batch.vk_fence));
+
+    VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.vk_command_buffer;
+    {
+        // The transfer queue can be the graphics queue, used by the main thread
+        std::lock_guard<std::mutex> lock(gpu->vulkan_queue_mutex);
+        check(vkQueueSubmit(gpu->vulkan_transfer_queue, 1, &submit_info, batch.vk_fence));
+    }
+
+    batch.recording = false;
+    batch.in_flight = true;
+    batches_in_flight++;
+    upload_statistics.batches_submitted++;
+
+    batch_current = (batch_current + 1) % k_asynchronous_loader_batches;
+}
+
+// Retires batches in submission order while their fence is signaled, waiting for the oldest one if asked
+void AsynchronousLoader::retire_batches(bool wait_oldest) {
+    while(batches_in_flight) {
+        // The oldest in flight batch is the one submitted batches_in_flight submissions ago
+        const u32 oldest = (batch_current + k_asynchronous_loader_batches - batches_in_flight) % k_asynchronous_loader_batches;
+        AsynchronousLoaderBatch& batch = batches[oldest];
+
+        VkResult status = vkGetFenceStatus(gpu->vulkan_device, batch.vk_fence);
+        if(status == VK_NOT_READY) {
+            if(!wait_oldest) {
+                return;
+            }
+            check(vkWaitForFences(gpu->vulkan_device, 1, &batch.vk_fence, VK_TRUE, UINT64_MAX));
+            upload_statistics.fence_waits++;
+            wait_oldest = false;
+        }
+
+        for(u32 i = 0; i < batch.textures.size; i++) {
+            gpu->complete_texture_upload(batch.textures[i]);
+            complete_request();
+        }
+        batch.textures.clear();
+
+        batch.in_flight = false;
+        batches_in_flight--;
+    }
+}
+
+} // namespace puffin
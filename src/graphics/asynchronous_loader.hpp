@@ -0,0 +1,132 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#pragma once
+
+#include "gpu_device.hpp"
+#include "renderer.hpp"
+
+#include "file_system.hpp"
+#include "queue.hpp"
+#include "task_scheduler.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace puffin {
+
+// Asynchronous Loader ///////////////////////////////////////////
+//
+// A thread filling textures that were created empty. File requests are read through the FileReadService, many
+// at once, and decoded by the task scheduler workers. The decoded images come back to it as upload requests.
+// Uploads are copied through a staging buffer of its own and submitted to the transfer queue in batches,
+// each with a fence. Once a batch fence is signaled its textures are handed to GpuDevice, which acquires
+// them on the graphics queue at the next present. Until then materials use the dummy texture, see
+// GpuDevice::is_texture_ready.
+
+static const u32            k_asynchronous_loader_batches = 2;
+
+// Texture fields the loader needs, copied on the requesting thread
+struct TextureUploadTarget {
+    TextureHandle           texture;
+    VkImage                 vk_image;
+    u16                     width;
+    u16                     height;
+    u8                      mipmaps;
+};
+
+struct FileLoadRequest {
+    char                    path[512];
+    const u8*               memory          = nullptr;  // Encoded image already in memory, used instead of path
+    u32                     memory_size     = 0;
+    TextureUploadTarget     target;
+    bool                    srgb            = false;
+};
+
+struct UploadRequest {
+    TextureData             data;                       // Freed by the loader once copied
+    TextureUploadTarget     target;
+};
+
+// Staging region, command buffer and fence of a submission to the transfer queue
+struct AsynchronousLoaderBatch {
+    VkCommandBuffer         vk_command_buffer;
+    VkFence                 vk_fence;
+    u32                     staging_used    = 0;
+    bool                    recording       = false;
+    bool                    in_flight       = false;
+
+    // Their last copy is in this batch, complete once the fence is signaled
+    Array<TextureHandle>    textures;
+};
+
+struct AsynchronousLoader {
+
+    // file_read_service and task_scheduler can be null, files are then read and decoded on the loader thread
+    void                    init(GpuDevice* gpu, FileReadService* file_read_service, TaskScheduler* task_scheduler, Allocator* allocator,
+                                 u32 staging_size = puffin_mega(32));
+    // Waits for the submitted batches, requests not started yet are dropped
+    void                    shutdown();
+
+    // The texture must have been created with the size and mip count of the image, see texture_data_load_info.
+    // The memory of an encoded image must live until the request completes.
+    void                    request_texture_data(cstring filename, TextureHandle texture, bool srgb);
+    void                    request_texture_data(const u8* memory, u32 size, TextureHandle texture, bool srgb);
+    // Takes ownership of data
+    void                    request_texture_upload(const TextureData& data, TextureHandle texture);
+
+    // Requests not completed yet
+    u32                     get_pending_count() const;
+
+    // Loader thread
+    void                    loader_loop();
+    void                    process_file_request(const FileLoadRequest& request);
+    void                    process_upload_request(UploadRequest& request);
+    void                    complete_request();
+
+    VkCommandBuffer         get_command_buffer();
+    u8*                     staging_allocate(u32 size, u32& out_offset);
+    void                    submit_batch();
+    void                    retire_batches(bool wait_oldest);
+
+    TextureUploadTarget     get_upload_target(TextureHandle texture);
+    void                    wake();
+
+    GpuDevice*              gpu                 = nullptr;
+    FileReadService*        file_read_service   = nullptr;
+    TaskScheduler*          task_scheduler      = nullptr;
+    Allocator*              allocator           = nullptr;
+
+    MpscQueue<FileLoadRequest> file_requests;
+    MpscQueue<UploadRequest> upload_requests;
+    TaskCounter             decode_counter;
+
+    std::thread             thread;
+    std::atomic<bool>       stop{ false };
+    std::atomic<u32>        pending_requests{ 0 };
+
+    // The loader sleeps when it has no request and no batch in flight
+    u32                     wake_signals        = 0;
+    std::mutex              wake_mutex;
+    std::condition_variable wake_condition;
+
+    // Transfer queue family
+    VkCommandPool           vulkan_command_pool;
+    AsynchronousLoaderBatch batches[k_asynchronous_loader_batches];
+    u32                     batch_current       = 0;
+    u32                     batches_in_flight   = 0;
+
+    // Split in a region per batch
+    VkBuffer                vulkan_staging_buffer;
+    VmaAllocation           vma_staging_allocation;
+    u8*                     staging_mapped_memory = nullptr;
+    u32                     staging_batch_size  = 0;
+
+    GpuUploadStatistics     upload_statistics;  // Loader thread only
+
+}; // struct AsynchronousLoader
+
+} // namespace puffin
@@ -15,16 +15,15 @@ void CommandBuffer::reset() {
 
     vkResetDescriptorPool(gpu_device->vulkan_device, vk_descriptor_pool, 0);
 
-    u32 resource_count = descriptor_sets.free_indices_head;
-    for(u32 i = 0; i < resource_count; i++) {
-        DescriptorSet* v_descriptor_set = (DescriptorSet*) descriptor_sets.access_resource(i);
+    descriptor_sets.for_each_live([&](u32 handle) {
+        DescriptorSet* v_descriptor_set = (DescriptorSet*) descriptor_sets.access_resource(handle);
 
-        if(v_descriptor_set->resources, gpu_device->allocator) {
-            puffin_free(v_descriptor_set->resources, gpu_device->allocator);
-        }
+        v_descriptor_set->resources.shutdown();
+        v_descriptor_set->samplers.shutdown();
+        v_descriptor_set->bindings.shutdown();
+    });
 
-        descriptor_sets.release_resource(i);
-    }
+    descriptor_sets.release_all_resources();
 }
 
 void CommandBuffer::init(QueueType::Enum type_, u32 buffer_size_, u32 submit_size_, bool baked_) {
@@ -58,7 +57,8 @@ void CommandBuffer::init(QueueType::Enum type_, u32 buffer_size_, u32 submit_siz
     VkResult result = vkCreateDescriptorPool(gpu_device->vulkan_device, &pool_info, gpu_device->vulkan_allocation_callbacks, &vk_descriptor_pool);
     PASSERT(result == VK_SUCCESS);
 
-    descriptor_sets.init(gpu_device->allocator, 256, sizeof(DescriptorSet));
+    // Every descriptor set is released on reset, the dense index keeps that sweep to the live ones
+    descriptor_sets.init(gpu_device->allocator, 256, sizeof(DescriptorSet), true);
 
     reset();
 }
@@ -87,10 +87,9 @@ DescriptorSetHandle CommandBuffer::create_descriptor_set(const DescriptorSetCrea
     PASSERT(result == VK_SUCCESS);
 
     // Cache data
-    u8* memory = puffin_alloc_return_mem_pointer((sizeof(ResourceHandle) + sizeof(SamplerHandle) + sizeof(u16)) * creation.num_resources, gpu_device->allocator);
-    descriptor_set->resources = (ResourceHandle*) memory;
-    descriptor_set->samplers = (SamplerHandle*) (memory + sizeof(ResourceHandle) * creation.num_resources);
-    descriptor_set->bindings = (u16*) (memory + ( sizeof(ResourceHandle) + sizeof(SamplerHandle) ) * creation.num_resources);
+    descriptor_set->resources.init(gpu_device->allocator, creation.num_resources, creation.num_resources);
+    descriptor_set->samplers.init(gpu_device->allocator, creation.num_resources, creation.num_resources);
+    descriptor_set->bindings.init(gpu_device->allocator, creation.num_resources, creation.num_resources);
     descriptor_set->num_resources = creation.num_resources;
     descriptor_set->layout = descriptor_set_layout;
 
@@ -117,7 +116,7 @@ DescriptorSetHandle CommandBuffer::create_descriptor_set(const DescriptorSetCrea
     return handle;
 }
 
-void CommandBuffer::bind_pass(RenderPassHandle render_pass_handle) {
+void CommandBuffer::bind_pass(RenderPassHandle render_pass_handle, bool use_secondary) {
     is_recording = true;
 
     RenderPass* render_pass = gpu_device->access_render_pass(render_pass_handle);
@@ -140,7 +139,7 @@ void CommandBuffer::bind_pass(RenderPassHandle render_pass_handle) {
         render_pass_begin.clearValueCount = 2;
         render_pass_begin.pClearValues = clears;
 
-        vkCmdBeginRenderPass(vk_command_buffer, &render_pass_begin, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBeginRenderPass(vk_command_buffer, &render_pass_begin, use_secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
     }
 
     current_render_pass = render_pass;
@@ -212,7 +211,7 @@ void CommandBuffer::bind_descriptor_set(DescriptorSetHandle* descriptor_set_hand
 
     if(gpu_device->bindless_supported) {
         vkCmdBindDescriptorSets(vk_command_buffer, current_pipeline->vk_bind_point, current_pipeline->vk_pipeline_layout,
-                                k_first_set, num_lists, vk_descriptor_sets, num_offsets, offsets_cache);
+                                1, 1, &gpu_device->vulkan_bindless_descriptor_set, 0, nullptr);
     }
 }
 
@@ -593,6 +592,38 @@ void CommandBuffer::pop_marker() {
     gpu_device->pop_marker(vk_command_buffer);
 }
 
+void CommandBuffer::begin_secondary(RenderPassHandle render_pass_handle) {
+    reset();
+
+    RenderPass* render_pass = gpu_device->access_render_pass(render_pass_handle);
+
+    VkCommandBufferInheritanceInfo inheritance_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+    inheritance_info.renderPass = render_pass->vk_render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = render_pass->type == RenderPassType::Swapchain ?
+                                   gpu_device->vulkan_swapchain_framebuffers[gpu_device->vulkan_image_index] : render_pass->vk_framebuffer;
+
+    VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    vkBeginCommandBuffer(vk_command_buffer, &begin_info);
+
+    // The render pass is already begun by the primary
+    is_recording = true;
+    current_render_pass = render_pass;
+}
+
+void CommandBuffer::end() {
+    vkEndCommandBuffer(vk_command_buffer);
+
+    is_recording = false;
+}
+
+void CommandBuffer::execute_secondary(CommandBuffer* secondary) {
+    vkCmdExecuteCommands(vk_command_buffer, 1, &secondary->vk_command_buffer);
+}
+
 
 
 } // namespace puffin
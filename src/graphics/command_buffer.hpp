@@ -18,7 +18,8 @@ struct CommandBuffer {
 
     DescriptorSetHandle     create_descriptor_set(const DescriptorSetCreation& creation);
 
-    void                    bind_pass(RenderPassHandle render_pass_handle);
+    // use_secondary begins the pass for secondary command buffers, nothing but execute_secondary can follow
+    void                    bind_pass(RenderPassHandle render_pass_handle, bool use_secondary = false);
     void                    bind_pipeline(PipelineHandle pipeline_handle);
     void                    bind_vertex_buffer(BufferHandle buffer_handle, u32 binding, u32 offset);
     void                    bind_index_buffer(BufferHandle buffer_handle, u32 offset, VkIndexType index_type);
@@ -49,6 +50,13 @@ struct CommandBuffer {
     void                    push_marker(const char* name);
     void                    pop_marker();
 
+    // Secondary command buffers continue the render pass of the primary that executes them. They can be recorded
+    // from any thread into the pools of that thread, with their own viewport and scissors.
+    // Markers use the frame timestamps, which only the main thread can push.
+    void                    begin_secondary(RenderPassHandle render_pass_handle);
+    void                    end();
+    void                    execute_secondary(CommandBuffer* secondary);
+
     void                    reset();
 
     VkCommandBuffer         vk_command_buffer;
@@ -56,72 +56,122 @@ static void check_result(VkResult result);
 
 #define                 check(result) PASSERTM(result == VK_SUCCESS, "Vulkan assert code %u", result)
 
+// Every frame has a command pool per recording thread, reset together once the frame fence is signaled.
+// A pool hands out its primaries and secondaries in order, the last primary of thread 0 is the instant one.
 struct CommandBufferRing {
 
-    void init(GpuDevice* gpu);
+    void init(GpuDevice* gpu, u32 num_threads);
 
     void shutdown();
 
     void reset_pools(u32 frame_index);
 
-    CommandBuffer* get_command_buffer(u32 frame, bool begin);
+    CommandBuffer* get_command_buffer(u32 frame, u32 thread_index, bool begin);
+
+    CommandBuffer* get_secondary_command_buffer(u32 frame, u32 thread_index);
 
     CommandBuffer* get_command_buffer_instant(u32 frame, bool begin);
 
-    static u16 pool_from_index(u32 index) { return (u16) index / k_buffer_per_pool; }
+    u32 pool_from_indices(u32 frame, u32 thread_index) const { return frame * num_threads + thread_index; }
 
 
-    static const u16 k_max_threads = 1;
-    static const u16 k_max_pools = k_max_swapchain_images * k_max_threads;
     static const u16 k_buffer_per_pool = 4;
-    static const u16 k_max_buffers = k_buffer_per_pool * k_max_pools;
+    static const u16 k_secondary_buffer_per_pool = 16;
 
     GpuDevice* gpu;
-    VkCommandPool vulkan_command_pools[k_max_pools];
-    CommandBuffer command_buffers[k_max_buffers];
-    u8 next_free_per_thread_frame[k_max_pools];
+    VkCommandPool* vulkan_command_pools;    // k_max_swapchain_images * num_threads
+    CommandBuffer* command_buffers;         // k_buffer_per_pool per pool
+    CommandBuffer* secondary_command_buffers; // k_secondary_buffer_per_pool per pool
+    u8* next_free_per_thread_frame;
+    u8* next_free_secondary_per_thread_frame;
+
+    u32 num_pools;
+    u32 num_threads;
 };
 
-void CommandBufferRing::init(GpuDevice* gpu_) {
+static void command_buffer_ring_allocate(GpuDevice* gpu, VkCommandPool pool, VkCommandBufferLevel level, CommandBuffer* command_buffers, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        VkCommandBufferAllocateInfo cmd = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr};
+        cmd.commandPool = pool;
+        cmd.level = level;
+        cmd.commandBufferCount = 1;
+
+        CommandBuffer& command_buffer = command_buffers[i];
+        new (&command_buffer) CommandBuffer();
+        check(vkAllocateCommandBuffers(gpu->vulkan_device, &cmd, &command_buffer.vk_command_buffer));
+
+        command_buffer.gpu_device = gpu;
+        command_buffer.init(QueueType::Enum::Graphics, 0, 0, false);
+        command_buffer.reset();
+    }
+}
+
+void CommandBufferRing::init(GpuDevice* gpu_, u32 num_threads_) {
     gpu = gpu_;
+    num_threads = num_threads_ ? num_threads_ : 1;
+    num_pools = k_max_swapchain_images * num_threads;
+
+    vulkan_command_pools = (VkCommandPool*)puffin_alloc(sizeof(VkCommandPool) * num_pools, gpu->allocator);
+    command_buffers = (CommandBuffer*)puffin_alloc(sizeof(CommandBuffer) * num_pools * k_buffer_per_pool, gpu->allocator);
+    secondary_command_buffers = (CommandBuffer*)puffin_alloc(sizeof(CommandBuffer) * num_pools * k_secondary_buffer_per_pool, gpu->allocator);
+    next_free_per_thread_frame = (u8*)puffin_alloc(num_pools, gpu->allocator);
+    next_free_secondary_per_thread_frame = (u8*)puffin_alloc(num_pools, gpu->allocator);
 
-    for (u32 i = 0; i < k_max_pools; i++) {
+    for (u32 i = 0; i < num_pools; i++) {
         VkCommandPoolCreateInfo cmd_pool_info = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr};
         cmd_pool_info.queueFamilyIndex = gpu->vulkan_queue_family;
         cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
         check(vkCreateCommandPool(gpu->vulkan_device, &cmd_pool_info, gpu->vulkan_allocation_callbacks,
                                   &vulkan_command_pools[i]));
-    }
 
-    for (u32 i = 0; i < k_max_buffers; i++) {
-        VkCommandBufferAllocateInfo cmd = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr};
-        const u32 pool_index = pool_from_index(i);
-        cmd.commandPool = vulkan_command_pools[pool_index];
-        cmd.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        cmd.commandBufferCount = 1;
-        check(vkAllocateCommandBuffers(gpu->vulkan_device, &cmd, &command_buffers[i].vk_command_buffer));
+        command_buffer_ring_allocate(gpu, vulkan_command_pools[i], VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                     command_buffers + i * k_buffer_per_pool, k_buffer_per_pool);
+        command_buffer_ring_allocate(gpu, vulkan_command_pools[i], VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                                     secondary_command_buffers + i * k_secondary_buffer_per_pool, k_secondary_buffer_per_pool);
 
-        command_buffers[i].gpu_device = gpu;
-        command_buffers[i].init(QueueType::Enum::Graphics, 0, 0, false);
-        command_buffers[i].reset();
+        next_free_per_thread_frame[i] = 0;
+        next_free_secondary_per_thread_frame[i] = 0;
     }
 }
 
 void CommandBufferRing::shutdown() {
-    for (u32 i = 0; i < k_max_swapchain_images * k_max_threads; i++) {
+    for (u32 i = 0; i < num_pools * k_buffer_per_pool; i++) {
+        command_buffers[i].terminate();
+    }
+    for (u32 i = 0; i < num_pools * k_secondary_buffer_per_pool; i++) {
+        secondary_command_buffers[i].terminate();
+    }
+
+    for (u32 i = 0; i < num_pools; i++) {
         vkDestroyCommandPool(gpu->vulkan_device, vulkan_command_pools[i], gpu->vulkan_allocation_callbacks);
     }
+
+    puffin_free(next_free_secondary_per_thread_frame, gpu->allocator);
+    puffin_free(next_free_per_thread_frame, gpu->allocator);
+    puffin_free(secondary_command_buffers, gpu->allocator);
+    puffin_free(command_buffers, gpu->allocator);
+    puffin_free(vulkan_command_pools, gpu->allocator);
 }
 
 void CommandBufferRing::reset_pools(u32 frame_index) {
-    for (u32 i = 0; i < k_max_threads; i++) {
-        vkResetCommandPool(gpu->vulkan_device, vulkan_command_pools[frame_index * k_max_threads + i], 0);
+    for (u32 i = 0; i < num_threads; i++) {
+        const u32 pool_index = pool_from_indices(frame_index, i);
+        vkResetCommandPool(gpu->vulkan_device, vulkan_command_pools[pool_index], 0);
+
+        next_free_per_thread_frame[pool_index] = 0;
+        next_free_secondary_per_thread_frame[pool_index] = 0;
     }
 }
 
-CommandBuffer* CommandBufferRing::get_command_buffer(u32 frame, bool begin) {
-    CommandBuffer* cb = &command_buffers[frame * k_buffer_per_pool];
+CommandBuffer* CommandBufferRing::get_command_buffer(u32 frame, u32 thread_index, bool begin) {
+    PASSERT(thread_index < num_threads);
+    const u32 pool_index = pool_from_indices(frame, thread_index);
+
+    // The last primary of every pool is left for the instant command buffer
+    u8& next_free = next_free_per_thread_frame[pool_index];
+    PASSERTM(next_free < k_buffer_per_pool - 1, "Out of primary command buffers for thread %u", thread_index);
+    CommandBuffer* cb = &command_buffers[pool_index * k_buffer_per_pool + next_free++];
 
     if (begin) {
         cb->reset();
@@ -134,8 +184,17 @@ CommandBuffer* CommandBufferRing::get_command_buffer(u32 frame, bool begin) {
     return cb;
 }
 
+CommandBuffer* CommandBufferRing::get_secondary_command_buffer(u32 frame, u32 thread_index) {
+    PASSERT(thread_index < num_threads);
+    const u32 pool_index = pool_from_indices(frame, thread_index);
+
+    u8& next_free = next_free_secondary_per_thread_frame[pool_index];
+    PASSERTM(next_free < k_secondary_buffer_per_pool, "Out of secondary command buffers for thread %u", thread_index);
+    return &secondary_command_buffers[pool_index * k_secondary_buffer_per_pool + next_free++];
+}
+
 CommandBuffer* CommandBufferRing::get_command_buffer_instant(u32 frame, bool begin) {
-    CommandBuffer* cb = &command_buffers[frame * k_buffer_per_pool + 1];
+    CommandBuffer* cb = &command_buffers[pool_from_indices(frame, 0) * k_buffer_per_pool + k_buffer_per_pool - 1];
     return cb;
 }
 
@@ -194,13 +253,14 @@ PFN_vkSetDebugUtilsObjectNameEXT    pfnSetDebugUtilsObjectNameEXT;
 PFN_vkCmdBeginDebugUtilsLabelEXT    pfnCmdBeginDebugUtilsLabelEXT;
 PFN_vkCmdEndDebugUtilsLabelEXT      pfnCmdEndDebugUtilsLabelEXT;
 
-static puffin::FlatHashMap<u64, VkRenderPass> render_pass_cache;
+// Keyed by the whole output description, equal hashes of different outputs can't alias a render pass
+static puffin::FlatHashMap<RenderPassOutput, VkRenderPass, puffin::HashCalculate<RenderPassOutput>,
+                           puffin::HashEqualMemory<RenderPassOutput>> render_pass_cache;
 static CommandBufferRing            command_buffer_ring;
 static size_t                       s_ubo_alignment     = 256;
 static size_t                       s_ssbo_alignment    = 256;
 
 static const u32                    k_bindless_texture_binding  = 10;
-static const u32                    k_max_bindless_resources    = 1024;
 
 void GpuDevice::init(const DeviceCreation& creation) {
     p_print("Gpu Device init\n");
@@ -336,24 +396,47 @@ void GpuDevice::init(const DeviceCreation& creation) {
         }
     }
 
+    // Transfer only families are usually backed by the copy engines, uploads there run alongside rendering.
+    // Texture copies start at mip sizes down to 1x1, so the family must copy at any granularity.
+    u32 transfer_family_index = family_index;
+    for(u32 i = 0; i < queue_family_count; i++) {
+        VkQueueFamilyProperties queue_family = queue_families[i];
+        const VkExtent3D granularity = queue_family.minImageTransferGranularity;
+        if(queue_family.queueCount > 0 && (queue_family.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+           (queue_family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0 &&
+           granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+            transfer_family_index = i;
+            break;
+        }
+    }
+
     puffin_free(queue_families, allocator);
 
     u32 device_extension_count = 1;
     cstring device_extensions[] = { "VK_KHR_swapchain" };
     const float queue_priority[] = {1.0f };
-    VkDeviceQueueCreateInfo queue_info[1] = {};
+    VkDeviceQueueCreateInfo queue_info[2] = {};
     queue_info[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queue_info[0].queueFamilyIndex = family_index;
     queue_info[0].queueCount = 1;
     queue_info[0].pQueuePriorities = queue_priority;
 
+    u32 queue_info_count = 1;
+    if(transfer_family_index != family_index) {
+        queue_info[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_info[1].queueFamilyIndex = transfer_family_index;
+        queue_info[1].queueCount = 1;
+        queue_info[1].pQueuePriorities = queue_priority;
+        queue_info_count++;
+    }
+
     // Enable all features: just pass the physical features to struct
     VkPhysicalDeviceFeatures2 physical_features_2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
     vkGetPhysicalDeviceFeatures2(vulkan_physical_device, &physical_features_2);
 
     VkDeviceCreateInfo device_create_info = {};
     device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.queueCreateInfoCount = PuffinArraySize(queue_info);
+    device_create_info.queueCreateInfoCount = queue_info_count;
     device_create_info.pQueueCreateInfos = queue_info;
     device_create_info.enabledExtensionCount = device_extension_count;
     device_create_info.ppEnabledExtensionNames = device_extensions;
@@ -374,8 +457,11 @@ void GpuDevice::init(const DeviceCreation& creation) {
     }
 
     vkGetDeviceQueue(vulkan_device, family_index, 0, &vulkan_queue);
+    vkGetDeviceQueue(vulkan_device, transfer_family_index, 0, &vulkan_transfer_queue);
 
     vulkan_queue_family = family_index;
+    vulkan_transfer_queue_family = transfer_family_index;
+    p_print("Transfer queue family %u, %s\n", transfer_family_index, transfer_family_index != family_index ? "dedicated" : "shared with graphics");
 
     // Create drawable surface
     GLFWwindow* window = (GLFWwindow*) creation.window;
@@ -509,6 +595,10 @@ void GpuDevice::init(const DeviceCreation& creation) {
         layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
 
         VkDescriptorBindingFlags bindless_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+        // Slots of new and freshly loaded textures are written while frames using other slots are in flight
+        if(indexing_features.descriptorBindingUpdateUnusedWhilePending) {
+            bindless_flags |= VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+        }
         VkDescriptorBindingFlags binding_flags[4];
 
         binding_flags[0] = bindless_flags;
@@ -549,7 +639,8 @@ void GpuDevice::init(const DeviceCreation& creation) {
 
     // Init pools
     buffers.init(allocator, 512, sizeof(Buffer));
-    textures.init(allocator, 512, sizeof(Texture));
+    // With bindless the texture slot is the array element, so the pool can't hand out more slots than the array has
+    textures.init(allocator, 512, sizeof(Texture), false, bindless_supported ? k_max_bindless_resources : k_resource_pool_max_resources);
     render_passes.init(allocator, 256, sizeof(RenderPass));
     descriptor_set_layouts.init(allocator, 128, sizeof(DescriptorSetLayout));
     pipelines.init(allocator, 128, sizeof(Pipeline));
@@ -558,7 +649,7 @@ void GpuDevice::init(const DeviceCreation& creation) {
     samplers.init(allocator, 32, sizeof(Sampler));
 
     // Init render frame information. Includes fences, semaphores, command buffer, etc.
-    u8* memory = puffin_alloc_return_mem_pointer(sizeof(GPUTimestampManager) + sizeof(CommandBuffer*) * 128, allocator);
+    u8* memory = puffin_alloc_return_mem_pointer(sizeof(GPUTimestampManager), allocator);
 
     VkSemaphoreCreateInfo semaphore_info = {
             VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
@@ -578,13 +669,53 @@ void GpuDevice::init(const DeviceCreation& creation) {
     gpu_timestamp_manager = (GPUTimestampManager*)(memory);
     gpu_timestamp_manager->init(allocator, creation.gpu_time_queries_per_frame, k_max_frames);
 
-    command_buffer_ring.init(this);
+    num_threads = creation.num_threads ? creation.num_threads : 1;
+    command_buffer_ring.init(this, num_threads);
+
+    // Staging ring, persistently mapped and shared by every upload
+    staging_buffer_size = (u32)memory_align(creation.staging_buffer_size, s_ubo_alignment);
+    staging_head = 0;
+    staging_tail = 0;
+
+    VkBufferCreateInfo staging_buffer_info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    staging_buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    staging_buffer_info.size = staging_buffer_size;
+
+    VmaAllocationCreateInfo staging_memory_info{};
+    staging_memory_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    staging_memory_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+    VmaAllocationInfo staging_allocation_info{};
+    check(vmaCreateBuffer(vma_allocator, &staging_buffer_info, &staging_memory_info, &vulkan_staging_buffer,
+                          &vma_staging_allocation, &staging_allocation_info));
+    staging_mapped_memory = (u8*)staging_allocation_info.pMappedData;
+    set_resource_name(VK_OBJECT_TYPE_BUFFER, (u64)vulkan_staging_buffer, "Staging_Ring_Buffer");
+
+    VkCommandPoolCreateInfo upload_pool_info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr };
+    upload_pool_info.queueFamilyIndex = vulkan_queue_family;
+    upload_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    check(vkCreateCommandPool(vulkan_device, &upload_pool_info, vulkan_allocation_callbacks, &vulkan_upload_command_pool));
+
+    VkCommandBufferAllocateInfo upload_cmd_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr };
+    upload_cmd_info.commandPool = vulkan_upload_command_pool;
+    upload_cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    upload_cmd_info.commandBufferCount = k_max_upload_batches;
+    check(vkAllocateCommandBuffers(vulkan_device, &upload_cmd_info, vulkan_upload_command_buffers));
 
-    // Allocate queued command buffers array
-    queued_command_buffers = (CommandBuffer**)(gpu_timestamp_manager + 1);
-    CommandBuffer** correctly_allocated_buffer = (CommandBuffer**)(memory + sizeof(GPUTimestampManager));
-    PASSERTM(queued_command_buffers == correctly_allocated_buffer, "Wrong calculations for queue command buffers arrays. Should be %p, but is %p.", correctly_allocated_buffer,
-             queued_command_buffers);
+    for(u32 i = 0; i < k_max_upload_batches; i++) {
+        VkFenceCreateInfo fence_info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+        vkCreateFence(vulkan_device, &fence_info, vulkan_allocation_callbacks, &vulkan_upload_fences[i]);
+        upload_batch_staging_end[i] = 0;
+    }
+
+    upload_batch_current = 0;
+    num_upload_batches_in_flight = 0;
+    upload_batch_recording = false;
+    upload_statistics = {};
+
+    // Grow with the number of recording threads
+    queued_command_buffers.init(allocator, 16);
+    submitted_command_buffers.init(allocator, 16);
 
     vulkan_image_index = 0;
     current_frame = 1;
@@ -595,6 +726,7 @@ void GpuDevice::init(const DeviceCreation& creation) {
     resource_deletion_queue.init(allocator, 16);
     descriptor_set_updates.init(allocator, 16);
     texture_to_update_bindless.init(allocator, 16);
+    textures_to_acquire.init(allocator, 16);
 
     // Init primitive resources
     SamplerCreation sc{};
@@ -634,12 +766,15 @@ void GpuDevice::init(const DeviceCreation& creation) {
     swapchain_pass_creation.set_operations(RenderPassOperation::Clear, RenderPassOperation::Clear, RenderPassOperation::Clear);
     swapchain_pass = create_render_pass(swapchain_pass_creation);
 
-    // Init dummy resources
+    // Init dummy resources. The dummy texture stands in for textures still loading, a white texel leaves
+    // the material factors as they are.
+    static const u32 k_dummy_texel = 0xffffffff;
     TextureCreation dummy_texture_creation = {
-            nullptr,
+            (void*)&k_dummy_texel,
             1, 1, 1, 1, 0,
-            VK_FORMAT_R8_UINT, TextureType::Texture2D
+            VK_FORMAT_R8G8B8A8_UNORM, TextureType::Texture2D
     };
+    dummy_texture_creation.set_name("Dummy_Texture");
     dummy_texture = create_texture(dummy_texture_creation);
 
     BufferCreation dummy_constant_buffer_creation = {
@@ -666,7 +801,7 @@ void GpuDevice::init(const DeviceCreation& creation) {
     dynamic_per_frame_size = 1024 * 1024 * 10;
     BufferCreation bc;
     bc.set(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-            ResourceUsageType::Immutable,
+            ResourceUsageType::Stream,
             dynamic_per_frame_size * k_max_frames)
             .set_name("Dynamic_Persistent_Buffer");
     dynamic_buffer = create_buffer(bc);
@@ -679,10 +814,19 @@ void GpuDevice::init(const DeviceCreation& creation) {
 }
 
 void GpuDevice::shutdown() {
-    vkDeviceWaitIdle(vulkan_device);
+    wait_uploads();
+    {
+        std::lock_guard<std::mutex> lock(vulkan_queue_mutex);
+        vkDeviceWaitIdle(vulkan_device);
+    }
 
     command_buffer_ring.shutdown();
 
+    for(u32 i = 0; i < k_max_upload_batches; i++) {
+        vkDestroyFence(vulkan_device, vulkan_upload_fences[i], vulkan_allocation_callbacks);
+    }
+    vkDestroyCommandPool(vulkan_device, vulkan_upload_command_pool, vulkan_allocation_callbacks);
+
     for(size_t i = 0; i < k_max_swapchain_images; i++) {
         vkDestroySemaphore(vulkan_device, vulkan_render_complete_semaphore[i], vulkan_allocation_callbacks);
         vkDestroyFence(vulkan_device, vulkan_command_buffer_executed_fence[i], vulkan_allocation_callbacks);
@@ -695,9 +839,12 @@ void GpuDevice::shutdown() {
     MapBufferParameters cb_map = {dynamic_buffer, 0, 0};
     unmap_buffer(cb_map);
 
-    // Memory: this contains allocations for gpu timestamp memory, queued command buffers and render frames
+    // Memory: this contains allocations for gpu timestamp memory and render frames
     puffin_free(gpu_timestamp_manager, allocator);
 
+    queued_command_buffers.shutdown();
+    submitted_command_buffers.shutdown();
+
     destroy_texture(depth_texture);
     destroy_buffer(fullscreen_vertex_buffer);
     destroy_buffer(dynamic_buffer);
@@ -777,9 +924,12 @@ void GpuDevice::shutdown() {
     destroy_swapchain();
     vkDestroySurfaceKHR(vulkan_instance, vulkan_window_surface, vulkan_allocation_callbacks);
 
+    vmaDestroyBuffer(vma_allocator, vulkan_staging_buffer, vma_staging_allocation);
+
     vmaDestroyAllocator(vma_allocator);
 
     texture_to_update_bindless.shutdown();
+    textures_to_acquire.shutdown();
     resource_deletion_queue.shutdown();
     descriptor_set_updates.shutdown();
 
@@ -811,7 +961,7 @@ void GpuDevice::shutdown() {
     p_print("GPU Device shutdown\n");
 }
 
-static void transition_image_layout(VkCommandBuffer command_buffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, bool is_depth) {
+static void transition_image_layout(VkCommandBuffer command_buffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, bool is_depth, u32 mip_count = 1) {
     VkImageMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = oldLayout;
@@ -823,7 +973,7 @@ static void transition_image_layout(VkCommandBuffer command_buffer, VkImage imag
     barrier.image = image;
     barrier.subresourceRange.aspectMask = is_depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = mip_count;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -918,7 +1068,7 @@ static void vulkan_create_texture(GpuDevice& gpu, const TextureCreation& creatio
         info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     }
 
-    info.subresourceRange.levelCount = 1;
+    info.subresourceRange.levelCount = creation.mipmaps;
     info.subresourceRange.layerCount = 1;
 
     result = vkCreateImageView(gpu.vulkan_device, &info, gpu.vulkan_allocation_callbacks, &texture->vk_image_view);
@@ -929,100 +1079,83 @@ static void vulkan_create_texture(GpuDevice& gpu, const TextureCreation& creatio
 
     if(gpu.bindless_supported) {
         ResourceUpdate resource_update { ResourceDeletionType::Texture, texture->handle.index, gpu.current_frame };
+
+        std::lock_guard<std::mutex> lock(gpu.texture_update_mutex);
         gpu.texture_to_update_bindless.push(resource_update);
     }
 }
 
-TextureHandle GpuDevice::create_texture(const TextureCreation& creation) {
-    u32 resource_index = textures.obtain_resource();
-    TextureHandle handle = {resource_index};
+// Records the copy of every mip level through the staging ring, data holds the tightly packed chain.
+// Rows are split in bands so that textures bigger than the ring are streamed instead of needing a dedicated staging buffer.
+static void vulkan_upload_texture_data(GpuDevice& gpu, Texture* texture, const u8* data) {
+    // Only 8 bit RGBA data is uploaded for now
+    const u32 texel_size = 4;
 
-    if(resource_index == k_invalid_index) {
-        return handle;
-    }
+    VkCommandBuffer command_buffer = gpu.get_upload_command_buffer();
+    transition_image_layout(command_buffer, texture->vk_image, texture->vk_format,
+                            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false, texture->mipmaps);
 
-    Texture* texture = access_texture(handle);
+    for(u32 mip = 0; mip < texture->mipmaps; mip++) {
+        const u32 mip_width = puffin_max(1u, (u32)texture->width >> mip);
+        const u32 mip_height = puffin_max(1u, (u32)texture->height >> mip);
+        const u32 row_pitch = mip_width * texel_size;
+        const u32 max_rows_per_band = puffin_max(1u, (gpu.staging_buffer_size / 2) / row_pitch);
 
-    vulkan_create_texture(*this, creation, handle, texture);
+        for(u32 row = 0; row < mip_height; row += max_rows_per_band) {
+            const u32 band_rows = puffin_min(max_rows_per_band, mip_height - row);
+            const u32 band_size = band_rows * row_pitch;
 
-    // Copy buffer_data if present
-    if(creation.initial_data) {
-        // Create staging buffer
-        VkBufferCreateInfo buffer_info = {
-                VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO
-        };
-        buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-
-        u32 image_size = creation.width * creation.height * 4;
-        buffer_info.size = image_size;
-
-        VmaAllocationCreateInfo memory_info{};
-        memory_info.flags = VMA_ALLOCATION_CREATE_STRATEGY_BEST_FIT_BIT;
-        memory_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+            u32 staging_offset = 0;
+            u8* staging_memory = gpu.staging_allocate(band_size, 16, staging_offset);
+            memcpy(staging_memory, data + (size_t)row * row_pitch, band_size);
+            vmaFlushAllocation(gpu.vma_allocator, gpu.vma_staging_allocation, staging_offset, band_size);
 
-        VmaAllocationInfo allocation_info{};
-        VkBuffer staging_buffer;
-        VmaAllocation staging_allocation;
+            VkBufferImageCopy region = {};
+            region.bufferOffset = staging_offset;
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
 
-        VkResult result = vmaCreateBuffer(vma_allocator, &buffer_info, &memory_info,
-                                          &staging_buffer, &staging_allocation, &allocation_info);
-        check(result);
-
-        void* destination_data;
-        vmaMapMemory(vma_allocator, staging_allocation, &destination_data);
-        memcpy(destination_data, creation.initial_data, static_cast<size_t>(image_size));
-        vmaUnmapMemory(vma_allocator, staging_allocation);
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = mip;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
 
-        VkCommandBufferBeginInfo beginInfo = {
-                VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-        };
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            region.imageOffset = {0, (i32)row, 0};
+            region.imageExtent = {mip_width, band_rows, texture->depth};
 
-        CommandBuffer* command_buffer = get_instant_command_buffer();
-        vkBeginCommandBuffer(command_buffer->vk_command_buffer, &beginInfo);
+            // Allocating from the ring can submit the current batch when full, so fetch the command buffer again
+            command_buffer = gpu.get_upload_command_buffer();
+            vkCmdCopyBufferToImage(command_buffer, gpu.vulkan_staging_buffer, texture->vk_image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-        VkBufferImageCopy region = {};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-
-        region.imageOffset = {0, 0, 0};
-        region.imageExtent = {creation.width, creation.height, creation.depth};
-
-        // Transition
-        transition_image_layout(command_buffer->vk_command_buffer, texture->vk_image, texture->vk_format,
-                                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false);
+            gpu.upload_statistics.bytes_uploaded += band_size;
+        }
 
-        // Copy
-        vkCmdCopyBufferToImage(command_buffer->vk_command_buffer, staging_buffer, texture->vk_image,
-                                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        data += (size_t)mip_height * row_pitch;
+    }
 
-        // Transition
-        transition_image_layout(command_buffer->vk_command_buffer, texture->vk_image, texture->vk_format,
-                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false);
+    transition_image_layout(command_buffer, texture->vk_image, texture->vk_format,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, texture->mipmaps);
 
-        vkEndCommandBuffer(command_buffer->vk_command_buffer);
+    texture->vk_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    gpu.upload_statistics.uploads++;
+}
 
-        // Submit command buffer
-        VkSubmitInfo submitInfo = {
-                VK_STRUCTURE_TYPE_SUBMIT_INFO
-        };
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &command_buffer->vk_command_buffer;
+TextureHandle GpuDevice::create_texture(const TextureCreation& creation) {
+    u32 resource_index = textures.obtain_resource();
+    TextureHandle handle = {resource_index};
 
-        vkQueueSubmit(vulkan_queue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(vulkan_queue);
+    if(resource_index == k_invalid_index) {
+        return handle;
+    }
 
-        vmaDestroyBuffer(vma_allocator, staging_buffer, staging_allocation);
+    Texture* texture = access_texture(handle);
 
-        vkResetCommandBuffer(command_buffer->vk_command_buffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
+    vulkan_create_texture(*this, creation, handle, texture);
 
-        texture->vk_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    // Copy buffer_data if present
+    if(creation.initial_data) {
+        vulkan_upload_texture_data(*this, texture, (const u8*)creation.initial_data);
     }
 
     return handle;
@@ -1525,6 +1658,32 @@ PipelineHandle GpuDevice::create_pipeline(const PipelineCreation& creation, cstr
     return handle;
 }
 
+// Records the copy of the whole buffer through the staging ring, in chunks of at most half the ring.
+static void vulkan_upload_buffer_data(GpuDevice& gpu, Buffer* buffer, const u8* data, u32 size) {
+    const u32 max_chunk_size = gpu.staging_buffer_size / 2;
+
+    for(u32 offset = 0; offset < size; offset += max_chunk_size) {
+        const u32 chunk_size = puffin_min(max_chunk_size, size - offset);
+
+        u32 staging_offset = 0;
+        u8* staging_memory = gpu.staging_allocate(chunk_size, 16, staging_offset);
+        memcpy(staging_memory, data + offset, chunk_size);
+        vmaFlushAllocation(gpu.vma_allocator, gpu.vma_staging_allocation, staging_offset, chunk_size);
+
+        VkBufferCopy region = {};
+        region.srcOffset = staging_offset;
+        region.dstOffset = offset;
+        region.size = chunk_size;
+
+        VkCommandBuffer command_buffer = gpu.get_upload_command_buffer();
+        vkCmdCopyBuffer(command_buffer, gpu.vulkan_staging_buffer, buffer->vk_buffer, 1, &region);
+
+        gpu.upload_statistics.bytes_uploaded += chunk_size;
+    }
+
+    gpu.upload_statistics.uploads++;
+}
+
 BufferHandle GpuDevice::create_buffer(const BufferCreation& creation) {
     BufferHandle handle = { buffers.obtain_resource() };
     if(handle.index == k_invalid_index) {
@@ -1554,9 +1713,14 @@ BufferHandle GpuDevice::create_buffer(const BufferCreation& creation) {
     buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | creation.type_flags;
     buffer_info.size = creation.size > 0 ? creation.size : 1; // 0 is not permitted
 
+    // Immutable buffers live in device local memory and are filled through the staging ring,
+    // the others stay host visible and persistently mapped.
+    const bool device_local = creation.usage == ResourceUsageType::Immutable;
+
     VmaAllocationCreateInfo memory_info{};
     memory_info.flags = VMA_ALLOCATION_CREATE_STRATEGY_BEST_FIT_BIT;
-    memory_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    memory_info.flags |= device_local ? 0 : VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    memory_info.usage = device_local ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_CPU_TO_GPU;
 
     VmaAllocationInfo allocation_info{};
     VkResult result = vmaCreateBuffer(vma_allocator, &buffer_info, &memory_info, &buffer->vk_buffer, &buffer->vma_allocation,
@@ -1566,12 +1730,15 @@ BufferHandle GpuDevice::create_buffer(const BufferCreation& creation) {
     set_resource_name(VK_OBJECT_TYPE_BUFFER, (u64)buffer->vk_buffer, creation.name);
 
     buffer->vk_device_memory = allocation_info.deviceMemory;
+    buffer->mapped_data = allocation_info.pMappedData;
 
     if(creation.initial_data) {
-        void* data;
-        vmaMapMemory(vma_allocator, buffer->vma_allocation, &data);
-        memcpy(data, creation.initial_data, (size_t)creation.size);
-        vmaUnmapMemory(vma_allocator, buffer->vma_allocation);
+        if(buffer->mapped_data) {
+            memcpy(buffer->mapped_data, creation.initial_data, (size_t)creation.size);
+            vmaFlushAllocation(vma_allocator, buffer->vma_allocation, 0, creation.size);
+        } else {
+            vulkan_upload_buffer_data(*this, buffer, (const u8*)creation.initial_data, creation.size);
+        }
     }
 
     return handle;
@@ -1603,6 +1770,8 @@ SamplerHandle GpuDevice::create_sampler(const SamplerCreation& creation) {
     create_info.compareEnable = 0;
     create_info.unnormalizedCoordinates = 0;
     create_info.borderColor = VkBorderColor::VK_BORDER_COLOR_INT_OPAQUE_WHITE;
+    // Sample the whole mip chain of the texture
+    create_info.maxLod = VK_LOD_CLAMP_NONE;
 
     vkCreateSampler(vulkan_device, &create_info, vulkan_allocation_callbacks, &sampler->vk_sampler);
 
@@ -1943,10 +2112,9 @@ DescriptorSetHandle GpuDevice::create_descriptor_set(const DescriptorSetCreation
     check(result);
 
     // Cache data
-    u8* memory = puffin_alloc_return_mem_pointer((sizeof(ResourceHandle) + sizeof(SamplerHandle) + sizeof(u16)) * creation.num_resources, allocator);
-    descriptor_set->resources = (ResourceHandle*) memory;
-    descriptor_set->samplers = (SamplerHandle*) (memory + sizeof(ResourceHandle) * creation.num_resources);
-    descriptor_set->bindings = (u16*) (memory + (sizeof(ResourceHandle) + sizeof(SamplerHandle)) * creation.num_resources);
+    descriptor_set->resources.init(allocator, creation.num_resources, creation.num_resources);
+    descriptor_set->samplers.init(allocator, creation.num_resources, creation.num_resources);
+    descriptor_set->bindings.init(allocator, creation.num_resources, creation.num_resources);
     descriptor_set->num_resources = creation.num_resources;
     descriptor_set->layout = descriptor_set_layout;
 
@@ -2085,11 +2253,13 @@ static void vulkan_create_swapchain_pass(GpuDevice& gpu, const RenderPassCreatio
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command_buffer->vk_command_buffer;
 
+    std::lock_guard<std::mutex> lock(gpu.vulkan_queue_mutex);
     vkQueueSubmit(gpu.vulkan_queue, 1, &submit_info, VK_NULL_HANDLE);
     // vkQueueWaitIdle is equivalent to having submitted a valid fence to every
     // previously executed queue submission command that accepts a fence, then waiting for all of
     // those fences to signal using vkWaitForFences with an infinite timeout and waitAll set to VK_TRUE.
     vkQueueWaitIdle(gpu.vulkan_queue);
+    gpu.upload_statistics.queue_waits++;
 }
 
 static void vulkan_create_framebuffer(GpuDevice& gpu, RenderPass* render_pass, const TextureHandle* output_textures, u32 num_render_targets, TextureHandle depth_stencil_texture) {
@@ -2321,7 +2491,7 @@ RenderPassHandle GpuDevice::create_render_pass(const RenderPassCreation& creatio
 
 // Resource destruction //////
 void GpuDevice::destroy_buffer(BufferHandle buffer) {
-    if(buffer.index < buffers.pool_size) {
+    if(buffers.is_valid(buffer.index)) {
         resource_deletion_queue.push({
             ResourceDeletionType::Buffer,
             buffer.index,
@@ -2333,7 +2503,7 @@ void GpuDevice::destroy_buffer(BufferHandle buffer) {
 }
 
 void GpuDevice::destroy_texture(TextureHandle texture) {
-    if(texture.index < textures.pool_size) {
+    if(textures.is_valid(texture.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::Texture,
                                              texture.index,
@@ -2345,7 +2515,7 @@ void GpuDevice::destroy_texture(TextureHandle texture) {
 }
 
 void GpuDevice::destroy_pipeline(PipelineHandle pipeline) {
-    if(pipeline.index < pipelines.pool_size) {
+    if(pipelines.is_valid(pipeline.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::Pipeline,
                                              pipeline.index,
@@ -2359,7 +2529,7 @@ void GpuDevice::destroy_pipeline(PipelineHandle pipeline) {
 }
 
 void GpuDevice::destroy_sampler(SamplerHandle sampler) {
-    if(sampler.index < samplers.pool_size) {
+    if(samplers.is_valid(sampler.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::Sampler,
                                              sampler.index,
@@ -2371,7 +2541,7 @@ void GpuDevice::destroy_sampler(SamplerHandle sampler) {
 }
 
 void GpuDevice::destroy_descriptor_set_layout(DescriptorSetLayoutHandle descriptor_set_layout) {
-    if(descriptor_set_layout.index < descriptor_set_layouts.pool_size) {
+    if(descriptor_set_layouts.is_valid(descriptor_set_layout.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::DescriptorSetLayout,
                                              descriptor_set_layout.index,
@@ -2383,7 +2553,7 @@ void GpuDevice::destroy_descriptor_set_layout(DescriptorSetLayoutHandle descript
 }
 
 void GpuDevice::destroy_descriptor_set(DescriptorSetHandle descriptor_set) {
-    if(descriptor_set.index < descriptor_sets.pool_size) {
+    if(descriptor_sets.is_valid(descriptor_set.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::DescriptorSet,
                                              descriptor_set.index,
@@ -2395,7 +2565,7 @@ void GpuDevice::destroy_descriptor_set(DescriptorSetHandle descriptor_set) {
 }
 
 void GpuDevice::destroy_render_pass(RenderPassHandle render_pass) {
-    if(render_pass.index < render_passes.pool_size) {
+    if(render_passes.is_valid(render_pass.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::RenderPass,
                                              render_pass.index,
@@ -2407,7 +2577,7 @@ void GpuDevice::destroy_render_pass(RenderPassHandle render_pass) {
 }
 
 void GpuDevice::destroy_shader_state(ShaderStateHandle shader_state) {
-    if(shader_state.index < shaders.pool_size) {
+    if(shaders.is_valid(shader_state.index)) {
         resource_deletion_queue.push({
                                              ResourceDeletionType::ShaderState,
                                              shader_state.index,
@@ -2472,7 +2642,9 @@ void GpuDevice::destroy_descriptor_set_instant(ResourceHandle descriptor_set_han
     DescriptorSet* descriptor_set = (DescriptorSet*) descriptor_sets.access_resource(descriptor_set_handle);
 
     if(descriptor_set) {
-        puffin_free(descriptor_set->resources, allocator);
+        descriptor_set->resources.shutdown();
+        descriptor_set->samplers.shutdown();
+        descriptor_set->bindings.shutdown();
         // the set is free along with its pool
     }
     descriptor_sets.release_resource(descriptor_set_handle);
@@ -2608,14 +2780,14 @@ void GpuDevice::destroy_swapchain() {
 VkRenderPass GpuDevice::get_vulkan_render_pass(const RenderPassOutput& output, cstring name) {
     // Hash the memory output and find the referenced VkRenderPass
     // RenderPassOutput should save everything we need
-    u64 hashed_memory = puffin::hash_bytes((void*)&output, sizeof(RenderPassOutput));
-    VkRenderPass vulkan_render_pass = render_pass_cache.get(hashed_memory);
-    if(vulkan_render_pass) {
-        return vulkan_render_pass;
+    const u64 hashed_memory = puffin::hash_calculate(output);
+    FlatHashMapIterator it = render_pass_cache.find_with_hash(output, hashed_memory);
+    if(it.is_valid()) {
+        return render_pass_cache.get(it);
     }
 
-    vulkan_render_pass = vulkan_create_render_pass(*this, output, name);
-    render_pass_cache.insert(hashed_memory, vulkan_render_pass);
+    VkRenderPass vulkan_render_pass = vulkan_create_render_pass(*this, output, name);
+    render_pass_cache.insert_with_hash(output, hashed_memory, vulkan_render_pass);
     return vulkan_render_pass;
 }
 
@@ -2635,7 +2807,10 @@ static void vulkan_resize_texture(GpuDevice& gpu, Texture* v_texture, Texture* v
 }
 
 void GpuDevice::resize_swapchain() {
-    vkDeviceWaitIdle(vulkan_device);
+    {
+        std::lock_guard<std::mutex> lock(vulkan_queue_mutex);
+        vkDeviceWaitIdle(vulkan_device);
+    }
 
     VkSurfaceCapabilitiesKHR surface_capabilities;
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vulkan_physical_device, vulkan_window_surface, &surface_capabilities);
@@ -2673,12 +2848,13 @@ void GpuDevice::resize_swapchain() {
         .set_name("Swapchain");
     vulkan_create_swapchain_pass(*this, swapchain_pass_creation, vk_swapchain_pass);
 
+    std::lock_guard<std::mutex> lock(vulkan_queue_mutex);
     vkDeviceWaitIdle(vulkan_device);
 }
 
 // Descriptor Set ///////////////////////////
 void GpuDevice::update_descriptor_set(DescriptorSetHandle descriptor_set) {
-    if(descriptor_set.index < descriptor_sets.pool_size) {
+    if(descriptor_sets.is_valid(descriptor_set.index)) {
         DescriptorSetUpdate new_update = { descriptor_set, current_frame };
         descriptor_set_updates.push(new_update);
     } else {
@@ -2695,9 +2871,9 @@ void GpuDevice::update_descriptor_set_instant(const DescriptorSetUpdate& update)
     const DescriptorSetLayout* descriptor_set_layout = descriptor_set->layout;
 
     dummy_delete_descriptor_set->vk_descriptor_set = descriptor_set->vk_descriptor_set;
-    dummy_delete_descriptor_set->bindings = nullptr;
-    dummy_delete_descriptor_set->resources = nullptr;
-    dummy_delete_descriptor_set->samplers = nullptr;
+    dummy_delete_descriptor_set->bindings.init(allocator, 0);
+    dummy_delete_descriptor_set->resources.init(allocator, 0);
+    dummy_delete_descriptor_set->samplers.init(allocator, 0);
     dummy_delete_descriptor_set->num_resources = 0;
 
     destroy_descriptor_set(dummy_delete_descriptor_set_handle);
@@ -2718,8 +2894,8 @@ void GpuDevice::update_descriptor_set_instant(const DescriptorSetUpdate& update)
     u32 num_resources = descriptor_set_layout->num_bindings;
     vulkan_fill_write_descriptor_sets(*this, descriptor_set_layout, descriptor_set->vk_descriptor_set,
                                         descriptor_write, buffer_info, image_info, vk_default_sampler->vk_sampler,
-                                        num_resources, descriptor_set->resources, descriptor_set->samplers,
-                                        descriptor_set->bindings);
+                                        num_resources, descriptor_set->resources.data, descriptor_set->samplers.data,
+                                        descriptor_set->bindings.data);
 
     vkUpdateDescriptorSets(vulkan_device, num_resources, descriptor_write, 0, nullptr);
 }
@@ -2828,6 +3004,8 @@ void GpuDevice::new_frame() {
     }
 
     vkResetFences(vulkan_device, 1, render_complete_fence);
+    // Reclaim staging memory of completed uploads
+    retire_uploads(false);
     // command pool reset
     command_buffer_ring.reset_pools(current_frame);
     // Dynamic memory update
@@ -2865,12 +3043,22 @@ void GpuDevice::present() {
     VkFence* render_complete_fence = &vulkan_command_buffer_executed_fence[current_frame];
     VkSemaphore* render_complete_semaphore = &vulkan_render_complete_semaphore[current_frame];
 
-    // copy all commands
-    VkCommandBuffer enqueued_command_buffers[4];
-    for(u32 c = 0; c < num_queued_command_buffers; c++) {
+    // Pending uploads are submitted first, their barriers cover the frame command buffers
+    flush_uploads();
+
+    // copy all commands, textures uploaded on the transfer queue are acquired before anything samples them
+    submitted_command_buffers.clear();
+
+    CommandBuffer* acquire_command_buffer = acquire_uploaded_textures();
+    if(acquire_command_buffer) {
+        vkEndCommandBuffer(acquire_command_buffer->vk_command_buffer);
+        submitted_command_buffers.push(acquire_command_buffer->vk_command_buffer);
+    }
+
+    for(u32 c = 0; c < queued_command_buffers.size; c++) {
         CommandBuffer* command_buffer = queued_command_buffers[c];
 
-        enqueued_command_buffers[c] = command_buffer->vk_command_buffer;
+        submitted_command_buffers.push(command_buffer->vk_command_buffer);
 
         if(command_buffer->is_recording && command_buffer->current_render_pass && (command_buffer->current_render_pass->type != RenderPassType::Compute)) {
             vkCmdEndRenderPass(command_buffer->vk_command_buffer);
@@ -2879,6 +3067,7 @@ void GpuDevice::present() {
         vkEndCommandBuffer(command_buffer->vk_command_buffer);
     }
 
+    std::unique_lock<std::mutex> texture_update_lock(texture_update_mutex);
     if(texture_to_update_bindless.size) {
         // Handle deferred writes to bindless textures.
         VkWriteDescriptorSet bindless_descriptor_writes[k_max_bindless_resources];
@@ -2894,7 +3083,8 @@ void GpuDevice::present() {
             VkWriteDescriptorSet& descriptor_write = bindless_descriptor_writes[current_write_index];
             descriptor_write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
             descriptor_write.descriptorCount = 1;
-            descriptor_write.dstArrayElement = texture_to_update.handle;
+            descriptor_write.dstArrayElement = resource_pool_index(texture_to_update.handle);
+            PASSERT(descriptor_write.dstArrayElement < k_max_bindless_resources);
             descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
             descriptor_write.dstSet = vulkan_bindless_descriptor_set;
             descriptor_write.dstBinding = k_bindless_texture_binding;
@@ -2910,6 +3100,8 @@ void GpuDevice::present() {
                 descriptor_image_info.sampler = vk_default_sampler->vk_sampler;
             }
 
+            // Slots are only written while nothing in flight samples them: at creation, and for textures filled by
+            // the asynchronous loader once more at acquire, materials use the dummy texture until is_texture_ready.
             descriptor_image_info.imageView = texture->vk_format != VK_FORMAT_UNDEFINED ? texture->vk_image_view : vk_dummy_texture->vk_image_view;
             descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
@@ -2919,7 +3111,11 @@ void GpuDevice::present() {
 
             texture_to_update_bindless.delete_swap(it);
 
-            current_write_index++;
+            // A texture can be queued more than once, so there can be more updates than array elements
+            if(++current_write_index == k_max_bindless_resources) {
+                vkUpdateDescriptorSets(vulkan_device, current_write_index, bindless_descriptor_writes, 0, nullptr);
+                current_write_index = 0;
+            }
         }
 
         if(current_write_index) {
@@ -2927,6 +3123,7 @@ void GpuDevice::present() {
         }
 
     }
+    texture_update_lock.unlock();
 
     // Submit command buffers
     VkSemaphore wait_semaphores[] = { vulkan_image_acquired_semaphore };
@@ -2936,11 +3133,12 @@ void GpuDevice::present() {
     submit_info.waitSemaphoreCount = 1;
     submit_info.pWaitSemaphores = wait_semaphores;
     submit_info.pWaitDstStageMask = wait_stages;
-    submit_info.commandBufferCount = num_queued_command_buffers;
-    submit_info.pCommandBuffers = enqueued_command_buffers;
+    submit_info.commandBufferCount = submitted_command_buffers.size;
+    submit_info.pCommandBuffers = submitted_command_buffers.data;
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = render_complete_semaphore; // telling present info we're good to present
 
+    std::unique_lock<std::mutex> queue_lock(vulkan_queue_mutex);
     vkQueueSubmit(vulkan_queue, 1, &submit_info, *render_complete_fence);
 
     VkPresentInfoKHR present_info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
@@ -2953,8 +3151,9 @@ void GpuDevice::present() {
     present_info.pImageIndices = &vulkan_image_index;
     present_info.pResults = nullptr;
     result = vkQueuePresentKHR(vulkan_queue, &present_info);
+    queue_lock.unlock();
 
-    num_queued_command_buffers = 0;
+    queued_command_buffers.clear();
 
     // GPU Timestamp resolve
     if(timestamps_enabled) {
@@ -3110,6 +3309,59 @@ void GpuDevice::link_texture_sampler(TextureHandle texture, SamplerHandle sample
     texture_vk->sampler = sampler_vk;
 }
 
+void GpuDevice::complete_texture_upload(TextureHandle texture) {
+    std::lock_guard<std::mutex> lock(texture_update_mutex);
+    textures_to_acquire.push(texture);
+}
+
+CommandBuffer* GpuDevice::acquire_uploaded_textures() {
+    std::lock_guard<std::mutex> lock(texture_update_mutex);
+    if(textures_to_acquire.size == 0) {
+        return nullptr;
+    }
+
+    // With a single family the loader already transitioned the textures for shader reads
+    CommandBuffer* command_buffer = nullptr;
+    if(vulkan_transfer_queue_family != vulkan_queue_family) {
+        command_buffer = get_command_buffer(QueueType::Graphics, true);
+    }
+
+    for(u32 i = 0; i < textures_to_acquire.size; i++) {
+        Texture* texture = access_texture(textures_to_acquire[i]);
+        // Destroyed while it was uploading
+        if(texture == nullptr) {
+            continue;
+        }
+
+        if(command_buffer) {
+            // Matches the release recorded by the loader, the source access mask is ignored on acquire
+            VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcQueueFamilyIndex = vulkan_transfer_queue_family;
+            barrier.dstQueueFamilyIndex = vulkan_queue_family;
+            barrier.image = texture->vk_image;
+            barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, texture->mipmaps, 0, 1 };
+
+            vkCmdPipelineBarrier(command_buffer->vk_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+
+        texture->vk_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        // The sampler can have been linked after creation. Nothing samples the slot yet, see is_texture_ready.
+        if(bindless_supported) {
+            ResourceUpdate resource_update { ResourceDeletionType::Texture, texture->handle.index, current_frame };
+            texture_to_update_bindless.push(resource_update);
+        }
+    }
+
+    textures_to_acquire.clear();
+    return command_buffer;
+}
+
 void GpuDevice::frame_counters_advance() {
     previous_frame = current_frame;
     current_frame = (current_frame + 1) % vulkan_swapchain_image_count;
@@ -3118,14 +3370,15 @@ void GpuDevice::frame_counters_advance() {
 }
 
 void GpuDevice::queue_command_buffer(CommandBuffer* command_buffer) {
-    queued_command_buffers[num_queued_command_buffers++] = command_buffer;
+    std::lock_guard<std::mutex> lock(queued_command_buffers_mutex);
+    queued_command_buffers.push(command_buffer);
 }
 
-CommandBuffer* GpuDevice::get_command_buffer(QueueType::Enum type, bool begin) {
-    CommandBuffer* cb = command_buffer_ring.get_command_buffer(current_frame, begin);
+CommandBuffer* GpuDevice::get_command_buffer(QueueType::Enum type, bool begin, u32 thread_index) {
+    CommandBuffer* cb = command_buffer_ring.get_command_buffer(current_frame, thread_index, begin);
 
     // The first command buffer issued in the frame is used to reset the timestamp queries used
-    if(gpu_timestamp_reset && begin) {
+    if(gpu_timestamp_reset && begin && thread_index == 0) {
         // these are currently indices
         vkCmdResetQueryPool(cb->vk_command_buffer, vulkan_timestamp_query_pool, current_frame * gpu_timestamp_manager->queries_per_frame * 2,
                             gpu_timestamp_manager->queries_per_frame);
@@ -3136,6 +3389,10 @@ CommandBuffer* GpuDevice::get_command_buffer(QueueType::Enum type, bool begin) {
     return cb;
 }
 
+CommandBuffer* GpuDevice::get_secondary_command_buffer(u32 thread_index) {
+    return command_buffer_ring.get_secondary_command_buffer(current_frame, thread_index);
+}
+
 CommandBuffer* GpuDevice::get_instant_command_buffer() {
     CommandBuffer* cb = command_buffer_ring.get_command_buffer_instant(current_frame, false);
     return cb;
@@ -3244,10 +3501,12 @@ void* GpuDevice::map_buffer(const MapBufferParameters& parameters) {
         return dynamic_allocate(parameters.size == 0 ? buffer->size : parameters.size);
     }
 
-    void* data;
-    vmaMapMemory(vma_allocator, buffer->vma_allocation, &data);
+    PASSERTM(buffer->mapped_data != nullptr, "Buffer %s is device local and cannot be mapped", buffer->name);
+    if(buffer->mapped_data == nullptr) {
+        return nullptr;
+    }
 
-    return data;
+    return (u8*)buffer->mapped_data + parameters.offset;
 }
 
 void GpuDevice::unmap_buffer(const MapBufferParameters& parameters) {
@@ -3260,7 +3519,10 @@ void GpuDevice::unmap_buffer(const MapBufferParameters& parameters) {
         return;
     }
 
-    vmaUnmapMemory(vma_allocator, buffer->vma_allocation);
+    // Memory stays mapped, only make the writes visible in case the memory is not host coherent
+    if(buffer->mapped_data) {
+        vmaFlushAllocation(vma_allocator, buffer->vma_allocation, parameters.offset, parameters.size == 0 ? VK_WHOLE_SIZE : parameters.size);
+    }
 }
 
 void* GpuDevice::dynamic_allocate(u32 size) {
@@ -3269,6 +3531,124 @@ void* GpuDevice::dynamic_allocate(u32 size) {
     return mapped_memory;
 }
 
+// Uploads ////////////////////////////////////////////////////////
+
+u8* GpuDevice::staging_allocate(u32 size, u32 alignment, u32& out_offset) {
+    PASSERTM(size <= staging_buffer_size, "Staging allocation of %u bytes is bigger than the ring (%u bytes)", size, staging_buffer_size);
+
+    for(;;) {
+        // Everything retired, restart from the beginning to avoid fragmentation
+        if(staging_head == staging_tail) {
+            staging_head = 0;
+            staging_tail = 0;
+        }
+
+        u64 offset = memory_align(staging_head, alignment);
+        u64 physical_offset = offset % staging_buffer_size;
+        // Allocations are contiguous, skip the end of the ring if needed
+        if(physical_offset + size > staging_buffer_size) {
+            offset += staging_buffer_size - physical_offset;
+            physical_offset = 0;
+        }
+
+        if(offset + size - staging_tail <= staging_buffer_size) {
+            staging_head = offset + size;
+            out_offset = (u32)physical_offset;
+            return staging_mapped_memory + physical_offset;
+        }
+
+        // Ring is full. If nothing is in flight the recording batch owns the memory, submit it first.
+        if(num_upload_batches_in_flight == 0) {
+            flush_uploads();
+        }
+        retire_uploads(true);
+    }
+}
+
+VkCommandBuffer GpuDevice::get_upload_command_buffer() {
+    VkCommandBuffer command_buffer = vulkan_upload_command_buffers[upload_batch_current];
+    if(upload_batch_recording) {
+        return command_buffer;
+    }
+
+    // All batches in flight: the current slot is the oldest one and has to retire before reuse
+    if(num_upload_batches_in_flight == k_max_upload_batches) {
+        retire_uploads(true);
+    }
+
+    VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+
+    upload_batch_recording = true;
+    return command_buffer;
+}
+
+void GpuDevice::flush_uploads() {
+    if(!upload_batch_recording) {
+        return;
+    }
+
+    VkCommandBuffer command_buffer = vulkan_upload_command_buffers[upload_batch_current];
+
+    // Make buffer copies visible to any later read. Textures have their own layout transitions.
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(command_buffer);
+
+    VkFence fence = vulkan_upload_fences[upload_batch_current];
+    vkResetFences(vulkan_device, 1, &fence);
+
+    VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    {
+        std::lock_guard<std::mutex> lock(vulkan_queue_mutex);
+        check(vkQueueSubmit(vulkan_queue, 1, &submit_info, fence));
+    }
+
+    upload_batch_staging_end[upload_batch_current] = staging_head;
+    upload_batch_current = (upload_batch_current + 1) % k_max_upload_batches;
+    num_upload_batches_in_flight++;
+    upload_batch_recording = false;
+
+    upload_statistics.batches_submitted++;
+}
+
+void GpuDevice::wait_uploads() {
+    flush_uploads();
+
+    while(num_upload_batches_in_flight) {
+        retire_uploads(true);
+    }
+}
+
+void GpuDevice::retire_uploads(bool wait_oldest) {
+    while(num_upload_batches_in_flight) {
+        const u32 oldest = (upload_batch_current + k_max_upload_batches - num_upload_batches_in_flight) % k_max_upload_batches;
+        VkFence fence = vulkan_upload_fences[oldest];
+
+        if(vkGetFenceStatus(vulkan_device, fence) != VK_SUCCESS) {
+            if(!wait_oldest) {
+                break;
+            }
+
+            vkWaitForFences(vulkan_device, 1, &fence, VK_TRUE, UINT64_MAX);
+            upload_statistics.fence_waits++;
+            // Only stall for one batch, the others are retired if already completed
+            wait_oldest = false;
+        }
+
+        staging_tail = upload_batch_staging_end[oldest];
+        num_upload_batches_in_flight--;
+    }
+}
+
 void GpuDevice::set_buffer_global_offset(puffin::BufferHandle buffer, u32 offset) {
     if(buffer.index == k_invalid_index) {
         return;
@@ -3332,6 +3712,11 @@ TextureHandle GpuDevice::get_dummy_texture() const {
     return dummy_texture;
 }
 
+bool GpuDevice::is_texture_ready(TextureHandle texture) const {
+    const Texture* vk_texture = access_texture(texture);
+    return vk_texture != nullptr && vk_texture->vk_image_layout != VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
 BufferHandle GpuDevice::get_dummy_constant_buffer() const {
     return dummy_constant_buffer;
 }
@@ -3507,5 +3892,10 @@ DeviceCreation& DeviceCreation::set_linear_allocator( StackAllocator* allocator
     return *this;
 }
 
+DeviceCreation& DeviceCreation::set_num_threads( u32 value ) {
+    num_threads = (u16)value;
+    return *this;
+}
+
 } // puffin namespace
 
@@ -23,11 +23,15 @@
 #include "service.hpp"
 #include "array.hpp"
 
+#include <mutex>
 
 namespace puffin {
 
     struct Allocator;
 
+    // Elements of the bindless texture array, with bindless the texture pool holds no more than this
+    static const u32            k_max_bindless_resources    = 1024;
+
     // Forward declarations ///
     struct CommandBuffer;
     struct DeviceRenderFrame;
@@ -50,6 +54,15 @@ namespace puffin {
         cstring         name;
     };
 
+    // Counters for the staging uploads, used to measure load times and stalls
+    struct GpuUploadStatistics {
+        u64             bytes_uploaded      = 0;
+        u32             uploads             = 0;    // Textures and buffers recorded into upload batches
+        u32             batches_submitted   = 0;
+        u32             fence_waits         = 0;    // CPU stalls waiting for a batch to retire
+        u32             queue_waits         = 0;    // Full queue idle waits
+    };
+
 
     struct GPUTimestampManager {
         void            init(Allocator* allocator, u16 queries_per_frame, u16 max_frames);
@@ -82,13 +95,17 @@ namespace puffin {
         u16                     width               = 1;
         u16                     height              = 1;
 
+        u32                     staging_buffer_size = 64 * 1024 * 1024;
+
         u16                     gpu_time_queries_per_frame = 32;
+        u16                     num_threads         = 1;    // Threads recording command buffers, each gets its own pools
         bool                    enabled_gpu_time_queries = false;
         bool                    debug               = false;
 
         DeviceCreation&         set_window(u32 width, u32 height, void* handle);
         DeviceCreation&         set_allocator(Allocator* allocator);
         DeviceCreation&         set_linear_allocator(StackAllocator* allocator);
+        DeviceCreation&         set_num_threads(u32 value);
     };
 
     struct GpuDevice : public Service {
@@ -141,6 +158,12 @@ namespace puffin {
         // Misc
         void                    link_texture_sampler(TextureHandle texture, SamplerHandle sampler);
 
+        // Any thread. The texture data has been copied, and released by the transfer queue if it has its own family.
+        // The next present acquires it on the graphics queue and writes its bindless slot.
+        void                    complete_texture_upload(TextureHandle texture);
+        // Records the queue ownership acquire of the completed uploads, nullptr if there is nothing to acquire
+        CommandBuffer*          acquire_uploaded_textures();
+
         void                    set_present_mode(PresentMode::Enum mode);
 
         void                    frame_counters_advance();
@@ -158,12 +181,24 @@ namespace puffin {
 
         void*                   dynamic_allocate(u32 size);
 
+        // Uploads
+        u8*                     staging_allocate(u32 size, u32 alignment, u32& out_offset);
+        VkCommandBuffer         get_upload_command_buffer();    // Begins a new upload batch if none is recording
+        void                    flush_uploads();                // Submits the recording batch, does not wait
+        void                    wait_uploads();                 // Submits and waits for every batch to retire
+        void                    retire_uploads(bool wait_oldest);
+
         void                    set_buffer_global_offset(BufferHandle buffer, u32 offset);
 
         // Command Buffers
-        CommandBuffer*          get_command_buffer(QueueType::Enum type, bool begin);
+        // Every thread_index has its own command pools per frame, different threads can record at the same time.
+        // The timestamp queries are reset by the first buffer begun on thread 0.
+        CommandBuffer*          get_command_buffer(QueueType::Enum type, bool begin, u32 thread_index = 0);
+        // Recorded with begin_secondary and run from a primary with execute_secondary
+        CommandBuffer*          get_secondary_command_buffer(u32 thread_index);
         CommandBuffer*          get_instant_command_buffer();
 
+        // Any thread, buffers are submitted in the order they were queued
         void                    queue_command_buffer(CommandBuffer* command_buffer);
 
         // Rendering
@@ -178,6 +213,9 @@ namespace puffin {
         RenderPassHandle        get_swapchain_pass() const; // returns what is considered the final pass that writes to the swapchain
 
         TextureHandle           get_dummy_texture() const;
+        // Main thread. False until the texture filled by the asynchronous loader is acquired, shaders must index
+        // the dummy texture instead so that its bindless slot is never rewritten while a frame samples it.
+        bool                    is_texture_ready(TextureHandle texture) const;
         BufferHandle            get_dummy_constant_buffer() const;
         const RenderPassOutput& get_swapchain_output() const { return swapchain_output; }
 
@@ -239,9 +277,31 @@ namespace puffin {
         u32                     dynamic_allocated_size;
         u32                     dynamic_per_frame_size;
 
-        CommandBuffer**         queued_command_buffers          = nullptr;
-        u32                     num_allocated_command_buffers   = 0;
-        u32                     num_queued_command_buffers      = 0;
+        // Staging ring: persistently mapped memory shared by all uploads.
+        // Head and tail are virtual offsets, the physical offset is the remainder by the ring size.
+        static const u32        k_max_upload_batches            = 4;
+
+        VkBuffer                vulkan_staging_buffer;
+        VmaAllocation           vma_staging_allocation;
+        u8*                     staging_mapped_memory           = nullptr;
+        u32                     staging_buffer_size             = 0;
+        u64                     staging_head                    = 0;
+        u64                     staging_tail                    = 0;
+
+        VkCommandPool           vulkan_upload_command_pool;
+        VkCommandBuffer         vulkan_upload_command_buffers[k_max_upload_batches];
+        VkFence                 vulkan_upload_fences[k_max_upload_batches];
+        u64                     upload_batch_staging_end[k_max_upload_batches];
+        u32                     upload_batch_current            = 0;
+        u32                     num_upload_batches_in_flight    = 0;
+        bool                    upload_batch_recording          = false;
+
+        GpuUploadStatistics     upload_statistics;
+
+        Array<CommandBuffer*>   queued_command_buffers;
+        Array<VkCommandBuffer>  submitted_command_buffers;      // Filled by present, kept to avoid regrowing
+        std::mutex              queued_command_buffers_mutex;
+        u32                     num_threads                     = 1;
 
         PresentMode::Enum       present_mode                    = PresentMode::VSync;
         u32                     current_frame;
@@ -268,6 +328,11 @@ namespace puffin {
         VkDevice                vulkan_device;
         VkQueue                 vulkan_queue;
         uint32_t                vulkan_queue_family;
+        // A queue of a transfer only family when the device has one, otherwise the same as vulkan_queue
+        VkQueue                 vulkan_transfer_queue;
+        uint32_t                vulkan_transfer_queue_family;
+        // Held around submits, presents and waits on both queues, the asynchronous loader submits from its thread
+        std::mutex              vulkan_queue_mutex;
         VkDescriptorPool        vulkan_descriptor_pool;
 
         // Bindless
@@ -309,8 +374,10 @@ namespace puffin {
         Array<ResourceUpdate>   resource_deletion_queue;
         Array<DescriptorSetUpdate>  descriptor_set_updates;
 
-        // Bindless
+        // Bindless, both guarded by texture_update_mutex
         Array<ResourceUpdate>   texture_to_update_bindless;
+        Array<TextureHandle>    textures_to_acquire;
+        std::mutex              texture_update_mutex;
 
         f32                     gpu_timestamp_frequency;
         bool                    gpu_timestamp_reset             = true;
@@ -17,7 +17,8 @@
 
 namespace puffin {
 
-puffin::FlatHashMap<u64, u32> name_to_color;
+// Keyed by the hash of the timestamp name, sharing a color on a collision is harmless
+puffin::FlatHashMap<u64, u32, puffin::HashPrecomputed> name_to_color;
 
 static u32 initial_frames_paused = 3;
 
@@ -7,6 +7,8 @@
 
 #include "memory.hpp"
 #include "file_system.hpp"
+#include "mipmap.hpp"
+#include "time.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -19,7 +21,7 @@ namespace puffin {
 
 struct TextureLoader : public puffin::ResourceLoader {
     Resource*           get(cstring name) override;
-    Resource*           get(u64 hashd_name) override;
+    Resource*           get(cstring name, u64 hashed_name) override;
 
     Resource*           unload(cstring name) override;
 
@@ -30,7 +32,7 @@ struct TextureLoader : public puffin::ResourceLoader {
 
 struct BufferLoader : public puffin::ResourceLoader {
     Resource*           get(cstring name) override;
-    Resource*           get(u64 hashed_name) override;
+    Resource*           get(cstring name, u64 hashed_name) override;
 
     Resource*           unload(cstring name) override;
 
@@ -39,7 +41,7 @@ struct BufferLoader : public puffin::ResourceLoader {
 
 struct SamplerLoader : public puffin::ResourceLoader {
     Resource*           get(cstring name) override;
-    Resource*           get(u64 hashed_name) override;
+    Resource*           get(cstring name, u64 hashed_name) override;
 
     Resource*           unload(cstring name) override;
 
@@ -70,37 +72,120 @@ MaterialCreation& MaterialCreation::set_name(cstring name_) {
 }
 
 
-static TextureHandle create_texture_from_file(GpuDevice& gpu, cstring filename, cstring name, bool create_mipmaps) {
-    if(filename) {
-        int comp, width, height;
-        uint8_t* image_data = stbi_load(filename, &width, &height, &comp, 4);
-        if(!image_data) {
-            p_print("Error loading texture %s", filename);
-            return k_invalid_texture;
+// Texture data ///
+
+// Grows the decoder allocation to hold the whole chain, generated in place after level 0
+static bool texture_data_finalize(uint8_t* image_data, int width, int height, bool create_mipmaps, bool srgb, i64 start_time, TextureData& out_data) {
+    const u32 mip_levels = create_mipmaps ? mipmap_level_count(width, height) : 1;
+
+    if(mip_levels > 1) {
+        uint8_t* chain_data = (uint8_t*)realloc(image_data, mipmap_chain_size(width, height, mip_levels));
+        if(!chain_data) {
+            stbi_image_free(image_data);
+            p_print("Error allocating mip chain of %ux%u texture", width, height);
+            return false;
         }
 
-        u32 mip_levels = 1;
-        if(create_mipmaps) {
-            u32 w = width;
-            u32 h = height;
+        image_data = chain_data;
+        mipmap_generate_rgba8(image_data, width, height, mip_levels, srgb);
+    }
+
+    out_data.data = image_data;
+    out_data.width = width;
+    out_data.height = height;
+    out_data.mip_levels = mip_levels;
+    out_data.decode_ms = time_delta_milliseconds(start_time, time_now());
 
-            while(w > 1 && h > 1) {
-                w /= 2;
-                h /= 2;
+    return true;
+}
 
-                mip_levels++;
-            }
-        }
+bool texture_data_load(cstring filename, bool create_mipmaps, bool srgb, TextureData& out_data) {
+    const i64 start_time = time_now();
+
+    int comp, width, height;
+    uint8_t* image_data = stbi_load(filename, &width, &height, &comp, 4);
+    if(!image_data) {
+        p_print("Error loading texture %s", filename);
+        return false;
+    }
+
+    return texture_data_finalize(image_data, width, height, create_mipmaps, srgb, start_time, out_data);
+}
+
+bool texture_data_load_from_memory(const u8* memory, u32 size, bool create_mipmaps, bool srgb, TextureData& out_data) {
+    const i64 start_time = time_now();
+
+    int comp, width, height;
+    uint8_t* image_data = stbi_load_from_memory(memory, (int)size, &width, &height, &comp, 4);
+    if(!image_data) {
+        p_print("Error loading texture from memory");
+        return false;
+    }
+
+    return texture_data_finalize(image_data, width, height, create_mipmaps, srgb, start_time, out_data);
+}
+
+static bool texture_data_info_finalize(bool found, int width, int height, bool create_mipmaps, TextureData& out_data) {
+    if(!found) {
+        return false;
+    }
 
-        TextureCreation creation;
-        creation.set_data(image_data)
-            .set_format_type(VK_FORMAT_R8G8B8A8_UNORM, TextureType::Texture2D)
-            .set_flags(mip_levels, 0).set_size((u16)width, (u16)height, 1)
-            .set_name(name);
+    out_data.data = nullptr;
+    out_data.width = width;
+    out_data.height = height;
+    out_data.mip_levels = create_mipmaps ? mipmap_level_count(width, height) : 1;
+    out_data.decode_ms = 0.0;
 
-        TextureHandle new_texture = gpu.create_texture(creation);
+    return true;
+}
+
+bool texture_data_load_info(cstring filename, bool create_mipmaps, TextureData& out_data) {
+    int comp, width, height;
+    if(!texture_data_info_finalize(stbi_info(filename, &width, &height, &comp), width, height, create_mipmaps, out_data)) {
+        p_print("Error reading texture header %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool texture_data_load_info_from_memory(const u8* memory, u32 size, bool create_mipmaps, TextureData& out_data) {
+    int comp, width, height;
+    if(!texture_data_info_finalize(stbi_info_from_memory(memory, (int)size, &width, &height, &comp), width, height, create_mipmaps, out_data)) {
+        p_print("Error reading texture header from memory\n");
+        return false;
+    }
+    return true;
+}
+
+void texture_data_free(TextureData& data) {
+    stbi_image_free(data.data);
+    data.data = nullptr;
+}
+
+static TextureHandle create_texture_from_data(GpuDevice& gpu, const TextureData& data, cstring name) {
+    if(data.width == 0 || data.height == 0) {
+        return k_invalid_texture;
+    }
+
+    TextureCreation creation;
+    creation.set_data(data.data)
+        .set_format_type(VK_FORMAT_R8G8B8A8_UNORM, TextureType::Texture2D)
+        .set_flags((u8)data.mip_levels, 0).set_size((u16)data.width, (u16)data.height, 1)
+        .set_name(name);
+
+    return gpu.create_texture(creation);
+}
+
+static TextureHandle create_texture_from_file(GpuDevice& gpu, cstring filename, cstring name, bool create_mipmaps, bool srgb) {
+    if(filename) {
+        TextureData data;
+        if(!texture_data_load(filename, create_mipmaps, srgb, data)) {
+            return k_invalid_texture;
+        }
 
-        free(image_data);
+        TextureHandle new_texture = create_texture_from_data(gpu, data, name);
+
+        texture_data_free(data);
 
         return new_texture;
     }
@@ -192,11 +277,11 @@ BufferResource* Renderer::create_buffer(const BufferCreation& creation) {
     if(buffer) {
         BufferHandle handle = gpu->create_buffer(creation);
         buffer->handle = handle;
-        buffer->name = creation.name;
         gpu->query_buffer(handle, buffer->desc);
 
+        buffer->name = nullptr;
         if(creation.name != nullptr) {
-            resource_cache.buffers.insert(hash_calculate(creation.name), buffer);
+            resource_cache.insert(resource_cache.buffers, creation.name, buffer);
         }
 
         buffer->references = 1;
@@ -221,31 +306,46 @@ TextureResource* Renderer::create_texture(const TextureCreation& creation) {
 
     TextureHandle handle = gpu->create_texture(creation);
     texture->handle = handle;
-    texture->name = creation.name;
     gpu->query_texture(handle, texture->desc);
 
+    texture->name = nullptr;
     if(creation.name != nullptr) {
-        resource_cache.textures.insert(hash_calculate(creation.name), texture);
+        resource_cache.insert(resource_cache.textures, creation.name, texture);
     }
 
     texture->references = 1;
     return texture;
 }
 
-TextureResource* Renderer::create_texture(cstring name, cstring filename, bool create_mipmaps) {
+TextureResource* Renderer::create_texture(cstring name, cstring filename, bool create_mipmaps, bool srgb) {
     TextureResource* texture = textures.obtain();
 
     if(!texture) {
         return nullptr;
     }
 
-    TextureHandle handle = create_texture_from_file(*gpu, filename, name, create_mipmaps);
+    TextureHandle handle = create_texture_from_file(*gpu, filename, name, create_mipmaps, srgb);
     texture->handle = handle;
     gpu->query_texture(handle, texture->desc);
     texture->references = 1;
-    texture->name = name;
 
-    resource_cache.textures.insert(hash_calculate(name), texture);
+    resource_cache.insert(resource_cache.textures, name, texture);
+    return texture;
+}
+
+TextureResource* Renderer::create_texture(cstring name, const TextureData& data) {
+    TextureResource* texture = textures.obtain();
+
+    if(!texture) {
+        return nullptr;
+    }
+
+    TextureHandle handle = create_texture_from_data(*gpu, data, name);
+    texture->handle = handle;
+    gpu->query_texture(handle, texture->desc);
+    texture->references = 1;
+
+    resource_cache.insert(resource_cache.textures, name, texture);
     return texture;
 }
 
@@ -255,11 +355,11 @@ SamplerResource* Renderer::create_sampler(const SamplerCreation& creation) {
     if(sampler) {
         SamplerHandle handle = gpu->create_sampler(creation);
         sampler->handle = handle;
-        sampler->name = creation.name;
         gpu->query_sampler(handle, sampler->desc);
 
+        sampler->name = nullptr;
         if(creation.name != nullptr) {
-            resource_cache.samplers.insert(hash_calculate(creation.name), sampler);
+            resource_cache.insert(resource_cache.samplers, creation.name, sampler);
         }
 
         sampler->references = 1;
@@ -277,7 +377,7 @@ Program* Renderer::create_program(const ProgramCreation& creation) {
         const u32 num_passes = 1;
         program->passes.init(gpu->allocator, num_passes, num_passes);
 
-        program->name = creation.pipeline_creation.name;
+        program->name = nullptr;
 
         StringBuffer pipeline_cache_path;
         pipeline_cache_path.init(gpu->allocator, 1024);
@@ -298,7 +398,7 @@ Program* Renderer::create_program(const ProgramCreation& creation) {
         pipeline_cache_path.shutdown();
 
         if(creation.pipeline_creation.name != nullptr) {
-            resource_cache.programs.insert(hash_calculate(creation.pipeline_creation.name), program);
+            resource_cache.insert(resource_cache.programs, creation.pipeline_creation.name, program);
         }
 
         program->references = 1;
@@ -314,11 +414,11 @@ Material* Renderer::create_material(const MaterialCreation& creation) {
 
     if(material) {
         material->program = creation.program;
-        material->name = creation.name;
         material->render_index = creation.render_index;
 
+        material->name = nullptr;
         if(creation.name != nullptr) {
-            resource_cache.materials.insert(hash_calculate(creation.name), material);
+            resource_cache.insert(resource_cache.materials, creation.name, material);
         }
 
         material->references = 1;
@@ -359,7 +459,9 @@ void Renderer::destroy_buffer(BufferResource* buffer) {
         return;
     }
 
-    resource_cache.buffers.remove(hash_calculate(buffer->desc.name));
+    if(buffer->name) {
+        resource_cache.buffers.remove(resource_cache.names.find(buffer->name));
+    }
     gpu->destroy_buffer(buffer->handle);
     buffers.release(buffer);
 }
@@ -374,7 +476,9 @@ void Renderer::destroy_texture(TextureResource* texture) {
         return;
     }
 
-    resource_cache.textures.remove(hash_calculate(texture->desc.name));
+    if(texture->name) {
+        resource_cache.textures.remove(resource_cache.names.find(texture->name));
+    }
     gpu->destroy_texture(texture->handle);
     textures.release(texture);
 }
@@ -389,7 +493,9 @@ void Renderer::destroy_sampler(SamplerResource* sampler) {
         return;
     }
 
-    resource_cache.samplers.remove(hash_calculate(sampler->desc.name));
+    if(sampler->name) {
+        resource_cache.samplers.remove(resource_cache.names.find(sampler->name));
+    }
     gpu->destroy_sampler(sampler->handle);
     samplers.release(sampler);
 }
@@ -404,7 +510,9 @@ void Renderer::destroy_program(Program* program) {
         return;
     }
 
-    resource_cache.programs.remove(hash_calculate(program->name));
+    if(program->name) {
+        resource_cache.programs.remove(resource_cache.names.find(program->name));
+    }
 
     gpu->destroy_pipeline(program->passes[0].pipeline);
     program->passes.shutdown();
@@ -422,7 +530,9 @@ void Renderer::destroy_material(Material* material) {
         return;
     }
 
-    resource_cache.materials.remove(hash_calculate(material->name));
+    if(material->name) {
+        resource_cache.materials.remove(resource_cache.names.find(material->name));
+    }
     materials.release(material);
 }
 
@@ -444,17 +554,16 @@ void Renderer::unmap_buffer(BufferResource* buffer) {
 // Resource Loaders ///////
 // Texture Loader //////
 Resource* TextureLoader::get(cstring name) {
-    const u64 hashed_name = hash_calculate(name);
-    return renderer->resource_cache.textures.get(hashed_name);
+    return renderer->resource_cache.textures.get(renderer->resource_cache.names.find(name));
 }
 
-Resource* TextureLoader::get(u64 hashed_name) {
-    return renderer->resource_cache.textures.get(hashed_name);
+Resource* TextureLoader::get(cstring name, u64 hashed_name) {
+    ResourceCache& cache = renderer->resource_cache;
+    return cache.textures.get(cache.names.find_with_hash(name, hashed_name));
 }
 
 Resource* TextureLoader::unload(cstring name) {
-    const u64 hashed_name = hash_calculate(name);
-    TextureResource* texture = renderer->resource_cache.textures.get(hashed_name);
+    TextureResource* texture = renderer->resource_cache.textures.get(renderer->resource_cache.names.find(name));
     if(texture) {
         renderer->destroy_texture(texture);
     }
@@ -467,17 +576,16 @@ Resource* TextureLoader::create_from_file(cstring name, cstring filename, Resour
 
 // Buffer Loader /////
 Resource* BufferLoader::get(cstring name) {
-    const u64 hashed_name = hash_calculate(name);
-    return renderer->resource_cache.buffers.get(hashed_name);
+    return renderer->resource_cache.buffers.get(renderer->resource_cache.names.find(name));
 }
 
-Resource* BufferLoader::get(u64 hashed_name) {
-    return renderer->resource_cache.buffers.get(hashed_name);
+Resource* BufferLoader::get(cstring name, u64 hashed_name) {
+    ResourceCache& cache = renderer->resource_cache;
+    return cache.buffers.get(cache.names.find_with_hash(name, hashed_name));
 }
 
 Resource* BufferLoader::unload(cstring name) {
-    const u64 hashed_name = hash_calculate(name);
-    BufferResource* buffer = renderer->resource_cache.buffers.get(hashed_name);
+    BufferResource* buffer = renderer->resource_cache.buffers.get(renderer->resource_cache.names.find(name));
     if(buffer) {
         renderer->destroy_buffer(buffer);
     }
@@ -486,17 +594,16 @@ Resource* BufferLoader::unload(cstring name) {
 
 // Sampler Loader ////////////
 Resource* SamplerLoader::get(cstring name) {
-    const u64 hashed_name = hash_calculate(name);
-    return renderer->resource_cache.samplers.get(hashed_name);
+    return renderer->resource_cache.samplers.get(renderer->resource_cache.names.find(name));
 }
 
-Resource* SamplerLoader::get(u64 hashed_name) {
-    return renderer->resource_cache.samplers.get(hashed_name);
+Resource* SamplerLoader::get(cstring name, u64 hashed_name) {
+    ResourceCache& cache = renderer->resource_cache;
+    return cache.samplers.get(cache.names.find_with_hash(name, hashed_name));
 }
 
 Resource* SamplerLoader::unload(cstring name) {
-    const u64 hashed_name = hash_calculate(name);
-    SamplerResource* sampler = renderer->resource_cache.samplers.get(hashed_name);
+    SamplerResource* sampler = renderer->resource_cache.samplers.get(renderer->resource_cache.names.find(name));
     if(sampler) {
         renderer->destroy_sampler(sampler);
     }
@@ -505,7 +612,10 @@ Resource* SamplerLoader::unload(cstring name) {
 
 // Resource Cache
 
-void ResourceCache::init(Allocator* allocator) {
+void ResourceCache::init(Allocator* allocator_) {
+    allocator = allocator_;
+    names.init(allocator, 256);
+
     // Init resources caching
     textures.init(allocator, 16);
     buffers.init(allocator, 16);
@@ -514,52 +624,45 @@ void ResourceCache::init(Allocator* allocator) {
     programs.init(allocator, 16);
 }
 
-void ResourceCache::shutdown(puffin::Renderer* renderer) {
-    FlatHashMapIterator it = textures.iterator_begin();
-    while(it.is_valid()) {
-        TextureResource* texture = textures.get(it);
-        renderer->destroy_texture(texture);
-
-        textures.iterator_advance(it);
-    }
-
-    it = buffers.iterator_begin();
-    while(it.is_valid()) {
-        BufferResource* buffer = buffers.get(it);
-        renderer->destroy_buffer(buffer);
-
-        buffers.iterator_advance(it);
+// Destroying a resource removes it from its cache, so the resources are copied out first
+template <typename T, typename Function>
+static void resource_cache_destroy_all(ResourceNameMap<T>& cache, Allocator* allocator, Function&& destroy) {
+    const u64 count = cache.get_size();
+    if(count == 0) {
+        return;
     }
 
-    it = samplers.iterator_begin();
-    while(it.is_valid()) {
-        SamplerResource* sampler = samplers.get(it);
-        renderer->destroy_sampler(sampler);
-
-        samplers.iterator_advance(it);
+    T** resources = (T**)puffin_alloc(count * sizeof(T*), allocator);
+    const u64 copied = cache.copy_values(resources, count);
+    for(u64 i = 0; i < copied; i++) {
+        destroy(resources[i]);
     }
+    puffin_free(resources, allocator);
+}
 
-    it = materials.iterator_begin();
-    while(it.is_valid()) {
-        Material* material = materials.get(it);
-        renderer->destroy_material(material);
-
-        materials.iterator_advance(it);
-    }
-
-    it = programs.iterator_begin();
-    while(it.is_valid()) {
-        Program* program = programs.get(it);
-        renderer->destroy_program(program);
-
-        programs.iterator_advance(it);
-    }
+void ResourceCache::shutdown(puffin::Renderer* renderer) {
+    resource_cache_destroy_all(textures, allocator, [renderer](TextureResource* texture) { renderer->destroy_texture(texture); });
+    resource_cache_destroy_all(buffers, allocator, [renderer](BufferResource* buffer) { renderer->destroy_buffer(buffer); });
+    resource_cache_destroy_all(samplers, allocator, [renderer](SamplerResource* sampler) { renderer->destroy_sampler(sampler); });
+    resource_cache_destroy_all(materials, allocator, [renderer](Material* material) { renderer->destroy_material(material); });
+    resource_cache_destroy_all(programs, allocator, [renderer](Program* program) { renderer->destroy_program(program); });
 
     textures.shutdown();
     buffers.shutdown();
     samplers.shutdown();
     materials.shutdown();
     programs.shutdown();
+
+    names.shutdown();
+}
+
+Atom ResourceCache::intern_name(cstring name, cstring& out_name) {
+    const Atom atom = names.intern(name);
+    PASSERT(atom != k_invalid_atom);
+    if(atom != k_invalid_atom) {
+        out_name = names.get_string(atom);
+    }
+    return atom;
 }
 
 
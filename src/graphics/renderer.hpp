@@ -7,6 +7,7 @@
 #include "gpu_device.hpp"
 #include "vulkan_resources.hpp"
 #include "resource_manager.hpp"
+#include "atom.hpp"
 
 namespace puffin {
 
@@ -45,6 +46,26 @@ struct SamplerResource : public puffin::Resource {
 
 };
 
+// Texture data //////////////////
+
+// CPU side RGBA8 image with its mip chain. Loading is thread safe, the memory comes
+// from the image decoder heap and not from the engine allocators.
+struct TextureData {
+    u8*                     data                = nullptr;  // Tightly packed mip chain
+    u32                     width               = 0;
+    u32                     height              = 0;
+    u32                     mip_levels          = 0;
+
+    f64                     decode_ms           = 0.0;      // Decode and mip generation time
+};
+
+bool                        texture_data_load(cstring filename, bool create_mipmaps, bool srgb, TextureData& out_data);
+bool                        texture_data_load_from_memory(const u8* memory, u32 size, bool create_mipmaps, bool srgb, TextureData& out_data);
+void                        texture_data_free(TextureData& data);
+// Size and mip count from the image header, without decoding it. data stays nullptr.
+bool                        texture_data_load_info(cstring filename, bool create_mipmaps, TextureData& out_data);
+bool                        texture_data_load_info_from_memory(const u8* memory, u32 size, bool create_mipmaps, TextureData& out_data);
+
 // Material/Shaders //////////////
 
 struct ProgramPass {
@@ -91,17 +112,40 @@ struct Material : public puffin::Resource {
 
 // Resource Cache ///////
 
+// Resources by the atom of their name. Lookups are lock free so loading threads can fill the caches.
+template <typename T>
+using ResourceNameMap = ConcurrentFlatHashMap<Atom, T*>;
+
 struct ResourceCache {
     void                    init(Allocator* allocate);
     void                    shutdown(Renderer* renderer);
 
-    FlatHashMap<u64, TextureResource*>  textures;
-    FlatHashMap<u64, BufferResource*>   buffers;
-    FlatHashMap<u64, SamplerResource*>  samplers;
-    FlatHashMap<u64, Program*>          programs;
-    FlatHashMap<u64, Material*>         materials;
+    // Keys the resource by its name, interned here so the caller's string can go away right after.
+    // The resource name is set to the interned copy, it lives until shutdown.
+    template <typename T>
+    void                    insert(ResourceNameMap<T>& cache, cstring name, T* resource);
+
+    // Asserts the name table has room. If it is full anyway, returns k_invalid_atom and leaves out_name as is.
+    Atom                    intern_name(cstring name, cstring& out_name);
+
+    AtomTable               names;
+    Allocator*              allocator;
+
+    ResourceNameMap<TextureResource>    textures;
+    ResourceNameMap<BufferResource>     buffers;
+    ResourceNameMap<SamplerResource>    samplers;
+    ResourceNameMap<Program>            programs;
+    ResourceNameMap<Material>           materials;
 };
 
+template <typename T>
+inline void ResourceCache::insert(ResourceNameMap<T>& cache, cstring name, T* resource) {
+    const Atom atom = intern_name(name, resource->name);
+    if(atom != k_invalid_atom) {
+        cache.insert(atom, resource);
+    }
+}
+
 // Renderer ////////////////
 
 struct RendererCreation {
@@ -132,7 +176,9 @@ struct Renderer : public Service {
     BufferResource*         create_buffer(VkBufferUsageFlags type, ResourceUsageType::Enum usage, u32 size, void* data, cstring name);
 
     TextureResource*        create_texture(const TextureCreation& creation);
-    TextureResource*        create_texture(cstring name, cstring filename, bool create_mipmaps);
+    TextureResource*        create_texture(cstring name, cstring filename, bool create_mipmaps, bool srgb = false);
+    // Without data the texture is created empty, showing the dummy texture until something uploads to it
+    TextureResource*        create_texture(cstring name, const TextureData& data);
 
     SamplerResource*        create_sampler(const SamplerCreation& creation);
 
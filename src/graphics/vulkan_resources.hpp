@@ -7,6 +7,7 @@
 
 #include "gpu_enum.hpp"
 #include "platform.hpp"
+#include "array.hpp"
 
 namespace puffin {
 
@@ -23,6 +24,7 @@ static const u8 k_max_image_outputs = 8; // Maximum number of images/render_targ
 static const u8 k_max_shader_stages = 5; // Maximum simultaneous shader stages. Applicable to all different types of pipelines.
 static const u8 k_max_descriptor_set_layouts = 8; // Maximum number of layouts in the pipeline.
 static const u8 k_max_descriptors_per_set = 16;
+static const u8 k_descriptor_set_inline_resources = 8; // Resources cached inside a DescriptorSet before spilling to the heap.
 static const u8 k_max_vertex_streams = 16;
 static const u8 k_max_vertex_attributes = 16;
 
@@ -144,6 +146,7 @@ struct BufferCreation {
 };
 
 struct TextureCreation {
+    // Tightly packed data for every mip level, starting from level 0
     void* initial_data = nullptr;
     u16 width = 1;
     u16 height = 1;
@@ -502,6 +505,9 @@ struct Buffer {
     u32 size = 0;
     u32 global_offset = 0;
 
+    // Persistently mapped pointer for host visible (Dynamic and Stream) buffers, null for device local ones
+    void* mapped_data = nullptr;
+
     BufferHandle handle;
     BufferHandle parent_buffer;
 
@@ -589,12 +595,13 @@ struct DescriptorSet {
     // Set of all resources used by a shader
     VkDescriptorSet vk_descriptor_set;
 
+    // Sets are created per draw, the inline storage keeps the common case off the heap.
     // each resource handle represents a resource that is bound to a descriptor slot in the set
-    ResourceHandle* resources = nullptr;
+    SmallArray<ResourceHandle, k_descriptor_set_inline_resources> resources;
     // each sampler handle represents a sampler that is bound to a desriptor slot in the set
-    SamplerHandle* samplers = nullptr;
+    SmallArray<SamplerHandle, k_descriptor_set_inline_resources> samplers;
     // represents the index of the descriptor slot in the descriptor set, that corresponds to a resource or sampler
-    u16* bindings = nullptr;
+    SmallArray<u16, k_descriptor_set_inline_resources> bindings;
 
     const DescriptorSetLayout* layout = nullptr;
     u32 num_resources = 0;
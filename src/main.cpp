@@ -13,6 +13,7 @@
 #include "graphics/renderer.hpp"
 #include "graphics/puffin_imgui.hpp"
 #include "graphics/gpu_profiler.hpp"
+#include "graphics/asynchronous_loader.hpp"
 
 #include "cglm/struct/mat3.h"
 #include "cglm/struct/mat4.h"
@@ -26,13 +27,19 @@
 
 #include "file_system.hpp"
 #include "gltf.hpp"
+#include "memory_tracking.hpp"
 #include "numerics.hpp"
 #include "resource_manager.hpp"
+#include "task_scheduler.hpp"
 #include "time.hpp"
 
 #include "puffin_config.h"
 
 #include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 static const u16 INVALID_TEXTURE_INDEX = ~0u;
 
@@ -49,6 +56,9 @@ struct MeshDraw {
     puffin::BufferHandle    texcoord_buffer;
     puffin::BufferHandle    material_buffer;
 
+    // Scene and material buffers, their dynamic offsets are read when bound
+    puffin::DescriptorSetHandle descriptor_set;
+
     u32                     index_offset;
     u32                     position_offset;
     u32                     tangent_offset;
@@ -57,11 +67,11 @@ struct MeshDraw {
 
     u32                     primitive_count;
 
-    // indices for bindless textures
-    u16                     diffuse_texture_index;
-    u16                     roughness_texture_index;
-    u16                     normal_texture_index;
-    u16                     occlusion_texture_index;
+    // bindless textures, k_invalid_texture when the material has none
+    puffin::TextureHandle   diffuse_texture;
+    puffin::TextureHandle   roughness_texture;
+    puffin::TextureHandle   normal_texture;
+    puffin::TextureHandle   occlusion_texture;
 
     vec4s                   base_color_factor;
     vec4s                   metallic_roughness_occlusion_factor;
@@ -100,11 +110,27 @@ struct GpuEffect {
     puffin::PipelineHandle  pipeline_no_cull;
 };
 
-static void upload_material(MeshData& mesh_data, const MeshDraw& mesh_draw, const f32 global_scale) {
-    mesh_data.textures[0] = mesh_draw.diffuse_texture_index;
-    mesh_data.textures[1] = mesh_draw.roughness_texture_index;
-    mesh_data.textures[2] = mesh_draw.normal_texture_index;
-    mesh_data.textures[3] = mesh_draw.occlusion_texture_index;
+// Bindless array element of the texture. The texture pool is capped to the array, so it fits in the 16 bits
+// and never reaches INVALID_TEXTURE_INDEX.
+static u16 get_mesh_texture_index(puffin::TextureHandle texture) {
+    const u32 index = puffin::resource_pool_index(texture.index);
+    PASSERT(index < puffin::k_max_bindless_resources && index < INVALID_TEXTURE_INDEX);
+    return (u16)index;
+}
+
+// Textures still loading are drawn with the dummy texture, their bindless slot is written when they are ready
+static u16 get_mesh_texture_index(puffin::GpuDevice& gpu, puffin::TextureHandle texture) {
+    if(texture.index == puffin::k_invalid_texture.index) {
+        return INVALID_TEXTURE_INDEX;
+    }
+    return get_mesh_texture_index(gpu.is_texture_ready(texture) ? texture : gpu.get_dummy_texture());
+}
+
+static void upload_material(puffin::GpuDevice& gpu, MeshData& mesh_data, const MeshDraw& mesh_draw, const f32 global_scale) {
+    mesh_data.textures[0] = get_mesh_texture_index(gpu, mesh_draw.diffuse_texture);
+    mesh_data.textures[1] = get_mesh_texture_index(gpu, mesh_draw.roughness_texture);
+    mesh_data.textures[2] = get_mesh_texture_index(gpu, mesh_draw.normal_texture);
+    mesh_data.textures[3] = get_mesh_texture_index(gpu, mesh_draw.occlusion_texture);
     mesh_data.base_color_factor = mesh_draw.base_color_factor;
     mesh_data.metallic_roughness_occlusion_factor = mesh_draw.metallic_roughness_occlusion_factor;
     mesh_data.alpha_cutoff = mesh_draw.alpha_cutoff;
@@ -115,22 +141,38 @@ static void upload_material(MeshData& mesh_data, const MeshDraw& mesh_draw, cons
     mesh_data.inverseM = glms_mat4_inv(glms_mat4_transpose(model));
 }
 
-static void draw_mesh(puffin::Renderer& renderer, puffin::CommandBuffer* gpu_commands, MeshDraw& mesh_draw) {
-    // Descriptor set
-    puffin::DescriptorSetCreation ds_creation{};
-    ds_creation.buffer(scene_cb, 0).buffer(mesh_draw.material_buffer, 1);
-    puffin::DescriptorSetHandle descriptor_set = renderer.create_descriptor_set(gpu_commands, mesh_draw.material, ds_creation);
-
+static void draw_mesh(puffin::CommandBuffer* gpu_commands, MeshDraw& mesh_draw) {
     gpu_commands->bind_vertex_buffer(mesh_draw.position_buffer, 0, mesh_draw.position_offset);
     gpu_commands->bind_vertex_buffer(mesh_draw.tangent_buffer, 1, mesh_draw.tangent_offset);
     gpu_commands->bind_vertex_buffer(mesh_draw.normal_buffer, 2, mesh_draw.normal_offset);
     gpu_commands->bind_vertex_buffer(mesh_draw.texcoord_buffer, 3, mesh_draw.texcoord_offset);
     gpu_commands->bind_index_buffer(mesh_draw.index_buffer, mesh_draw.index_offset, VkIndexType::VK_INDEX_TYPE_UINT16);
-    gpu_commands->bind_local_descriptor_set(&descriptor_set, 1, nullptr, 0);
+    gpu_commands->bind_descriptor_set(&mesh_draw.descriptor_set, 1, nullptr, 0);
 
     gpu_commands->draw_indexed(TopologyType::Triangle, mesh_draw.primitive_count, 1, 0, 0, 0);
 }
 
+// Draws [begin, end) of the mesh draws repeated draw_copies times each, so that the material order is kept.
+// Only reads the scene, secondary command buffers of different threads record it at the same time.
+static void draw_meshes(puffin::Renderer& renderer, puffin::CommandBuffer* gpu_commands, puffin::Array<MeshDraw>& mesh_draws,
+                        u32 draw_copies, u32 begin, u32 end) {
+    puffin::Material* last_material = nullptr;
+
+    for(u32 draw_index = begin; draw_index < end; draw_index++) {
+        MeshDraw& mesh_draw = mesh_draws[draw_index / draw_copies];
+
+        if(mesh_draw.material != last_material) {
+            puffin::PipelineHandle pipeline_handle = renderer.get_pipeline(mesh_draw.material);
+
+            gpu_commands->bind_pipeline(pipeline_handle);
+
+            last_material = mesh_draw.material;
+        }
+
+        draw_mesh(gpu_commands, mesh_draw);
+    }
+}
+
 enum MaterialFeatures {
     MaterialFeatures_ColorTexture       = 1 << 0,
     MaterialFeatures_NormalTexture      = 1 << 1,
@@ -194,6 +236,36 @@ static u8* get_buffer_data(puffin::glTF::BufferView* buffer_views, u32 buffer_in
     return data;
 }
 
+// Startup //////////////////////////////////////////////////////
+//
+// The CPU side of the scene is loaded on the workers while the window and the device are created: the glTF
+// is parsed, its buffers mapped and its images read and decoded. Textures are created once the device is
+// ready. A decoded image goes to the asynchronous loader when both its data and its texture exist, whichever
+// comes last hands it over.
+
+enum SceneImageState : u32 {
+    SceneImageState_Decoding = 0,
+    SceneImageState_Decoded,
+    SceneImageState_TextureCreated
+};
+
+struct Scene;
+
+struct SceneImage {
+    Scene*                          scene;
+    char                            path[puffin::k_max_path];   // Empty for images embedded in a buffer view
+    const u8*                       memory;
+    u32                             memory_size;
+    char*                           file_data;                  // Read from path, freed once decoded
+    size_t                          file_size;
+    bool                            srgb;
+
+    puffin::TextureData             info;                       // Size and mips from the header
+    puffin::TextureData             data;
+    puffin::TextureHandle           texture;
+    std::atomic<u32>                state;
+};
+
 struct Scene {
     puffin::Array<MeshDraw>         mesh_draws;
 
@@ -201,23 +273,225 @@ struct Scene {
     puffin::Array<puffin::SamplerResource>  samplers;
     puffin::Array<puffin::BufferResource>   buffers;
 
+    puffin::Array<puffin::FileMapping>      buffers_mappings;
+
     puffin::glTF::glTF              gltf_scene;
+
+    // Startup
+    SceneImage*                     startup_images      = nullptr;
+    puffin::Array<void*>            buffers_data;
+    puffin::TaskCounter             decode_counter;
+    std::atomic<u32>                images_pending{ 0 };        // Not handed to the loader yet
+    puffin::AsynchronousLoader*     loader              = nullptr;
+    puffin::Allocator*              allocator           = nullptr;
 };
 
-static void scene_load_from_gltf(cstring filename, puffin::Renderer& renderer, puffin::Allocator* allocator, Scene& scene) {
+// Arguments of the CPU side load, run as a task
+struct SceneLoadTask {
+    Scene*                          scene;
+    cstring                         base_path;          // Directory of the glTF file, uris are relative to it
+    cstring                         filename;
+    puffin::Allocator*              allocator;
+    i64                             end_tick;
+};
+
+static void scene_image_hand_over(SceneImage& image) {
+    Scene& scene = *image.scene;
+    if(image.texture.index != puffin::k_invalid_index) {
+        scene.loader->request_texture_upload(image.data, image.texture);
+    } else {
+        puffin::texture_data_free(image.data);
+    }
+    scene.images_pending.fetch_sub(1);
+}
+
+// Worker or file read thread
+static void scene_image_decoded(SceneImage& image) {
+    u32 expected = SceneImageState_Decoding;
+    if(!image.state.compare_exchange_strong(expected, SceneImageState_Decoded, std::memory_order_acq_rel)) {
+        scene_image_hand_over(image);
+    }
+}
+
+// Device thread, once the texture is created
+static void scene_image_texture_created(SceneImage& image) {
+    u32 expected = SceneImageState_Decoding;
+    if(!image.state.compare_exchange_strong(expected, SceneImageState_TextureCreated, std::memory_order_acq_rel)) {
+        scene_image_hand_over(image);
+    }
+}
+
+static void scene_image_decode_task(void* data, u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {
+    SceneImage& image = *(SceneImage*)data;
+
+    const u8* memory = image.file_data ? (const u8*)image.file_data : image.memory;
+    const u32 memory_size = image.file_data ? (u32)image.file_size : image.memory_size;
+    const i64 decode_begin = puffin::time_now();
+    if(!puffin::texture_data_load_from_memory(memory, memory_size, true, image.srgb, image.data)) {
+        p_print("Error decoding image %s\n", image.path[0] ? image.path : "from memory");
+    } else {
+        p_print("Image %s %ux%u decoded in %.2fms\n", image.path[0] ? image.path : "from memory", image.data.width,
+                image.data.height, puffin::time_from_milliseconds(decode_begin));
+    }
+
+    if(image.file_data) {
+        puffin_free(image.file_data, image.scene->allocator);
+        image.file_data = nullptr;
+    }
+
+    scene_image_decoded(image);
+}
+
+static void scene_image_file_read(const puffin::FileReadResult& result, void* user_data) {
+    SceneImage& image = *(SceneImage*)user_data;
+    if(result.data == nullptr) {
+        p_print("Error reading image %s\n", image.path);
+        scene_image_decoded(image);
+        return;
+    }
+
+    image.file_data = result.data;
+    image.file_size = result.size;
+    puffin::TaskScheduler::instance()->submit(scene_image_decode_task, &image, 0, 1, &image.scene->decode_counter);
+}
+
+// CPU only, runs on a worker while the device is created
+static void scene_load_cpu(SceneLoadTask& load) {
 
     using namespace puffin;
 
-    scene.gltf_scene = gltf_load_file(filename);
+    Scene& scene = *load.scene;
+    Allocator* allocator = load.allocator;
+    scene.allocator = allocator;
 
-    // Load all textures
-    scene.images.init(allocator, scene.gltf_scene.images_count);
+    char path[k_max_path];
+    snprintf(path, k_max_path, "%s%s", load.base_path, load.filename);
+    scene.gltf_scene = gltf_load_file(path);
 
-    for(u32 image_index = 0; image_index < scene.gltf_scene.images_count; image_index++) {
-        glTF::Image& image = scene.gltf_scene.images[image_index];
-        TextureResource* tr = renderer.create_texture(image.uri.data, image.uri.data, true);
+    // Buffers are mapped first, images and buffer views are read straight from the mappings.
+    // Buffer views are copied once, into the staging ring. Embedded images are decoded later by the workers,
+    // the mappings live as long as the scene.
+    puffin::Array<FileMapping>& buffers_mappings = scene.buffers_mappings;
+    buffers_mappings.init(allocator, scene.gltf_scene.buffers_count, scene.gltf_scene.buffers_count);
+
+    puffin::Array<void*>& buffers_data = scene.buffers_data;
+    buffers_data.init(allocator, scene.gltf_scene.buffers_count);
+
+    for(u32 buffer_index = 0; buffer_index < scene.gltf_scene.buffers_count; buffer_index++) {
+        glTF::Buffer& buffer = scene.gltf_scene.buffers[buffer_index];
+
+        FileMapping& mapping = buffers_mappings[buffer_index];
+        mapping = {};
+
+        // GLB BIN chunk, already mapped with the scene file
+        u8* embedded_data = gltf_get_embedded_buffer_data(scene.gltf_scene, buffer_index);
+        if(embedded_data) {
+            buffers_data.push(embedded_data);
+            continue;
+        }
+
+        snprintf(path, k_max_path, "%s%s", load.base_path, buffer.uri.data);
+        if(!file_map(path, mapping)) {
+            p_print("Error mapping buffer %s\n", buffer.uri.data);
+        }
+        buffers_data.push(mapping.data);
+    }
+
+    const u32 images_count = scene.gltf_scene.images_count;
+    scene.startup_images = (SceneImage*)puffin_alloc(sizeof(SceneImage) * (images_count ? images_count : 1), allocator);
+    scene.images_pending.store(images_count);
+
+    for(u32 image_index = 0; image_index < images_count; image_index++) {
+        SceneImage& image = *new (&scene.startup_images[image_index]) SceneImage();
+        image.scene = &scene;
+        image.path[0] = 0;
+        image.memory = nullptr;
+        image.memory_size = 0;
+        image.file_data = nullptr;
+        image.file_size = 0;
+        image.srgb = false;
+        image.texture = k_invalid_texture;
+        image.state.store(SceneImageState_Decoding, std::memory_order_relaxed);
+    }
+
+    // Color textures are sRGB encoded, their mips are filtered in linear space
+    for(u32 material_index = 0; material_index < scene.gltf_scene.materials_count; material_index++) {
+        glTF::Material& material = scene.gltf_scene.materials[material_index];
+
+        glTF::TextureInfo* color_textures[] = {
+                material.pbr_metallic_roughness ? material.pbr_metallic_roughness->base_color_texture : nullptr,
+                material.emissive_texture
+        };
+
+        for(glTF::TextureInfo* texture_info : color_textures) {
+            if(texture_info != nullptr) {
+                const i32 image_index = scene.gltf_scene.textures[texture_info->index].source;
+                if(image_index >= 0 && image_index < (i32)images_count) {
+                    scene.startup_images[image_index].srgb = true;
+                }
+            }
+        }
+    }
+
+    // Headers are read now so that textures can be created as soon as the device is ready, the images are
+    // read and decoded in the background.
+    for(u32 image_index = 0; image_index < images_count; image_index++) {
+        glTF::Image& gltf_image = scene.gltf_scene.images[image_index];
+        SceneImage& image = scene.startup_images[image_index];
+
+        // Image embedded in a buffer view, usually in GLB files
+        if(gltf_image.uri.data == nullptr && gltf_image.buffer_view != glTF::INVALID_INT_VALUE) {
+            image.memory = get_buffer_data(scene.gltf_scene.buffer_views, gltf_image.buffer_view, buffers_data, &image.memory_size);
+            texture_data_load_info_from_memory(image.memory, image.memory_size, true, image.info);
+            TaskScheduler::instance()->submit(scene_image_decode_task, &image, 0, 1, &scene.decode_counter);
+            continue;
+        }
+
+        snprintf(image.path, k_max_path, "%s%s", load.base_path, gltf_image.uri.data);
+        texture_data_load_info(image.path, true, image.info);
+        file_read_async(image.path, allocator, scene_image_file_read, &image);
+    }
+
+    load.end_tick = time_now();
+}
+
+static void scene_load_cpu_task(void* data, u32 /*begin*/, u32 /*end*/, u32 /*worker_index*/) {
+    scene_load_cpu(*(SceneLoadTask*)data);
+}
+
+// Creates the GPU resources of a scene loaded by scene_load_cpu
+static void scene_load_gpu(puffin::Renderer& renderer, puffin::AsynchronousLoader& loader, puffin::Allocator* allocator, Scene& scene) {
+
+    using namespace puffin;
+
+    scene.loader = &loader;
+    puffin::Array<void*>& buffers_data = scene.buffers_data;
+
+    // Textures are created empty from the image headers and filled by the loader as their images are
+    // decoded, frames start right away and show the dummy texture until then.
+    const u32 images_count = scene.gltf_scene.images_count;
+    scene.images.init(allocator, images_count);
+
+    for(u32 image_index = 0; image_index < images_count; image_index++) {
+        glTF::Image& gltf_image = scene.gltf_scene.images[image_index];
+        SceneImage& image = scene.startup_images[image_index];
+
+        // Embedded images have no uri, name them in the scene arena so the name lives as long as the scene
+        char* image_name = gltf_image.uri.data;
+        if(image_name == nullptr) {
+            image_name = (char*)scene.gltf_scene.allocator.allocate(32, 1);
+            snprintf(image_name, 32, "image_%u", image_index);
+        }
+
+        TextureResource* tr = renderer.create_texture(image_name, image.info);
         PASSERT(tr != nullptr);
 
+        if(tr->handle.index == k_invalid_index) {
+            p_print("Error reading image %s\n", image_name);
+        }
+        image.texture = tr->handle;
+        scene_image_texture_created(image);
+
         scene.images.push(*tr);
     }
 
@@ -292,17 +566,6 @@ static void scene_load_from_gltf(cstring filename, puffin::Renderer& renderer, p
         scene.samplers.push(*sr);
     }
 
-    // Temp buffer data array
-    puffin::Array<void*> buffers_data;
-    buffers_data.init(allocator, scene.gltf_scene.buffers_count);
-
-    for(u32 buffer_index = 0; buffer_index < scene.gltf_scene.buffers_count; buffer_index++) {
-        glTF::Buffer& buffer = scene.gltf_scene.buffers[buffer_index];
-
-        FileReadResult buffer_data = file_read_binary(buffer.uri.data, allocator);
-        buffers_data.push(buffer_data.data);
-    }
-
     scene.buffers.init(allocator, scene.gltf_scene.buffer_views_count);
 
     for(u32 buffer_view_index = 0; buffer_view_index < scene.gltf_scene.buffer_views_count; buffer_view_index++) {
@@ -328,10 +591,6 @@ static void scene_load_from_gltf(cstring filename, puffin::Renderer& renderer, p
         scene.buffers.push(*br);
     }
 
-    for(u32 buffer_index = 0; buffer_index < scene.gltf_scene.buffers_count; buffer_index++) {
-        void* buffer = buffers_data[buffer_index];
-        allocator->deallocate(buffer);
-    }
     buffers_data.shutdown();
 
     resource_name_buffer.shutdown();
@@ -344,20 +603,37 @@ static void scene_free_gpu_resources(Scene& scene, puffin::Renderer& renderer) {
 
     for(u32 mesh_index = 0; mesh_index < scene.mesh_draws.size; mesh_index++) {
         MeshDraw& mesh_draw = scene.mesh_draws[mesh_index];
+        gpu.destroy_descriptor_set(mesh_draw.descriptor_set);
         gpu.destroy_buffer(mesh_draw.material_buffer);
     }
 
     scene.mesh_draws.shutdown();
 }
 
+// Images still being read or decoded reference the scene
+static void scene_wait_startup(Scene& scene) {
+    puffin::FileReadService::instance()->wait_idle();
+    puffin::TaskScheduler::instance()->wait(&scene.decode_counter);
+}
+
 static void scene_unload(Scene& scene, puffin::Renderer& renderer) {
     puffin::GpuDevice& gpu = *renderer.gpu;
 
+    for(u32 image_index = 0; image_index < scene.gltf_scene.images_count; image_index++) {
+        scene.startup_images[image_index].~SceneImage();
+    }
+    puffin_free(scene.startup_images, scene.allocator);
+
     // Free scene buffers
     scene.samplers.shutdown();
     scene.images.shutdown();
     scene.buffers.shutdown();
 
+    for(u32 buffer_index = 0; buffer_index < scene.buffers_mappings.size; buffer_index++) {
+        puffin::file_unmap(scene.buffers_mappings[buffer_index]);
+    }
+    scene.buffers_mappings.shutdown();
+
     puffin::gltf_free(scene.gltf_scene);
 }
 
@@ -430,11 +706,11 @@ static bool get_mesh_material(puffin::Renderer& renderer, Scene& scene, puffin::
             TextureResource& diffuse_texture_gpu = scene.images[diffuse_texture.source];
             SamplerResource& diffuse_sampler_gpu = scene.samplers[diffuse_texture.sampler];
 
-            mesh_draw.diffuse_texture_index = diffuse_texture_gpu.handle.index;
+            mesh_draw.diffuse_texture = diffuse_texture_gpu.handle;
 
             gpu.link_texture_sampler(diffuse_texture_gpu.handle, diffuse_sampler_gpu.handle);
         } else {
-            mesh_draw.diffuse_texture_index = INVALID_TEXTURE_INDEX;
+            mesh_draw.diffuse_texture = k_invalid_texture;
         }
 
         if (material.pbr_metallic_roughness->metallic_roughness_texture != nullptr) {
@@ -442,11 +718,11 @@ static bool get_mesh_material(puffin::Renderer& renderer, Scene& scene, puffin::
             TextureResource& roughness_texture_gpu = scene.images[roughness_texture.source];
             SamplerResource& roughness_sampler_gpu = scene.samplers[roughness_texture.sampler];
 
-            mesh_draw.roughness_texture_index = roughness_texture_gpu.handle.index;
+            mesh_draw.roughness_texture = roughness_texture_gpu.handle;
 
             gpu.link_texture_sampler(roughness_texture_gpu.handle, roughness_sampler_gpu.handle);
         } else {
-            mesh_draw.roughness_texture_index = INVALID_TEXTURE_INDEX;
+            mesh_draw.roughness_texture = k_invalid_texture;
         }
     }
 
@@ -455,7 +731,7 @@ static bool get_mesh_material(puffin::Renderer& renderer, Scene& scene, puffin::
         TextureResource& occlusion_texture_gpu = scene.images[occlusion_texture.source];
         SamplerResource& occlusion_sampler_gpu = scene.samplers[occlusion_texture.sampler];
 
-        mesh_draw.occlusion_texture_index = occlusion_texture_gpu.handle.index;
+        mesh_draw.occlusion_texture = occlusion_texture_gpu.handle;
 
         if(material.occlusion_texture->strength != glTF::INVALID_FLOAT_VALUE) {
             mesh_draw.metallic_roughness_occlusion_factor.z = material.occlusion_texture->strength;
@@ -465,7 +741,7 @@ static bool get_mesh_material(puffin::Renderer& renderer, Scene& scene, puffin::
 
         gpu.link_texture_sampler(occlusion_texture_gpu.handle, occlusion_sampler_gpu.handle);
     } else {
-        mesh_draw.occlusion_texture_index = INVALID_TEXTURE_INDEX;
+        mesh_draw.occlusion_texture = k_invalid_texture;
     }
 
     if(material.normal_texture != nullptr) {
@@ -475,9 +751,9 @@ static bool get_mesh_material(puffin::Renderer& renderer, Scene& scene, puffin::
 
         gpu.link_texture_sampler(normal_texture_gpu.handle, normal_sampler_gpu.handle);
 
-        mesh_draw.normal_texture_index = normal_texture_gpu.handle.index;
+        mesh_draw.normal_texture = normal_texture_gpu.handle;
     } else {
-        mesh_draw.normal_texture_index = INVALID_TEXTURE_INDEX;
+        mesh_draw.normal_texture = k_invalid_texture;
     }
 
     // Create material buffer
@@ -491,18 +767,50 @@ static bool get_mesh_material(puffin::Renderer& renderer, Scene& scene, puffin::
 int main(int argc, char** argv) {
 
     if(argc < 2) {
-        printf("Usage: project [path to gltf model]");
+        printf("Usage: project [path to gltf model] [--io-uring]");
         InjectDefault3DModel();
     }
 
     using namespace puffin;
 
+    time_service_init();
+    const i64 startup_begin = time_now();
+
     // Init services
-    MemoryService::instance()->init(nullptr);
+    // Workers, the texture loader thread and the file read threads all allocate from the system allocator
+    MemoryServiceConfiguration memory_configuration;
+    memory_configuration.maximum_dynamic_size = puffin_mega(64);
+    memory_configuration.thread_safe = true;
+    MemoryService::instance()->init(&memory_configuration);
     Allocator* allocator = &MemoryService::instance()->system_allocator;
 
+    // A worker per remaining hardware thread, this thread runs tasks while it waits on them
+    TaskScheduler::instance()->init(nullptr);
+
+    // Texture files are read in the background by pread threads, --io-uring reads them through a ring instead
+    FileReadServiceConfiguration file_read_configuration;
+    for(int i = 2; i < argc; i++) {
+        file_read_configuration.use_io_uring = file_read_configuration.use_io_uring || strcmp(argv[i], "--io-uring") == 0;
+    }
+    FileReadService::instance()->init(&file_read_configuration);
+
+    // The scene is parsed, mapped and decoded on the workers while the window and the device are created
+    char gltf_base_path[512] {};
+    memcpy(gltf_base_path, argv[1], strlen(argv[1]));
+    file_directory_from_path(gltf_base_path);
+
+    char gltf_file[512] {};
+    memcpy(gltf_file, argv[1], strlen(argv[1]));
+    file_name_from_path(gltf_file);
+
+    Scene scene;
+    SceneLoadTask scene_load { &scene, gltf_base_path, gltf_file, allocator, 0 };
+    TaskCounter scene_load_counter;
+    TaskScheduler::instance()->submit(scene_load_cpu_task, &scene_load, 0, 1, &scene_load_counter);
+
     StackAllocator scratch_allocator;
-    scratch_allocator.init(puffin_mega(8));
+    // Address space only, pages are committed as the scratch stack grows
+    scratch_allocator.init_virtual(puffin_giga(1));
 
     // window
     WindowConfiguration w_conf { 1200, 800, "Puffin Window", allocator };
@@ -516,7 +824,9 @@ int main(int argc, char** argv) {
 
     // graphics
     DeviceCreation dc;
-    dc.set_window(window.width, window.height, window.platform_handle).set_allocator(allocator).set_linear_allocator(&scratch_allocator);
+    // Draws are recorded from every worker, each one gets its own command pools
+    dc.set_window(window.width, window.height, window.platform_handle).set_allocator(allocator).set_linear_allocator(&scratch_allocator)
+      .set_num_threads(TaskScheduler::instance()->get_worker_count());
 
     GpuDevice gpu;
     gpu.init(dc);
@@ -535,29 +845,29 @@ int main(int argc, char** argv) {
     ImGuiServiceConfiguration imgui_config {&gpu, window.platform_handle};
     imgui->init(&imgui_config);
 
+    AsynchronousLoader async_loader;
+    async_loader.init(&gpu, FileReadService::instance(), TaskScheduler::instance(), allocator);
+
     GameCamera game_camera;
     game_camera.camera.init_perspective(0.1f, 4000.f, 60.f, w_conf.width * 1.f / w_conf.height);
     game_camera.init(true, 20.f, 6.f, 0.1f);
 
-    time_service_init();
+    const i64 device_ready_tick = time_now();
 
-    Directory cwd{};
-    directory_current(&cwd);
+    // Image decodes are queued by now, helping could keep the main thread on one of them long after the scene is parsed
+    TaskScheduler::instance()->wait_blocking(&scene_load_counter);
+    const f64 scene_wait_ms = time_from_milliseconds(device_ready_tick);
 
-    char gltf_base_path[512] {};
-    memcpy(gltf_base_path, argv[1], strlen(argv[1]));
-    file_directory_from_path(gltf_base_path);
+    const i64 scene_load_begin = time_now();
+    scene_load_gpu(renderer, async_loader, allocator, scene);
 
-    directory_change(gltf_base_path);
+    // Kick the recorded uploads, they complete while the pipelines are built
+    gpu.flush_uploads();
 
-    char gltf_file[512] {};
-    memcpy(gltf_file, argv[1], strlen(argv[1]));
-    file_name_from_path(gltf_file);
-
-    Scene scene;
-    scene_load_from_gltf(gltf_file, renderer, allocator, scene);
-
-    directory_change(cwd.path);
+    const GpuUploadStatistics& upload_stats = gpu.upload_statistics;
+    p_print("Scene resources created in %.2fms: %u uploads, %llu bytes, %u batches, %u fence waits, %u queue waits\n",
+            time_delta_milliseconds(scene_load_begin, time_now()), upload_stats.uploads, upload_stats.bytes_uploaded,
+            upload_stats.batches_submitted, upload_stats.fence_waits, upload_stats.queue_waits);
 
     {
         // Create pipeline state
@@ -706,6 +1016,11 @@ int main(int argc, char** argv) {
                     }
                 }
 
+                DescriptorSetCreation ds_creation{};
+                ds_creation.buffer(scene_cb, 0).buffer(mesh_draw.material_buffer, 1)
+                           .set_layout(mesh_draw.material->program->passes[0].descriptor_set_layout);
+                mesh_draw.descriptor_set = gpu.create_descriptor_set(ds_creation);
+
                 scene.mesh_draws.push(mesh_draw);
             }
 
@@ -722,6 +1037,21 @@ int main(int argc, char** argv) {
     float light_range = 20.0f;
     float light_intensity = 80.0f;
 
+    // Heap allocations made while recording the mesh draws of the last frame, expected to be zero
+    u64 draw_allocations = 0;
+
+    // Every mesh is drawn draw_copies times, to measure how recording scales with the number of draws.
+    // In parallel, chunks of draws go to secondary command buffers recorded by the workers.
+    TaskScheduler* task_scheduler = TaskScheduler::instance();
+    static const u32 k_max_draw_chunks = 8;     // Secondaries per thread and frame are limited, leave room for ImGui
+    i32 draw_copies = 1;
+    bool parallel_recording = true;
+    f64 draw_recording_ms = 0.0;
+
+    // Times from the start of the process
+    f64 textures_loaded_ms = 0.0;
+    bool first_frame = true;
+
     while(!window.should_exit()) {
         ZoneScopedN("RenderLoop");
 
@@ -740,6 +1070,11 @@ int main(int argc, char** argv) {
         imgui->new_frame();
 
         const i64 current_tick = time_now();
+        const u32 textures_pending = scene.images_pending.load() + async_loader.get_pending_count();
+        if(textures_loaded_ms == 0.0 && textures_pending == 0) {
+            textures_loaded_ms = time_delta_milliseconds(startup_begin, current_tick);
+            p_print("Textures loaded in %.2fms\n", textures_loaded_ms);
+        }
         f32 delta_time = (f32) time_delta_seconds(begin_frame_tick, current_tick);
         begin_frame_tick = current_tick;
 
@@ -754,6 +1089,16 @@ int main(int argc, char** argv) {
             ImGui::InputFloat( "Light intensity", &light_intensity );
             ImGui::InputFloat3( "Camera position", game_camera.camera.position.raw );
             ImGui::InputFloat3( "Camera target movement", game_camera.target_movement.raw );
+            ImGui::Text("Draw heap allocations %llu", draw_allocations);
+            ImGui::SliderInt("Draw copies", &draw_copies, 1, 1024);
+            ImGui::Checkbox("Parallel recording", &parallel_recording);
+            ImGui::Text("%u draws recorded in %.3fms", scene.mesh_draws.size * draw_copies, draw_recording_ms);
+
+            if(textures_pending) {
+                ImGui::Text("Textures loading %u/%u", textures_pending, scene.images.size);
+            } else {
+                ImGui::Text("Textures loaded in %.2fms", textures_loaded_ms);
+            }
         }
         ImGui::End();
 
@@ -794,7 +1139,7 @@ int main(int argc, char** argv) {
                 cb_map.buffer = mesh_draw.material_buffer;
                 MeshData* mesh_data = (MeshData*)gpu.map_buffer(cb_map);
                 if(mesh_data) {
-                    upload_material(*mesh_data,  mesh_draw, model_scale);
+                    upload_material(gpu, *mesh_data,  mesh_draw, model_scale);
 
                     gpu.unmap_buffer(cb_map);
                 }
@@ -807,28 +1152,62 @@ int main(int argc, char** argv) {
 
             gpu_commands->clear(0.3f, 0.3f, 0.3f, 1.0f);
             gpu_commands->clear_depth_stencil(1.0f, 0);
-            gpu_commands->bind_pass(gpu.get_swapchain_pass());
-            gpu_commands->set_scissors(nullptr);
-            gpu_commands->set_viewport(nullptr);
-
-            Material* last_material = nullptr;
+            gpu_commands->bind_pass(gpu.get_swapchain_pass(), parallel_recording);
+
+            const u32 draw_count = scene.mesh_draws.size * (u32)draw_copies;
+
+            const HeapAllocator& system_allocator = MemoryService::instance()->system_allocator;
+            const u64 draw_allocation_start = system_allocator.get_allocation_count();
+            const i64 draw_recording_start = time_now();
+
+            if(parallel_recording) {
+                u32 chunk_count = min(task_scheduler->get_worker_count() * 2, k_max_draw_chunks);
+                chunk_count = min(chunk_count, draw_count);
+                const u32 chunk_size = chunk_count ? (draw_count + chunk_count - 1) / chunk_count : 0;
+
+                // Executed in chunk order, which keeps the material order of the draws
+                CommandBuffer* draw_chunks[k_max_draw_chunks];
+                task_scheduler->parallel_for(chunk_count, 1, [&](u32 begin, u32 end, u32 worker_index) {
+                    for(u32 chunk = begin; chunk < end; chunk++) {
+                        CommandBuffer* secondary_commands = gpu.get_secondary_command_buffer(worker_index);
+                        secondary_commands->begin_secondary(gpu.get_swapchain_pass());
+                        secondary_commands->set_scissors(nullptr);
+                        secondary_commands->set_viewport(nullptr);
+
+                        const u32 first_draw = chunk * chunk_size;
+                        draw_meshes(renderer, secondary_commands, scene.mesh_draws, (u32)draw_copies, first_draw,
+                                    min(first_draw + chunk_size, draw_count));
+
+                        secondary_commands->end();
+                        draw_chunks[chunk] = secondary_commands;
+                    }
+                });
 
-            for(u32 mesh_index = 0; mesh_index < scene.mesh_draws.size; mesh_index++) {
-                MeshDraw& mesh_draw = scene.mesh_draws[mesh_index];
+                for(u32 chunk = 0; chunk < chunk_count; chunk++) {
+                    gpu_commands->execute_secondary(draw_chunks[chunk]);
+                }
+            } else {
+                gpu_commands->set_scissors(nullptr);
+                gpu_commands->set_viewport(nullptr);
 
-                if(mesh_draw.material != last_material) {
-                    PipelineHandle pipeline_handle = renderer.get_pipeline(mesh_draw.material);
+                draw_meshes(renderer, gpu_commands, scene.mesh_draws, (u32)draw_copies, 0, draw_count);
+            }
 
-                    gpu_commands->bind_pipeline(pipeline_handle);
+            draw_recording_ms = time_delta_milliseconds(draw_recording_start, time_now());
+            draw_allocations = system_allocator.get_allocation_count() - draw_allocation_start;
 
-                    last_material = mesh_draw.material;
-                }
+            if(parallel_recording) {
+                // Nothing can be recorded inline in a pass begun for secondaries
+                CommandBuffer* imgui_commands = gpu.get_secondary_command_buffer(0);
+                imgui_commands->begin_secondary(gpu.get_swapchain_pass());
+                imgui->render(*imgui_commands);
+                imgui_commands->end();
 
-                draw_mesh(renderer, gpu_commands, mesh_draw);
+                gpu_commands->execute_secondary(imgui_commands);
+            } else {
+                imgui->render(*gpu_commands);
             }
 
-            imgui->render(*gpu_commands);
-
             gpu_commands->pop_marker();
 
             gpu_profiler.update(gpu);
@@ -836,6 +1215,13 @@ int main(int argc, char** argv) {
             // Send commands to GPU
             gpu.queue_command_buffer(gpu_commands);
             gpu.present();
+
+            if(first_frame) {
+                first_frame = false;
+                p_print("First frame after %.2fms: device ready at %.2fms, scene parsed at %.2fms on the workers, %.2fms waited for it\n",
+                        time_from_milliseconds(startup_begin), time_delta_milliseconds(startup_begin, device_ready_tick),
+                        time_delta_milliseconds(startup_begin, scene_load.end_tick), scene_wait_ms);
+            }
         } else {
             ImGui::Render();
         }
@@ -843,6 +1229,10 @@ int main(int argc, char** argv) {
         FrameMark;
     }
 
+    // Uploads still running write to the scene textures
+    scene_wait_startup(scene);
+    async_loader.shutdown();
+
     gpu.destroy_buffer(scene_cb);
     imgui->shutdown();
 
@@ -858,6 +1248,13 @@ int main(int argc, char** argv) {
     input_handler.shutdown();
     window.shutdown();
 
+    scratch_allocator.shutdown();
+
+    FileReadService::instance()->shutdown();
+    TaskScheduler::instance()->shutdown();
+
+    // Whatever is still live here is a leak, reported with its callsite
+    puffin_memory_tracking_dump_json("memory_tracking.json");
     MemoryService::instance()->shutdown();
 
     return 0;
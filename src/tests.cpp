@@ -0,0 +1,92 @@
+//
+// Created by darby on 10/17/2026.
+//
+
+#include "memory.hpp"
+#include "data_structures.hpp"
+#include "hash_map.hpp"
+#include "concurrent_hash_map.hpp"
+#include "bit.hpp"
+#include "atom.hpp"
+#include "queue.hpp"
+#include "task_scheduler.hpp"
+#include "file_system.hpp"
+#include "gltf.hpp"
+#include "mipmap.hpp"
+#include "log.hpp"
+#include "time.hpp"
+
+#include <cstring>
+
+// Runs the test hooks of the base library, all of them or the one named on the command line.
+// Tests writing files put them in the directory given after the name, the working directory otherwise.
+//
+// Usage: tests [test name|all] [directory]
+
+namespace {
+
+    using namespace puffin;
+
+    struct Test {
+        cstring             name;
+        bool                (*run)(cstring directory);
+    };
+
+    const Test k_tests[] = {
+        { "resource_pool",          [](cstring /*directory*/) { return resource_pool_test(); } },
+        { "hash_map",               [](cstring /*directory*/) { return hash_map_test(); } },
+        { "concurrent_hash_map",    [](cstring /*directory*/) { return concurrent_hash_map_test(); } },
+        { "bit_set",                [](cstring /*directory*/) { return bit_set_test(); } },
+        { "atom_table",             [](cstring /*directory*/) { return atom_table_test(); } },
+        { "queue",                  [](cstring /*directory*/) { return queue_test(); } },
+        { "task_scheduler",         [](cstring /*directory*/) { return task_scheduler_test(); } },
+        { "file_read_async",        [](cstring directory) { return file_read_async_test(directory); } },
+        { "gltf_glb",               [](cstring directory) { return gltf_glb_test(directory); } },
+        { "mipmap",                 [](cstring /*directory*/) { return mipmap_test(); } },
+        // Benchmarks the heap allocator, failures are caught by its asserts and the leak report
+        { "memory",                 [](cstring /*directory*/) { MemoryService::instance()->test(); return true; } },
+    };
+
+} // namespace
+
+int main(int argc, char** argv) {
+
+    using namespace puffin;
+
+    cstring name = argc > 1 ? argv[1] : "all";
+    cstring directory = argc > 2 ? argv[2] : ".";
+
+    time_service_init();
+
+    // The tests start their own threads, some of them allocate from the system allocator
+    MemoryServiceConfiguration memory_configuration;
+    memory_configuration.maximum_dynamic_size = puffin_mega(64);
+    memory_configuration.thread_safe = true;
+    MemoryService::instance()->init(&memory_configuration);
+
+    u32 run = 0;
+    u32 failed = 0;
+    for(const Test& test : k_tests) {
+        if(strcmp(name, "all") != 0 && strcmp(name, test.name) != 0) {
+            continue;
+        }
+
+        const bool passed = test.run(directory);
+        p_print("%s: %s\n", test.name, passed ? "passed" : "FAILED");
+        run++;
+        failed += passed ? 0 : 1;
+    }
+
+    if(run == 0) {
+        p_print("Unknown test %s, tests are:", name);
+        for(const Test& test : k_tests) {
+            p_print(" %s", test.name);
+        }
+        p_print("\n");
+    }
+
+    MemoryService::instance()->shutdown();
+    time_service_shutdown();
+
+    return run > 0 && failed == 0 ? 0 : 1;
+}